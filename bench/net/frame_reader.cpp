@@ -0,0 +1,86 @@
+#include <benchmark/benchmark.h>
+
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/io_context.hpp>
+#include <asio/write.hpp>
+#include <cstring>
+#include <vector>
+
+#include "message/block_pool.h"
+#include "message/frame_reader.h"
+
+// Run it on the default build and with ENABLE_IO_URING to compare epoll and io_uring, the syscalls
+// could be counted with `strace -c -f`
+
+static constexpr usize MESSAGE_COUNT = 4096;
+
+static std::vector<u8> make_stream(usize body_size)
+{
+  std::vector<u8> stream{};
+  stream.reserve((ar::Message::header_size + body_size) * MESSAGE_COUNT);
+  for (usize i = 0; i < MESSAGE_COUNT; ++i)
+  {
+    ar::Message::Header header{.body_size = body_size};
+    auto bytes = reinterpret_cast<const u8*>(&header);
+    stream.insert(stream.end(), bytes, bytes + ar::Message::header_size);
+    stream.insert(stream.end(), body_size, static_cast<u8>(i));
+  }
+  return stream;
+}
+
+static void read_frames(benchmark::State& state, bool is_pooled)
+{
+  asio::io_context context{1};
+  asio::ip::tcp::acceptor acceptor{context, {asio::ip::address_v4::loopback(), 0}};
+  asio::ip::tcp::socket sender{context};
+  asio::ip::tcp::socket receiver{context};
+  sender.connect(acceptor.local_endpoint());
+  acceptor.accept(receiver);
+
+  auto pool = is_pooled ? ar::BlockPool::make_shared(context, ar::FrameReader::BLOCK_SIZE, 64)
+                        : nullptr;
+  auto stream = make_stream(static_cast<usize>(state.range()));
+  u64 read_count = 0;
+
+  for (auto _ : state)
+  {
+    asio::co_spawn(
+        context, [&]() -> asio::awaitable<void> {
+          ar::FrameReader reader{};
+          if (pool)
+            reader.use_pool(pool);
+          for (usize i = 0; i < MESSAGE_COUNT; ++i)
+          {
+            ar::Message message{};
+            if (co_await reader.read_header(receiver, message.header))
+              co_return;
+            if (co_await reader.read_body(receiver, message.as_header()->body_size, message.body))
+              co_return;
+            benchmark::DoNotOptimize(message.body.data());
+          }
+          read_count += reader.read_count();
+        },
+        asio::detached);
+    asio::async_write(sender, asio::buffer(stream), asio::detached);
+    context.run();
+    context.restart();
+  }
+
+  state.SetBytesProcessed(static_cast<i64>(state.iterations() * stream.size()));
+  state.counters["reads_per_message"] = benchmark::Counter(
+      static_cast<double>(read_count) / static_cast<double>(state.iterations() * MESSAGE_COUNT));
+}
+
+static void read_frames_allocated(benchmark::State& state)
+{
+  read_frames(state, false);
+}
+
+static void read_frames_pooled(benchmark::State& state)
+{
+  read_frames(state, true);
+}
+
+BENCHMARK(read_frames_allocated)->Arg(64)->Arg(1024)->Arg(16 * 1024);
+BENCHMARK(read_frames_pooled)->Arg(64)->Arg(1024)->Arg(16 * 1024);
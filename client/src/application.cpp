@@ -42,6 +42,8 @@ namespace ar
       context_{ctx},
       state_{PageState::Login},
       window_{std::move(window)},
+      online_version_{0},
+      online_cursor_{0},
       save_dir_{save_dir},
       selected_user_{-1},
       client_{ctx.get_executor(), asio::ip::make_address_v4(ip), port, this}
@@ -351,7 +353,8 @@ namespace ar
       state_.expect_operation_state(OperationState::SendFile);
 
       auto ts = get_current_time();
-      if (!client_.send_file(opponent_user->public_key, filepath, opponent_user->id))
+      if (!client_.send_file(opponent_user->public_key, opponent_user->compressions, filepath,
+                             opponent_user->id))
       {
         state_.active_overlay(OverlayState::FileNotExist);
         continue;
@@ -913,7 +916,8 @@ namespace ar
 
     // store payload
     StorePublicKeyPayload public_key_payload{
-        .key = ar::serialize(client_.asymmetric_encryptor().public_key())};
+        .key = ar::serialize(client_.asymmetric_encryptor().public_key()),
+        .compressions = SUPPORTED_COMPRESSIONS};
 
     client_.write<true>(std::move(public_key_payload), server_->id);
 
@@ -981,7 +985,8 @@ namespace ar
     }
 
     // Get user onlines
-    GetUserOnlinePayload user_online_payload{};
+    online_cursor_ = 0;
+    GetUserOnlinePayload user_online_payload{.version = online_version_, .cursor = online_cursor_};
     client_.write<true>(std::move(user_online_payload), server_->id);
 
     state_.active_loading_overlay(); // make it loading and still on loading page
@@ -1098,7 +1103,10 @@ namespace ar
   {
     // Save file (overwrite)
     auto dest_path = save_dir_ / received_file.filename;
-    if (!save_bytes_as_file<true>(dest_path.string(), received_file.files))
+    bool saved = received_file.filepath.empty()
+                   ? save_bytes_as_file<true>(dest_path.string(), received_file.files)
+                   : move_file(received_file.filepath, dest_path.string());
+    if (!saved)
     {
       Logger::error("failed to save incoming file to disk");
       return;
@@ -1124,59 +1132,40 @@ namespace ar
           return;
         }
 
-        files_.emplace_back(true, format, received_file.files.size_bytes(), &*it,
+        files_.emplace_back(true, format, received_file.file_size, &*it,
                             dest_path.string(), get_current_time());
       }
     }
   }
 
-  void Application::on_user_login(const UserLoginPayload& payload) noexcept
+  void Application::set_user_online(const UserResponse& user, bool is_online) noexcept
   {
-    std::unique_lock lock{user_mutex_};
-    // search if user already on database (offline)
-    auto offline_users
-        = users_ | std::views::filter([](const UserClient& uc) {
-          return !uc.is_online;
-        });
-    if (offline_users.empty())
-    {
-      users_.emplace_back(true, payload.id, payload.username);
-      return;
-    }
-    // toggle is_online
-    auto it = std::ranges::find_if(offline_users,
-                                   [&](const UserClient& uc) {
-                                     return uc.id == payload.id;
-                                   });
-    if (it == offline_users.end())
-    {
-      users_.emplace_back(true, payload.id, payload.username);
+    // the server replies are shared by every client, so they contain this user as well
+    if (user.name == username_)
       return;
-    }
-    it->is_online = true;
+    auto it = std::ranges::find_if(users_, [&](const UserClient& uc) {
+      return uc.id == user.id;
+    });
+    if (it != users_.end())
+      it->is_online = is_online;
+    else if (is_online)
+      users_.emplace_back(true, user.id, user.name);
   }
 
-  void Application::on_user_logout(const UserLogoutPayload& payload) noexcept
+  void Application::on_user_presence(const UserOnlinePayload& payload) noexcept
   {
     std::unique_lock lock{user_mutex_};
-    // std::erase_if(users_, [&](const UserClient& user) { return user.id ==
-    // payload.id; });
-    auto it = std::ranges::find_if(users_,
-                                   [&](const UserClient& user) {
-                                     return user.id == payload.id;
-                                   });
-    if (it == users_.end())
-    {
-      Logger::warn(
-          "got signal user logout, but the user doesn't exists on "
-          "client database");
+    // the changes are already part of the online users snapshot received later
+    if (payload.version <= online_version_)
       return;
-    }
-    // set to offline
-    it->is_online = false;
+
+    for (const auto& user : payload.users)
+      set_user_online(user, true);
+    for (auto id : payload.offline_ids)
+      set_user_online(UserResponse{id, ""}, false);
   }
 
-  void Application::on_user_detail_response(const UserDetailPayload& payload) noexcept
+  void Application::on_user_detail_response(const UserDetailPayloadView& payload) noexcept
   {
     if (state_.expected_operation_state() != OperationState::GetUserDetails)
     {
@@ -1213,6 +1202,7 @@ namespace ar
 
       it->name = payload.username;
       it->public_key = result.value();
+      it->compressions = payload.compressions;
     }
 
     state_.operation_state_complete();
@@ -1233,12 +1223,39 @@ namespace ar
 
     {
       std::unique_lock lock{user_mutex_};
-      for (const auto& user : payload.users)
+      if (payload.is_delta)
+      {
+        for (const auto& user : payload.users)
+          set_user_online(user, true);
+        for (auto id : payload.offline_ids)
+          set_user_online(UserResponse{id, ""}, false);
+        online_version_ = payload.version;
+      }
+      else
       {
-        users_.emplace_back(true, user.id, user.name);
+        // the first page replaces the known online users, the set could change while the next
+        // pages are requested so keep the oldest version to get the missing changes later
+        if (online_cursor_ == 0)
+        {
+          for (auto& user : users_)
+            user.is_online = false;
+          online_version_ = payload.version;
+        }
+        online_version_ = std::min(online_version_, payload.version);
+        for (const auto& user : payload.users)
+          set_user_online(user, true);
       }
     }
 
+    // request the next page
+    if (!payload.is_delta && payload.next_cursor != 0)
+    {
+      online_cursor_ = payload.next_cursor;
+      GetUserOnlinePayload user_online_payload{.version = 0, .cursor = online_cursor_};
+      client_.write<true>(std::move(user_online_payload), server_->id);
+      return;
+    }
+
     state_.operation_state_complete();
     state_.disable_loading_overlay();
     state_.active_page(PageState::Dashboard);
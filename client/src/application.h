@@ -71,16 +71,18 @@ namespace ar
     void delete_file_on_dashboard(usize file_index) noexcept;
     void open_file_on_dashboard(usize file_index) noexcept;
 
+    // the caller should hold the user mutex
+    void set_user_online(const UserResponse& user, bool is_online) noexcept;
+
 
     // Callback, called by io thread
   public:
     void on_feedback_response(const FeedbackPayload& payload) noexcept override;
     void on_file_receive(const Message::Header& header,
                          const ReceivedFile& received_file) noexcept override;
-    void on_user_login(const UserLoginPayload& payload) noexcept override;
-    void on_user_logout(const UserLogoutPayload& payload) noexcept override;
-    void on_user_detail_response(const UserDetailPayload& payload) noexcept override;
+    void on_user_detail_response(const UserDetailPayloadView& payload) noexcept override;
     void on_user_online_response(const UserOnlinePayload& payload) noexcept override;
+    void on_user_presence(const UserOnlinePayload& payload) noexcept override;
     void on_server_detail_response(const ServerDetailsPayload& payload) noexcept override;
 
   private:
@@ -124,6 +126,9 @@ namespace ar
     std::vector<UserClient> users_;
     std::unique_ptr<UserClient> server_;
     std::unique_ptr<UserClient> this_user_;
+    // online users version and snapshot page being requested
+    u64 online_version_;
+    User::id_type online_cursor_;
 
     // Send File data
     std::filesystem::path save_dir_;
@@ -10,11 +10,14 @@
 #include <asio/co_spawn.hpp>
 #include <asio/detached.hpp>
 #include <asio/thread_pool.hpp>
+#include <filesystem>
 #include <utility>
 
+#include "core.h"
 #include "file.h"
 #include "handler.h"
 #include "logger.h"
+#include "util/compression.h"
 #include "util/time.h"
 
 #include "message/feedback.h"
@@ -33,7 +36,8 @@ namespace ar
       executor_{std::move(executor)},
       endpoint_{std::move(endpoint)},
       connection_{executor_},
-      symm_encryptor_{Camellia::create()}
+      symm_encryptor_{Camellia::create()},
+      transfer_id_{random<transfer_id_type>()}
   {
     Logger::info(fmt::format("client connecting to {}: {}", endpoint_.address().to_string(),
                              endpoint_.port()));
@@ -45,7 +49,9 @@ namespace ar
     : event_handler_{other.event_handler_},
       executor_{std::move(other.executor_)},
       endpoint_{std::move(other.endpoint_)},
-      connection_{std::move(other.connection_)}
+      connection_{std::move(other.connection_)},
+      transfer_id_{other.transfer_id_.load()},
+      incoming_transfers_{std::move(other.incoming_transfers_)}
   {
     other.event_handler_ = nullptr;
   }
@@ -114,37 +120,104 @@ namespace ar
   // }
 
 
-  bool Client::send_file(const asymm_enc::_public_key& pk, std::string_view filepath,
-                         User::id_type opponent_id) noexcept
+  bool Client::send_file(const asymm_enc::_public_key& pk, u8 compressions,
+                         std::string_view filepath, User::id_type opponent_id) noexcept
   {
     std::string_view filename = get_filename_with_format(filepath);
 
-    // Read file
-    auto result = read_file_as_bytes(filepath);
-    if (!result.has_value())
+    std::error_code ec;
+    auto file_size = std::filesystem::file_size(filepath, ec);
+    if (ec)
+    {
+      Logger::error(fmt::format("failed to get file size: {}", ec.message()));
+      return false;
+    }
+
+    std::ifstream file{filepath.data(), std::ios::binary};
+    if (!file.is_open())
     {
-      Logger::error(result.error());
+      Logger::error("failed to open file");
       return false;
     }
 
-    SendFilePayload2::Data data{
-        .file_size = result->size(),
+    // Generate symmetric key for this transfer only
+    auto symmetric_key = random_bytes<KEY_BYTE>();
+    symm_type symmetric{symmetric_key};
+    auto [key_padding, cipher_key] = encrypt_key(pk, symmetric_key);
+
+    auto [format, _] = get_file_format(filename);
+    // the older opponent rejects the transfer with unknown compression
+    bool is_supported = compressions & compression_bit(CompressionType::Lz);
+    auto compression = is_compressible(format) && is_supported ? CompressionType::Lz
+                                                               : CompressionType::None;
+
+    SendFileBeginPayload::Data data{
+        .file_size = file_size,
         .filename = std::string{filename},
-        .files = std::move(result.value())
+        .compression = compression,
+    };
+    auto [data_padding, cipher_data] = symmetric.encrypts(data.serialize());
+
+    const auto transfer_id = transfer_id_.fetch_add(1);
+    SendFileBeginPayload begin_payload{
+        .transfer_id = transfer_id,
+        .key_padding = key_padding,
+        .data_padding = static_cast<u8>(data_padding),
+        .key = std::move(cipher_key),
+        .data = std::move(cipher_data)
     };
+    write<false>(std::move(begin_payload), opponent_id);
 
-    auto symm_serialized = data.serialize();
-    auto enc_result = encrypt(pk, symm_serialized);
+    // Stream the file, only several chunks are kept in memory at a time
+    bool success = true;
+    std::vector<u8> buffer(SEND_FILE_CHUNK_SIZE);
+    for (u64 remaining = file_size; remaining > 0;)
+    {
+      connection_.wait_pending_below(SEND_FILE_WINDOW_SIZE);
+      if (!connection_.is_open())
+      {
+        Logger::warn(fmt::format("connection closed while sending file {}", filename));
+        return false;
+      }
 
-    SendFilePayload2 payload{
-        .key_padding = enc_result.key_padding,
-        .data_padding = enc_result.data_padding,
-        .key = std::move(enc_result.cipher_key),
-        .data = std::move(enc_result.cipher_data)
-    };
+      auto size = std::min<u64>(remaining, buffer.size());
+      file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(size));
+      if (static_cast<u64>(file.gcount()) != size)
+      {
+        Logger::error(fmt::format("failed to read file {}", filename));
+        success = false;
+        break;
+      }
+
+      std::span<const u8> plain{buffer.data(), size};
+      std::vector<u8> compressed{};
+      if (compression == CompressionType::Lz)
+      {
+        compressed = compress(plain);
+        if (compressed.size() < size - size / SEND_FILE_MIN_COMPRESSION_SAVING)
+          plain = compressed;
+        else if (remaining == file_size)
+        {
+          // the first chunk is not compressible, most likely the rest isn't either
+          Logger::trace(fmt::format("file {} is not compressible", filename));
+          compression = CompressionType::None;
+        }
+      }
 
-    write<false>(std::move(payload), opponent_id);
-    return true;
+      bool is_compressed = plain.data() == compressed.data();
+      auto [padding, cipher] = symmetric.encrypts(plain);
+      SendFileChunkPayload chunk_payload{
+          .transfer_id = transfer_id,
+          .padding = static_cast<u8>(padding),
+          .is_compressed = is_compressed,
+          .data = std::move(cipher)
+      };
+      write<false>(std::move(chunk_payload), opponent_id);
+      remaining -= size;
+    }
+
+    write<false>(SendFileEndPayload{.transfer_id = transfer_id, .success = success}, opponent_id);
+    return success;
   }
 
   asymm_type& Client::asymmetric_encryptor() noexcept
@@ -180,6 +253,8 @@ namespace ar
       message_handler(msg.value());
     }
 
+    // the unfinished transfers would never get their end
+    abort_transfers(std::nullopt);
     asio::post(executor_, [this] {
       disconnect();
     });
@@ -196,7 +271,7 @@ namespace ar
     {
     case Message::Type::SendFile: {
       // auto result = get_payload<SendFilePayload>(msg);
-      auto result = get_payload<SendFilePayload2>(msg);
+      auto result = get_payload_view<SendFilePayload2View>(msg);
       if (!result)
       {
         Logger::error(fmt::format("failed to deserialize send file payload: {}", result.error()));
@@ -214,55 +289,65 @@ namespace ar
         return;
       }
 
-      auto data = parse_body<SendFilePayload2::Data>(dec_result.value());
+      auto data = parse_view<SendFilePayload2View::Data>(dec_result.value());
       if (!data)
       {
         Logger::error(fmt::format("failed to serialize payload: {}",
-                                  dec_result.error()));
+                                  data.error()));
         return;
       }
 
-      ReceivedFile recv_file{.filename = data->filename, .files = data->files};
+      ReceivedFile recv_file{
+          .filename = data->filename,
+          .filepath = ""sv,
+          .files = data->files,
+          .file_size = data->files.size()
+      };
       if (event_handler_)
         event_handler_->on_file_receive(
             *header, recv_file);
       break;
     }
-    case Message::Type::UserLogin: {
-      auto result = get_payload<UserLoginPayload>(msg);
-      if (!result)
-      {
-        Logger::error(fmt::format("failed to deserialize user login payload: {}", result.error()));
-        break;
-      }
-      if (event_handler_)
-        event_handler_->on_user_login(result.value());
+    case Message::Type::SendFileBegin: {
+      send_file_begin_handler(msg);
+      break;
+    }
+    case Message::Type::SendFileChunk: {
+      send_file_chunk_handler(msg);
+      break;
+    }
+    case Message::Type::SendFileEnd: {
+      send_file_end_handler(msg);
       break;
     }
-    case Message::Type::UserLogout: {
-      auto result = get_payload<UserLogoutPayload>(msg);
+    case Message::Type::GetUserOnline: {
+      auto result = get_payload<UserOnlinePayload>(msg);
       if (!result)
       {
-        Logger::error(fmt::format("failed to deserialize user login payload: {}", result.error()));
+        Logger::error(fmt::format("failed to deserialize user online payload: {}", result.error()));
         break;
       }
       if (event_handler_)
-        event_handler_->on_user_logout(result.value());
+        event_handler_->on_user_online_response(result.value());
       break;
     }
-    case Message::Type::GetUserOnline: {
+    case Message::Type::UserPresence: {
       auto result = get_payload<UserOnlinePayload>(msg);
       if (!result)
       {
-        Logger::error(fmt::format("failed to deserialize user online payload: {}", result.error()));
+        Logger::error(fmt::format("failed to deserialize user presence payload: {}",
+                                  result.error()));
         break;
       }
+      // the transfers from the users going offline would never end
+      for (auto id : result->offline_ids)
+        abort_transfers(id);
       if (event_handler_)
-        event_handler_->on_user_online_response(result.value());
+        event_handler_->on_user_presence(result.value());
       break;
     }
     case Message::Type::GetUserDetails: {
-      auto result = get_payload<UserDetailPayload>(msg);
+      auto result = get_payload_view<UserDetailPayloadView>(msg);
       if (!result)
       {
         Logger::error(fmt::format("failed to deserialize user details payload: {}",
@@ -299,4 +384,162 @@ namespace ar
     }
     }
   }
+
+  void Client::send_file_begin_handler(const Message& msg) noexcept
+  {
+    auto header = msg.as_header();
+    auto result = get_payload<SendFileBeginPayload>(msg);
+    if (!result)
+    {
+      Logger::error(fmt::format("failed to deserialize send file begin payload: {}",
+                                result.error()));
+      return;
+    }
+
+    auto decryptor = decrypt_key(asymm_encryptor_, result->key_padding, result->key);
+    if (!decryptor)
+    {
+      Logger::error(fmt::format("failed to decrypt transfer key: {}", decryptor.error()));
+      return;
+    }
+
+    auto data_bytes = decryptor->decrypts(result->data, result->data_padding);
+    if (!data_bytes)
+    {
+      Logger::error(fmt::format("failed to decrypt transfer data: {}", data_bytes.error()));
+      return;
+    }
+
+    auto data = parse_body<SendFileBeginPayload::Data>(data_bytes.value());
+    if (!data)
+    {
+      Logger::error(fmt::format("failed to deserialize transfer data: {}", data.error()));
+      return;
+    }
+
+    if (!magic_enum::enum_contains(data->compression))
+    {
+      Logger::error(fmt::format("transfer {} uses unsupported compression {}",
+                                result->transfer_id, std::to_underlying(data->compression)));
+      return;
+    }
+
+    auto filepath = std::filesystem::temp_directory_path() /
+                    fmt::format("{}-{}-{}.part", PROGRAM_NAME, header->opponent_id,
+                                result->transfer_id);
+
+    IncomingTransfer transfer{
+        .decryptor = std::move(decryptor.value()),
+        .filename = std::move(data->filename),
+        .filepath = filepath.string(),
+        .file = std::ofstream{filepath, std::ios::binary | std::ios::trunc},
+        .compression = data->compression,
+        .file_size = data->file_size,
+        .received_size = 0
+    };
+
+    if (!transfer.file.is_open())
+    {
+      Logger::error(fmt::format("failed to create temporary file {}", transfer.filepath));
+      return;
+    }
+
+    Logger::info(fmt::format("receiving file {} with {} bytes from {}", transfer.filename,
+                             transfer.file_size, header->opponent_id));
+    incoming_transfers_.insert_or_assign(transfer_key(header->opponent_id, result->transfer_id),
+                                         std::move(transfer));
+  }
+
+  void Client::send_file_chunk_handler(const Message& msg) noexcept
+  {
+    auto header = msg.as_header();
+    auto result = get_payload_view<SendFileChunkPayloadView>(msg);
+    if (!result)
+    {
+      Logger::error(fmt::format("failed to deserialize send file chunk payload: {}",
+                                result.error()));
+      return;
+    }
+
+    auto key = transfer_key(header->opponent_id, result->transfer_id);
+    auto it = incoming_transfers_.find(key);
+    if (it == incoming_transfers_.end())
+    {
+      Logger::warn(fmt::format("got chunk for unknown transfer {}", result->transfer_id));
+      return;
+    }
+
+    auto& transfer = it->second;
+    auto bytes = transfer.decryptor.decrypts(result->data, result->padding);
+    if (bytes && result->is_compressed)
+    {
+      if (transfer.compression == CompressionType::Lz)
+        bytes = decompress(bytes.value(), SEND_FILE_CHUNK_SIZE);
+      else
+        bytes = std::unexpected("chunk is compressed without compression"sv);
+    }
+    if (!bytes || transfer.received_size + bytes->size() > transfer.file_size)
+    {
+      Logger::error(fmt::format("transfer {} got malformed chunk", result->transfer_id));
+      transfer.file.close();
+      delete_file(transfer.filepath);
+      incoming_transfers_.erase(it);
+      return;
+    }
+
+    transfer.file.write(reinterpret_cast<const char*>(bytes->data()),
+                        static_cast<std::streamsize>(bytes->size()));
+    transfer.received_size += bytes->size();
+  }
+
+  void Client::send_file_end_handler(const Message& msg) noexcept
+  {
+    auto header = msg.as_header();
+    auto result = get_payload<SendFileEndPayload>(msg);
+    if (!result)
+    {
+      Logger::error(fmt::format("failed to deserialize send file end payload: {}",
+                                result.error()));
+      return;
+    }
+
+    auto node = incoming_transfers_.extract(transfer_key(header->opponent_id,
+                                                         result->transfer_id));
+    if (node.empty())
+    {
+      Logger::warn(fmt::format("got end of unknown transfer {}", result->transfer_id));
+      return;
+    }
+
+    auto& transfer = node.mapped();
+    transfer.file.close();
+    if (!result->success || transfer.file.fail() || transfer.received_size != transfer.file_size)
+    {
+      Logger::error(fmt::format("transfer of file {} is incomplete", transfer.filename));
+      delete_file(transfer.filepath);
+      return;
+    }
+
+    ReceivedFile recv_file{
+        .filename = transfer.filename,
+        .filepath = transfer.filepath,
+        .files = {},
+        .file_size = transfer.file_size
+    };
+    if (event_handler_)
+      event_handler_->on_file_receive(*header, recv_file);
+  }
+
+  void Client::abort_transfers(std::optional<User::id_type> opponent_id) noexcept
+  {
+    std::erase_if(incoming_transfers_, [&](auto& entry) {
+      auto& [key, transfer] = entry;
+      if (opponent_id && key >> 32 != *opponent_id)
+        return false;
+      Logger::warn(fmt::format("transfer of file {} is aborted", transfer.filename));
+      transfer.file.close();
+      delete_file(transfer.filepath);
+      return true;
+    });
+  }
 } // namespace ar
\ No newline at end of file
@@ -3,10 +3,15 @@
 #include <asio/awaitable.hpp>
 #include <asio/execution_context.hpp>
 #include <asio/ip/tcp.hpp>
+#include <fstream>
+#include <optional>
 #include <string_view>
+#include <unordered_map>
 
 #include "connection.h"
 #include "crypto/hybrid.h"
+#include "message/feedback.h"
+#include "message/view.h"
 #include "util/asio.h"
 #include "util/types.h"
 
@@ -53,7 +58,8 @@ namespace ar
     template <bool Encrypt, serializable T>
     void write(T&& payload, Message::Header::opponent_id_type opponent_id) noexcept;
 
-    bool send_file(const asymm_enc::_public_key& pk, std::string_view filepath,
+    // the file is only compressed when the opponent supports it
+    bool send_file(const asymm_enc::_public_key& pk, u8 compressions, std::string_view filepath,
                    User::id_type opponent_id) noexcept;
 
     template <typename Self>
@@ -67,12 +73,49 @@ namespace ar
     template <payload T>
     std::expected<T, std::string_view> get_payload(const Message& msg) noexcept;
 
+    // parse the payload in place, the view shares the message body when it is not encrypted
+    template <payload_view T>
+    std::expected<BodyView<T>, std::string_view> get_payload_view(const Message& msg) noexcept;
+
     void send_message(Message&& payload) noexcept;
 
     asio::awaitable<void> reader() noexcept;
 
     void message_handler(const Message& msg) noexcept;
 
+    void send_file_begin_handler(const Message& msg) noexcept;
+    void send_file_chunk_handler(const Message& msg) noexcept;
+    void send_file_end_handler(const Message& msg) noexcept;
+
+    // drop the unfinished transfers from the opponent, or every transfer when it is empty, and
+    // delete their temporary files
+    void abort_transfers(std::optional<User::id_type> opponent_id) noexcept;
+
+  private:
+    using transfer_id_type = SendFileBeginPayload::transfer_id_type;
+
+    // maximum bytes of file chunks queued on connection, it bounds the memory used by send_file
+    static constexpr usize SEND_FILE_WINDOW_SIZE = 4 * SEND_FILE_CHUNK_SIZE;
+    // compressed chunk should save at least 1/N of its size to be sent compressed
+    static constexpr usize SEND_FILE_MIN_COMPRESSION_SAVING = 16;
+
+    struct IncomingTransfer
+    {
+      symm_type decryptor;
+      std::string filename;
+      std::string filepath; // temporary file
+      std::ofstream file;
+      CompressionType compression;
+      u64 file_size;
+      u64 received_size;
+    };
+
+    // key is the combination of opponent id and transfer id
+    static constexpr u64 transfer_key(User::id_type opponent_id, transfer_id_type id) noexcept
+    {
+      return (static_cast<u64>(opponent_id) << 32) | id;
+    }
+
   private:
     IEventHandler* event_handler_;
     asio::any_io_executor executor_;
@@ -81,6 +124,9 @@ namespace ar
     Connection connection_;
     DMRSA asymm_encryptor_;
     Camellia symm_encryptor_;
+
+    std::atomic<transfer_id_type> transfer_id_;
+    std::unordered_map<u64, IncomingTransfer> incoming_transfers_; // only touched by io thread
   };
 
   template <typename Self>
@@ -116,12 +162,12 @@ namespace ar
     {
       auto [filler, cipher] = symm_encryptor_.encrypts(body);
       auto msg = create_message<type, Message::EncryptionType::Symmetric>(
-          cipher, opponent_id, filler);
+          std::move(cipher), opponent_id, filler);
       send_message(std::move(msg));
     }
     else
     {
-      auto msg = create_message<type>(body, opponent_id, 0);
+      auto msg = create_message<type>(std::move(body), opponent_id, 0);
       send_message(std::move(msg));
     }
   }
@@ -139,6 +185,9 @@ namespace ar
       if (!result)
         return std::unexpected(result.error());
 
+      if (result->size() != header->real_size())
+        return std::unexpected(MESSAGE_MALFORMED);
+
       return parse_body<T>(result.value());
     }
 
@@ -156,4 +205,36 @@ namespace ar
     return msg.body_as<T>();
   }
 
+  template <payload_view T>
+  std::expected<BodyView<T>, std::string_view> Client::get_payload_view(const Message& msg) noexcept
+  {
+    const auto header = msg.as_header();
+
+    if (header->encryption == Message::EncryptionType::Symmetric)
+    {
+      auto result = symm_encryptor_.decrypts(msg.body, header->body_filler);
+      if (!result)
+        return std::unexpected(result.error());
+
+      if (result->size() != header->real_size())
+        return std::unexpected(MESSAGE_MALFORMED);
+
+      return parse_view<T>(SharedBuffer{std::move(result.value())});
+    }
+
+    if (header->encryption == Message::EncryptionType::Asymmetric)
+    {
+      auto result = asymm_encryptor_.decrypts(msg.body);
+      if (!result)
+        return std::unexpected(result.error());
+
+      auto blocks = std::make_shared<std::vector<asymm_type::block_type>>(
+          std::move(result.value()));
+      auto bytes = as_byte_span<asymm_type::block_type>(*blocks, header->body_filler);
+      return parse_view<T>(SharedBuffer{std::move(blocks), bytes});
+    }
+
+    return parse_view<T>(msg.body);
+  }
+
 } // namespace ar
\ No newline at end of file
@@ -15,6 +15,7 @@
 #include <asio/use_awaitable.hpp>
 #include <asio/write.hpp>
 #include <asio/awaitable.hpp>
+#include <fmt/chrono.h>
 
 #include "core.h"
 #include "logger.h"
@@ -26,16 +27,31 @@ namespace ar
 {
   Connection::Connection(asio::any_io_executor executor) noexcept
       : is_closing_{true},
-        socket_{std::move(executor)},
-        write_timer_{socket_.get_executor(), std::chrono::steady_clock::time_point::max()}
+        write_lanes_{executor},
+        pending_bytes_{0},
+        socket_{executor},
+        heartbeat_timer_{std::move(executor)},
+        last_active_at_{0},
+        written_bytes_{0},
+        checked_bytes_{0},
+        is_ping_pending_{false},
+        round_trip_time_{0}
   {
   }
 
   Connection::Connection(Connection&& other) noexcept
       : is_closing_{other.is_closing_.exchange(true)},
-        write_message_queue_{std::move(other.write_message_queue_)},
+        write_lanes_{std::move(other.write_lanes_)},
+        pending_bytes_{other.pending_bytes_.exchange(0)},
+        write_budget_{other.write_budget_},
+        frame_reader_{std::move(other.frame_reader_)},
         socket_{std::move(other.socket())},
-        write_timer_{std::move(other.write_timer_)},
+        heartbeat_timer_{std::move(other.heartbeat_timer_)},
+        last_active_at_{other.last_active_at_.load()},
+        written_bytes_{other.written_bytes_},
+        checked_bytes_{other.checked_bytes_},
+        is_ping_pending_{other.is_ping_pending_.load()},
+        round_trip_time_{other.round_trip_time_.load()},
         user_{std::move(other.user_)}
   {
   }
@@ -45,9 +61,16 @@ namespace ar
     if (this == &other)
       return *this;
 
-    write_timer_ = std::move(other.write_timer_);
-    write_message_queue_ = std::move(other.write_message_queue_);
+    write_lanes_ = std::move(other.write_lanes_);
+    pending_bytes_ = other.pending_bytes_.exchange(0);
+    frame_reader_ = std::move(other.frame_reader_);
     socket_ = std::move(other.socket_);
+    heartbeat_timer_ = std::move(other.heartbeat_timer_);
+    last_active_at_ = other.last_active_at_.load();
+    written_bytes_ = other.written_bytes_;
+    checked_bytes_ = other.checked_bytes_;
+    is_ping_pending_ = other.is_ping_pending_.load();
+    round_trip_time_ = other.round_trip_time_.load();
     user_ = std::move(other.user_);
     is_closing_ = other.is_closing_.exchange(!other.is_closing_.load());
     return *this;
@@ -59,6 +82,8 @@ namespace ar
       const asio::ip::tcp::endpoint& endpoint) noexcept
   {
     auto [ec] = co_await socket_.async_connect(endpoint, ar::await_with_error());
+    if (!ec)
+      set_no_delay(socket_, true);
     co_return ec;
   }
 
@@ -66,7 +91,10 @@ namespace ar
   {
     Logger::info("Connection started!");
     is_closing_.store(false);
+    last_active_at_.store(clock_type::now().time_since_epoch().count());
     asio::co_spawn(socket_.get_executor(), [this] { return write_handler(); }, asio::detached);
+    asio::co_spawn(socket_.get_executor(), [this] { return heartbeat_handler(); },
+                   asio::detached);
   }
 
   void Connection::close() noexcept
@@ -74,9 +102,13 @@ namespace ar
     if (is_closing_.load())
       return;
     is_closing_.store(true);
-    write_timer_.cancel();
+    write_lanes_.close();
+    heartbeat_timer_.cancel();
     socket_.cancel();
     socket_.close();
+    // nothing will be written anymore, wake up the waiting writers
+    pending_bytes_.store(0);
+    pending_bytes_.notify_all();
     Logger::info("connection closed!");
   }
 
@@ -84,23 +116,21 @@ namespace ar
   {
     Logger::trace("Connection waiting new message from remote...");
     Message message{};
+    while (true)
     {
-      auto [ec, n] = co_await asio::async_read(socket_, asio::buffer(message.header),
-                                               asio::transfer_exactly(Message::header_size),
-                                               ar::await_with_error());
-      if (ec || n != Message::header_size)
+      if (auto ec = co_await frame_reader_.read_header(socket_, message.header))
+        co_return std::unexpected(ec);
+
+      auto header = message.as_header();
+      if (auto ec = co_await frame_reader_.read_body(socket_, header->body_size, message.body))
         co_return std::unexpected(ec);
-    }
 
-    auto header = message.as_header();
-    message.body.resize(
-        header
-            ->body_size);  // NOTE: need to resize instead of reserve because of using asio::buffer
-    auto [ec, n] = co_await asio::async_read(socket_, asio::buffer(message.body),
-                                             asio::transfer_exactly(header->body_size),
-                                             ar::await_with_error());
-    if (ec || n != header->body_size)
-      co_return std::unexpected(ec);
+      last_active_at_.store(clock_type::now().time_since_epoch().count());
+      if (header->message_type != Message::Type::Ping &&
+          header->message_type != Message::Type::Pong)
+        break;
+      on_heartbeat(message);
+    }
 
     Logger::info(fmt::format("Connection got data {} bytes", message.size()));
     co_return ar::make_expected<Message, asio::error_code>(std::move(message));
@@ -120,44 +150,95 @@ namespace ar
     }
 
     Logger::trace(fmt::format("Connection send data {} bytes", msg.size()));
-    write_message_queue_.push(std::forward<Message>(msg));
-    asio::error_code ec;
-    write_timer_.cancel_one(ec);
-    if constexpr (AR_DEBUG)
+    pending_bytes_.fetch_add(msg.size());
+    auto lane = lane_of(msg.as_header()->message_type);
+    write_lanes_.push(lane, std::forward<Message>(msg));
+  }
+
+  void Connection::wait_pending_below(usize limit) const noexcept
+  {
+    auto pending = pending_bytes_.load();
+    while (pending >= limit && is_open())
     {
-      if (ec)
-        Logger::warn(fmt::format("failed to cancel timer: {}", ec.message()));
+      pending_bytes_.wait(pending);
+      pending = pending_bytes_.load();
+    }
+  }
+
+  usize Connection::pending_bytes() const noexcept
+  {
+    return pending_bytes_.load();
+  }
+
+  WriteStats::Snapshot Connection::write_stats() const noexcept
+  {
+    return write_stats_.snapshot();
+  }
+
+  std::chrono::nanoseconds Connection::round_trip_time() const noexcept
+  {
+    return std::chrono::nanoseconds{round_trip_time_.load()};
+  }
+
+  void Connection::pop_write_batch(std::vector<Message>& batch) noexcept
+  {
+    usize bytes = 0;
+    auto& queue = write_lanes_.next();
+    while (!queue.empty())
+    {
+      // the first message is always taken even when it is bigger than the budget
+      auto& msg = queue.front();
+      if (!batch.empty() && (bytes + msg.size() > write_budget_.max_bytes ||
+                             (batch.size() + 1) * 2 > write_budget_.max_buffers))
+        return;
+      bytes += msg.size();
+      batch.emplace_back(std::move(msg));
+      queue.pop();
     }
   }
 
   asio::awaitable<void> Connection::write_handler() noexcept
   {
+    std::vector<Message> batch{};
+    std::vector<asio::const_buffer> buffers{};
     while (is_open())
     {
-      if (write_message_queue_.empty())
+      batch.clear();
+      pop_write_batch(batch);
+      if (batch.empty())
       {
         Logger::trace("connection waiting for new message to write");
-        auto [ec] = co_await write_timer_.async_wait(ar::await_with_error());
-        // WARN: in case the timer is expired
-        // if (!ec)
-        // m_send_timer.expires_from_now(std::chrono::duration<std::chrono::days>::max());
-        // cancelled
-        if (ec != asio::error::operation_aborted)
-        {
-          Logger::trace(fmt::format("Error while waiting timer: {}", ec.message()));
+        // closed
+        if (!co_await write_lanes_.wait())
           break;
-        }
         continue;
       }
 
-      auto msg = std::move(write_message_queue_.front());
-
-      // send 2 bufer in one go
-      std::vector<asio::const_buffer> buffers{};
-      buffers.emplace_back(asio::buffer(msg.header));
-      buffers.emplace_back(asio::buffer(msg.body));
-      auto expected_bytes = msg.size();
-      auto [ec, n] = co_await asio::async_write(socket_, buffers, ar::await_with_error());
+      // send every header and body in one go
+      buffers.clear();
+      usize expected_bytes = 0;
+      for (auto& msg : batch)
+      {
+        buffers.emplace_back(asio::buffer(msg.header));
+        if (!msg.body.empty())
+          buffers.emplace_back(asio::buffer(msg.body.data(), msg.body.size()));
+        expected_bytes += msg.size();
+      }
+      // the progress is counted on every partial write, so sending a big message is not seen as
+      // idle. The condition is not asked after the last write, so it is counted from the result
+      auto base = written_bytes_;
+      auto [ec, n] = co_await asio::async_write(
+          socket_, buffers,
+          [&](const asio::error_code& error, usize transferred) {
+            written_bytes_ = base + transferred;
+            return asio::transfer_all()(error, transferred);
+          },
+          ar::await_with_error());
+      written_bytes_ = base + n;
+      write_stats_.record(batch.size(), n);
+      // the batch is already popped, so it is not retried
+      pending_bytes_.fetch_sub(expected_bytes);
+      pending_bytes_.notify_all();
       if (ec)
       {
         if (ar::is_connection_lost(ec))
@@ -171,10 +252,80 @@ namespace ar
         continue;
       }
 
-      Logger::info("success sent 1 message!");
-      write_message_queue_.pop();
+      Logger::info(fmt::format("success sent {} message!", batch.size()));
     }
+    auto stats = write_stats_.snapshot();
+    Logger::info(fmt::format("{} messages, {} bytes sent in {} flushes (max {})", stats.messages,
+                             stats.bytes, stats.flushes, stats.max_messages));
     Logger::trace("connection no longer run write handler");
     // close(); TODO: Should be called from outside class
   }
+
+  asio::awaitable<void> Connection::heartbeat_handler() noexcept
+  {
+    while (is_open())
+    {
+      auto now = clock_type::now();
+      // the partial reads of a big body and the writes in progress count as activity too
+      auto moved_bytes = frame_reader_.read_bytes() + written_bytes_;
+      if (moved_bytes != checked_bytes_)
+      {
+        checked_bytes_ = moved_bytes;
+        last_active_at_.store(now.time_since_epoch().count());
+      }
+      auto last_active_at = clock_type::time_point{clock_type::duration{last_active_at_.load()}};
+      if (now - last_active_at >= IDLE_TIMEOUT)
+      {
+        Logger::warn(fmt::format("nothing is moved from or to server for {}, closing it",
+                                 std::chrono::duration_cast<std::chrono::seconds>(
+                                     now - last_active_at)));
+        close();
+        break;
+      }
+
+      auto deadline = last_active_at + IDLE_TIMEOUT;
+      if (!is_ping_pending_.load())
+      {
+        if (now - last_active_at >= HEARTBEAT_INTERVAL)
+        {
+          auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              now.time_since_epoch());
+          PingPayload payload{.timestamp = static_cast<u64>(timestamp.count())};
+          write(create_message<Message::Type::Ping>(payload.serialize(), 0, 0));
+          is_ping_pending_.store(true);
+        }
+        else
+          deadline = last_active_at + HEARTBEAT_INTERVAL;
+      }
+
+      heartbeat_timer_.expires_at(deadline);
+      auto [ec] = co_await heartbeat_timer_.async_wait(ar::await_with_error());
+      if (ec)
+        break;
+    }
+    Logger::trace("connection no longer run heartbeat handler");
+  }
+
+  void Connection::on_heartbeat(const Message& msg) noexcept
+  {
+    if (msg.as_header()->message_type == Message::Type::Ping)
+    {
+      write(create_message<Message::Type::Pong>(msg.body, 0, 0));
+      return;
+    }
+
+    auto payload = msg.body_as<PingPayload>();
+    if (!payload)
+    {
+      Logger::warn("server sent malformed pong");
+      return;
+    }
+    auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock_type::now().time_since_epoch());
+    round_trip_time_.store(static_cast<i64>(timestamp.count() - payload->timestamp));
+    is_ping_pending_.store(false);
+    Logger::trace(fmt::format("round trip time to server {}",
+                              std::chrono::duration_cast<std::chrono::microseconds>(
+                                  round_trip_time())));
+  }
 }  // namespace ar
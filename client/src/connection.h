@@ -2,10 +2,15 @@
 
 #include <asio/awaitable.hpp>
 #include <asio/ip/tcp.hpp>
-#include <queue>
+#include <asio/steady_timer.hpp>
+#include <atomic>
+#include <chrono>
 
+#include "message/frame_reader.h"
+#include "message/write_lanes.h"
 #include "message/payload.h"
 #include "util/literal.h"
+#include "util/socket.h"
 #include "util/types.h"
 
 namespace ar
@@ -16,6 +21,12 @@ namespace ar
   {
   public:
     using id_type = u16;
+    using clock_type = std::chrono::steady_clock;
+
+    // Ping is sent when nothing is read from the server for this long
+    constexpr static std::chrono::seconds HEARTBEAT_INTERVAL{15};
+    // the connection is closed when nothing is read from or written to the server for this long
+    constexpr static std::chrono::seconds IDLE_TIMEOUT{45};
 
     explicit Connection(asio::any_io_executor executor) noexcept;
 
@@ -34,12 +45,24 @@ namespace ar
     // it is okay to call it multiple times
     void close() noexcept;
 
+    // Ping and Pong are handled here, so they are never returned
     asio::awaitable<std::expected<Message, asio::error_code>> read() noexcept;
 
     bool is_open() const noexcept;
 
     void write(Message&& msg) noexcept;
 
+    // block the caller until the queued bytes are below the limit or the connection is closed,
+    // it should not be called from the io thread
+    void wait_pending_below(usize limit) const noexcept;
+
+    [[nodiscard]] usize pending_bytes() const noexcept;
+
+    [[nodiscard]] WriteStats::Snapshot write_stats() const noexcept;
+
+    // round trip time of the last Pong, 0 when there is none yet
+    [[nodiscard]] std::chrono::nanoseconds round_trip_time() const noexcept;
+
     template <typename Self>
     auto&& socket(this Self&& self) noexcept;
 
@@ -51,15 +74,35 @@ namespace ar
   private:
     asio::awaitable<void> write_handler() noexcept;
 
+    // send Ping when the server is quiet and close the connection when it is gone
+    asio::awaitable<void> heartbeat_handler() noexcept;
+
+    // reply Ping and measure the round trip time from Pong
+    void on_heartbeat(const Message& msg) noexcept;
+
+    // pop queued messages of the next lane within the write budget
+    void pop_write_batch(std::vector<Message>& batch) noexcept;
+
   private:
     std::atomic_bool is_closing_;
 
     // Message m_input_message;
-    std::queue<Message> write_message_queue_;
+    WriteLanes<Message> write_lanes_;
+    std::atomic<usize> pending_bytes_; // bytes queued but not yet written
+    WriteBudget write_budget_;
+    WriteStats write_stats_;
+    FrameReader frame_reader_; // only used by read
     asio::ip::tcp::socket socket_;
 
+    asio::steady_timer heartbeat_timer_;
+    std::atomic<clock_type::rep> last_active_at_;
+    // read and written bytes, only used by the io thread
+    u64 written_bytes_;
+    u64 checked_bytes_;
+    std::atomic_bool is_ping_pending_;
+    std::atomic<i64> round_trip_time_; // nanoseconds
+
     // correspond authenticated user, it will be null when the connection is not authenticated yet
-    asio::steady_timer write_timer_;
     std::unique_ptr<User> user_;
   };
 
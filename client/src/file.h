@@ -26,6 +26,7 @@ namespace ar
     User::id_type id;
     std::string name;
     DMRSA::_public_key public_key;
+    u8 compressions; // bits of CompressionType the user could decompress
   };
 
   struct FileProperty
@@ -108,4 +109,10 @@ namespace ar
       return std::make_tuple(FileFormat::Document, format_str);
     return std::make_tuple(FileFormat::Other, format_str);
   }
+
+  // images and archives are already compressed, compressing them only wastes cpu
+  static constexpr bool is_compressible(FileFormat format) noexcept
+  {
+    return format != FileFormat::Image && format != FileFormat::Archive;
+  }
 } // namespace ar
\ No newline at end of file
@@ -21,32 +21,30 @@ namespace ar
     std::vector<u8> cipher_key;
   };
 
-  [[nodiscard]] static EncryptHybridResult encrypt(const DMRSA::_public_key& public_key,
-                                                   std::span<u8> data) noexcept
+  struct EncryptKeyResult
   {
-    // Encrypt file
-    auto symmetric_key = random_bytes<KEY_BYTE>();
-    Camellia symmetric{symmetric_key};
-    auto [data_padding, enc_data] = symmetric.encrypts(data);
+    u8 key_padding;
+    std::vector<u8> cipher_key;
+  };
 
-    // Encrypt symmetric key
+  // Encrypt symmetric key using the opponent public key
+  [[nodiscard]] static EncryptKeyResult encrypt_key(const DMRSA::_public_key& public_key,
+                                                    std::span<u8, KEY_BYTE> symmetric_key) noexcept
+  {
     DMRSA rsa{public_key};
     auto [key_padding, enc_key] = rsa.encrypts(symmetric_key);
     auto enc_key_bytes = ar::as_byte_span<asymm_type::block_enc_type>(enc_key);
 
-    return EncryptHybridResult{
-        .data_padding = static_cast<u8>(data_padding),
+    return EncryptKeyResult{
         .key_padding = static_cast<u8>(key_padding),
-        .cipher_data = std::move(enc_data),
         .cipher_key = std::vector<u8>{enc_key_bytes.begin(), enc_key_bytes.end()}
     };
   }
 
-  [[nodiscard]] static std::expected<std::vector<u8>, std::string_view> decrypt(
-      asymm_type& asymm, u8 key_padding, std::span<u8> cipher_key, u8 data_padding,
-      std::span<u8> cipher_data) noexcept
+  // Decrypt symmetric key encrypted by encrypt_key and create the symmetric encryptor
+  [[nodiscard]] static std::expected<Camellia, std::string_view> decrypt_key(
+      asymm_type& asymm, u8 key_padding, std::span<const u8> cipher_key) noexcept
   {
-    // Decrypt key
     auto decipher_key_result = asymm.decrypts(cipher_key);
     if (!decipher_key_result)
       return std::unexpected(decipher_key_result.error());
@@ -57,10 +55,40 @@ namespace ar
     if (decipher_key_bytes.size() != KEY_BYTE)
       return std::unexpected("decrypted key is malformed");
 
-    // Decrypt files
     Camellia::key_type key{decipher_key_bytes};
-    Camellia symmetric_encryptor{key};
-    auto decipher_file_result = symmetric_encryptor.decrypts(cipher_data, data_padding);
+    return Camellia{key};
+  }
+
+  [[nodiscard]] static EncryptHybridResult encrypt(const DMRSA::_public_key& public_key,
+                                                   std::span<u8> data) noexcept
+  {
+    // Encrypt file
+    auto symmetric_key = random_bytes<KEY_BYTE>();
+    Camellia symmetric{symmetric_key};
+    auto [data_padding, enc_data] = symmetric.encrypts(data);
+
+    // Encrypt symmetric key
+    auto [key_padding, cipher_key] = encrypt_key(public_key, symmetric_key);
+
+    return EncryptHybridResult{
+        .data_padding = static_cast<u8>(data_padding),
+        .key_padding = key_padding,
+        .cipher_data = std::move(enc_data),
+        .cipher_key = std::move(cipher_key)
+    };
+  }
+
+  [[nodiscard]] static std::expected<std::vector<u8>, std::string_view> decrypt(
+      asymm_type& asymm, u8 key_padding, std::span<const u8> cipher_key, u8 data_padding,
+      std::span<const u8> cipher_data) noexcept
+  {
+    // Decrypt key
+    auto symmetric_encryptor = decrypt_key(asymm, key_padding, cipher_key);
+    if (!symmetric_encryptor)
+      return std::unexpected(symmetric_encryptor.error());
+
+    // Decrypt files
+    auto decipher_file_result = symmetric_encryptor->decrypts(cipher_data, data_padding);
     if (!decipher_file_result)
       return std::unexpected(decipher_file_result.error());
 
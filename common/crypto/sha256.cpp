@@ -0,0 +1,192 @@
+#include "sha256.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace ar
+{
+  namespace
+  {
+    constexpr std::array<u32, 64> ROUND_CONSTANTS{
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+        0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+        0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+        0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+        0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+        0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+        0xc67178f2,
+    };
+
+    constexpr std::array<u32, 8> INITIAL_STATE{
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+  } // namespace
+
+  SHA256::SHA256() noexcept
+    : state_{INITIAL_STATE},
+      buffer_{},
+      buffered_{0},
+      total_{0}
+  {
+  }
+
+  void SHA256::update(std::span<const u8> bytes) noexcept
+  {
+    total_ += bytes.size();
+    // fill the partial block first
+    if (buffered_ != 0)
+    {
+      auto size = std::min(bytes.size(), BLOCK_BYTE - buffered_);
+      std::memcpy(buffer_.data() + buffered_, bytes.data(), size);
+      buffered_ += size;
+      bytes = bytes.subspan(size);
+      if (buffered_ < BLOCK_BYTE)
+        return;
+      compress(buffer_.data());
+      buffered_ = 0;
+    }
+
+    for (; bytes.size() >= BLOCK_BYTE; bytes = bytes.subspan(BLOCK_BYTE))
+      compress(bytes.data());
+    std::memcpy(buffer_.data(), bytes.data(), bytes.size());
+    buffered_ = bytes.size();
+  }
+
+  SHA256::digest_type SHA256::finish() noexcept
+  {
+    // padding bit, zeros and the message length in bits as big endian
+    u64 bits = total_ * 8;
+    buffer_[buffered_++] = 0x80;
+    if (buffered_ > BLOCK_BYTE - sizeof(bits))
+    {
+      std::fill(buffer_.begin() + buffered_, buffer_.end(), 0);
+      compress(buffer_.data());
+      buffered_ = 0;
+    }
+    std::fill(buffer_.begin() + buffered_, buffer_.end() - sizeof(bits), 0);
+    for (usize i = 0; i < sizeof(bits); ++i)
+      buffer_[BLOCK_BYTE - 1 - i] = static_cast<u8>(bits >> (i * 8));
+    compress(buffer_.data());
+
+    digest_type result{};
+    for (usize i = 0; i < state_.size(); ++i)
+    {
+      for (usize j = 0; j < 4; ++j)
+        result[i * 4 + j] = static_cast<u8>(state_[i] >> (24 - j * 8));
+    }
+    return result;
+  }
+
+  SHA256::digest_type SHA256::digest(std::span<const u8> bytes) noexcept
+  {
+    SHA256 hasher{};
+    hasher.update(bytes);
+    return hasher.finish();
+  }
+
+  void SHA256::compress(const u8* block) noexcept
+  {
+    std::array<u32, 64> w{};
+    for (usize i = 0; i < 16; ++i)
+    {
+      w[i] = static_cast<u32>(block[i * 4]) << 24 | static_cast<u32>(block[i * 4 + 1]) << 16 |
+             static_cast<u32>(block[i * 4 + 2]) << 8 | static_cast<u32>(block[i * 4 + 3]);
+    }
+    for (usize i = 16; i < 64; ++i)
+    {
+      auto s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      auto s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto [a, b, c, d, e, f, g, h] = state_;
+    for (usize i = 0; i < 64; ++i)
+    {
+      auto s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+      auto choose = (e & f) ^ (~e & g);
+      auto temp1 = h + s1 + choose + ROUND_CONSTANTS[i] + w[i];
+      auto s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+      auto majority = (a & b) ^ (a & c) ^ (b & c);
+      auto temp2 = s0 + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + temp1;
+      d = c;
+      c = b;
+      b = a;
+      a = temp1 + temp2;
+    }
+
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+  }
+
+  SHA256::digest_type hmac_sha256(std::span<const u8> key, std::span<const u8> message) noexcept
+  {
+    // the key longer than a block is hashed first
+    std::array<u8, SHA256::BLOCK_BYTE> block_key{};
+    if (key.size() > SHA256::BLOCK_BYTE)
+    {
+      auto hashed = SHA256::digest(key);
+      std::ranges::copy(hashed, block_key.begin());
+    }
+    else
+      std::ranges::copy(key, block_key.begin());
+
+    std::array<u8, SHA256::BLOCK_BYTE> pad{};
+    SHA256 inner{};
+    std::ranges::transform(block_key, pad.begin(), [](u8 byte) {
+      return static_cast<u8>(byte ^ 0x36);
+    });
+    inner.update(pad);
+    inner.update(message);
+    auto inner_digest = inner.finish();
+
+    SHA256 outer{};
+    std::ranges::transform(block_key, pad.begin(), [](u8 byte) {
+      return static_cast<u8>(byte ^ 0x5c);
+    });
+    outer.update(pad);
+    outer.update(inner_digest);
+    return outer.finish();
+  }
+
+  std::vector<u8> pbkdf2_sha256(std::span<const u8> password, std::span<const u8> salt,
+                                u32 rounds, usize size) noexcept
+  {
+    std::vector<u8> result{};
+    result.reserve(size);
+    std::vector<u8> first(salt.size() + sizeof(u32));
+    std::ranges::copy(salt, first.begin());
+    for (u32 index = 1; result.size() < size; ++index)
+    {
+      // salt followed by the block index as big endian
+      for (usize i = 0; i < sizeof(u32); ++i)
+        first[salt.size() + i] = static_cast<u8>(index >> (24 - i * 8));
+
+      auto u = hmac_sha256(password, first);
+      auto block = u;
+      for (u32 round = 1; round < rounds; ++round)
+      {
+        u = hmac_sha256(password, u);
+        for (usize i = 0; i < block.size(); ++i)
+          block[i] ^= u[i];
+      }
+      auto take = std::min(block.size(), size - result.size());
+      result.insert(result.end(), block.begin(), block.begin() + static_cast<isize>(take));
+    }
+    return result;
+  }
+} // namespace ar
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <vector>
+
+#include "util/types.h"
+
+namespace ar
+{
+  // SHA-256 (FIPS 180-4), update could be called many times before finish
+  class SHA256
+  {
+  public:
+    constexpr static usize DIGEST_BYTE = 32;
+    constexpr static usize BLOCK_BYTE = 64;
+    using digest_type = std::array<u8, DIGEST_BYTE>;
+
+    SHA256() noexcept;
+
+    void update(std::span<const u8> bytes) noexcept;
+
+    // the hasher should not be used after it
+    [[nodiscard]] digest_type finish() noexcept;
+
+    [[nodiscard]] static digest_type digest(std::span<const u8> bytes) noexcept;
+
+  private:
+    void compress(const u8* block) noexcept;
+
+  private:
+    std::array<u32, 8> state_;
+    std::array<u8, BLOCK_BYTE> buffer_;
+    usize buffered_;
+    u64 total_;
+  };
+
+  // HMAC-SHA256 (RFC 2104)
+  [[nodiscard]] SHA256::digest_type hmac_sha256(std::span<const u8> key,
+                                                std::span<const u8> message) noexcept;
+
+  // PBKDF2 with HMAC-SHA256 (RFC 8018), it is meant to be slow by the rounds
+  [[nodiscard]] std::vector<u8> pbkdf2_sha256(std::span<const u8> password,
+                                              std::span<const u8> salt, u32 rounds,
+                                              usize size) noexcept;
+} // namespace ar
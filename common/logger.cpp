@@ -5,13 +5,201 @@
 #include <fmt/core.h>
 #include <fmt/std.h>
 
+#include <condition_variable>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include "core.h"
+#include "util/spsc_ring.h"
 #include "util/types.h"
 
 namespace ar
 {
+  namespace
+  {
+    // lines are written once the buffer is over it, even before the flush is done
+    constexpr usize FLUSH_BUFFER_SIZE = 64 * 1024;
+    constexpr std::chrono::milliseconds FLUSH_INTERVAL{10};
+
+    // the strings keep their capacity when the slot is reused
+    struct Record
+    {
+      std::string_view type;
+      std::string_view function;
+      std::chrono::system_clock::time_point time;
+      std::string thread;
+      std::string message;
+    };
+
+    struct AsyncState
+    {
+      std::mutex mutex; // guards every member except the atomics
+      std::atomic_bool is_running{false};
+      Logger::AsyncConfig config{};
+      std::FILE* file = stdout;
+      std::vector<std::unique_ptr<SpscRing<Record>>> rings{};
+      std::condition_variable wake{};
+      bool is_stopping = false;
+      std::thread flusher{};
+      std::atomic<u64> dropped{0};
+      // threads inside push, the last flush waits for them
+      std::atomic<u32> pushing{0};
+      // held by start_async and stop_async, so a concurrent stop waits until the join is done
+      std::mutex control_mutex;
+    };
+
+    // it is never destroyed, so the threads logging on exit could still use it
+    AsyncState& async_state() noexcept
+    {
+      static auto s_state = new AsyncState{};
+      return *s_state;
+    }
+
+    std::mutex s_thread_names_mutex;
+    std::map<std::thread::id, std::string> s_thread_names;
+    // increased on every name change, so the cached names are refreshed
+    std::atomic<u64> s_thread_names_version{0};
+
+    const std::string& current_thread_name() noexcept
+    {
+      struct Cache
+      {
+        u64 version = ~u64{0};
+        std::string name{};
+      };
+      thread_local Cache cache{};
+
+      auto version = s_thread_names_version.load(std::memory_order_acquire);
+      if (cache.version == version)
+        return cache.name;
+
+      auto id = std::this_thread::get_id();
+      std::lock_guard lock{s_thread_names_mutex};
+      auto it = s_thread_names.find(id);
+      cache.name = it != s_thread_names.end() ? it->second : fmt::format("{}", id);
+      cache.version = version;
+      return cache.name;
+    }
+
+    void format_line(fmt::memory_buffer& out, std::string_view thread,
+                     std::chrono::system_clock::time_point time, std::string_view type,
+                     std::string_view function, std::string_view message) noexcept
+    {
+      fmt::format_to(std::back_inserter(out), "[{:^8}] {:%H:%M:%S} |{:^8}| '{}' => {}\n", thread,
+                     time, type, function, message);
+    }
+
+    void write(std::FILE* file, fmt::memory_buffer& out) noexcept
+    {
+      std::fwrite(out.data(), 1, out.size(), file);
+      std::fflush(file);
+      out.clear();
+    }
+
+    // take the lines of every thread, it is only called by the flush thread or while it is stopped
+    void flush(AsyncState& state, fmt::memory_buffer& out) noexcept
+    {
+      std::unique_lock lock{state.mutex};
+      for (auto& ring : state.rings)
+      {
+        while (auto record = ring->front())
+        {
+          format_line(out, record->thread, record->time, record->type, record->function,
+                      record->message);
+          ring->pop();
+          if (out.size() >= FLUSH_BUFFER_SIZE)
+            write(state.file, out);
+        }
+      }
+      if (auto dropped = state.dropped.exchange(0, std::memory_order_relaxed); dropped != 0)
+      {
+        format_line(out, "LOGGER", std::chrono::system_clock::now(), "WARN", "flush",
+                    fmt::format("{} lines are dropped because the buffers were full", dropped));
+      }
+      if (out.size() != 0)
+        write(state.file, out);
+    }
+
+    void flusher(AsyncState& state) noexcept
+    {
+      fmt::memory_buffer out{};
+      while (true)
+      {
+        {
+          std::unique_lock lock{state.mutex};
+          state.wake.wait_for(lock, FLUSH_INTERVAL);
+          if (state.is_stopping)
+            break;
+        }
+        flush(state, out);
+      }
+      flush(state, out);
+    }
+
+    SpscRing<Record>* current_ring(AsyncState& state) noexcept
+    {
+      // the ring is kept by the state after the thread exits
+      thread_local SpscRing<Record>* ring = nullptr;
+      if (ring)
+        return ring;
+      std::lock_guard lock{state.mutex};
+      ring = state.rings.emplace_back(std::make_unique<SpscRing<Record>>(state.config.capacity))
+                 .get();
+      return ring;
+    }
+
+    bool push_record(AsyncState& state, std::string_view type, std::string_view function,
+                     std::string_view message) noexcept
+    {
+      if (!state.is_running.load())
+        return false;
+
+      auto ring = current_ring(state);
+      auto record = ring->reserve();
+      while (!record)
+      {
+        if (state.config.overflow == Logger::OverflowPolicy::Drop)
+        {
+          state.dropped.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+        if (!state.is_running.load(std::memory_order_acquire))
+          return false;
+        state.wake.notify_one();
+        std::this_thread::yield();
+        record = ring->reserve();
+      }
+
+      record->type = type;
+      record->function = function;
+      record->time = std::chrono::system_clock::now();
+      record->thread.assign(current_thread_name());
+      record->message.assign(message);
+      ring->commit();
+      // the flush thread wakes up by itself, it is only hurried when the ring is filling up
+      if (ring->size() > ring->capacity() / 2)
+        state.wake.notify_one();
+      return true;
+    }
+
+    // return false when the line should be written synchronously instead
+    bool push(std::string_view type, std::string_view function, std::string_view message) noexcept
+    {
+      auto& state = async_state();
+      // counted before is_running is checked, so stop_async sees either the count or the line is
+      // written synchronously
+      state.pushing.fetch_add(1);
+      auto is_pushed = push_record(state, type, function, message);
+      state.pushing.fetch_sub(1, std::memory_order_release);
+      return is_pushed;
+    }
+  } // namespace
+
   static constexpr std::string_view get_function_name(std::string_view func_) noexcept
   {
     if constexpr (AR_WINDOWS)
@@ -73,6 +261,8 @@ namespace ar
 
   void Logger::critical(std::string_view val, std::source_location sl) noexcept
   {
+    // the buffered lines should be written before it aborts
+    stop_async();
     log(Level::Critical, CRITICAL_HEADER, val, sl);
     std::abort();
   }
@@ -84,7 +274,9 @@ namespace ar
 
   void Logger::set_thread_name(std::string name, thread_id id) noexcept
   {
+    std::lock_guard lock{s_thread_names_mutex};
     s_thread_names[id] = std::move(name);
+    s_thread_names_version.fetch_add(1, std::memory_order_release);
   }
 
   void Logger::set_current_thread_name(std::string name) noexcept
@@ -99,14 +291,69 @@ namespace ar
     if (level < s_level)
       return;
 
-    auto id = std::this_thread::get_id();
-    auto thread = fmt::format("{}", id);
-    if (s_thread_names.contains(id))
-      thread = s_thread_names[id];
+    auto function = get_function_name(sl.function_name());
+    if (push(type, function, val))
+      return;
 
-    fmt::println("[{:^8}] {:%H:%M:%S} |{:^8}| '{}' => {}", thread, std::chrono::system_clock::now(),
-                 type,
-                 get_function_name(sl.function_name()), val);
+    fmt::memory_buffer out{};
+    format_line(out, current_thread_name(), std::chrono::system_clock::now(), type, function, val);
+    std::lock_guard lock{async_state().mutex};
+    write(async_state().file, out);
     #endif
   }
+
+  std::expected<void, std::string_view> Logger::start_async(AsyncConfig config) noexcept
+  {
+    auto& state = async_state();
+    std::lock_guard control_lock{state.control_mutex};
+    std::lock_guard lock{state.mutex};
+    if (state.is_running)
+      return std::unexpected{"logger is already asynchronous"sv};
+
+    std::FILE* file = stdout;
+    if (!config.path.empty())
+    {
+      file = std::fopen(config.path.string().c_str(), "a");
+      if (!file)
+        return std::unexpected{"failed to open the log file"sv};
+    }
+
+    state.config = std::move(config);
+    state.file = file;
+    state.is_stopping = false;
+    state.flusher = std::thread{[&state] {
+      flusher(state);
+    }};
+    state.is_running.store(true, std::memory_order_release);
+    return {};
+  }
+
+  void Logger::stop_async() noexcept
+  {
+    auto& state = async_state();
+    std::lock_guard control_lock{state.control_mutex};
+    {
+      std::lock_guard lock{state.mutex};
+      if (!state.is_running)
+        return;
+      // the new lines are written synchronously, the flush thread takes the rest
+      state.is_running.store(false);
+      state.is_stopping = true;
+    }
+    state.wake.notify_one();
+    state.flusher.join();
+
+    // take what is pushed by the threads that saw it running while it was stopped, after they
+    // are done committing it
+    while (state.pushing.load(std::memory_order_acquire) != 0)
+      std::this_thread::yield();
+    fmt::memory_buffer out{};
+    flush(state, out);
+    std::lock_guard lock{state.mutex};
+    if (state.file != stdout)
+    {
+      std::fclose(state.file);
+      state.file = stdout;
+    }
+  }
 } // namespace ar
\ No newline at end of file
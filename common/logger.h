@@ -1,6 +1,8 @@
 #pragma once
-#include <map>
+#include <expected>
+#include <filesystem>
 #include <source_location>
+#include <string>
 #include <string_view>
 #include <thread>
 
@@ -24,6 +26,20 @@ namespace ar
       Critical
     };
 
+    // what the logging thread does when its buffer is full
+    enum class OverflowPolicy : u8
+    {
+      Drop,  // the line is dropped and counted, the count is logged with the next flush
+      Block, // the thread waits until the flush thread takes some lines
+    };
+
+    struct AsyncConfig
+    {
+      std::filesystem::path path{}; // stdout when empty
+      usize capacity = 4096;        // lines buffered by each thread
+      OverflowPolicy overflow = OverflowPolicy::Drop;
+    };
+
     static void trace(std::string_view val,
                       std::source_location sl = std::source_location::current()) noexcept;
     static void info(std::string_view val,
@@ -44,12 +60,19 @@ namespace ar
     static void set_thread_name(std::string name, thread_id id) noexcept;
     static void set_current_thread_name(std::string name) noexcept;
 
+    // Move the writes off the logging threads. Each thread pushes its lines into its own ring
+    // buffer and a flush thread writes them in batches, so the lines keep their order only within
+    // the same thread. Before it is started and after it is stopped the lines are written
+    // synchronously.
+    static std::expected<void, std::string_view> start_async(AsyncConfig config) noexcept;
+    // write the buffered lines and stop the flush thread
+    static void stop_async() noexcept;
+
   private:
     static void log(Level level, std::string_view type, std::string_view val,
                     const std::source_location& sl);
 
   private:
-    static inline std::map<thread_id, std::string> s_thread_names;
     static inline Level s_level{Level::Trace};
 
     static constexpr std::string_view HEADER_NAME{"nourton"sv};  // NOTE: Currently not used
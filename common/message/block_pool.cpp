@@ -0,0 +1,80 @@
+#include "block_pool.h"
+
+#include <fmt/format.h>
+
+#include <system_error>
+
+#include "logger.h"
+
+namespace ar
+{
+  BlockPool::BlockPool(usize block_size, usize block_count) noexcept
+    : block_size_{block_size},
+      memory_{std::make_unique_for_overwrite<u8[]>(block_size * block_count)}
+  {
+    buffers_.reserve(block_count);
+    for (usize i = 0; i < block_count; ++i)
+    {
+      buffers_.emplace_back(memory_.get() + i * block_size, block_size);
+      free_blocks_.push(static_cast<u32>(i));
+    }
+  }
+
+  std::shared_ptr<BlockPool> BlockPool::make_shared(asio::io_context& context, usize block_size,
+                                                    usize block_count) noexcept
+  {
+    std::shared_ptr<BlockPool> pool{new BlockPool{block_size, block_count}};
+    pool->register_blocks(context);
+    return pool;
+  }
+
+  std::optional<BlockPool::Block> BlockPool::acquire() noexcept
+  {
+    if (free_blocks_.empty())
+      return std::nullopt;
+    auto index = free_blocks_.front();
+    free_blocks_.pop();
+
+    // the deleter keeps the pool alive until the block is returned
+    Block block{
+        .data = std::shared_ptr<u8[]>{memory_.get() + index * block_size_,
+                                      [pool = shared_from_this(), index](u8*) {
+                                        pool->free_blocks_.push(u32{index});
+                                      }},
+        .registered = std::nullopt,
+    };
+    if (registration_)
+      block.registered = (*registration_)[index];
+    return block;
+  }
+
+  usize BlockPool::block_size() const noexcept
+  {
+    return block_size_;
+  }
+
+  bool BlockPool::is_registered() const noexcept
+  {
+    return registration_.has_value();
+  }
+
+  void BlockPool::unregister_blocks() noexcept
+  {
+    registration_.reset();
+  }
+
+  void BlockPool::register_blocks(asio::io_context& context) noexcept
+  {
+    // the kernel could refuse it when the blocks are over the locked memory limit, the blocks
+    // are still used as regular buffers
+    try
+    {
+      registration_.emplace(context, buffers_);
+    }
+    catch (const std::system_error& e)
+    {
+      Logger::warn(fmt::format("failed to register {} read blocks: {}", buffers_.size(),
+                               e.what()));
+    }
+  }
+} // namespace ar
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <asio/buffer_registration.hpp>
+#include <asio/io_context.hpp>
+#include <asio/registered_buffer.hpp>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "util/mpsc_queue.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Read blocks of FrameReader allocated together and registered into the io_context. With the
+  // io_uring backend the reads into them are fixed buffer operations, which don't map the pages on
+  // every read, on the other backends the registration does nothing and the blocks are only
+  // reused. The blocks should be taken by the context thread, but they could be released from
+  // any thread since the message bodies refer to them.
+  class BlockPool : public std::enable_shared_from_this<BlockPool>
+  {
+  public:
+    struct Block
+    {
+      std::shared_ptr<u8[]> data; // the block is returned when every reference is released
+      std::optional<asio::mutable_registered_buffer> registered; // null when not registered
+    };
+
+    static std::shared_ptr<BlockPool> make_shared(asio::io_context& context, usize block_size,
+                                                  usize block_count) noexcept;
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    // it will return null when every block is used
+    std::optional<Block> acquire() noexcept;
+
+    [[nodiscard]] usize block_size() const noexcept;
+
+    [[nodiscard]] bool is_registered() const noexcept;
+
+    // drop the registration while the context is still alive, the blocks are kept as regular
+    // buffers. The message bodies could keep the pool alive after the context is destroyed, so it
+    // should be called before the context is destroyed and while it is not running.
+    void unregister_blocks() noexcept;
+
+  private:
+    BlockPool(usize block_size, usize block_count) noexcept;
+
+    void register_blocks(asio::io_context& context) noexcept;
+
+  private:
+    usize block_size_;
+    std::unique_ptr<u8[]> memory_;
+    std::vector<asio::mutable_buffer> buffers_;
+    std::optional<asio::buffer_registration<std::vector<asio::mutable_buffer>>> registration_;
+    MpscQueue<u32> free_blocks_;
+  };
+} // namespace ar
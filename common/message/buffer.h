@@ -0,0 +1,89 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "util/types.h"
+
+namespace ar
+{
+  // Reference counted immutable bytes. Copying it only copies the reference, so one message body
+  // can be queued into several connections without copying the bytes.
+  class SharedBuffer
+  {
+  public:
+    SharedBuffer() noexcept
+      : owner_{}, data_{nullptr}, size_{0}
+    {
+    }
+
+    // take the ownership of bytes without copying it
+    SharedBuffer(std::vector<u8>&& bytes) noexcept
+      : SharedBuffer{}
+    {
+      auto owner = std::make_shared<const std::vector<u8>>(std::move(bytes));
+      data_ = owner->data();
+      size_ = owner->size();
+      owner_ = std::move(owner);
+    }
+
+    // copy the bytes
+    explicit SharedBuffer(std::span<const u8> bytes) noexcept
+      : SharedBuffer{std::vector<u8>{bytes.begin(), bytes.end()}}
+    {
+    }
+
+    // refer to the bytes which lifetime is managed by owner
+    SharedBuffer(std::shared_ptr<const void> owner, std::span<const u8> bytes) noexcept
+      : owner_{std::move(owner)}, data_{bytes.data()}, size_{bytes.size()}
+    {
+    }
+
+    [[nodiscard]] const u8* data() const noexcept
+    {
+      return data_;
+    }
+
+    [[nodiscard]] usize size() const noexcept
+    {
+      return size_;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+
+    [[nodiscard]] const u8* begin() const noexcept
+    {
+      return data_;
+    }
+
+    [[nodiscard]] const u8* end() const noexcept
+    {
+      return data_ + size_;
+    }
+
+    [[nodiscard]] std::span<const u8> span() const noexcept
+    {
+      return {data_, size_};
+    }
+
+    operator std::span<const u8>() const noexcept
+    {
+      return span();
+    }
+
+    // number of messages sharing the same bytes
+    [[nodiscard]] long use_count() const noexcept
+    {
+      return owner_.use_count();
+    }
+
+  private:
+    std::shared_ptr<const void> owner_;
+    const u8* data_;
+    usize size_;
+  };
+} // namespace ar
@@ -44,9 +44,21 @@ namespace ar
   static constexpr std::string_view USER_ALREADY_EXIST{
       "user already exist"
   };
+  static constexpr std::string_view USER_LIMIT_REACHED{
+      "server could not register more users"
+  };
+  static constexpr std::string_view USER_STORE_FAILED{
+      "server could not save the changes"
+  };
   static constexpr std::string_view PASSWORD_INVALID{
       "password provided is invalid"
   };
+  static constexpr std::string_view SPOOL_QUOTA_EXCEEDED{
+      "the opponent has too many files waiting for it"
+  };
+  static constexpr std::string_view SPOOL_FAILED{
+      "server could not save the file for the opponent"
+  };
 
   struct FeedbackPayload
   {
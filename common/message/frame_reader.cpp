@@ -0,0 +1,192 @@
+#include "frame_reader.h"
+
+#include <asio/read.hpp>
+#include <cstring>
+
+#include "util/asio.h"
+
+namespace ar
+{
+  FrameReader::FrameReader(usize block_size) noexcept
+    : block_size_{block_size},
+      block_{std::make_shared_for_overwrite<u8[]>(block_size)},
+      begin_{0},
+      end_{0},
+      read_count_{0},
+      read_bytes_{0}
+  {
+  }
+
+  void FrameReader::use_pool(std::shared_ptr<BlockPool> pool) noexcept
+  {
+    pool_ = std::move(pool);
+    block_size_ = pool_->block_size();
+    next_block();
+  }
+
+  asio::awaitable<asio::error_code> FrameReader::read_header(
+      asio::ip::tcp::socket& socket, std::array<u8, Message::header_size>& header) noexcept
+  {
+    if (auto ec = co_await fill(socket, Message::header_size))
+      co_return ec;
+
+    auto bytes = consume(Message::header_size);
+    std::memcpy(header.data(), bytes.data(), Message::header_size);
+    co_return asio::error_code{};
+  }
+
+  asio::awaitable<asio::error_code> FrameReader::read_body(asio::ip::tcp::socket& socket,
+                                                           usize size, SharedBuffer& body) noexcept
+  {
+    if (size <= block_size_)
+    {
+      if (auto ec = co_await fill(socket, size))
+        co_return ec;
+
+      body = SharedBuffer{block_, consume(size)};
+      co_return asio::error_code{};
+    }
+
+    std::vector<u8> bytes(size);
+    if (auto ec = co_await read_exactly(socket, bytes))
+      co_return ec;
+    body = SharedBuffer{std::move(bytes)};
+    co_return asio::error_code{};
+  }
+
+  asio::awaitable<asio::error_code> FrameReader::read_exactly(asio::ip::tcp::socket& socket,
+                                                              std::span<u8> dest) noexcept
+  {
+    // take the buffered bytes first
+    auto bytes = consume(std::min(dest.size(), buffered()));
+    if (!bytes.empty())
+      std::memcpy(dest.data(), bytes.data(), bytes.size());
+
+    auto remaining = dest.subspan(bytes.size());
+    if (remaining.empty())
+      co_return asio::error_code{};
+
+    ++read_count_;
+    // the progress is counted on every partial read, so the big body is not seen as idle. The
+    // condition is not asked after the last read, so it is counted again from the result
+    auto condition = asio::transfer_exactly(remaining.size());
+    auto base = read_bytes_;
+    auto [ec, n] = co_await asio::async_read(
+        socket, asio::buffer(remaining.data(), remaining.size()),
+        [&](const asio::error_code& error, usize transferred) {
+          read_bytes_ = base + transferred;
+          return condition(error, transferred);
+        },
+        ar::await_with_error());
+    read_bytes_ = base + n;
+    co_return ec;
+  }
+
+  usize FrameReader::buffered() const noexcept
+  {
+    return end_ - begin_;
+  }
+
+  std::span<const u8> FrameReader::take_buffered(usize size) noexcept
+  {
+    return consume(std::min(size, buffered()));
+  }
+
+  bool FrameReader::preload(std::span<const u8> bytes) noexcept
+  {
+    if (bytes.empty())
+      return true;
+    if (bytes.size() > block_size_ - buffered())
+      return false;
+    reserve(buffered() + bytes.size());
+    std::memcpy(block_.get() + end_, bytes.data(), bytes.size());
+    end_ += bytes.size();
+    return true;
+  }
+
+  u64 FrameReader::read_count() const noexcept
+  {
+    return read_count_;
+  }
+
+  u64 FrameReader::read_bytes() const noexcept
+  {
+    return read_bytes_;
+  }
+
+  asio::awaitable<asio::error_code> FrameReader::fill(asio::ip::tcp::socket& socket,
+                                                      usize size) noexcept
+  {
+    if (buffered() >= size)
+      co_return asio::error_code{};
+
+    // start from the beginning when everything is consumed and nobody refers to the block
+    if (buffered() == 0 && block_.use_count() == 1)
+    {
+      begin_ = 0;
+      end_ = 0;
+    }
+    reserve(size);
+    while (buffered() < size)
+    {
+      ++read_count_;
+      // the registered block is read with fixed buffer operation on io_uring
+      auto [ec, n] = registered_
+                       ? co_await socket.async_read_some(*registered_ + end_,
+                                                         ar::await_with_error())
+                       : co_await socket.async_read_some(
+                           asio::buffer(block_.get() + end_, block_size_ - end_),
+                           ar::await_with_error());
+      if (ec)
+        co_return ec;
+      end_ += n;
+      read_bytes_ += n;
+    }
+    co_return asio::error_code{};
+  }
+
+  void FrameReader::reserve(usize size) noexcept
+  {
+    if (block_size_ - begin_ >= size)
+      return;
+
+    auto pending = std::span<const u8>{block_.get() + begin_, buffered()};
+    if (block_.use_count() == 1)
+    {
+      // nobody refers to the consumed bytes
+      std::memmove(block_.get(), pending.data(), pending.size());
+    }
+    else
+    {
+      // the consumed bytes are still used by the previous bodies
+      // keep the pending bytes alive while they are copied
+      auto previous = std::move(block_);
+      next_block();
+      std::memcpy(block_.get(), pending.data(), pending.size());
+    }
+    begin_ = 0;
+    end_ = pending.size();
+  }
+
+  void FrameReader::next_block() noexcept
+  {
+    if (pool_)
+    {
+      if (auto block = pool_->acquire())
+      {
+        block_ = std::move(block->data);
+        registered_ = block->registered;
+        return;
+      }
+    }
+    block_ = std::make_shared_for_overwrite<u8[]>(block_size_);
+    registered_.reset();
+  }
+
+  std::span<const u8> FrameReader::consume(usize size) noexcept
+  {
+    std::span<const u8> bytes{block_.get() + begin_, size};
+    begin_ += size;
+    return bytes;
+  }
+} // namespace ar
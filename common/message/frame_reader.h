@@ -0,0 +1,82 @@
+#pragma once
+
+#include <asio/awaitable.hpp>
+#include <asio/ip/tcp.hpp>
+#include <asio/registered_buffer.hpp>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "block_pool.h"
+#include "message.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Reads messages through a buffer, so the small messages that arrive together are parsed from one
+  // read instead of 2 reads per message. Bodies that fit the block refer to it without copying and
+  // keep it alive, the block is reused when nobody refers to it anymore, otherwise the pending bytes
+  // are moved into a new block. Bigger bodies are read directly into their own buffer.
+  class FrameReader
+  {
+  public:
+    static constexpr usize BLOCK_SIZE = 64 * 1024;
+
+    explicit FrameReader(usize block_size = BLOCK_SIZE) noexcept;
+
+    // take the next blocks from the pool, the blocks are allocated as usual when the pool is
+    // empty. It should be called before reading anything.
+    void use_pool(std::shared_ptr<BlockPool> pool) noexcept;
+
+    asio::awaitable<asio::error_code> read_header(asio::ip::tcp::socket& socket,
+                                                  std::array<u8, Message::header_size>& header)
+    noexcept;
+
+    asio::awaitable<asio::error_code> read_body(asio::ip::tcp::socket& socket, usize size,
+                                                SharedBuffer& body) noexcept;
+
+    // read exactly dest size bytes, used to read the body in pieces
+    asio::awaitable<asio::error_code> read_exactly(asio::ip::tcp::socket& socket,
+                                                   std::span<u8> dest) noexcept;
+
+    // bytes already read from the socket but not consumed yet
+    [[nodiscard]] usize buffered() const noexcept;
+
+    // consume at most size bytes that are already read, the socket is not read
+    std::span<const u8> take_buffered(usize size) noexcept;
+
+    // put bytes read by another reader of the socket after the buffered bytes, used when the
+    // socket is handed over. It will return false when the bytes don't fit the block.
+    [[nodiscard]] bool preload(std::span<const u8> bytes) noexcept;
+
+    // number of socket reads done, used to check how many messages are parsed per read
+    [[nodiscard]] u64 read_count() const noexcept;
+
+    // bytes received from the socket, it grows while a big body is read too so it could be used
+    // to tell whether the peer is still sending
+    [[nodiscard]] u64 read_bytes() const noexcept;
+
+  private:
+    // read until at least size bytes are buffered, size should not be bigger than the block size
+    asio::awaitable<asio::error_code> fill(asio::ip::tcp::socket& socket, usize size) noexcept;
+
+    // make room at the end of block for at least size bytes
+    void reserve(usize size) noexcept;
+
+    // replace the block, the old one is kept by the bodies that refer to it
+    void next_block() noexcept;
+
+    std::span<const u8> consume(usize size) noexcept;
+
+  private:
+    usize block_size_;
+    std::shared_ptr<BlockPool> pool_;
+    std::shared_ptr<u8[]> block_;
+    std::optional<asio::mutable_registered_buffer> registered_; // registered range of the block
+    usize begin_; // first unconsumed byte
+    usize end_;   // end of read bytes
+    u64 read_count_;
+    u64 read_bytes_;
+  };
+} // namespace ar
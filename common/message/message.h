@@ -6,6 +6,7 @@
 
 #include <alpaca/alpaca.h>
 
+#include "buffer.h"
 #include "util/types.h"
 
 namespace ar
@@ -42,7 +43,18 @@ namespace ar
       UserLogout,
       UserLogin,
       // ---Signal
-      Feedback
+      Feedback,
+      // ---Streaming file transfer
+      SendFileBegin,
+      SendFileChunk,
+      SendFileEnd,
+      // ---Signal
+      // batch of users going online and offline, the body is delta of UserOnlinePayload
+      UserPresence,
+      // ---Liveness
+      // the receiver replies Pong with the same body, they are handled by the connections
+      Ping,
+      Pong,
     };
 
     enum class EncryptionType: u8
@@ -81,16 +93,31 @@ namespace ar
       std::memcpy(header.data(), &header_, header_size);
     }
 
+    // copy the body
     explicit Message(const Header& header_, std::span<const u8> body) noexcept
-      : header(), body{body.begin(), body.end()}
+      : header(), body{body}
+    {
+      std::memcpy(header.data(), &header_, header_size);
+    }
+
+    explicit Message(const Header& header_, std::vector<u8>&& body) noexcept
+      : header(), body{std::move(body)}
+    {
+      std::memcpy(header.data(), &header_, header_size);
+    }
+
+    explicit Message(const Header& header_, SharedBuffer body) noexcept
+      : header(), body{std::move(body)}
     {
       std::memcpy(header.data(), &header_, header_size);
     }
 
     // WARN: header should not be serialized using alpaca, use the underlying memory layout of
     // Header struct instead
+    // NOTE: header is owned by each message, while the body is shared between the copies. so
+    // copying message to change the header for each destination doesn't copy the body.
     std::array<u8, header_size> header;
-    std::vector<u8> body;
+    SharedBuffer body;
 
     [[nodiscard]]
     Header parse_header() const noexcept
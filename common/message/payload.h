@@ -6,6 +6,7 @@
 #include <array>
 #include <expected>
 #include <span>
+#include <utility>
 #include <vector>
 
 #include "message.h"
@@ -22,11 +23,17 @@ namespace ar
     User::id_type id;
     std::string username;
     std::vector<u8> public_key;
+    // bits of CompressionType the user could decompress, 0 when it is unknown
+    u8 compressions;
 
+    // the older clients reject the trailing field, so it is left out when it is 0, which is also
+    // sent to them
     [[nodiscard]] std::vector<u8> serialize() const noexcept
     {
       std::vector<u8> temp{};
       alpaca::serialize(*this, temp);
+      if (compressions == 0)
+        temp.pop_back();
       return temp;
     }
   };
@@ -68,7 +75,11 @@ namespace ar
 
   struct GetUserOnlinePayload
   {
-    // Empty struct
+    // version of the last online users the client has, 0 to get the full snapshot
+    u64 version;
+    // first user id of the requested snapshot page, it is the next_cursor of the previous page
+    User::id_type cursor;
+
     [[nodiscard]] std::vector<u8> serialize() const noexcept
     {
       std::vector<u8> temp{};
@@ -79,7 +90,15 @@ namespace ar
 
   struct UserOnlinePayload
   {
+    u64 version;
+    // delta contains the changes since the requested version, otherwise it is a page of snapshot
+    bool is_delta;
+    // online users of the page, or users going online for delta
     std::vector<UserResponse> users;
+    // users going offline, only used by delta
+    std::vector<User::id_type> offline_ids;
+    // cursor of the next snapshot page, 0 when it is the last page
+    User::id_type next_cursor;
 
     [[nodiscard]] std::vector<u8> serialize() const noexcept
     {
@@ -118,6 +137,8 @@ namespace ar
   struct StorePublicKeyPayload
   {
     std::vector<u8> key;
+    // bits of CompressionType the client could decompress, the older clients don't send it
+    u8 compressions;
 
     [[nodiscard]] std::vector<u8> serialize() const noexcept
     {
@@ -187,6 +208,90 @@ namespace ar
     }
   };
 
+  // Streaming file transfer, the file is sent as SendFileBegin followed by several SendFileChunk
+  // and closed by SendFileEnd. Those messages are not encrypted by the connection symmetric key,
+  // the server only relays them to the opponent.
+  // NOTE: chunk size should be multiple of the symmetric block size, so only the last chunk
+  // has padding
+  static constexpr usize SEND_FILE_CHUNK_SIZE = 64 * 1024;
+
+  // compression applied on each file chunk before it is encrypted
+  enum class CompressionType : u8
+  {
+    None,
+    Lz, // util/compression.h
+  };
+
+  constexpr u8 compression_bit(CompressionType type) noexcept
+  {
+    return static_cast<u8>(1u << std::to_underlying(type));
+  }
+
+  // advertised with the public key, the opponents only compress with the ones the user supports
+  constexpr u8 SUPPORTED_COMPRESSIONS = compression_bit(CompressionType::None) |
+                                        compression_bit(CompressionType::Lz);
+
+  struct SendFileBeginPayload
+  {
+    using transfer_id_type = u32;
+
+    transfer_id_type transfer_id;
+    u8 key_padding;
+    u8 data_padding;
+    std::vector<u8> key;  // symmetric key encrypted with opponent public key
+    std::vector<u8> data; // Data encrypted with the symmetric key
+
+    struct Data
+    {
+      u64 file_size;
+      std::string filename;
+      // chunks could still be sent uncompressed when it doesn't help
+      CompressionType compression;
+
+      [[nodiscard]] std::vector<u8> serialize() const noexcept
+      {
+        std::vector<u8> temp;
+        alpaca::serialize(*this, temp);
+        return temp;
+      }
+    };
+
+    [[nodiscard]] std::vector<u8> serialize() const noexcept
+    {
+      std::vector<u8> temp;
+      alpaca::serialize(*this, temp);
+      return temp;
+    }
+  };
+
+  struct SendFileChunkPayload
+  {
+    SendFileBeginPayload::transfer_id_type transfer_id;
+    u8 padding;
+    bool is_compressed;
+    std::vector<u8> data; // encrypted with the transfer symmetric key
+
+    [[nodiscard]] std::vector<u8> serialize() const noexcept
+    {
+      std::vector<u8> temp;
+      alpaca::serialize(*this, temp);
+      return temp;
+    }
+  };
+
+  struct SendFileEndPayload
+  {
+    SendFileBeginPayload::transfer_id_type transfer_id;
+    bool success; // false when the sender aborts the transfer
+
+    [[nodiscard]] std::vector<u8> serialize() const noexcept
+    {
+      std::vector<u8> temp;
+      alpaca::serialize(*this, temp);
+      return temp;
+    }
+  };
+
   struct UserLoginPayload
   {
     User::id_type id;
@@ -213,6 +318,20 @@ namespace ar
   };
 
 
+  // Body of Ping and Pong. The timestamp is only read by the Ping sender to measure the round trip
+  // time, so the clocks of both sides don't have to match
+  struct PingPayload
+  {
+    u64 timestamp; // steady clock of the Ping sender in nanoseconds
+
+    [[nodiscard]] std::vector<u8> serialize() const noexcept
+    {
+      std::vector<u8> temp{};
+      alpaca::serialize(*this, temp);
+      return temp;
+    }
+  };
+
   // create message, with bytes as payload. the payload could be encrypted first, because this function
   // only create a message and the payload is copied instead of referenced.
   template <Message::Type MsgType, Message::EncryptionType EncryptType =
@@ -232,6 +351,25 @@ namespace ar
     return Message{header, payload};
   }
 
+  // create message which body refers to the payload instead of copying it, pass the serialized or
+  // encrypted bytes as rvalue to move them into the message.
+  template <Message::Type MsgType, Message::EncryptionType EncryptType =
+                Message::EncryptionType::None>
+  static Message create_message(SharedBuffer payload,
+                                Message::Header::opponent_id_type opponent_id,
+                                u16 filler) noexcept
+  {
+    auto header = Message::Header{
+        .body_size = payload.size(),
+        .body_filler = filler,
+        .encryption = EncryptType,
+        .message_type = MsgType,
+        .opponent_id = opponent_id,
+    };
+
+    return Message{header, std::move(payload)};
+  }
+
   template <typename T>
   consteval Message::Type get_payload_type() noexcept
   {
@@ -283,6 +421,18 @@ namespace ar
     {
       return Message::Type::SendFile;
     }
+    if constexpr (std::same_as<T, SendFileBeginPayload>)
+    {
+      return Message::Type::SendFileBegin;
+    }
+    if constexpr (std::same_as<T, SendFileChunkPayload>)
+    {
+      return Message::Type::SendFileChunk;
+    }
+    if constexpr (std::same_as<T, SendFileEndPayload>)
+    {
+      return Message::Type::SendFileEnd;
+    }
     if constexpr (std::same_as<T, UserLoginPayload>)
     {
       return Message::Type::UserLogin;
@@ -295,6 +445,10 @@ namespace ar
     {
       return Message::Type::Feedback;
     }
+    if constexpr (std::same_as<T, PingPayload>)
+    {
+      return Message::Type::Ping;
+    }
 
     Logger::error("payload type unknown");
     return static_cast<Message::Type>(std::numeric_limits<std::underlying_type_t<
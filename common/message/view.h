@@ -0,0 +1,230 @@
+#pragma once
+
+#include <concepts>
+#include <expected>
+#include <limits>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+#include "buffer.h"
+#include "payload.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Reader of alpaca encoded payload which refers to the bytes in place instead of copying them
+  // into owning containers. It follows alpaca default options: 8 and 16 bit integers are fixed
+  // little endian, 32 and 64 bit integers and container sizes are variable length encoded.
+  class PayloadReader
+  {
+  public:
+    explicit PayloadReader(std::span<const u8> bytes) noexcept
+      : bytes_{bytes}, pos_{0}
+    {
+    }
+
+    template <typename... T>
+    bool read(T&... values) noexcept
+    {
+      return (read_one(values) && ...);
+    }
+
+    [[nodiscard]] bool is_end() const noexcept
+    {
+      return pos_ == bytes_.size();
+    }
+
+  private:
+    bool read_one(u8& value) noexcept
+    {
+      if (bytes_.size() - pos_ < 1)
+        return false;
+      value = bytes_[pos_++];
+      return true;
+    }
+
+    bool read_one(bool& value) noexcept
+    {
+      u8 byte;
+      if (!read_one(byte) || byte > 1)
+        return false;
+      value = byte;
+      return true;
+    }
+
+    bool read_one(u16& value) noexcept
+    {
+      if (bytes_.size() - pos_ < 2)
+        return false;
+      value = static_cast<u16>(bytes_[pos_] | bytes_[pos_ + 1] << 8);
+      pos_ += 2;
+      return true;
+    }
+
+    template <typename T>
+      requires std::unsigned_integral<T> && (sizeof(T) >= 4)
+    bool read_one(T& value) noexcept
+    {
+      u64 result;
+      if (!read_varint(result) || result > std::numeric_limits<T>::max())
+        return false;
+      value = static_cast<T>(result);
+      return true;
+    }
+
+    template <typename T>
+      requires std::is_enum_v<T>
+    bool read_one(T& value) noexcept
+    {
+      std::underlying_type_t<T> underlying;
+      if (!read_one(underlying))
+        return false;
+      value = static_cast<T>(underlying);
+      return true;
+    }
+
+    bool read_one(std::span<const u8>& value) noexcept
+    {
+      u64 size;
+      if (!read_varint(size) || size > bytes_.size() - pos_)
+        return false;
+      value = bytes_.subspan(pos_, size);
+      pos_ += size;
+      return true;
+    }
+
+    bool read_one(std::string_view& value) noexcept
+    {
+      std::span<const u8> bytes;
+      if (!read_one(bytes))
+        return false;
+      value = {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+      return true;
+    }
+
+    // first byte has sign bit, continuation bit and 6 bits of value, the next bytes have
+    // continuation bit and 7 bits of value
+    bool read_varint(u64& value) noexcept
+    {
+      u8 byte;
+      if (!read_one(byte) || byte & 0x80)
+        return false;
+      value = byte & 0x3F;
+      bool has_next = byte & 0x40;
+      for (usize shift = 6; has_next; shift += 7)
+      {
+        if (shift >= 64 || !read_one(byte))
+          return false;
+        value |= static_cast<u64>(byte & 0x7F) << shift;
+        has_next = byte & 0x80;
+      }
+      return true;
+    }
+
+  private:
+    std::span<const u8> bytes_;
+    usize pos_;
+  };
+
+  // Views are the non owning counterpart of payload, their fields refer to the parsed bytes so the
+  // bytes should outlive the view
+  template <typename T>
+  concept payload_view = std::default_initializable<T> && requires(T t, PayloadReader& reader)
+  {
+    { t.read_from(reader) } noexcept -> std::same_as<bool>;
+  };
+
+  template <payload_view T>
+  std::expected<T, std::string_view> parse_view(std::span<const u8> bytes) noexcept
+  {
+    using namespace std::literals;
+
+    T view{};
+    PayloadReader reader{bytes};
+    if (!view.read_from(reader) || !reader.is_end())
+      return std::unexpected("failed to parse payload"sv);
+    return view;
+  }
+
+  // View along with the bytes it refers to, so it could outlive the message
+  template <payload_view T>
+  struct BodyView : T
+  {
+    SharedBuffer bytes;
+  };
+
+  template <payload_view T>
+  std::expected<BodyView<T>, std::string_view> parse_view(SharedBuffer bytes) noexcept
+  {
+    auto view = parse_view<T>(bytes.span());
+    if (!view)
+      return std::unexpected(view.error());
+    return BodyView<T>{view.value(), std::move(bytes)};
+  }
+
+  struct UserDetailPayloadView
+  {
+    User::id_type id;
+    std::string_view username;
+    std::span<const u8> public_key;
+    u8 compressions; // 0 when the server leaves it out
+
+    bool read_from(PayloadReader& reader) noexcept
+    {
+      compressions = 0;
+      return reader.read(id, username, public_key) &&
+             (reader.is_end() || reader.read(compressions));
+    }
+  };
+
+  struct StorePublicKeyPayloadView
+  {
+    std::span<const u8> key;
+    u8 compressions; // 0 for the older clients
+
+    bool read_from(PayloadReader& reader) noexcept
+    {
+      compressions = 0;
+      return reader.read(key) && (reader.is_end() || reader.read(compressions));
+    }
+  };
+
+  struct SendFilePayload2View
+  {
+    u8 key_padding;
+    u8 data_padding;
+    std::span<const u8> key;
+    std::span<const u8> data;
+
+    struct Data
+    {
+      u64 file_size;
+      std::string_view filename;
+      std::span<const u8> files;
+
+      bool read_from(PayloadReader& reader) noexcept
+      {
+        return reader.read(file_size, filename, files);
+      }
+    };
+
+    bool read_from(PayloadReader& reader) noexcept
+    {
+      return reader.read(key_padding, data_padding, key, data);
+    }
+  };
+
+  struct SendFileChunkPayloadView
+  {
+    SendFileBeginPayload::transfer_id_type transfer_id;
+    u8 padding;
+    bool is_compressed;
+    std::span<const u8> data;
+
+    bool read_from(PayloadReader& reader) noexcept
+    {
+      return reader.read(transfer_id, padding, is_compressed, data);
+    }
+  };
+} // namespace ar
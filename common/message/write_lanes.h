@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "message.h"
+#include "util/async_signal.h"
+#include "util/mpsc_queue.h"
+#include "util/types.h"
+
+namespace ar
+{
+  enum class WriteLane : u8
+  {
+    Control,
+    Bulk,
+  };
+
+  // file transfer messages take the bulk lane, so they don't delay the other messages
+  constexpr WriteLane lane_of(Message::Type type) noexcept
+  {
+    switch (type)
+    {
+    case Message::Type::SendFile:
+    case Message::Type::SendFileBegin:
+    case Message::Type::SendFileChunk:
+    case Message::Type::SendFileEnd:
+      return WriteLane::Bulk;
+    default:
+      return WriteLane::Control;
+    }
+  }
+
+  // Write queues of connection by priority. Control lane is taken first, but the lanes take turn
+  // after each batch when both have entries, so the bulk transfer keeps progressing while the
+  // control messages only wait for one bulk batch at most. Entries in the same lane keep their
+  // order. Any thread could push without blocking, the rest is only used by the writer.
+  template <typename Entry>
+  class WriteLanes
+  {
+  public:
+    explicit WriteLanes(asio::any_io_executor executor) noexcept
+      : signal_{std::make_unique<AsyncSignal>(std::move(executor))}
+    {
+    }
+
+    // not thread safe, the writer should not be started yet
+    WriteLanes(WriteLanes&& other) noexcept
+      : lanes_{std::move(other.lanes_)},
+        signal_{std::move(other.signal_)},
+        is_waiting_{other.is_waiting_.load()},
+        bulk_turn_{other.bulk_turn_}
+    {
+    }
+
+    WriteLanes& operator=(WriteLanes&& other) noexcept
+    {
+      lanes_ = std::move(other.lanes_);
+      signal_ = std::move(other.signal_);
+      is_waiting_ = other.is_waiting_.load();
+      bulk_turn_ = other.bulk_turn_;
+      return *this;
+    }
+
+    void push(WriteLane lane, Entry&& entry) noexcept
+    {
+      lanes_[std::to_underlying(lane)].push(std::move(entry));
+      // pairs with the fence in wait, either the writer sees the entry or it is woken up
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (is_waiting_.exchange(false))
+        signal_->notify();
+    }
+
+    // wake up the writer and make every wait return false
+    void close() noexcept
+    {
+      signal_->close();
+    }
+
+    // wait until there is an entry, return false when closed
+    asio::awaitable<bool> wait() noexcept
+    {
+      while (empty())
+      {
+        is_waiting_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!empty())
+        {
+          is_waiting_.store(false);
+          break;
+        }
+        if (!co_await signal_->wait())
+          co_return false;
+      }
+      co_return true;
+    }
+
+    // pick the lane of the next batch
+    MpscQueue<Entry>& next() noexcept
+    {
+      auto& control = lanes_[std::to_underlying(WriteLane::Control)];
+      auto& bulk = lanes_[std::to_underlying(WriteLane::Bulk)];
+      bool is_control = !control.empty() && (!bulk_turn_ || bulk.empty());
+      bulk_turn_ = is_control;
+      return is_control ? control : bulk;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+      return std::ranges::all_of(lanes_, [](const auto& lane) {
+        return lane.empty();
+      });
+    }
+
+    void clear() noexcept
+    {
+      for (auto& lane : lanes_)
+        lane.clear();
+    }
+
+  private:
+    std::array<MpscQueue<Entry>, 2> lanes_;
+    std::unique_ptr<AsyncSignal> signal_;
+    std::atomic_bool is_waiting_{false};
+    bool bulk_turn_ = false;
+  };
+} // namespace ar
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <asio/any_io_executor.hpp>
+#include <asio/awaitable.hpp>
+#include <asio/experimental/concurrent_channel.hpp>
+
+#include "asio.h"
+
+namespace ar
+{
+  // Awaitable notification that can be notified from any thread. Notifications are coalesced and
+  // not lost when nobody is waiting yet, so the waiter can check its condition first and wait after
+  // it without racing with the notifier. Only one waiter is supported at a time.
+  class AsyncSignal
+  {
+  public:
+    explicit AsyncSignal(asio::any_io_executor executor) noexcept
+      : channel_{std::move(executor), 1}
+    {
+    }
+
+    void notify() noexcept
+    {
+      channel_.try_send(asio::error_code{});
+    }
+
+    // return false when the signal is closed
+    asio::awaitable<bool> wait() noexcept
+    {
+      auto [ec] = co_await channel_.async_receive(ar::await_with_error());
+      co_return !ec;
+    }
+
+    // wake up the waiter and make every future wait return immediately
+    void close() noexcept
+    {
+      channel_.close();
+    }
+
+  private:
+    asio::experimental::concurrent_channel<void(asio::error_code)> channel_;
+  };
+} // namespace ar
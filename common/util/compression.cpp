@@ -0,0 +1,182 @@
+#include "compression.h"
+
+#include <cstring>
+
+namespace ar
+{
+  namespace
+  {
+    constexpr usize MIN_MATCH = 4;
+    // the last match should start at least 12 bytes before the end and the last 5 bytes are always
+    // literals, required by the format
+    constexpr usize MATCH_FIND_LIMIT = 12;
+    constexpr usize LAST_LITERALS = 5;
+    constexpr usize MAX_OFFSET = 65535;
+    constexpr usize HASH_BITS = 12;
+    // skip faster on incompressible data, the step grows every 64 bytes without match
+    constexpr usize SKIP_TRIGGER = 6;
+
+    u32 read_u32(const u8* ptr) noexcept
+    {
+      u32 value;
+      std::memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+
+    u32 hash(u32 sequence) noexcept
+    {
+      return (sequence * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    void write_length(std::vector<u8>& out, usize length) noexcept
+    {
+      for (; length >= 255; length -= 255)
+        out.push_back(255);
+      out.push_back(static_cast<u8>(length));
+    }
+
+    void write_sequence(std::vector<u8>& out, std::span<const u8> literals, usize offset,
+                        usize match_length) noexcept
+    {
+      auto literal_token = std::min<usize>(literals.size(), 15);
+      auto match_token = std::min<usize>(match_length - MIN_MATCH, 15);
+      out.push_back(static_cast<u8>(literal_token << 4 | match_token));
+      if (literal_token == 15)
+        write_length(out, literals.size() - 15);
+      out.insert(out.end(), literals.begin(), literals.end());
+
+      out.push_back(static_cast<u8>(offset));
+      out.push_back(static_cast<u8>(offset >> 8));
+      if (match_token == 15)
+        write_length(out, match_length - MIN_MATCH - 15);
+    }
+
+    void write_last_literals(std::vector<u8>& out, std::span<const u8> literals) noexcept
+    {
+      auto literal_token = std::min<usize>(literals.size(), 15);
+      out.push_back(static_cast<u8>(literal_token << 4));
+      if (literal_token == 15)
+        write_length(out, literals.size() - 15);
+      out.insert(out.end(), literals.begin(), literals.end());
+    }
+  } // namespace
+
+  std::vector<u8> compress(std::span<const u8> bytes) noexcept
+  {
+    std::vector<u8> out{};
+    out.reserve(compress_bound(bytes.size()));
+
+    const auto size = bytes.size();
+    const auto* src = bytes.data();
+    usize anchor = 0;
+    if (size > MATCH_FIND_LIMIT)
+    {
+      std::vector<u32> table(1 << HASH_BITS, 0);
+      const usize limit = size - MATCH_FIND_LIMIT;
+      usize pos = 1;
+      usize attempts = 1 << SKIP_TRIGGER;
+      while (pos < limit)
+      {
+        auto& slot = table[hash(read_u32(src + pos))];
+        usize ref = slot;
+        slot = static_cast<u32>(pos);
+        if (ref >= pos || pos - ref > MAX_OFFSET || read_u32(src + ref) != read_u32(src + pos))
+        {
+          pos += attempts++ >> SKIP_TRIGGER;
+          continue;
+        }
+        attempts = 1 << SKIP_TRIGGER;
+
+        // extend the match backward into the pending literals
+        while (pos > anchor && ref > 0 && src[pos - 1] == src[ref - 1])
+        {
+          --pos;
+          --ref;
+        }
+
+        usize match_length = MIN_MATCH;
+        while (pos + match_length < size - LAST_LITERALS &&
+               src[pos + match_length] == src[ref + match_length])
+          ++match_length;
+
+        write_sequence(out, bytes.subspan(anchor, pos - anchor), pos - ref, match_length);
+        pos += match_length;
+        anchor = pos;
+        if (pos < limit)
+          table[hash(read_u32(src + pos - 2))] = static_cast<u32>(pos - 2);
+      }
+    }
+
+    write_last_literals(out, bytes.subspan(anchor));
+    return out;
+  }
+
+  std::expected<std::vector<u8>, std::string_view> decompress(std::span<const u8> bytes,
+                                                              usize max_size) noexcept
+  {
+    using namespace std::literals;
+
+    std::vector<u8> out(max_size);
+    usize out_pos = 0;
+    usize pos = 0;
+
+    auto read_length = [&](usize& length) {
+      u8 value;
+      do
+      {
+        if (pos >= bytes.size())
+          return false;
+        value = bytes[pos++];
+        length += value;
+      } while (value == 255);
+      return true;
+    };
+
+    while (pos < bytes.size())
+    {
+      const u8 token = bytes[pos++];
+      usize literal_length = token >> 4;
+      if (literal_length == 15 && !read_length(literal_length))
+        return std::unexpected("truncated literal length"sv);
+      if (literal_length > bytes.size() - pos || literal_length > max_size - out_pos)
+        return std::unexpected("literals out of bound"sv);
+      if (literal_length > 0)
+        std::memcpy(out.data() + out_pos, bytes.data() + pos, literal_length);
+      pos += literal_length;
+      out_pos += literal_length;
+
+      // last sequence has no match
+      if (pos == bytes.size())
+        break;
+
+      if (bytes.size() - pos < 2)
+        return std::unexpected("truncated match offset"sv);
+      usize offset = bytes[pos] | bytes[pos + 1] << 8;
+      pos += 2;
+      if (offset == 0 || offset > out_pos)
+        return std::unexpected("invalid match offset"sv);
+
+      usize match_length = token & 15;
+      if (match_length == 15 && !read_length(match_length))
+        return std::unexpected("truncated match length"sv);
+      match_length += MIN_MATCH;
+      if (match_length > max_size - out_pos)
+        return std::unexpected("match out of bound"sv);
+
+      auto* dest = out.data() + out_pos;
+      const auto* ref = dest - offset;
+      if (offset >= match_length)
+        std::memcpy(dest, ref, match_length);
+      else
+      {
+        // overlapped match repeats the last offset bytes
+        for (usize i = 0; i < match_length; ++i)
+          dest[i] = ref[i];
+      }
+      out_pos += match_length;
+    }
+
+    out.resize(out_pos);
+    return out;
+  }
+} // namespace ar
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <expected>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "types.h"
+
+namespace ar
+{
+  // Fast LZ77 compression using the LZ4 block format, it trades ratio for speed so it could keep up
+  // with the network. Each call produces independent block, nothing is shared between calls.
+  std::vector<u8> compress(std::span<const u8> bytes) noexcept;
+
+  // decompress block produced by compress, max_size is the upper bound of decompressed bytes and
+  // the block is treated as malformed when it needs more than that
+  std::expected<std::vector<u8>, std::string_view> decompress(std::span<const u8> bytes,
+                                                              usize max_size) noexcept;
+
+  // maximum compressed bytes of incompressible data
+  constexpr usize compress_bound(usize size) noexcept
+  {
+    return size + size / 255 + 16;
+  }
+} // namespace ar
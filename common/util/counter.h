@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "types.h"
+
+namespace ar
+{
+  constexpr usize THREAD_SLOT_COUNT = 32;
+
+  // index of the calling thread, the threads over THREAD_SLOT_COUNT share the slots
+  inline usize thread_slot() noexcept
+  {
+    static std::atomic<usize> s_next_slot{0};
+    thread_local usize slot = s_next_slot.fetch_add(1, std::memory_order_relaxed) %
+                              THREAD_SLOT_COUNT;
+    return slot;
+  }
+
+  // Number summed from per-thread slots. Each thread adds into its own cache line with relaxed
+  // atomic, so an update costs a few nanoseconds without contention. The threads over SLOT_COUNT
+  // share the slots. Reading sums every slot, it could miss the updates that are in progress.
+  template <typename T>
+  class PerThreadCounter
+  {
+  public:
+    constexpr static usize SLOT_COUNT = THREAD_SLOT_COUNT;
+
+    PerThreadCounter() noexcept = default;
+
+    PerThreadCounter(const PerThreadCounter&) = delete;
+    PerThreadCounter& operator=(const PerThreadCounter&) = delete;
+
+    void add(T value = 1) noexcept
+    {
+      slots_[thread_slot()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void sub(T value = 1) noexcept
+    {
+      slots_[thread_slot()].value.fetch_sub(value, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] T value() const noexcept
+    {
+      // the slots could be negative on their own when another thread takes what this one added
+      T sum{};
+      for (const auto& slot : slots_)
+        sum += slot.value.load(std::memory_order_relaxed);
+      return sum;
+    }
+
+  private:
+    struct alignas(64) Slot
+    {
+      std::atomic<T> value{0};
+    };
+
+  private:
+    std::array<Slot, SLOT_COUNT> slots_{};
+  };
+
+  // only increased
+  using Counter = PerThreadCounter<u64>;
+  // increased and decreased, possibly from different threads
+  using Gauge = PerThreadCounter<i64>;
+
+  // add the elapsed nanoseconds into the counter when it is destroyed
+  class ScopedTimer
+  {
+  public:
+    explicit ScopedTimer(Counter& nanoseconds) noexcept
+      : nanoseconds_{nanoseconds},
+        start_{std::chrono::steady_clock::now()}
+    {
+    }
+
+    ~ScopedTimer() noexcept
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start_;
+      nanoseconds_.add(static_cast<u64>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  private:
+    Counter& nanoseconds_;
+    std::chrono::steady_clock::time_point start_;
+  };
+} // namespace ar
@@ -38,7 +38,7 @@ namespace ar
   }
 
   template <bool Overwrite = false>
-  static bool save_bytes_as_file(std::string_view dest_path, std::span<u8> bytes) noexcept
+  static bool save_bytes_as_file(std::string_view dest_path, std::span<const u8> bytes) noexcept
   {
     // Prevent overwrite file
     if constexpr (!Overwrite)
@@ -63,6 +63,23 @@ namespace ar
     return !ec;
   }
 
+  // move file into dest_path and overwrite it when exists, it will fallback into copying when the
+  // file can't be renamed (e.g. different filesystem)
+  static bool move_file(std::string_view src_path, std::string_view dest_path) noexcept
+  {
+    std::error_code ec;
+    std::filesystem::rename(src_path, dest_path, ec);
+    if (!ec)
+      return true;
+
+    std::filesystem::copy_file(src_path, dest_path,
+                               std::filesystem::copy_options::overwrite_existing, ec);
+    if (ec)
+      return false;
+    std::filesystem::remove(src_path, ec);
+    return true;
+  }
+
   template <bool Block = true>
   static void execute_file(std::string_view fullpath) noexcept
   {
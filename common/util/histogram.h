@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+
+#include "counter.h"
+#include "types.h"
+
+namespace ar
+{
+  // Bucketed values of a histogram, it is only a copy so it could be merged and queried freely.
+  // Values below SUB_BUCKET_COUNT have their own bucket, above it each power of two is split into
+  // SUB_BUCKET_COUNT buckets, so the reported value is at most 1/SUB_BUCKET_COUNT bigger than the
+  // recorded one. Values at or above MAX_VALUE are counted into the last bucket.
+  class HistogramSnapshot
+  {
+  public:
+    constexpr static usize SUB_BUCKET_BITS = 4;
+    constexpr static usize SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    constexpr static usize MAX_VALUE_BITS = 40;
+    constexpr static u64 MAX_VALUE = u64{1} << MAX_VALUE_BITS;
+    constexpr static usize BUCKET_COUNT =
+        SUB_BUCKET_COUNT + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT;
+
+    constexpr static usize bucket_of(u64 value) noexcept
+    {
+      if (value < SUB_BUCKET_COUNT)
+        return static_cast<usize>(value);
+      if (value >= MAX_VALUE)
+        return BUCKET_COUNT - 1;
+      // the highest bit selects the power of two, the next bits select the sub bucket
+      usize exponent = std::bit_width(value) - 1;
+      usize sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+      return SUB_BUCKET_COUNT + (exponent - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT + sub;
+    }
+
+    // the biggest value counted into the bucket
+    constexpr static u64 upper_bound_of(usize bucket) noexcept
+    {
+      if (bucket < SUB_BUCKET_COUNT)
+        return bucket;
+      usize exponent = (bucket - SUB_BUCKET_COUNT) / SUB_BUCKET_COUNT + SUB_BUCKET_BITS;
+      u64 sub = (bucket - SUB_BUCKET_COUNT) % SUB_BUCKET_COUNT;
+      u64 width = u64{1} << (exponent - SUB_BUCKET_BITS);
+      return (u64{1} << exponent) + (sub + 1) * width - 1;
+    }
+
+    void record(u64 value, u64 count = 1) noexcept
+    {
+      buckets_[bucket_of(value)] += count;
+      count_ += count;
+      sum_ += value * count;
+      max_ = std::max(max_, value);
+    }
+
+    void merge(const HistogramSnapshot& other) noexcept
+    {
+      for (usize i = 0; i < BUCKET_COUNT; ++i)
+        buckets_[i] += other.buckets_[i];
+      count_ += other.count_;
+      sum_ += other.sum_;
+      max_ = std::max(max_, other.max_);
+    }
+
+    // the value that the given fraction of the values are at or below it, 0 when it is empty
+    [[nodiscard]] u64 percentile(double fraction) const noexcept
+    {
+      if (count_ == 0)
+        return 0;
+      auto rank = static_cast<u64>(std::clamp(fraction, 0.0, 1.0) * static_cast<double>(count_));
+      rank = std::clamp<u64>(rank, 1, count_);
+      u64 seen = 0;
+      for (usize i = 0; i < BUCKET_COUNT; ++i)
+      {
+        seen += buckets_[i];
+        if (seen >= rank)
+          return std::min(upper_bound_of(i), max_);
+      }
+      return max_;
+    }
+
+    [[nodiscard]] u64 count() const noexcept
+    {
+      return count_;
+    }
+
+    [[nodiscard]] u64 sum() const noexcept
+    {
+      return sum_;
+    }
+
+    [[nodiscard]] u64 max() const noexcept
+    {
+      return max_;
+    }
+
+  private:
+    friend class Histogram;
+
+    std::array<u64, BUCKET_COUNT> buckets_{};
+    u64 count_ = 0;
+    u64 sum_ = 0;
+    u64 max_ = 0;
+  };
+
+  // Histogram recorded from many threads. Each thread records into its own buckets with relaxed
+  // atomic, they are allocated on the first record of the thread so the unused slots cost nothing.
+  // snapshot merges every slot, it could miss the records that are in progress.
+  class Histogram
+  {
+  public:
+    Histogram() noexcept = default;
+
+    ~Histogram() noexcept
+    {
+      for (auto& slot : slots_)
+        delete slot.load(std::memory_order_relaxed);
+    }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(u64 value) noexcept
+    {
+      auto& buckets = slot();
+      buckets.counts[HistogramSnapshot::bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+      buckets.sum.fetch_add(value, std::memory_order_relaxed);
+      auto max = buckets.max.load(std::memory_order_relaxed);
+      while (value > max &&
+             !buckets.max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    void record(std::chrono::nanoseconds duration) noexcept
+    {
+      record(static_cast<u64>(std::max<i64>(duration.count(), 0)));
+    }
+
+    [[nodiscard]] HistogramSnapshot snapshot() const noexcept
+    {
+      HistogramSnapshot result{};
+      for (const auto& slot : slots_)
+      {
+        auto buckets = slot.load(std::memory_order_acquire);
+        if (!buckets)
+          continue;
+        for (usize i = 0; i < HistogramSnapshot::BUCKET_COUNT; ++i)
+        {
+          auto count = buckets->counts[i].load(std::memory_order_relaxed);
+          result.buckets_[i] += count;
+          result.count_ += count;
+        }
+        result.sum_ += buckets->sum.load(std::memory_order_relaxed);
+        result.max_ = std::max(result.max_, buckets->max.load(std::memory_order_relaxed));
+      }
+      return result;
+    }
+
+  private:
+    struct Buckets
+    {
+      std::array<std::atomic<u64>, HistogramSnapshot::BUCKET_COUNT> counts{};
+      std::atomic<u64> sum{0};
+      std::atomic<u64> max{0};
+    };
+
+    Buckets& slot() noexcept
+    {
+      auto& slot = slots_[thread_slot()];
+      auto buckets = slot.load(std::memory_order_acquire);
+      if (buckets)
+        return *buckets;
+      // another thread sharing the slot could allocate it first
+      auto created = std::make_unique<Buckets>();
+      if (slot.compare_exchange_strong(buckets, created.get(), std::memory_order_acq_rel))
+        return *created.release();
+      return *buckets;
+    }
+
+  private:
+    std::array<std::atomic<Buckets*>, THREAD_SLOT_COUNT> slots_{};
+  };
+
+  // record the elapsed nanoseconds into the histogram when it is destroyed
+  class HistogramTimer
+  {
+  public:
+    explicit HistogramTimer(Histogram& histogram) noexcept
+      : histogram_{histogram},
+        start_{std::chrono::steady_clock::now()}
+    {
+    }
+
+    ~HistogramTimer() noexcept
+    {
+      histogram_.record(std::chrono::steady_clock::now() - start_);
+    }
+
+    HistogramTimer(const HistogramTimer&) = delete;
+    HistogramTimer& operator=(const HistogramTimer&) = delete;
+
+  private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+  };
+} // namespace ar
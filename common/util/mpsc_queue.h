@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace ar
+{
+  // Lock-free unbounded multi producer single consumer queue (Dmitry Vyukov's intrusive MPSC
+  // algorithm). push can be called from any thread and never blocks, the other functions should
+  // only be called by the single consumer.
+  // NOTE: a pushed entry is visible to the consumer after push returns, while push is still in
+  // progress the consumer could see the queue as empty.
+  template <typename T>
+  class MpscQueue
+  {
+    struct Node
+    {
+      std::atomic<Node*> next{nullptr};
+      std::optional<T> value{};
+    };
+
+  public:
+    MpscQueue() noexcept
+    {
+      auto stub = new Node{};
+      head_.store(stub, std::memory_order_relaxed);
+      tail_ = stub;
+    }
+
+    ~MpscQueue() noexcept
+    {
+      clear();
+      delete tail_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // not thread safe, nobody should use both queues while moving
+    MpscQueue(MpscQueue&& other) noexcept
+      : MpscQueue{}
+    {
+      swap(other);
+    }
+
+    MpscQueue& operator=(MpscQueue&& other) noexcept
+    {
+      if (this != &other)
+        swap(other);
+      return *this;
+    }
+
+    void push(T&& value) noexcept
+    {
+      auto node = new Node{};
+      node->value.emplace(std::move(value));
+      auto prev = head_.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+      return tail_->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+    // the queue should not be empty
+    T& front() noexcept
+    {
+      return *tail_->next.load(std::memory_order_acquire)->value;
+    }
+
+    // the queue should not be empty
+    void pop() noexcept
+    {
+      auto next = tail_->next.load(std::memory_order_acquire);
+      // the popped node becomes the new stub
+      next->value.reset();
+      delete tail_;
+      tail_ = next;
+    }
+
+    void clear() noexcept
+    {
+      while (!empty())
+        pop();
+    }
+
+  private:
+    void swap(MpscQueue& other) noexcept
+    {
+      auto head = head_.load(std::memory_order_relaxed);
+      head_.store(other.head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      other.head_.store(head, std::memory_order_relaxed);
+      std::swap(tail_, other.tail_);
+    }
+
+  private:
+    std::atomic<Node*> head_; // last pushed node, shared by producers
+    Node* tail_;              // stub node before the front, only used by consumer
+  };
+} // namespace ar
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+namespace ar
+{
+  // Handle of SlotMap entry, it becomes stale when the entry is erased even if the slot is reused
+  struct SlotHandle
+  {
+    u32 index = std::numeric_limits<u32>::max();
+    u32 generation = 0;
+
+    [[nodiscard]] bool is_valid() const noexcept
+    {
+      return index != std::numeric_limits<u32>::max();
+    }
+
+    bool operator==(const SlotHandle&) const noexcept = default;
+  };
+
+  // Generational slot map. Insert, lookup and erase are O(1), the values are kept densely so they
+  // could be iterated without holes, the order is not kept when erasing.
+  template <typename T>
+  class SlotMap
+  {
+  public:
+    SlotHandle insert(T&& value) noexcept
+    {
+      u32 index;
+      if (free_head_ != NPOS)
+      {
+        index = free_head_;
+        free_head_ = slots_[index].dense_index;
+      }
+      else
+      {
+        index = static_cast<u32>(slots_.size());
+        slots_.emplace_back();
+      }
+
+      auto& slot = slots_[index];
+      slot.dense_index = static_cast<u32>(values_.size());
+      values_.emplace_back(std::move(value));
+      dense_slots_.emplace_back(index);
+      return SlotHandle{.index = index, .generation = slot.generation};
+    }
+
+    // return null when the handle is stale
+    T* get(SlotHandle handle) noexcept
+    {
+      if (!contains(handle))
+        return nullptr;
+      return &values_[slots_[handle.index].dense_index];
+    }
+
+    const T* get(SlotHandle handle) const noexcept
+    {
+      if (!contains(handle))
+        return nullptr;
+      return &values_[slots_[handle.index].dense_index];
+    }
+
+    // return false when the handle is stale
+    bool erase(SlotHandle handle) noexcept
+    {
+      if (!contains(handle))
+        return false;
+
+      auto& slot = slots_[handle.index];
+      // move the last value into the hole
+      auto dense_index = slot.dense_index;
+      if (dense_index != values_.size() - 1)
+      {
+        values_[dense_index] = std::move(values_.back());
+        dense_slots_[dense_index] = dense_slots_.back();
+        slots_[dense_slots_[dense_index]].dense_index = dense_index;
+      }
+      values_.pop_back();
+      dense_slots_.pop_back();
+
+      ++slot.generation;
+      slot.dense_index = free_head_;
+      free_head_ = handle.index;
+      return true;
+    }
+
+    [[nodiscard]] bool contains(SlotHandle handle) const noexcept
+    {
+      // the generation is bumped on erase, so the free slot never matches
+      return handle.index < slots_.size() && slots_[handle.index].generation == handle.generation;
+    }
+
+    [[nodiscard]] usize size() const noexcept
+    {
+      return values_.size();
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+      return values_.empty();
+    }
+
+    auto begin() noexcept
+    {
+      return values_.begin();
+    }
+
+    auto end() noexcept
+    {
+      return values_.end();
+    }
+
+    auto begin() const noexcept
+    {
+      return values_.begin();
+    }
+
+    auto end() const noexcept
+    {
+      return values_.end();
+    }
+
+  private:
+    constexpr static u32 NPOS = std::numeric_limits<u32>::max();
+
+    struct Slot
+    {
+      u32 dense_index = NPOS; // next free slot when the slot is free
+      u32 generation = 0;
+    };
+
+    std::vector<Slot> slots_;
+    std::vector<T> values_;
+    std::vector<u32> dense_slots_; // slot index of each value
+    u32 free_head_ = NPOS;
+  };
+} // namespace ar
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <asio/ip/tcp.hpp>
+#include <atomic>
+
+#include "types.h"
+
+namespace ar
+{
+  // Limit of queued messages coalesced into one vectored write
+  struct WriteBudget
+  {
+    usize max_bytes = 256 * 1024;
+    // each message takes 2 buffers (header and body), keep it below IOV_MAX
+    usize max_buffers = 128;
+  };
+
+  // Counters of coalesced writes, used to tune the write budget and the socket options
+  class WriteStats
+  {
+  public:
+    struct Snapshot
+    {
+      u64 flushes;
+      u64 messages;
+      u64 bytes;
+      u64 max_messages; // the biggest batch
+    };
+
+    void record(usize messages, usize bytes) noexcept
+    {
+      flushes_.fetch_add(1, std::memory_order_relaxed);
+      messages_.fetch_add(messages, std::memory_order_relaxed);
+      bytes_.fetch_add(bytes, std::memory_order_relaxed);
+      auto max = max_messages_.load(std::memory_order_relaxed);
+      while (messages > max && !max_messages_.compare_exchange_weak(max, messages,
+                                                                     std::memory_order_relaxed))
+      {
+      }
+    }
+
+    [[nodiscard]] Snapshot snapshot() const noexcept
+    {
+      return Snapshot{
+          .flushes = flushes_.load(std::memory_order_relaxed),
+          .messages = messages_.load(std::memory_order_relaxed),
+          .bytes = bytes_.load(std::memory_order_relaxed),
+          .max_messages = max_messages_.load(std::memory_order_relaxed),
+      };
+    }
+
+  private:
+    std::atomic<u64> flushes_{0};
+    std::atomic<u64> messages_{0};
+    std::atomic<u64> bytes_{0};
+    std::atomic<u64> max_messages_{0};
+  };
+
+  // the writers already coalesce small messages, so Nagle only delays them
+  inline void set_no_delay(asio::ip::tcp::socket& socket, bool enable) noexcept
+  {
+    asio::error_code ec;
+    socket.set_option(asio::ip::tcp::no_delay{enable}, ec);
+  }
+
+  // Hold partial frames in the kernel until the guard is released, used when one message is sent
+  // by several writes. It does nothing on platforms without TCP_CORK.
+  class CorkGuard
+  {
+  public:
+    explicit CorkGuard(asio::ip::tcp::socket& socket) noexcept
+      : socket_{socket}
+    {
+      set(true);
+    }
+
+    ~CorkGuard() noexcept
+    {
+      set(false);
+    }
+
+    CorkGuard(const CorkGuard&) = delete;
+    CorkGuard& operator=(const CorkGuard&) = delete;
+
+  private:
+    void set([[maybe_unused]] bool enable) noexcept
+    {
+#ifdef TCP_CORK
+      using tcp_cork = asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>;
+      asio::error_code ec;
+      socket_.set_option(tcp_cork{enable}, ec);
+#endif
+    }
+
+  private:
+    asio::ip::tcp::socket& socket_;
+  };
+} // namespace ar
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <vector>
+
+#include "types.h"
+
+namespace ar
+{
+  // Lock-free bounded single producer single consumer ring. The slots are constructed once and
+  // reused, so the producer could fill a slot in place and keep the capacity of its members
+  // instead of allocating for each entry. reserve and commit should only be called by the
+  // producer, front and pop only by the consumer.
+  template <typename T>
+  class SpscRing
+  {
+  public:
+    // the capacity is rounded up to power of two
+    explicit SpscRing(usize capacity) noexcept
+      : slots_(std::bit_ceil(std::max<usize>(capacity, 1))),
+        mask_{slots_.size() - 1}
+    {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // slot to be filled by the producer, null when the ring is full
+    [[nodiscard]] T* reserve() noexcept
+    {
+      auto head = head_.load(std::memory_order_relaxed);
+      if (head - tail_.load(std::memory_order_acquire) > mask_)
+        return nullptr;
+      return &slots_[head & mask_];
+    }
+
+    // publish the reserved slot to the consumer
+    void commit() noexcept
+    {
+      head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // null when the ring is empty
+    [[nodiscard]] T* front() noexcept
+    {
+      auto tail = tail_.load(std::memory_order_relaxed);
+      if (tail == head_.load(std::memory_order_acquire))
+        return nullptr;
+      return &slots_[tail & mask_];
+    }
+
+    // release the front slot to the producer, it keeps its value until it is reserved again
+    void pop() noexcept
+    {
+      tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // could be stale when it is called while the other side is running
+    [[nodiscard]] usize size() const noexcept
+    {
+      return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] usize capacity() const noexcept
+    {
+      return slots_.size();
+    }
+
+  private:
+    std::vector<T> slots_;
+    usize mask_;
+    alignas(64) std::atomic<usize> head_{0}; // written by producer
+    alignas(64) std::atomic<usize> tail_{0}; // written by consumer
+  };
+} // namespace ar
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+namespace ar
+{
+  // Hierarchical timing wheel on integer ticks. Each level has 64 slots and each slot of the next
+  // level covers the whole previous level, entries are moved down when the wheel reaches their
+  // slot. Scheduling is O(1) and advancing costs one slot per tick, so it scales with the number of
+  // expiring entries instead of every entry. There is no cancellation, the owner should check
+  // whether the expired value is still relevant. It is not thread safe.
+  template <typename T>
+  class TimerWheel
+  {
+  public:
+    using tick_type = u64;
+
+    constexpr static usize SLOT_BITS = 6;
+    constexpr static usize SLOT_COUNT = 1 << SLOT_BITS;
+    constexpr static usize LEVEL_COUNT = 4;
+
+    explicit TimerWheel(tick_type now = 0) noexcept
+      : tick_{now},
+        size_{0}
+    {
+    }
+
+    // the deadline that is already passed will expire on the next tick
+    void schedule(tick_type deadline, T value) noexcept
+    {
+      insert(Entry{.deadline = std::max(deadline, tick_ + 1), .value = std::move(value)});
+    }
+
+    // expire every entry with deadline up to now, on_expired could schedule new entries
+    template <typename F>
+    void advance(tick_type now, F&& on_expired) noexcept
+    {
+      while (tick_ < now)
+      {
+        ++tick_;
+        cascade();
+
+        auto& slot = levels_[0][tick_ & (SLOT_COUNT - 1)];
+        if (slot.empty())
+          continue;
+        auto expired = std::exchange(slot, {});
+        size_ -= expired.size();
+        for (auto& entry : expired)
+          on_expired(std::move(entry.value));
+      }
+    }
+
+    [[nodiscard]] tick_type now() const noexcept
+    {
+      return tick_;
+    }
+
+    [[nodiscard]] usize size() const noexcept
+    {
+      return size_;
+    }
+
+  private:
+    struct Entry
+    {
+      tick_type deadline;
+      T value;
+    };
+
+    void insert(Entry&& entry) noexcept
+    {
+      // the lowest level which slot of the deadline is not passed yet
+      usize level = 0;
+      for (; level < LEVEL_COUNT; ++level)
+      {
+        auto shift = level * SLOT_BITS;
+        if ((entry.deadline >> shift) - (tick_ >> shift) < SLOT_COUNT)
+          break;
+      }
+      tick_type position;
+      if (level == LEVEL_COUNT)
+      {
+        // beyond the wheel, keep it on the farthest slot and place it again when it is reached
+        level = LEVEL_COUNT - 1;
+        position = (tick_ >> (level * SLOT_BITS)) + SLOT_COUNT - 1;
+      }
+      else
+        position = entry.deadline >> (level * SLOT_BITS);
+
+      levels_[level][position & (SLOT_COUNT - 1)].emplace_back(std::move(entry));
+      ++size_;
+    }
+
+    // move the entries of higher level slot that starts on the current tick into the lower levels
+    void cascade() noexcept
+    {
+      usize level = 1;
+      while (level < LEVEL_COUNT && (tick_ & ((tick_type{1} << (level * SLOT_BITS)) - 1)) == 0)
+        ++level;
+      // the highest level goes first, so its entries could land on the lower slots that are moved
+      // right after it
+      for (--level; level > 0; --level)
+      {
+        auto& slot = levels_[level][(tick_ >> (level * SLOT_BITS)) & (SLOT_COUNT - 1)];
+        if (slot.empty())
+          continue;
+        auto entries = std::exchange(slot, {});
+        size_ -= entries.size();
+        for (auto& entry : entries)
+          insert(std::move(entry));
+      }
+    }
+
+  private:
+    tick_type tick_;
+    usize size_;
+    std::array<std::array<std::vector<Entry>, SLOT_COUNT>, LEVEL_COUNT> levels_;
+  };
+} // namespace ar
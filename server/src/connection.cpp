@@ -4,47 +4,105 @@
 
 #include "connection.h"
 
+#include <fmt/chrono.h>
 #include <fmt/format.h>
 #include <util/asio.h>
 
+#include <algorithm>
+#include <array>
 #include <asio/awaitable.hpp>
+#include <cstring>
+#include <optional>
+#include <tuple>
+#include <variant>
+
+#if AR_LINUX
+  #include <sys/sendfile.h>
+#endif
 
 #include "core.h"
 #include "handler.h"
 #include "logger.h"
 #include "message/payload.h"
+#include "metrics.h"
+#include "native_file.h"
+#include "trace.h"
 
 namespace ar
 {
+  namespace
+  {
+    Message::Header parse_header(const std::array<u8, Message::header_size>& bytes) noexcept
+    {
+      Message::Header header{};
+      std::memcpy(&header, bytes.data(), Message::header_size);
+      return header;
+    }
+  } // namespace
+
   Connection::Connection(asio::ip::tcp::socket&& socket, IMessageHandler* message_handler,
-                         IConnectionHandler* connection_handler) noexcept
+                         IConnectionHandler* connection_handler,
+                         ConnectionConfig config) noexcept
     : message_handler_{message_handler},
       connection_handler_{connection_handler},
+      config_{config},
       id_{s_current_id.fetch_add(1)},
       user_{},
+      handle_{},
       is_closing_{false},
       // is_closing is false at the constructor due to the socket should be already connected
-      write_timer_{socket.get_executor(), std::chrono::steady_clock::time_point::max()},
+      started_at_{clock_type::now()},
+      last_active_at_{started_at_},
+      written_bytes_{0},
+      checked_bytes_{0},
+      is_handshake_done_{false},
+      is_reader_busy_{false},
+      is_reader_paused_{false},
+      compressions_{0},
+      is_ping_pending_{false},
+      round_trip_time_{0},
+      is_detaching_{false},
+      is_reader_stopped_{false},
+      is_writing_{false},
+      spooling_{0},
+      write_lanes_{socket.get_executor()},
+      queued_bytes_{0},
+      queued_messages_{0},
+      drain_signal_{std::make_shared<AsyncSignal>(socket.get_executor())},
       socket_{std::forward<decltype(socket)>(socket)}
   {
+    Metrics::instance().connections.add();
   }
 
   Connection::~Connection() noexcept
   {
     Logger::trace(fmt::format("Connection-{} deconstructed", id_));
     // close();
+    release_queued();
+    if (user_)
+      Metrics::instance().authenticated_connections.sub();
+    Metrics::instance().connections.sub();
   }
 
   Connection::Connection(Connection&& other) noexcept
     : message_handler_(other.message_handler_),
       connection_handler_(other.connection_handler_),
+      config_(other.config_),
       id_(other.id_),
       user_(other.user_),
+      handle_(other.handle_),
       is_closing_(other.is_closing_.exchange(true)),
-      write_timer_(std::move(other.write_timer_)),
-      write_message_queue_(std::move(other.write_message_queue_)),
+      spooling_(other.spooling_),
+      write_lanes_(std::move(other.write_lanes_)),
+      queued_bytes_(other.queued_bytes_.exchange(0)),
+      queued_messages_(other.queued_messages_.exchange(0)),
+      drain_waiters_(std::move(other.drain_waiters_)),
+      drain_signal_(std::move(other.drain_signal_)),
+      throttled_by_(std::move(other.throttled_by_)),
       socket_(std::move(other.socket_))
   {
+    // the moved one is still counted until it is destroyed
+    Metrics::instance().connections.add();
     other.id_ = std::numeric_limits<id_type>::max();
     other.user_ = nullptr;
     other.connection_handler_ = nullptr;
@@ -55,13 +113,24 @@ namespace ar
   {
     if (this == &other)
       return *this;
+    // the replaced state leaves the metrics, the taken one is still counted by the other
+    release_queued();
+    if (user_)
+      Metrics::instance().authenticated_connections.sub();
     message_handler_ = other.message_handler_;
     connection_handler_ = other.connection_handler_;
+    config_ = other.config_;
     id_ = other.id_;
     user_ = other.user_;
+    handle_ = other.handle_;
     is_closing_ = other.is_closing_.exchange(true);
-    write_timer_ = std::move(other.write_timer_);
-    write_message_queue_ = std::move(other.write_message_queue_);
+    spooling_ = other.spooling_;
+    write_lanes_ = std::move(other.write_lanes_);
+    queued_bytes_ = other.queued_bytes_.exchange(0);
+    queued_messages_ = other.queued_messages_.exchange(0);
+    drain_waiters_ = std::move(other.drain_waiters_);
+    drain_signal_ = std::move(other.drain_signal_);
+    throttled_by_ = std::move(other.throttled_by_);
     socket_ = std::move(other.socket_);
 
     other.id_ = std::numeric_limits<id_type>::max();
@@ -73,15 +142,16 @@ namespace ar
 
   std::shared_ptr<Connection> Connection::make_shared(
       asio::ip::tcp::socket&& socket, IMessageHandler* message_handler,
-      IConnectionHandler* connection_handler) noexcept
+      IConnectionHandler* connection_handler, ConnectionConfig config) noexcept
   {
     return std::make_shared<Connection>(std::forward<decltype(socket)>(socket), message_handler,
-                                        connection_handler);
+                                        connection_handler, config);
   }
 
   void Connection::start() noexcept
   {
     Logger::info(fmt::format("Connection-{} started!", id_));
+    set_no_delay(socket_, config_.no_delay);
     asio::co_spawn(
         socket_.get_executor(), [self = shared_from_this()] {
           return self->reader();
@@ -100,13 +170,33 @@ namespace ar
     if (is_closing_.load())
       return;
     is_closing_.store(true);
-    write_timer_.cancel();
+    write_lanes_.close();
     socket_.cancel();
     socket_.close();
     Logger::info(fmt::format("Connection-{} closed!", id_));
   }
 
   void Connection::write(Message&& msg) noexcept
+  {
+    push_write_entry(std::forward<Message>(msg));
+  }
+
+  void Connection::write(RelayMessage&& msg) noexcept
+  {
+    push_write_entry(std::forward<RelayMessage>(msg));
+  }
+
+  void Connection::write(SpliceMessage&& msg) noexcept
+  {
+    push_write_entry(std::forward<SpliceMessage>(msg));
+  }
+
+  void Connection::write(SpoolFile&& file) noexcept
+  {
+    push_write_entry(std::forward<SpoolFile>(file));
+  }
+
+  void Connection::push_write_entry(write_entry_type&& entry) noexcept
   {
     if (!is_open())
     {
@@ -116,28 +206,244 @@ namespace ar
     }
 
     Logger::trace(fmt::format("Push message to connection-{} writer", id_));
+    auto size = entry_size(entry);
+    // the relaying senders are already paused at the limit, so the queue only grows this far
+    // when the client stops reading. single message bigger than the limit is still allowed
+    auto queued = queued_bytes_.fetch_add(size);
+    if (queued != 0 && queued + size > config_.write_queue_limit * WRITE_QUEUE_HARD_LIMIT_FACTOR)
+    {
+      queued_bytes_ -= size;
+      Logger::warn(fmt::format("Connection-{} is too slow with {} bytes queued, closing it", id_,
+                               queued));
+      close();
+      return;
+    }
+
+    // the entry pushed after the writer is stopped is released with the connection
+    queued_messages_.fetch_add(1);
+    Metrics::instance().write_queue_messages.add();
+    Metrics::instance().write_queue_bytes.add(static_cast<i64>(size));
+    auto lane = entry_lane(entry);
+    write_lanes_.push(lane, QueuedEntry{.entry = std::forward<write_entry_type>(entry),
+                                        .queued_at = clock_type::now()});
+  }
+
+  void Connection::release_queued() noexcept
+  {
+    Metrics::instance().write_queue_messages.sub(static_cast<i64>(queued_messages_.exchange(0)));
+    Metrics::instance().write_queue_bytes.sub(static_cast<i64>(queued_bytes_.exchange(0)));
+  }
+
+  void Connection::on_written(const Message::Header& header,
+                              clock_type::time_point queued_at) noexcept
+  {
+    auto now = clock_type::now();
+    Metrics::instance().queue_wait(header.message_type, now - queued_at);
+    AsyncTraceSpan::record("queue"sv, queued_at, write_started_at_, id_, header.message_type);
+    AsyncTraceSpan::record("write"sv, write_started_at_, now, id_, header.message_type);
+    if (message_handler_)
+      message_handler_->on_message_out(*this, header);
+  }
+
+  bool Connection::is_open() const noexcept
+  {
+    return socket_.is_open() && !is_closing_.load();
+  }
+
+  bool Connection::is_writable() const noexcept
+  {
+    return queued_bytes_.load() < config_.write_queue_limit;
+  }
+
+  usize Connection::queued_bytes() const noexcept
+  {
+    return queued_bytes_.load();
+  }
+
+  usize Connection::spooling() const noexcept
+  {
+    return spooling_;
+  }
+
+  void Connection::spooling(usize count) noexcept
+  {
+    spooling_ = count;
+  }
+
+  WriteStats::Snapshot Connection::write_stats() const noexcept
+  {
+    return write_stats_.snapshot();
+  }
+
+  void Connection::use_block_pool(std::shared_ptr<BlockPool> pool) noexcept
+  {
+    frame_reader_.use_pool(std::move(pool));
+  }
+
+  bool Connection::resume(const HandoffState& state) noexcept
+  {
+    if (state.session_key.size() != KEY_BYTE)
+      return false;
+    symmetric_encryptor(symm_type::key_type{state.session_key});
+    return frame_reader_.preload(state.buffered);
+  }
+
+  void Connection::stop_reading() noexcept
+  {
+    is_detaching_ = true;
+  }
+
+  asio::awaitable<void> Connection::wait_reader_stopped() noexcept
+  {
+    stop_reading();
+    auto deadline = clock_type::now() + DETACH_TIMEOUT;
+    asio::steady_timer timer{socket_.get_executor()};
+    while (is_open() && !is_reader_stopped_)
     {
-      std::unique_lock l{write_message_mtx_};
-      write_message_queue_.push(std::forward<Message>(msg));
+      // wake up the reader waiting for the next header, the cancel would break the write in
+      // progress so it waits for the writer to be idle
+      if (!is_reader_busy_ && !is_writing_ && write_lanes_.empty())
+      {
+        asio::error_code ec;
+        socket_.cancel(ec);
+      }
+      if (clock_type::now() >= deadline)
+      {
+        Logger::warn(fmt::format("Connection-{} reader is not stopped in {}, closing it", id_,
+                                 DETACH_TIMEOUT));
+        close();
+        co_return;
+      }
+      timer.expires_after(DETACH_POLL_INTERVAL);
+      co_await timer.async_wait(ar::await_with_error());
+    }
+  }
 
-      // cancel the timer when this is the only message
-      if (write_message_queue_.size() - 1 == 0)
+  asio::awaitable<std::optional<HandoffConnection>> Connection::detach() noexcept
+  {
+    stop_reading();
+    auto deadline = clock_type::now() + DETACH_TIMEOUT;
+    asio::steady_timer timer{socket_.get_executor()};
+    while (is_open())
+    {
+      bool is_drained = !is_writing_ && write_lanes_.empty();
+      if (is_drained && is_reader_stopped_)
+        break;
+      // wake up the reader waiting for the next header, the writer is idle so only the read is
+      // cancelled
+      if (is_drained && !is_reader_busy_)
       {
         asio::error_code ec;
-        write_timer_.cancel(ec);
+        socket_.cancel(ec);
+      }
+      if (clock_type::now() >= deadline)
+      {
+        Logger::warn(fmt::format("Connection-{} is not drained in {}, closing it", id_,
+                                 DETACH_TIMEOUT));
+        close();
+        co_return std::nullopt;
+      }
+      timer.expires_after(DETACH_POLL_INTERVAL);
+      co_await timer.async_wait(ar::await_with_error());
+    }
+    if (!is_open())
+      co_return std::nullopt;
+    // the new process has its own key pair, so the client which has not sent its session key
+    // could not finish the handshake with it
+    if (!is_handshake_done_)
+    {
+      Logger::info(fmt::format("Connection-{} has no session key, closing it instead", id_));
+      close();
+      co_return std::nullopt;
+    }
+
+    HandoffConnection handoff{};
+    if (user_)
+      handoff.state.username = user_->name;
+    auto key = symmetric_encryptor_.key();
+    handoff.state.session_key.assign(key.begin(), key.end());
+    auto buffered = frame_reader_.take_buffered(frame_reader_.buffered());
+    handoff.state.buffered.assign(buffered.begin(), buffered.end());
+
+    asio::error_code ec;
+    handoff.socket = socket_.release(ec);
+    if (ec)
+    {
+      Logger::warn(fmt::format("Connection-{} could not release its socket: {}", id_,
+                               ec.message()));
+      close();
+      co_return std::nullopt;
+    }
+    // the writer is stopped without touching the released socket
+    is_closing_.store(true);
+    write_lanes_.close();
+    Logger::info(fmt::format("Connection-{} detached with {} bytes buffered", id_,
+                             handoff.state.buffered.size()));
+    co_return handoff;
+  }
 
-        if constexpr (AR_DEBUG)
+  void Connection::throttle(std::shared_ptr<Connection> destination) noexcept
+  {
+    if (!destination || destination.get() == this)
+      return;
+    if (std::ranges::find(throttled_by_, destination) != throttled_by_.end())
+      return;
+    throttled_by_.emplace_back(std::move(destination));
+  }
+
+  WriteLane Connection::entry_lane(const write_entry_type& entry) noexcept
+  {
+    if (auto msg = std::get_if<Message>(&entry))
+      return lane_of(msg->as_header()->message_type);
+    return WriteLane::Bulk;
+  }
+
+  usize Connection::entry_size(const write_entry_type& entry) noexcept
+  {
+    // the relayed body is bounded by the relay window instead, and the spliced body is kept by the
+    // kernel
+    if (std::holds_alternative<RelayMessage>(entry) || std::holds_alternative<SpliceMessage>(entry))
+      return Message::header_size;
+    // the spooled message stays on the disk
+    if (std::holds_alternative<SpoolFile>(entry))
+      return 0;
+    return std::get<Message>(entry).size();
+  }
+
+  asio::awaitable<void> Connection::wait_throttled() noexcept
+  {
+    auto throttled_by = std::exchange(throttled_by_, {});
+    for (auto& dest : throttled_by)
+    {
+      Logger::trace(fmt::format("Connection-{} paused by connection-{} with {} bytes queued", id_,
+                                dest->id_, dest->queued_bytes()));
+      while (true)
+      {
         {
-          if (ec)
-            Logger::warn(fmt::format("failed to cancel timer: {}", ec.message()));
+          // register first and check after it, so the notification is not lost
+          std::unique_lock l{dest->drain_waiters_mtx_};
+          dest->drain_waiters_.emplace_back(drain_signal_);
         }
+        if (!dest->is_open() || dest->queued_bytes() <= dest->config_.write_queue_limit / 2)
+          break;
+        if (!co_await drain_signal_->wait())
+          co_return;
       }
     }
   }
 
-  bool Connection::is_open() const noexcept
+  void Connection::notify_drained() noexcept
   {
-    return socket_.is_open() && !is_closing_.load();
+    std::vector<std::weak_ptr<AsyncSignal>> waiters{};
+    {
+      std::unique_lock l{drain_waiters_mtx_};
+      waiters = std::exchange(drain_waiters_, {});
+    }
+    for (auto& waiter : waiters)
+    {
+      if (auto signal = waiter.lock())
+        signal->notify();
+    }
   }
 
   bool Connection::is_authenticated() const noexcept
@@ -145,13 +451,116 @@ namespace ar
     return user_;
   }
 
+  u8 Connection::compressions() const noexcept
+  {
+    return compressions_;
+  }
+
+  void Connection::compressions(u8 compressions) noexcept
+  {
+    compressions_ = compressions;
+  }
+
+  std::optional<Connection::clock_type::time_point> Connection::check_liveness(
+      clock_type::time_point now) noexcept
+  {
+    if (!is_open())
+      return std::nullopt;
+
+    auto handshake_deadline = started_at_ + config_.handshake_timeout;
+    if (!is_handshake_done_ && now >= handshake_deadline)
+    {
+      Logger::warn(fmt::format("Connection-{} did not finish the handshake in {}", id_,
+                               config_.handshake_timeout));
+      close();
+      return std::nullopt;
+    }
+
+    // the client is active while its bytes move in either direction, including the partial reads
+    // of a big body and the writes in progress. The paused reader is not waiting for the client.
+    auto moved_bytes = frame_reader_.read_bytes() + written_bytes_;
+    if (moved_bytes != checked_bytes_ || is_reader_paused_)
+    {
+      checked_bytes_ = moved_bytes;
+      last_active_at_ = now;
+    }
+    if (now - last_active_at_ >= config_.idle_timeout)
+    {
+      Logger::warn(fmt::format("Connection-{} is idle for {}, closing it", id_,
+                               std::chrono::duration_cast<std::chrono::seconds>(
+                                   now - last_active_at_)));
+      close();
+      return std::nullopt;
+    }
+
+    auto heartbeat_deadline = last_active_at_ + config_.heartbeat_interval;
+    if (!is_ping_pending_ && now >= heartbeat_deadline)
+    {
+      auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now.time_since_epoch());
+      PingPayload payload{.timestamp = static_cast<u64>(timestamp.count())};
+      write(create_message<Message::Type::Ping>(payload.serialize(), User::SERVER_ID, 0));
+      is_ping_pending_ = true;
+    }
+
+    auto deadline = last_active_at_ + config_.idle_timeout;
+    if (!is_handshake_done_)
+      deadline = std::min(deadline, handshake_deadline);
+    if (!is_ping_pending_)
+      deadline = std::min(deadline, heartbeat_deadline);
+    return deadline;
+  }
+
+  std::chrono::nanoseconds Connection::round_trip_time() const noexcept
+  {
+    return round_trip_time_;
+  }
+
+  void Connection::on_heartbeat(const Message& msg) noexcept
+  {
+    if (msg.as_header()->message_type == Message::Type::Ping)
+    {
+      write(create_message<Message::Type::Pong>(msg.body, User::SERVER_ID, 0));
+      return;
+    }
+
+    auto payload = msg.body_as<PingPayload>();
+    if (!payload)
+    {
+      Logger::warn(fmt::format("Connection-{} sent malformed pong", id_));
+      return;
+    }
+    auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock_type::now().time_since_epoch());
+    round_trip_time_ = timestamp - std::chrono::nanoseconds{payload->timestamp};
+    is_ping_pending_ = false;
+    Logger::trace(fmt::format("Connection-{} round trip time {}", id_,
+                              std::chrono::duration_cast<std::chrono::microseconds>(
+                                  round_trip_time_)));
+  }
+
   void Connection::symmetric_encryptor(symm_type::key_type key) noexcept
   {
     symmetric_encryptor_ = symm_type{key};
+    is_handshake_done_ = true;
+  }
+
+  SlotHandle Connection::handle() const noexcept
+  {
+    return handle_;
+  }
+
+  void Connection::handle(SlotHandle handle) noexcept
+  {
+    handle_ = handle;
   }
 
   void Connection::user(User* user) noexcept
   {
+    if (!user_ && user)
+      Metrics::instance().authenticated_connections.add();
+    else if (user_ && !user)
+      Metrics::instance().authenticated_connections.sub();
     user_ = user;
   }
 
@@ -161,106 +570,447 @@ namespace ar
     Message message{};
     while (is_open())
     {
+      // release the previous body, so the read block could be reused
+      message.body = {};
+      is_reader_busy_ = false;
+      // the connection is handed over at the message boundary
+      if (is_detaching_)
+        break;
+      if (auto ec = co_await frame_reader_.read_header(socket_, message.header))
       {
-        auto [ec, n] = co_await asio::async_read(socket_, asio::buffer(message.header),
-                                                 asio::transfer_exactly(Message::header_size),
-                                                 ar::await_with_error());
-        if (ec)
+        if (is_connection_lost(ec))
+          break;
+        Logger::warn(fmt::format("Connection-{} error on reading header: {}", id_, ec.message()));
+        continue;
+      }
+      last_active_at_ = clock_type::now();
+      auto header_read_at = last_active_at_;
+      is_reader_busy_ = true;
+      if (message_handler_)
+      {
+        auto header = message.parse_header();
+        auto target = message_handler_->on_relay_in(*this, header);
+        if (auto stream = std::get_if<std::shared_ptr<RelayStream>>(&target))
         {
-          if (is_connection_lost(ec))
+          if (!co_await relay_body(header, std::move(*stream)))
             break;
-          Logger::warn(fmt::format("Connection-{} error on reading header: {}", id_, ec.message()));
           continue;
         }
-        if (n != Message::header_size)
+        if (auto relay = std::get_if<std::shared_ptr<SpliceRelay>>(&target))
         {
-          Logger::warn(fmt::format("Connection-{} is reading header with different size", id_));
+          if (!co_await splice_body(header, std::move(*relay)))
+            break;
           continue;
         }
       }
       {
         auto header = message.as_header();
-        message.body.resize(header->body_size); // NOTE: need to resize instead of reserve because
-        // of using asio::buffer
-        auto [ec, n] = co_await asio::async_read(socket_, asio::buffer(message.body),
-                                                 asio::transfer_exactly(header->body_size),
-                                                 ar::await_with_error());
-        if (ec)
+        if (header->body_size > config_.max_body_size)
+        {
+          Logger::warn(fmt::format("Connection-{} sent {} bytes body, over the limit of {} bytes",
+                                   id_, header->body_size, config_.max_body_size));
+          break;
+        }
+        // small body refers to the read block instead of being copied
+        if (auto ec = co_await frame_reader_.read_body(socket_, header->body_size, message.body))
         {
           if (is_connection_lost(ec))
             break;
           Logger::warn(fmt::format("Connection-{} error on reading body: {}", id_, ec.message()));
           continue;
         }
-        if (n != header->body_size)
-        {
-          Logger::warn(fmt::format("Connection-{} is reading body with different size", id_));
-          continue;
-        }
       }
+
+      last_active_at_ = clock_type::now();
+      auto type = message.as_header()->message_type;
+      AsyncTraceSpan::record("read"sv, header_read_at, last_active_at_, id_, type);
+      if (type == Message::Type::Ping || type == Message::Type::Pong)
+      {
+        on_heartbeat(message);
+        continue;
+      }
+
       Logger::info(fmt::format("Connection-{} got data {} bytes", id_, message.size()));
       if (message_handler_)
         message_handler_->on_message_in(*this, message);
+
+      // stop reading until the opponents could take more message
+      if (!throttled_by_.empty())
+      {
+        is_reader_paused_ = true;
+        co_await wait_throttled();
+        is_reader_paused_ = false;
+      }
+    }
+    Logger::trace(fmt::format("Connection-{} no longer reading message! {} socket reads", id_,
+                              frame_reader_.read_count()));
+    // detach takes the socket over
+    if (is_detaching_ && is_open())
+    {
+      is_reader_stopped_ = true;
+      co_return;
     }
-    Logger::trace(fmt::format("Connection-{} no longer reading message!", id_));
     close();
     if (connection_handler_)
       connection_handler_->on_connection_closed(*this);
   }
 
+  asio::awaitable<bool> Connection::relay_body(const Message::Header& header,
+                                               std::shared_ptr<RelayStream> stream) noexcept
+  {
+    Logger::trace(fmt::format("Connection-{} relaying {} bytes body", id_, header.body_size));
+    AsyncTraceSpan span{"relay_body"sv, id_, header.message_type};
+    bool has_consumer = true;
+    for (u64 remaining = header.body_size; remaining > 0;)
+    {
+      std::vector<u8> piece(std::min<u64>(remaining, RelayStream::PIECE_SIZE));
+      if (auto ec = co_await frame_reader_.read_exactly(socket_, piece))
+      {
+        Logger::warn(fmt::format("Connection-{} error on relaying body: {}", id_, ec.message()));
+        stream->abort();
+        co_return false;
+      }
+      remaining -= piece.size();
+
+      // keep reading the body to not break the next message even when there is no consumer
+      if (has_consumer)
+      {
+        is_reader_paused_ = true;
+        has_consumer = co_await stream->push(std::move(piece));
+        is_reader_paused_ = false;
+      }
+    }
+    co_return true;
+  }
+
+  asio::awaitable<bool> Connection::splice_body(const Message::Header& header,
+                                                std::shared_ptr<SpliceRelay> relay) noexcept
+  {
+    Logger::trace(fmt::format("Connection-{} splicing {} bytes body", id_, header.body_size));
+    AsyncTraceSpan span{"splice_body"sv, id_, header.message_type};
+    // the buffered part of body is written by the opponent before the spliced bytes
+    auto buffered = frame_reader_.take_buffered(header.body_size);
+    relay->prefix({buffered.begin(), buffered.end()});
+
+    // the opponent moves the body out of the socket meanwhile
+    is_reader_paused_ = true;
+    auto remaining = co_await relay->wait();
+    is_reader_paused_ = false;
+    if (!remaining)
+    {
+      Logger::warn(fmt::format("Connection-{} error on splicing body", id_));
+      co_return false;
+    }
+
+    // the opponent is gone before taking the whole body, drop the rest of it
+    std::vector<u8> piece(std::min<u64>(*remaining, RelayStream::PIECE_SIZE));
+    while (*remaining > 0)
+    {
+      auto size = std::min<u64>(*remaining, piece.size());
+      if (auto ec = co_await frame_reader_.read_exactly(socket_, {piece.data(), size}))
+      {
+        Logger::warn(fmt::format("Connection-{} error on dropping body: {}", id_, ec.message()));
+        co_return false;
+      }
+      *remaining -= size;
+    }
+    co_return true;
+  }
+
   asio::awaitable<void> Connection::writer() noexcept
   {
     Logger::trace(fmt::format("Connection-{} starting writer handler", id_));
+    std::vector<Message> batch{};
+    std::vector<clock_type::time_point> batch_queued_at{};
     while (is_open())
     {
-      bool is_empty;
-      {
-        std::unique_lock l{write_message_mtx_};
-        is_empty = write_message_queue_.empty();
-      }
-      if (is_empty)
+      std::optional<QueuedEntry> single{};
+      batch.clear();
+      batch_queued_at.clear();
+      pop_write_batch(batch, batch_queued_at, single);
+      if (batch.empty() && !single)
       {
-        auto [ec] = co_await write_timer_.async_wait(ar::await_with_error());
-        // NOTE: when the error is not cancel
-        if (ec != asio::error::operation_aborted)
-        {
-          Logger::warn(fmt::format("Error while waiting timer: {}", ec.message()));
+        if (!co_await write_lanes_.wait())
           break;
-        }
         Logger::trace(fmt::format("Connection-{} writer woken up", id_));
         continue;
       }
 
+      Logger::trace(fmt::format("Connection-{} writer sending {} message...", id_,
+                                single ? 1 : batch.size()));
+      usize written = single ? entry_size(single->entry) : 0;
+      for (const auto& msg : batch)
+        written += msg.size();
+      usize count = single ? 1 : batch.size();
+      bool is_connected;
+      is_writing_ = true;
+      write_started_at_ = clock_type::now();
+      if (!single)
+        is_connected = co_await write_batch(batch, batch_queued_at);
+      else if (auto relay = std::get_if<RelayMessage>(&single->entry))
+        is_connected = co_await write_entry(*relay, single->queued_at);
+      else if (auto splice = std::get_if<SpliceMessage>(&single->entry))
+        is_connected = co_await write_entry(*splice, single->queued_at);
+      else
+        is_connected = co_await write_entry(std::get<SpoolFile>(single->entry), single->queued_at);
+      is_writing_ = false;
+      queued_messages_ -= count;
+      Metrics::instance().write_queue_messages.sub(static_cast<i64>(count));
+      Metrics::instance().write_queue_bytes.sub(static_cast<i64>(written));
+      auto queued = queued_bytes_ -= written;
+      if (queued <= config_.write_queue_limit / 2)
+        notify_drained();
+      if (!is_connected)
+        break;
+    }
+
+    // release queued messages, especially relay consumers so the senders are not waiting for it
+    close();
+    write_lanes_.clear();
+    release_queued();
+    notify_drained();
+    auto stats = write_stats_.snapshot();
+    Logger::info(fmt::format(
+        "Connection-{} no longer sending message! {} messages, {} bytes in {} flushes (max {})",
+        id_, stats.messages, stats.bytes, stats.flushes, stats.max_messages));
+  }
+
+  void Connection::pop_write_batch(std::vector<Message>& batch,
+                                   std::vector<clock_type::time_point>& batch_queued_at,
+                                   std::optional<QueuedEntry>& single) noexcept
+  {
+    const auto& budget = config_.write_budget;
+    usize bytes = 0;
+    auto& queue = write_lanes_.next();
+    while (!queue.empty())
+    {
+      auto& [entry, queued_at] = queue.front();
+      if (!std::holds_alternative<Message>(entry))
       {
-        Logger::trace(fmt::format("Connection-{} writer sending message...", id_));
-        std::unique_lock l{write_message_mtx_};
-        auto msg = std::move(write_message_queue_.front());
-
-        // send 2 bufer in one go
-        std::vector<asio::const_buffer> buffers{};
-        buffers.emplace_back(asio::buffer(msg.header));
-        buffers.emplace_back(asio::buffer(msg.body));
-        auto expected_bytes = msg.size();
-        auto [ec, n] = co_await asio::async_write(socket_, buffers, ar::await_with_error());
-        if (ec)
+        // the relay body and spool file are streamed, so they can't be part of vectored write
+        if (batch.empty())
         {
-          if (is_connection_lost(ec))
-            break;
-          Logger::warn(fmt::format("Connection-{} error on sending message: {}", id_,
-                                   ec.message()));
-          continue;
+          single.emplace(std::move(queue.front()));
+          queue.pop();
         }
-        if (n != expected_bytes)
+        return;
+      }
+
+      // the first message is always taken even when it is bigger than the budget
+      auto& msg = std::get<Message>(entry);
+      if (!batch.empty() && (bytes + msg.size() > budget.max_bytes ||
+                             (batch.size() + 1) * 2 > budget.max_buffers))
+        return;
+      bytes += msg.size();
+      batch.emplace_back(std::move(msg));
+      batch_queued_at.emplace_back(queued_at);
+      queue.pop();
+    }
+  }
+
+  asio::awaitable<bool> Connection::write_batch(
+      std::span<Message> batch, std::span<const clock_type::time_point> queued_at) noexcept
+  {
+    // send every header and body in one go
+    write_buffers_.clear();
+    usize expected_bytes = 0;
+    for (auto& msg : batch)
+    {
+      write_buffers_.emplace_back(asio::buffer(msg.header));
+      if (!msg.body.empty())
+        write_buffers_.emplace_back(asio::buffer(msg.body.data(), msg.body.size()));
+      expected_bytes += msg.size();
+    }
+    // the progress is counted on every partial write, so the big message is not seen as idle. The
+    // condition is not asked after the last write, so it is counted again from the result
+    auto base = written_bytes_;
+    auto [ec, n] = co_await asio::async_write(
+        socket_, write_buffers_,
+        [&](const asio::error_code& error, usize transferred) {
+          written_bytes_ = base + transferred;
+          return asio::transfer_all()(error, transferred);
+        },
+        ar::await_with_error());
+    written_bytes_ = base + n;
+    write_stats_.record(batch.size(), n);
+    if (ec)
+    {
+      if (is_connection_lost(ec))
+        co_return false;
+      Logger::warn(fmt::format("Connection-{} error on sending message: {}", id_,
+                               ec.message()));
+      co_return true;
+    }
+    if (n != expected_bytes)
+    {
+      Logger::warn(
+          fmt::format("Connection-{} is sending message with different size: {}", id_, n));
+      co_return true;
+    }
+
+    for (usize i = 0; i < batch.size(); ++i)
+      on_written(*batch[i].as_header(), queued_at[i]);
+    Logger::info(fmt::format("success sent {} message to connection-{}!", batch.size(), id_));
+    co_return true;
+  }
+
+  asio::awaitable<bool> Connection::write_entry(RelayMessage& msg,
+                                               clock_type::time_point queued_at) noexcept
+  {
+    // the message is sent piece by piece, send full segments only until it is done
+    CorkGuard cork{socket_};
+    {
+      auto [ec, n] = co_await asio::async_write(socket_, asio::buffer(msg.header),
+                                                ar::await_with_error());
+      written_bytes_ += n;
+      if (ec)
+      {
+        Logger::warn(fmt::format("Connection-{} error on sending relay header: {}", id_,
+                                 ec.message()));
+        co_return false;
+      }
+    }
+
+    for (u64 remaining = msg.body.size(); remaining > 0;)
+    {
+      auto piece = co_await msg.body.next();
+      if (!piece)
+      {
+        // the sender is gone, fill the rest of body with zeros to keep the message boundary
+        Logger::warn(fmt::format("Connection-{} relay aborted with {} bytes left", id_,
+                                 remaining));
+        std::vector<u8> zeros(std::min<u64>(remaining, RelayStream::PIECE_SIZE));
+        while (remaining > 0)
         {
-          Logger::warn(
-              fmt::format("Connection-{} is sending message with different size: {}", id_, n));
-          continue;
+          auto size = std::min<u64>(remaining, zeros.size());
+          auto [ec, n] = co_await asio::async_write(socket_, asio::buffer(zeros.data(), size),
+                                                    ar::await_with_error());
+          written_bytes_ += n;
+          if (ec)
+            co_return false;
+          remaining -= n;
         }
+        break;
+      }
 
-        Logger::info(fmt::format("success sent 1 message to connection-{}!", id_));
-        write_message_queue_.pop();
+      auto [ec, n] = co_await asio::async_write(socket_, asio::buffer(*piece),
+                                                ar::await_with_error());
+      written_bytes_ += n;
+      if (ec)
+      {
+        Logger::warn(fmt::format("Connection-{} error on sending relay body: {}", id_,
+                                 ec.message()));
+        co_return false;
       }
+      remaining -= n;
     }
-    Logger::trace(fmt::format("Connection-{} no longer sending message!", id_));
+
+    write_stats_.record(1, Message::header_size + msg.body.size());
+    on_written(parse_header(msg.header), queued_at);
+    Logger::info(fmt::format("success relayed 1 message to connection-{}!", id_));
+    co_return true;
+  }
+
+  asio::awaitable<bool> Connection::write_entry(SpliceMessage& msg,
+                                               clock_type::time_point queued_at) noexcept
+  {
+    CorkGuard cork{socket_};
+    std::array buffers{asio::buffer(msg.header),
+                       asio::buffer(msg.body.prefix().data(), msg.body.prefix().size())};
+    auto [ec, n] = co_await asio::async_write(socket_, buffers, ar::await_with_error());
+    written_bytes_ += n;
+    if (ec)
+    {
+      Logger::warn(fmt::format("Connection-{} error on sending splice header: {}", id_,
+                               ec.message()));
+      co_return false;
+    }
+
+    ec = co_await msg.body.transfer(socket_, written_bytes_);
+    if (ec)
+    {
+      Logger::warn(fmt::format("Connection-{} error on splicing body: {}", id_, ec.message()));
+      co_return false;
+    }
+
+    write_stats_.record(1, Message::header_size + msg.body.size());
+    on_written(parse_header(msg.header), queued_at);
+    Logger::info(fmt::format("success spliced 1 message to connection-{}!", id_));
+    co_return true;
+  }
+
+  asio::awaitable<bool> Connection::write_entry(SpoolFile& file,
+                                               clock_type::time_point queued_at) noexcept
+  {
+    auto path = file.path();
+    auto source = NativeFile::open(path, false);
+    if (!source || source->size() != file.size())
+    {
+      // the file is removed or changed outside the server, drop it instead of keeping it forever
+      Logger::error(fmt::format("Connection-{} could not open spool file {}", id_,
+                                path.string()));
+      file.delivered();
+      co_return true;
+    }
+
+#if AR_LINUX
+    // the kernel copies the file into the socket, so the message is never loaded into memory
+    asio::error_code ec;
+    socket_.native_non_blocking(true, ec);
+    off_t offset = 0;
+    while (!ec && static_cast<u64>(offset) < file.size())
+    {
+      auto n = ::sendfile(socket_.native_handle(), source->native_handle(), &offset,
+                          file.size() - offset);
+      if (n > 0)
+      {
+        written_bytes_ += n;
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        std::tie(ec) = co_await socket_.async_wait(asio::socket_base::wait_write,
+                                                   ar::await_with_error());
+        continue;
+      }
+      ec = n < 0 ? asio::error_code{errno, asio::system_category()} : asio::error::eof;
+    }
+#else
+    // send the file piece by piece, only one piece is kept in memory
+    asio::error_code ec;
+    std::vector<u8> piece(std::min<u64>(file.size(), RelayStream::PIECE_SIZE));
+    for (u64 offset = 0; !ec && offset < file.size();)
+    {
+      auto size = std::min<u64>(file.size() - offset, piece.size());
+      if (!source->read(offset, {piece.data(), size}))
+      {
+        ec = asio::error::eof;
+        break;
+      }
+      usize n;
+      std::tie(ec, n) = co_await asio::async_write(socket_, asio::buffer(piece.data(), size),
+                                                   ar::await_with_error());
+      offset += n;
+      written_bytes_ += n;
+    }
+#endif
+    if (ec)
+    {
+      Logger::warn(fmt::format("Connection-{} error on sending spool file: {}", id_,
+                               ec.message()));
+      co_return false;
+    }
+
+    // the header is only kept on the file
+    std::array<u8, Message::header_size> header{};
+    bool has_header = source->read(0, header);
+    file.delivered();
+    write_stats_.record(1, file.size());
+    if (has_header)
+      on_written(parse_header(header), queued_at);
+    Logger::info(fmt::format("success sent 1 spooled message to connection-{}!", id_));
+    co_return true;
   }
 } // namespace ar
\ No newline at end of file
@@ -4,10 +4,20 @@
 #pragma once
 #include <asio.hpp>
 #include <atomic>
-#include <queue>
-
+#include <chrono>
+#include <optional>
+#include <mutex>
+#include <variant>
+
+#include "hot_restart.h"
+#include "message/frame_reader.h"
+#include "message/write_lanes.h"
 #include "message/payload.h"
+#include "relay.h"
+#include "spool.h"
 #include "util/literal.h"
+#include "util/slot_map.h"
+#include "util/socket.h"
 
 namespace ar
 {
@@ -15,16 +25,37 @@ namespace ar
   class IConnectionHandler;
   class IMessageHandler;
 
+  struct ConnectionConfig
+  {
+    // maximum body bytes of buffered message, bigger message will close the connection before
+    // allocating the body
+    u64 max_body_size = 256 * 1024 * 1024;
+    // bytes queued on writer before the relaying senders are paused, the control messages will
+    // close the connection when the queue is grown to WRITE_QUEUE_HARD_LIMIT_FACTOR times of it
+    usize write_queue_limit = 4 * 1024 * 1024;
+    // disable Nagle algorithm, small messages are coalesced by the writer instead
+    bool no_delay = true;
+    WriteBudget write_budget{};
+    // the connection is closed when the session key is not stored within this time
+    std::chrono::milliseconds handshake_timeout{10'000};
+    // Ping is sent when nothing is read from the client for this long
+    std::chrono::milliseconds heartbeat_interval{15'000};
+    // the connection is closed when nothing is read from or written to the client for this long
+    std::chrono::milliseconds idle_timeout{45'000};
+  };
+
   class Connection : public std::enable_shared_from_this<Connection>
   {
   public:
     using id_type = u16;
+    using clock_type = std::chrono::steady_clock;
+
     Connection(asio::ip::tcp::socket&& socket, IMessageHandler* message_handler,
-               IConnectionHandler* connection_handler) noexcept;
+               IConnectionHandler* connection_handler, ConnectionConfig config = {}) noexcept;
 
     template <typename T>
       requires std::derived_from<T, IMessageHandler> && std::derived_from<T, IConnectionHandler>
-    Connection(asio::ip::tcp::socket&& socket, T* handler) noexcept;
+    Connection(asio::ip::tcp::socket&& socket, T* handler, ConnectionConfig config = {}) noexcept;
 
     ~Connection() noexcept;
 
@@ -38,22 +69,84 @@ namespace ar
 
     static std::shared_ptr<Connection> make_shared(asio::ip::tcp::socket&& socket,
                                                    IMessageHandler* message_handler,
-                                                   IConnectionHandler* connection_handler) noexcept;
+                                                   IConnectionHandler* connection_handler,
+                                                   ConnectionConfig config = {}) noexcept;
 
     template <typename T>
       requires std::derived_from<T, IMessageHandler> && std::derived_from<T, IConnectionHandler>
     static std::shared_ptr<Connection> make_shared(asio::ip::tcp::socket&& socket,
-                                                   T* handler) noexcept;
+                                                   T* handler,
+                                                   ConnectionConfig config = {}) noexcept;
 
     // Start reading and writing handler
     void start() noexcept;
 
+    // read into the blocks of the pool, it should be called before start
+    void use_block_pool(std::shared_ptr<BlockPool> pool) noexcept;
+
+    // restore the state handed over by the old process, it should be called before start. It
+    // will return false when there is no session key or the buffered bytes are bigger than the
+    // read block.
+    [[nodiscard]] bool resume(const HandoffState& state) noexcept;
+
+    // stop reading at the next message boundary, the socket is kept open for detach
+    void stop_reading() noexcept;
+
+    // stop reading and wait until the reader is stopped, so the connection no longer produces
+    // messages. The connection is closed when it is not stopped within DETACH_TIMEOUT
+    asio::awaitable<void> wait_reader_stopped() noexcept;
+
+    // wait until the reader is stopped and the queued writes are flushed, then release the socket
+    // from the connection. It returns null when the connection is closed meanwhile, it is not
+    // drained within DETACH_TIMEOUT or the client has not sent its session key, the connection
+    // is closed in that case
+    asio::awaitable<std::optional<HandoffConnection>> detach() noexcept;
+
     void write(Message&& msg) noexcept;
 
+    // write message which body is relayed from another connection
+    void write(RelayMessage&& msg) noexcept;
+
+    // write message which body is spliced from another connection socket
+    void write(SpliceMessage&& msg) noexcept;
+
+    // write message saved on the spool, it is sent from the file without being loaded
+    void write(SpoolFile&& file) noexcept;
+
     bool is_open() const noexcept;
 
+    // whether the write queue is below the limit
+    [[nodiscard]] bool is_writable() const noexcept;
+
+    [[nodiscard]] usize queued_bytes() const noexcept;
+
+    // relayed messages being saved on the spool for this connection, the next relayed messages
+    // go through the spool too until they are queued, so the order is kept. It should be called
+    // from the connection thread
+    [[nodiscard]] usize spooling() const noexcept;
+    void spooling(usize count) noexcept;
+
+    [[nodiscard]] WriteStats::Snapshot write_stats() const noexcept;
+
+    // pause reading the next message until the destination write queue is drained, it should be
+    // called by the message handler when it writes into destination that is not writable
+    void throttle(std::shared_ptr<Connection> destination) noexcept;
+
     [[nodiscard]] bool is_authenticated() const noexcept;
 
+    // bits of CompressionType advertised by the client with its public key, 0 for the older
+    // clients which don't know the field
+    [[nodiscard]] u8 compressions() const noexcept;
+    void compressions(u8 compressions) noexcept;
+
+    // close the connection when its deadlines are passed and send Ping when it is idle. it returns
+    // when it should be checked again, null when the connection is closed or has no deadline. It
+    // should be called from the connection thread
+    std::optional<clock_type::time_point> check_liveness(clock_type::time_point now) noexcept;
+
+    // round trip time of the last Pong, 0 when there is none yet
+    [[nodiscard]] std::chrono::nanoseconds round_trip_time() const noexcept;
+
     template <typename Self>
     auto&& socket(this Self&& self) noexcept;
 
@@ -63,6 +156,11 @@ namespace ar
     template <typename Self>
     auto&& user(this Self&& self) noexcept;
 
+    // slot of the connection on its shard table
+    [[nodiscard]] SlotHandle handle() const noexcept;
+
+    void handle(SlotHandle handle) noexcept;
+
     template <typename Self>
     auto&& symmetric_encryptor(this Self&& self) noexcept;
 
@@ -73,23 +171,110 @@ namespace ar
   private:
     void close() noexcept;
 
+    using write_entry_type = std::variant<Message, RelayMessage, SpliceMessage, SpoolFile>;
+
+    struct QueuedEntry
+    {
+      write_entry_type entry;
+      clock_type::time_point queued_at;
+    };
+
+    constexpr static usize WRITE_QUEUE_HARD_LIMIT_FACTOR = 4;
+    constexpr static std::chrono::milliseconds DETACH_POLL_INTERVAL{10};
+    constexpr static std::chrono::seconds DETACH_TIMEOUT{10};
+
+    void push_write_entry(write_entry_type&& entry) noexcept;
+
+    // bytes kept in memory by the entry
+    static usize entry_size(const write_entry_type& entry) noexcept;
+
+    // take the queued entries out of the metrics once they are released
+    void release_queued() noexcept;
+
+    // report the written message into the handler, its queue wait into the metrics and its queue
+    // and write spans into the tracer
+    void on_written(const Message::Header& header, clock_type::time_point queued_at) noexcept;
+
+    static WriteLane entry_lane(const write_entry_type& entry) noexcept;
+
+    // reply Ping and measure the round trip time from Pong
+    void on_heartbeat(const Message& msg) noexcept;
+
+    // wait until all destinations from throttle are drained
+    asio::awaitable<void> wait_throttled() noexcept;
+
+    // notify the throttled senders when the queue is drained enough
+    void notify_drained() noexcept;
+
     asio::awaitable<void> reader() noexcept;
+    // read the body directly into relay stream instead of buffering it
+    asio::awaitable<bool> relay_body(const Message::Header& header,
+                                     std::shared_ptr<RelayStream> stream) noexcept;
+    // hand the socket over to the opponent writer until the body is spliced
+    asio::awaitable<bool> splice_body(const Message::Header& header,
+                                      std::shared_ptr<SpliceRelay> relay) noexcept;
     asio::awaitable<void> writer() noexcept;
+    // pop queued messages of the next lane within the write budget, relay message, splice message
+    // and spool file are always popped alone
+    void pop_write_batch(std::vector<Message>& batch,
+                         std::vector<clock_type::time_point>& batch_queued_at,
+                         std::optional<QueuedEntry>& single) noexcept;
+    // return false when the connection is lost
+    asio::awaitable<bool> write_batch(std::span<Message> batch,
+                                      std::span<const clock_type::time_point> queued_at) noexcept;
+    asio::awaitable<bool> write_entry(RelayMessage& msg, clock_type::time_point queued_at) noexcept;
+    asio::awaitable<bool> write_entry(SpliceMessage& msg,
+                                      clock_type::time_point queued_at) noexcept;
+    asio::awaitable<bool> write_entry(SpoolFile& file, clock_type::time_point queued_at) noexcept;
 
   private:
     inline static std::atomic<id_type> s_current_id = 1_u16;
 
     IMessageHandler* message_handler_;
     IConnectionHandler* connection_handler_;
+    ConnectionConfig config_;
 
     id_type id_;
     User* user_;
+    SlotHandle handle_;
 
     std::atomic_bool is_closing_;
 
-    asio::steady_timer write_timer_;
-    std::queue<Message> write_message_queue_; // WARN: need mutex?
-    std::mutex write_message_mtx_;
+    // liveness, only used by the connection thread
+    clock_type::time_point started_at_;
+    clock_type::time_point last_active_at_;
+    u64 written_bytes_; // it grows while a big entry is written too
+    u64 checked_bytes_; // read and written bytes on the last check
+    bool is_handshake_done_;
+    bool is_reader_busy_; // reading a body or paused by throttling
+    bool is_reader_paused_; // waiting for the opponents instead of the client
+    u8 compressions_;
+    bool is_ping_pending_;
+    std::chrono::nanoseconds round_trip_time_;
+
+    // hot restart, only used by the connection thread
+    bool is_detaching_;
+    bool is_reader_stopped_;
+    bool is_writing_;
+
+    usize spooling_; // only used by the connection thread
+
+    FrameReader frame_reader_; // only used by reader
+
+    WriteLanes<QueuedEntry> write_lanes_;
+    std::atomic<usize> queued_bytes_;
+    std::atomic<usize> queued_messages_;
+    // signal of senders waiting this queue to be drained
+    std::vector<std::weak_ptr<AsyncSignal>> drain_waiters_;
+    std::mutex drain_waiters_mtx_;
+
+    // used by reader to wait the throttling destinations
+    std::shared_ptr<AsyncSignal> drain_signal_;
+    std::vector<std::shared_ptr<Connection>> throttled_by_;
+
+    std::vector<asio::const_buffer> write_buffers_; // only used by writer
+    clock_type::time_point write_started_at_;       // only used by writer
+    WriteStats write_stats_;
     asio::ip::tcp::socket socket_;
 
     symm_type symmetric_encryptor_; // Used for communicating between client and server
@@ -97,17 +282,20 @@ namespace ar
 
   template <typename T>
     requires std::derived_from<T, IMessageHandler> && std::derived_from<T, IConnectionHandler>
-  Connection::Connection(asio::ip::tcp::socket&& socket, T* handler) noexcept
-    : Connection{std::forward<decltype(socket)>(socket), handler, handler}
+  Connection::Connection(asio::ip::tcp::socket&& socket, T* handler,
+                         ConnectionConfig config) noexcept
+    : Connection{std::forward<decltype(socket)>(socket), handler, handler, config}
   {
   }
 
   template <typename T>
     requires std::derived_from<T, IMessageHandler> && std::derived_from<T, IConnectionHandler>
   std::shared_ptr<Connection> Connection::make_shared(asio::ip::tcp::socket&& socket,
-                                                      T* handler) noexcept
+                                                      T* handler,
+                                                      ConnectionConfig config) noexcept
   {
-    return std::make_shared<Connection>(std::forward<decltype(socket)>(socket), handler, handler);
+    return std::make_shared<Connection>(std::forward<decltype(socket)>(socket), handler, handler,
+                                        config);
   }
 
   template <typename Self>
@@ -1,12 +1,14 @@
 #pragma once
 
+#include <memory>
 #include <span>
 
+#include "message/message.h"
+#include "relay.h"
 #include "util/types.h"
 
 namespace ar
 {
-  struct Message;
   class Connection;
 
   class IMessageHandler
@@ -14,13 +16,19 @@ namespace ar
   public:
     virtual ~IMessageHandler() = default;
     virtual void on_message_in(Connection& conn, const Message& msg) noexcept = 0;
-    virtual void on_message_out(Connection& conn, std::span<const u8> bytes) noexcept = 0;
+    // called when the header is read and before the body is read. when it returns a stream, the
+    // body will be pushed into it while being read (cut-through), when it returns a splice relay,
+    // the body is moved by the opponent writer. on_message_in is not called for both of them.
+    virtual relay_target_type on_relay_in(Connection& conn,
+                                          const Message::Header& header) noexcept = 0;
+    // called once the whole message is written into the socket
+    virtual void on_message_out(Connection& conn, const Message::Header& header) noexcept = 0;
   };
 
   template <typename T>
   concept message_handler = requires(T t, Connection& conn, const Message& msg) {
     { t.on_message_in(conn, msg) } noexcept -> std::same_as<void>;
-    { t.on_message_out(conn, msg) } noexcept -> std::same_as<void>;
+    { t.on_message_out(conn, *msg.as_header()) } noexcept -> std::same_as<void>;
   };
 
   class IConnectionHandler
@@ -0,0 +1,283 @@
+#include "hot_restart.h"
+
+#include <fmt/format.h>
+#include <fmt/std.h>
+
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/post.hpp>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+#include "core.h"
+#include "logger.h"
+#include "message/message.h"
+#include "server.h"
+#include "util/asio.h"
+
+#if AR_LINUX
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+namespace ar
+{
+  namespace
+  {
+#if AR_LINUX
+    enum class RecordKind : u8
+    {
+      Listener,
+      Connection,
+    };
+
+    // every socket is sent as one record, the socket is attached on the header
+    struct RecordHeader
+    {
+      u32 body_size;
+      RecordKind kind;
+    };
+
+    struct Record
+    {
+      RecordKind kind;
+      int socket;
+      std::vector<u8> body;
+    };
+
+    bool send_record(int peer, RecordKind kind, int socket, std::span<const u8> body) noexcept
+    {
+      RecordHeader header{.body_size = static_cast<u32>(body.size()), .kind = kind};
+      std::vector<u8> bytes(sizeof(header) + body.size());
+      std::memcpy(bytes.data(), &header, sizeof(header));
+      std::ranges::copy(body, bytes.begin() + sizeof(header));
+
+      iovec iov{.iov_base = bytes.data(), .iov_len = bytes.size()};
+      alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+      msghdr msg{};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.data();
+      msg.msg_controllen = control.size();
+      auto cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      std::memcpy(CMSG_DATA(cmsg), &socket, sizeof(int));
+
+      auto sent = ::sendmsg(peer, &msg, MSG_NOSIGNAL);
+      if (sent < 0)
+        return false;
+      // the socket is already attached, send the rest as usual
+      for (auto offset = static_cast<usize>(sent); offset < bytes.size();)
+      {
+        auto n = ::send(peer, bytes.data() + offset, bytes.size() - offset, MSG_NOSIGNAL);
+        if (n < 0)
+          return false;
+        offset += static_cast<usize>(n);
+      }
+      return true;
+    }
+
+    // null on the end of stream
+    std::optional<Record> receive_record(int peer) noexcept
+    {
+      RecordHeader header{};
+      iovec iov{.iov_base = &header, .iov_len = sizeof(header)};
+      alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+      msghdr msg{};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.data();
+      msg.msg_controllen = control.size();
+
+      auto received = ::recvmsg(peer, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+      if (received != sizeof(header))
+        return std::nullopt;
+
+      Record record{.kind = header.kind, .socket = -1, .body = std::vector<u8>(header.body_size)};
+      auto cmsg = CMSG_FIRSTHDR(&msg);
+      if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        std::memcpy(&record.socket, CMSG_DATA(cmsg), sizeof(int));
+
+      for (usize offset = 0; offset < record.body.size();)
+      {
+        auto n = ::recv(peer, record.body.data() + offset, record.body.size() - offset,
+                        MSG_WAITALL);
+        if (n <= 0)
+        {
+          if (record.socket >= 0)
+            ::close(record.socket);
+          return std::nullopt;
+        }
+        offset += static_cast<usize>(n);
+      }
+      return record;
+    }
+
+    // the sockets are duplicated into the peer, the local ones are closed either way
+    void send_handoff(int peer, Handoff&& handoff) noexcept
+    {
+      bool is_connected = true;
+      for (auto listener : handoff.listeners)
+      {
+        is_connected = is_connected && send_record(peer, RecordKind::Listener, listener, {});
+        ::close(listener);
+      }
+      for (auto& conn : handoff.connections)
+      {
+        is_connected = is_connected && send_record(peer, RecordKind::Connection, conn.socket,
+                                                   conn.state.serialize());
+        ::close(conn.socket);
+      }
+
+      if (!is_connected)
+        Logger::error("new process is gone while handing the server over, the rest is closed");
+      else
+        Logger::info(fmt::format("handed {} listeners and {} connections over",
+                                 handoff.listeners.size(), handoff.connections.size()));
+    }
+#endif
+  } // namespace
+
+  HotRestart::HotRestart(asio::local::stream_protocol::acceptor&& acceptor,
+                         std::filesystem::path path, Server& server,
+                         callback_type on_handed_over) noexcept
+    : acceptor_{std::move(acceptor)},
+      path_{std::move(path)},
+      server_{server},
+      on_handed_over_{std::move(on_handed_over)}
+  {
+  }
+
+  HotRestart::~HotRestart() noexcept
+  {
+    std::error_code ec;
+    if (!path_.empty())
+      std::filesystem::remove(path_, ec);
+  }
+
+  std::expected<std::unique_ptr<HotRestart>, std::string_view> HotRestart::listen(
+      asio::io_context& context, const std::filesystem::path& path, Server& server,
+      callback_type on_handed_over) noexcept
+  {
+#if AR_LINUX
+    // the file is left by the previous process
+    std::error_code fs_ec;
+    std::filesystem::remove(path, fs_ec);
+
+    asio::local::stream_protocol::acceptor acceptor{context};
+    asio::error_code ec;
+    acceptor.open(asio::local::stream_protocol{}, ec);
+    if (!ec)
+      acceptor.bind(asio::local::stream_protocol::endpoint{path.string()}, ec);
+    if (!ec)
+      acceptor.listen(1, ec);
+    if (ec)
+      return std::unexpected{"failed to listen on the hot restart path"sv};
+
+    std::unique_ptr<HotRestart> hot_restart{
+        new HotRestart{std::move(acceptor), path, server, std::move(on_handed_over)}};
+    asio::co_spawn(context, [hot_restart = hot_restart.get()] {
+      return hot_restart->acceptor_handler();
+    }, asio::detached);
+    return hot_restart;
+#else
+    return std::unexpected{"hot restart is only supported on linux"sv};
+#endif
+  }
+
+  std::expected<Handoff, std::string_view> HotRestart::take_over(
+      const std::filesystem::path& path) noexcept
+  {
+#if AR_LINUX
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    auto path_str = path.string();
+    if (path_str.size() >= sizeof(address.sun_path))
+      return std::unexpected{"hot restart path is too long"sv};
+    std::ranges::copy(path_str, address.sun_path);
+
+    auto peer = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (peer < 0)
+      return std::unexpected{"failed to create hot restart socket"sv};
+    if (::connect(peer, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+      ::close(peer);
+      return std::unexpected{"no server is listening on the hot restart path"sv};
+    }
+
+    Logger::info(fmt::format("taking the server over from {}", path));
+    Handoff handoff{};
+    while (auto record = receive_record(peer))
+    {
+      if (record->socket < 0)
+      {
+        Logger::warn("hot restart record without socket is skipped");
+        continue;
+      }
+
+      if (record->kind == RecordKind::Listener)
+      {
+        handoff.listeners.emplace_back(record->socket);
+        continue;
+      }
+
+      auto state = parse_body<HandoffState>(record->body);
+      if (!state)
+      {
+        Logger::warn(fmt::format("malformed connection state is handed over: {}", state.error()));
+        ::close(record->socket);
+        continue;
+      }
+      handoff.connections.emplace_back(record->socket, std::move(state.value()));
+    }
+    // the old process is gone, so its stores are closed
+    ::close(peer);
+    Logger::info(fmt::format("took {} listeners and {} connections over",
+                             handoff.listeners.size(), handoff.connections.size()));
+    return handoff;
+#else
+    return std::unexpected{"hot restart is only supported on linux"sv};
+#endif
+  }
+
+  asio::awaitable<void> HotRestart::acceptor_handler() noexcept
+  {
+    auto [ec, peer] = co_await acceptor_.async_accept(ar::await_with_error());
+    if (ec)
+    {
+      if (ec != asio::error::operation_aborted)
+        Logger::warn(fmt::format("error on accepting hot restart: {}", ec.message()));
+      co_return;
+    }
+
+    Logger::info("new process connected, handing the server over");
+    // the path is listened by the new process once this process exits
+    acceptor_.close(ec);
+    std::error_code fs_ec;
+    std::filesystem::remove(path_, fs_ec);
+    path_.clear();
+
+    peer.native_non_blocking(false, ec);
+    server_.hand_over([this, peer = std::move(peer)](Handoff&& handoff) mutable {
+      // sent from the context thread, the shards are not blocked by the peer
+      asio::post(acceptor_.get_executor(),
+                 [this, peer = std::move(peer), handoff = std::move(handoff)]() mutable {
+#if AR_LINUX
+                   send_handoff(peer.native_handle(), std::move(handoff));
+#endif
+                   // the peer sees the end of stream when this process exits, after the stores
+                   // are closed
+                   asio::error_code release_ec;
+                   std::ignore = peer.release(release_ec);
+                   on_handed_over_();
+                 });
+    });
+  }
+} // namespace ar
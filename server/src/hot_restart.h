@@ -0,0 +1,87 @@
+#pragma once
+
+#include <alpaca/alpaca.h>
+
+#include <asio/awaitable.hpp>
+#include <asio/io_context.hpp>
+#include <asio/ip/tcp.hpp>
+#include <asio/local/stream_protocol.hpp>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/types.h"
+
+namespace ar
+{
+  class Server;
+
+  // state of connection handed over with its socket
+  struct HandoffState
+  {
+    std::string username;         // empty when the user is not logged in
+    std::vector<u8> session_key;  // empty when the handshake is not done
+    std::vector<u8> buffered;     // bytes read from the socket but not parsed yet
+
+    [[nodiscard]] std::vector<u8> serialize() const noexcept
+    {
+      std::vector<u8> temp{};
+      alpaca::serialize(*this, temp);
+      return temp;
+    }
+  };
+
+  struct HandoffConnection
+  {
+    asio::ip::tcp::socket::native_handle_type socket;
+    HandoffState state;
+  };
+
+  // sockets released by the old process, they are owned by the receiver
+  struct Handoff
+  {
+    std::vector<asio::ip::tcp::acceptor::native_handle_type> listeners;
+    std::vector<HandoffConnection> connections;
+  };
+
+  // Hands the running server over to the new process through unix socket. The new process
+  // connects to the path and takes the listening sockets, so the new connections wait in their
+  // backlog instead of being refused. Each established connection follows once its queued writes
+  // are flushed. The old process exits after it, the new process sees the end of stream when the
+  // stores are closed and only then opens them. Only supported on linux.
+  class HotRestart
+  {
+  public:
+    using callback_type = std::move_only_function<void()>;
+
+    // listen on the path, on_handed_over is called from the context thread once everything is sent
+    static std::expected<std::unique_ptr<HotRestart>, std::string_view> listen(
+        asio::io_context& context, const std::filesystem::path& path, Server& server,
+        callback_type on_handed_over) noexcept;
+
+    // take the server from the process listening on the path, it blocks until the process exits
+    static std::expected<Handoff, std::string_view> take_over(
+        const std::filesystem::path& path) noexcept;
+
+    ~HotRestart() noexcept;
+
+    HotRestart(const HotRestart&) = delete;
+    HotRestart& operator=(const HotRestart&) = delete;
+
+  private:
+    HotRestart(asio::local::stream_protocol::acceptor&& acceptor, std::filesystem::path path,
+               Server& server, callback_type on_handed_over) noexcept;
+
+    asio::awaitable<void> acceptor_handler() noexcept;
+
+  private:
+    asio::local::stream_protocol::acceptor acceptor_;
+    std::filesystem::path path_;
+    Server& server_;
+    callback_type on_handed_over_;
+  };
+} // namespace ar
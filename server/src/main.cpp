@@ -6,7 +6,9 @@
 
 #include "core.h"
 #include "logger.h"
+#include "metrics.h"
 #include "server.h"
+#include "trace.h"
 #include "util/asio.h"
 
 void cli(argparse::ArgumentParser& program, int argc, char* argv[]) noexcept
@@ -16,6 +18,117 @@ void cli(argparse::ArgumentParser& program, int argc, char* argv[]) noexcept
          .help("port of remove server")
          .scan<'u', u16>()
          .default_value(1291_u16);
+  program.add_argument("--cut-through")
+         .help("minimum body bytes of relayed file message to be forwarded while being read, "
+               "0 to disable")
+         .scan<'u', u64>()
+         .default_value(ar::ServerConfig{}.cut_through_threshold);
+  program.add_argument("--relay-window")
+         .help("maximum bytes of relayed body kept in memory per message")
+         .scan<'u', usize>()
+         .default_value(ar::ServerConfig{}.relay_window);
+  program.add_argument("--splice")
+         .help("minimum body bytes of cut-through file message to be spliced between sockets, "
+               "0 to disable")
+         .scan<'u', u64>()
+         .default_value(ar::ServerConfig{}.splice_threshold);
+  program.add_argument("--max-body")
+         .help("maximum body bytes of buffered message, bigger message closes the connection")
+         .scan<'u', u64>()
+         .default_value(ar::ConnectionConfig{}.max_body_size);
+  program.add_argument("--write-queue-limit")
+         .help("bytes queued per connection before the senders relaying into it are paused")
+         .scan<'u', usize>()
+         .default_value(ar::ConnectionConfig{}.write_queue_limit);
+  program.add_argument("--write-budget")
+         .help("maximum bytes of queued messages coalesced into one write")
+         .scan<'u', usize>()
+         .default_value(ar::WriteBudget{}.max_bytes);
+  program.add_argument("--shards")
+         .help("number of single threaded shards, 0 to use one shard per core")
+         .scan<'u', usize>()
+         .default_value(ar::ServerConfig{}.shard_count);
+  program.add_argument("--online-page-size")
+         .help("maximum users per reply of online users")
+         .scan<'u', usize>()
+         .default_value(ar::ServerConfig{}.online_page_size);
+  program.add_argument("--presence-window")
+         .help("milliseconds of logins and logouts coalesced into one presence message")
+         .scan<'u', u64>()
+         .default_value(static_cast<u64>(ar::ServerConfig{}.presence_window.count()));
+  program.add_argument("--data-dir")
+         .help("directory of the persistent user store, users are only kept in memory when empty")
+         .default_value(std::string{});
+  program.add_argument("--spool-dir")
+         .help("directory of file messages waiting for offline or slow users, disabled when empty")
+         .default_value(std::string{});
+  program.add_argument("--spool-threshold")
+         .help("queued bytes of user connection from which the file messages are spooled")
+         .scan<'u', usize>()
+         .default_value(ar::ServerConfig{}.spool_threshold);
+  program.add_argument("--spool-user-limit")
+         .help("bytes on the spool waiting for each user, 0 for no limit")
+         .scan<'u', u64>()
+         .default_value(ar::ServerConfig{}.spool_user_limit);
+  program.add_argument("--spool-limit")
+         .help("bytes on the spool for every user, 0 for no limit")
+         .scan<'u', u64>()
+         .default_value(ar::ServerConfig{}.spool_limit);
+  program.add_argument("--registered-blocks")
+         .help("read blocks registered into each shard, used by io_uring build as fixed buffers")
+         .scan<'u', usize>()
+         .default_value(ar::ServerConfig{}.registered_blocks);
+  program.add_argument("--password-threads")
+         .help("threads hashing and verifying the passwords off the shards")
+         .scan<'u', usize>()
+         .default_value(ar::ServerConfig{}.password_threads);
+  program.add_argument("--handshake-timeout")
+         .help("milliseconds for new connection to store its session key before it is closed")
+         .scan<'u', u64>()
+         .default_value(static_cast<u64>(ar::ConnectionConfig{}.handshake_timeout.count()));
+  program.add_argument("--heartbeat")
+         .help("milliseconds without reading anything from client before it is pinged")
+         .scan<'u', u64>()
+         .default_value(static_cast<u64>(ar::ConnectionConfig{}.heartbeat_interval.count()));
+  program.add_argument("--idle-timeout")
+         .help("milliseconds without reading from or writing to client before it is closed")
+         .scan<'u', u64>()
+         .default_value(static_cast<u64>(ar::ConnectionConfig{}.idle_timeout.count()));
+  program.add_argument("--hot-restart")
+         .help("unix socket path to take the server over from the running process and hand it "
+               "to the next one, disabled when empty")
+         .default_value(std::string{});
+  program.add_argument("--metrics-port")
+         .help("localhost port serving the metrics in prometheus format, 0 to disable")
+         .scan<'u', u16>()
+         .default_value(0_u16);
+  program.add_argument("--latency-log")
+         .help("seconds between logging p50, p99 and p999 latency of each message type, "
+               "0 to disable")
+         .scan<'u', u64>()
+         .default_value(0_u64);
+  program.add_argument("--trace")
+         .help("file to write chrome trace json of the message spans on exit, disabled when empty")
+         .default_value(std::string{});
+  program.add_argument("--trace-events")
+         .help("maximum trace events kept by each thread, the oldest ones are overwritten")
+         .scan<'u', usize>()
+         .default_value(ar::Tracer::DEFAULT_CAPACITY);
+  program.add_argument("--log-file")
+         .help("file to append the logs into instead of stdout")
+         .default_value(std::string{});
+  program.add_argument("--log-buffer")
+         .help("log lines buffered by each thread before they are written by the log thread")
+         .scan<'u', usize>()
+         .default_value(ar::Logger::AsyncConfig{}.capacity);
+  program.add_argument("--log-block")
+         .help("wait for the log thread when the buffer is full instead of dropping the line")
+         .default_value(false)
+         .implicit_value(true);
+  program.add_argument("--nagle")
+         .help("keep Nagle algorithm enabled on client sockets")
+         .default_value(false)
+         .implicit_value(true);
 
   program.parse_args(argc, argv);
 }
@@ -30,13 +143,20 @@ int main(int argc, char* argv[])
     ar::Logger::set_minimum_level(ar::Logger::Level::Info);
   }
 
-  constexpr static usize thread_num = 5;
-  asio::thread_pool context{thread_num};
-
   // CLI
   argparse::ArgumentParser program{std::string{PROGRAM_SERVER_NAME}, std::string{PROGRAM_VERSION}};
   cli(program, argc, argv);
 
+  // the connections log several lines per message, so they are written by another thread
+  auto log_result = ar::Logger::start_async({
+      .path = program.get<std::string>("--log-file"),
+      .capacity = program.get<usize>("--log-buffer"),
+      .overflow = program.get<bool>("--log-block") ? ar::Logger::OverflowPolicy::Block
+                                                   : ar::Logger::OverflowPolicy::Drop,
+  });
+  if (!log_result)
+    ar::Logger::warn(fmt::format("could not start the log thread: {}", log_result.error()));
+
   auto ip_str = program.get<std::string>("-i");
   auto port = program.get<u16>("-p");
 
@@ -45,12 +165,58 @@ int main(int argc, char* argv[])
   if (ec) // exit
     ar::Logger::critical(fmt::format("could not listen to ip: {}", ip_str));
 
+  ar::ServerConfig config{
+      .cut_through_threshold = program.get<u64>("--cut-through"),
+      .relay_window = program.get<usize>("--relay-window"),
+      .splice_threshold = program.get<u64>("--splice"),
+      .shard_count = program.get<usize>("--shards"),
+      .online_page_size = program.get<usize>("--online-page-size"),
+      .presence_window = std::chrono::milliseconds{program.get<u64>("--presence-window")},
+      .data_directory = program.get<std::string>("--data-dir"),
+      .spool_directory = program.get<std::string>("--spool-dir"),
+      .spool_threshold = program.get<usize>("--spool-threshold"),
+      .spool_user_limit = program.get<u64>("--spool-user-limit"),
+      .spool_limit = program.get<u64>("--spool-limit"),
+      .registered_blocks = program.get<usize>("--registered-blocks"),
+      .password_threads = program.get<usize>("--password-threads"),
+      .connection = {
+          .max_body_size = program.get<u64>("--max-body"),
+          .write_queue_limit = program.get<usize>("--write-queue-limit"),
+          .no_delay = !program.get<bool>("--nagle"),
+          .write_budget = {.max_bytes = program.get<usize>("--write-budget")},
+          .handshake_timeout = std::chrono::milliseconds{program.get<u64>("--handshake-timeout")},
+          .heartbeat_interval = std::chrono::milliseconds{program.get<u64>("--heartbeat")},
+          .idle_timeout = std::chrono::milliseconds{program.get<u64>("--idle-timeout")},
+      },
+  };
+
+  // the shard threads should see it enabled
+  std::filesystem::path trace_path{program.get<std::string>("--trace")};
+  if (!trace_path.empty())
+    ar::Tracer::enable(program.get<usize>("--trace-events"));
+
+  // the running server is taken over before the stores are opened, it returns once that process
+  // exits
+  std::filesystem::path hot_restart_path{program.get<std::string>("--hot-restart")};
+  ar::Handoff handoff{};
+  std::error_code fs_ec;
+  if (!hot_restart_path.empty() && std::filesystem::exists(hot_restart_path, fs_ec))
+  {
+    auto result = ar::HotRestart::take_over(hot_restart_path);
+    if (result)
+      handoff = std::move(result.value());
+    else
+      ar::Logger::warn(fmt::format("could not take the server over: {}", result.error()));
+  }
+
   asio::ip::tcp::endpoint ep{ip, port};
-  ar::Server server{context.executor(), ep};
+  ar::Server server{ep, config, std::move(handoff)};
   server.start();
 
+  // the main thread only waits for the signals, each shard runs on its own thread
+  asio::io_context context{1};
   asio::signal_set signals{context, SIGINT, SIGABRT, SIGTERM};
-  signals.async_wait([&context](const asio::error_code& ec, int signal) {
+  signals.async_wait([&server, &context](const asio::error_code& ec, int signal) {
     if (ec)
     {
       ar::Logger::warn(fmt::format("Signal Set Error: {}", ec.message()));
@@ -58,9 +224,46 @@ int main(int argc, char* argv[])
     }
     ar::Logger::warn(fmt::format("Got signal: {}", signal));
     ar::Logger::info("Stopping server!");
+    server.stop();
+    // the hot restart and metrics listeners keep the context running
     context.stop();
   });
 
-  context.join();
+  std::unique_ptr<ar::HotRestart> hot_restart{};
+  if (!hot_restart_path.empty())
+  {
+    auto result = ar::HotRestart::listen(context, hot_restart_path, server, [&server, &context] {
+      ar::Logger::info("Stopping server after handing it over!");
+      server.stop();
+      context.stop();
+    });
+    if (result)
+      hot_restart = std::move(result.value());
+    else
+      ar::Logger::warn(fmt::format("could not listen for hot restart: {}", result.error()));
+  }
+
+  std::unique_ptr<ar::MetricsServer> metrics_server{};
+  if (auto metrics_port = program.get<u16>("--metrics-port"); metrics_port != 0)
+  {
+    auto result = ar::MetricsServer::listen(
+        context, asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), metrics_port});
+    if (result)
+      metrics_server = std::move(result.value());
+    else
+      ar::Logger::warn(fmt::format("could not serve the metrics: {}", result.error()));
+  }
+
+  if (auto latency_log = program.get<u64>("--latency-log"); latency_log != 0)
+    asio::co_spawn(context, ar::log_latency(std::chrono::seconds{latency_log}), asio::detached);
+
+  context.run();
+
+  if (!trace_path.empty())
+  {
+    if (auto result = ar::Tracer::write_chrome_trace(trace_path); !result)
+      ar::Logger::warn(fmt::format("could not write the trace: {}", result.error()));
+  }
+  ar::Logger::stop_async();
   return 0;
 }
\ No newline at end of file
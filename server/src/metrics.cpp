@@ -0,0 +1,309 @@
+#include "metrics.h"
+
+#include <fmt/format.h>
+
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/read_until.hpp>
+#include <asio/steady_timer.hpp>
+#include <asio/this_coro.hpp>
+#include <asio/write.hpp>
+#include <iterator>
+#include <tuple>
+#include <utility>
+
+#include "core.h"
+#include "logger.h"
+#include "trace.h"
+#include "util/asio.h"
+
+namespace ar
+{
+  namespace me = magic_enum;
+
+  namespace
+  {
+    // request bigger than this is dropped
+    constexpr usize MAX_REQUEST_SIZE = 8 * 1024;
+    // the request that is not fully read in it is dropped
+    constexpr std::chrono::seconds REQUEST_TIMEOUT{5};
+
+    void write_family(std::string& out, std::string_view name, std::string_view type,
+                      std::string_view help) noexcept
+    {
+      fmt::format_to(std::back_inserter(out), "# HELP nourton_{} {}\n# TYPE nourton_{} {}\n", name,
+                     help, name, type);
+    }
+
+    template <typename T>
+    void write_value(std::string& out, std::string_view name, const T& value) noexcept
+    {
+      fmt::format_to(std::back_inserter(out), "nourton_{} {}\n", name, value);
+    }
+
+    // one sample per enum value as label
+    template <typename E, usize N, typename F>
+    void write_labeled(std::string& out, std::string_view name, std::string_view label,
+                       const std::array<Counter, N>& counters, F&& transform) noexcept
+    {
+      for (usize i = 0; i < N; ++i)
+      {
+        fmt::format_to(std::back_inserter(out), "nourton_{}{{{}=\"{}\"}} {}\n", name, label,
+                       me::enum_name(static_cast<E>(i)), transform(counters[i].value()));
+      }
+    }
+
+    template <typename E, usize N>
+    void write_labeled(std::string& out, std::string_view name, std::string_view label,
+                       const std::array<Counter, N>& counters) noexcept
+    {
+      write_labeled<E>(out, name, label, counters, [](u64 value) {
+        return value;
+      });
+    }
+
+    constexpr std::array QUANTILES{0.5, 0.99, 0.999};
+
+    // prometheus summary in seconds, the type without record is skipped
+    void write_summary(
+        std::string& out, std::string_view name, std::string_view help,
+        const std::array<Histogram, Metrics::MESSAGE_TYPE_COUNT>& histograms) noexcept
+    {
+      write_family(out, name, "summary", help);
+      for (usize i = 0; i < histograms.size(); ++i)
+      {
+        auto snapshot = histograms[i].snapshot();
+        if (snapshot.count() == 0)
+          continue;
+        auto type = me::enum_name(static_cast<Message::Type>(i));
+        for (auto quantile : QUANTILES)
+        {
+          fmt::format_to(std::back_inserter(out),
+                         "nourton_{}{{type=\"{}\",quantile=\"{}\"}} {}\n", name, type, quantile,
+                         static_cast<double>(snapshot.percentile(quantile)) / 1e9);
+        }
+        fmt::format_to(std::back_inserter(out), "nourton_{}_sum{{type=\"{}\"}} {}\n", name, type,
+                       static_cast<double>(snapshot.sum()) / 1e9);
+        fmt::format_to(std::back_inserter(out), "nourton_{}_count{{type=\"{}\"}} {}\n", name,
+                       type, snapshot.count());
+      }
+    }
+
+    std::string format_latency(const HistogramSnapshot& snapshot) noexcept
+    {
+      auto us = [](u64 nanoseconds) {
+        return static_cast<double>(nanoseconds) / 1e3;
+      };
+      return fmt::format("n={} p50={:.1f}us p99={:.1f}us p999={:.1f}us max={:.1f}us",
+                         snapshot.count(), us(snapshot.percentile(0.5)),
+                         us(snapshot.percentile(0.99)), us(snapshot.percentile(0.999)),
+                         us(snapshot.max()));
+    }
+  } // namespace
+
+  Metrics& Metrics::instance() noexcept
+  {
+    static auto s_instance = new Metrics{};
+    return *s_instance;
+  }
+
+  void Metrics::message_in(const Message::Header& header) noexcept
+  {
+    auto index = static_cast<usize>(std::to_underlying(header.message_type));
+    if (index >= MESSAGE_TYPE_COUNT)
+      return;
+    messages_in_[index].add();
+    bytes_in_[index].add(Message::header_size + header.body_size);
+  }
+
+  void Metrics::message_out(const Message::Header& header) noexcept
+  {
+    auto index = static_cast<usize>(std::to_underlying(header.message_type));
+    if (index >= MESSAGE_TYPE_COUNT)
+      return;
+    messages_out_[index].add();
+    bytes_out_[index].add(Message::header_size + header.body_size);
+  }
+
+  void Metrics::relayed(RelayMode mode, u64 bytes) noexcept
+  {
+    relayed_messages_[std::to_underlying(mode)].add();
+    relayed_bytes_[std::to_underlying(mode)].add(bytes);
+  }
+
+  ScopedTimer Metrics::time_crypto(CryptoOperation operation) noexcept
+  {
+    crypto_operations_[std::to_underlying(operation)].add();
+    return ScopedTimer{crypto_nanoseconds_[std::to_underlying(operation)]};
+  }
+
+  std::optional<HistogramTimer> Metrics::time_handler(Message::Type type) noexcept
+  {
+    auto index = static_cast<usize>(std::to_underlying(type));
+    if (index >= MESSAGE_TYPE_COUNT)
+      return std::nullopt;
+    return std::optional<HistogramTimer>{std::in_place, handler_latency_[index]};
+  }
+
+  void Metrics::queue_wait(Message::Type type, std::chrono::nanoseconds duration) noexcept
+  {
+    auto index = static_cast<usize>(std::to_underlying(type));
+    if (index >= MESSAGE_TYPE_COUNT)
+      return;
+    queue_wait_[index].record(duration);
+  }
+
+  std::vector<std::string> Metrics::latency_report() const noexcept
+  {
+    std::vector<std::string> lines{};
+    for (usize i = 0; i < MESSAGE_TYPE_COUNT; ++i)
+    {
+      auto handler = handler_latency_[i].snapshot();
+      auto queue_wait = queue_wait_[i].snapshot();
+      if (handler.count() == 0 && queue_wait.count() == 0)
+        continue;
+      lines.emplace_back(fmt::format("{}: handler {} | queue wait {}",
+                                     me::enum_name(static_cast<Message::Type>(i)),
+                                     format_latency(handler), format_latency(queue_wait)));
+    }
+    return lines;
+  }
+
+  std::string Metrics::render() const noexcept
+  {
+    std::string out{};
+    write_family(out, "connections", "gauge", "Open client connections.");
+    write_value(out, "connections", connections.value());
+    write_family(out, "authenticated_connections", "gauge", "Connections with logged in user.");
+    write_value(out, "authenticated_connections", authenticated_connections.value());
+    write_family(out, "online_users", "gauge", "Users with at least one logged in connection.");
+    write_value(out, "online_users", online_users.value());
+
+    write_family(out, "messages_in_total", "counter", "Messages read from the clients.");
+    write_labeled<Message::Type>(out, "messages_in_total", "type", messages_in_);
+    write_family(out, "bytes_in_total", "counter", "Message bytes read from the clients.");
+    write_labeled<Message::Type>(out, "bytes_in_total", "type", bytes_in_);
+    write_family(out, "messages_out_total", "counter", "Messages written into the clients.");
+    write_labeled<Message::Type>(out, "messages_out_total", "type", messages_out_);
+    write_family(out, "bytes_out_total", "counter", "Message bytes written into the clients.");
+    write_labeled<Message::Type>(out, "bytes_out_total", "type", bytes_out_);
+
+    write_family(out, "write_queue_messages", "gauge", "Messages waiting in the writers.");
+    write_value(out, "write_queue_messages", write_queue_messages.value());
+    write_family(out, "write_queue_bytes", "gauge", "Bytes kept in memory by the writers.");
+    write_value(out, "write_queue_bytes", write_queue_bytes.value());
+
+    write_family(out, "relayed_messages_total", "counter", "Messages relayed between users.");
+    write_labeled<RelayMode>(out, "relayed_messages_total", "mode", relayed_messages_);
+    write_family(out, "relayed_bytes_total", "counter", "Bytes relayed between users.");
+    write_labeled<RelayMode>(out, "relayed_bytes_total", "mode", relayed_bytes_);
+
+    write_family(out, "crypto_operations_total", "counter", "Encryptions and decryptions.");
+    write_labeled<CryptoOperation>(out, "crypto_operations_total", "operation",
+                                   crypto_operations_);
+    write_family(out, "crypto_seconds_total", "counter",
+                 "Time spent on encryptions and decryptions.");
+    write_labeled<CryptoOperation>(out, "crypto_seconds_total", "operation", crypto_nanoseconds_,
+                                   [](u64 nanoseconds) {
+                                     return static_cast<double>(nanoseconds) / 1e9;
+                                   });
+
+    write_summary(out, "handler_seconds", "Time spent by the handler of each message type.",
+                  handler_latency_);
+    write_summary(out, "queue_wait_seconds",
+                  "Time from queueing the message into the writer until it is written.",
+                  queue_wait_);
+    return out;
+  }
+
+  asio::awaitable<void> log_latency(std::chrono::seconds interval) noexcept
+  {
+    asio::steady_timer timer{co_await asio::this_coro::executor};
+    while (true)
+    {
+      timer.expires_after(interval);
+      auto [ec] = co_await timer.async_wait(ar::await_with_error());
+      if (ec)
+        break;
+      auto lines = Metrics::instance().latency_report();
+      for (const auto& line : lines)
+        Logger::info(fmt::format("latency {}", line));
+    }
+  }
+
+  MetricsServer::MetricsServer(asio::ip::tcp::acceptor&& acceptor) noexcept
+    : acceptor_{std::move(acceptor)}
+  {
+  }
+
+  std::expected<std::unique_ptr<MetricsServer>, std::string_view> MetricsServer::listen(
+      asio::io_context& context, const asio::ip::tcp::endpoint& endpoint) noexcept
+  {
+    asio::ip::tcp::acceptor acceptor{context};
+    asio::error_code ec;
+    acceptor.open(endpoint.protocol(), ec);
+    if (!ec)
+      acceptor.set_option(asio::socket_base::reuse_address{true}, ec);
+    if (!ec)
+      acceptor.bind(endpoint, ec);
+    if (!ec)
+      acceptor.listen(asio::socket_base::max_listen_connections, ec);
+    if (ec)
+      return std::unexpected{"failed to listen on the metrics endpoint"sv};
+
+    std::unique_ptr<MetricsServer> server{new MetricsServer{std::move(acceptor)}};
+    asio::co_spawn(context, [server = server.get()] {
+      return server->acceptor_handler();
+    }, asio::detached);
+    return server;
+  }
+
+  asio::awaitable<void> MetricsServer::acceptor_handler() noexcept
+  {
+    while (true)
+    {
+      auto [ec, socket] = co_await acceptor_.async_accept(ar::await_with_error());
+      if (ec)
+      {
+        if (ec != asio::error::operation_aborted)
+          Logger::warn(fmt::format("error on accepting metrics request: {}", ec.message()));
+        break;
+      }
+      asio::co_spawn(acceptor_.get_executor(), serve(std::move(socket)), asio::detached);
+    }
+  }
+
+  asio::awaitable<void> MetricsServer::serve(asio::ip::tcp::socket accepted) noexcept
+  {
+    // the socket is shared with the deadline, whose handler could run after the request ends
+    auto socket = std::make_shared<asio::ip::tcp::socket>(std::move(accepted));
+    asio::steady_timer deadline{socket->get_executor()};
+    deadline.expires_after(REQUEST_TIMEOUT);
+    deadline.async_wait([socket](asio::error_code ec) {
+      // the pending read fails once the socket is closed
+      if (!ec)
+        socket->close(ec);
+    });
+
+    // the request is only read to its end, every other path gets the metrics
+    std::string request{};
+    auto [ec, n] = co_await asio::async_read_until(
+        *socket, asio::dynamic_buffer(request, MAX_REQUEST_SIZE), "\r\n\r\n",
+        ar::await_with_error());
+    deadline.cancel();
+    if (ec)
+      co_return;
+
+    bool is_trace = Tracer::is_enabled() && request.starts_with("GET /trace ");
+    auto body = is_trace ? Tracer::chrome_trace() : Metrics::instance().render();
+    auto response = fmt::format("HTTP/1.1 200 OK\r\n"
+                                "Content-Type: {}\r\n"
+                                "Content-Length: {}\r\n"
+                                "Connection: close\r\n\r\n{}",
+                                is_trace ? "application/json" : "text/plain; version=0.0.4",
+                                body.size(), body);
+    std::tie(ec, n) = co_await asio::async_write(*socket, asio::buffer(response),
+                                                 ar::await_with_error());
+    socket->shutdown(asio::socket_base::shutdown_both, ec);
+  }
+} // namespace ar
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <magic_enum.hpp>
+
+#include <array>
+#include <asio/awaitable.hpp>
+#include <asio/io_context.hpp>
+#include <asio/ip/tcp.hpp>
+#include <chrono>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "message/message.h"
+#include "util/counter.h"
+#include "util/histogram.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // how the relayed body goes into the opponent
+  enum class RelayMode : u8
+  {
+    Buffered,
+    CutThrough,
+    Splice,
+    Spool,
+  };
+
+  enum class CryptoOperation : u8
+  {
+    Encrypt,
+    Decrypt,
+  };
+
+  // Load of the server process. It is updated from the hot paths of every thread, each update is a
+  // relaxed add on the slot of the thread.
+  class Metrics
+  {
+  public:
+    constexpr static usize MESSAGE_TYPE_COUNT = magic_enum::enum_count<Message::Type>();
+    constexpr static usize RELAY_MODE_COUNT = magic_enum::enum_count<RelayMode>();
+    constexpr static usize CRYPTO_OPERATION_COUNT = magic_enum::enum_count<CryptoOperation>();
+
+    // it is never destroyed, so the connections released on exit could still update it
+    static Metrics& instance() noexcept;
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // the message with unknown type is not counted
+    void message_in(const Message::Header& header) noexcept;
+    void message_out(const Message::Header& header) noexcept;
+
+    void relayed(RelayMode mode, u64 bytes) noexcept;
+
+    // count the operation and add its time when the timer is destroyed
+    [[nodiscard]] ScopedTimer time_crypto(CryptoOperation operation) noexcept;
+
+    // time the handler of the message, nothing is recorded for the unknown type
+    [[nodiscard]] std::optional<HistogramTimer> time_handler(Message::Type type) noexcept;
+    // time from the message being queued into the writer until it is written
+    void queue_wait(Message::Type type, std::chrono::nanoseconds duration) noexcept;
+
+    // prometheus text format
+    [[nodiscard]] std::string render() const noexcept;
+    // p50, p99 and p999 of each message type that has been recorded, one line per type
+    [[nodiscard]] std::vector<std::string> latency_report() const noexcept;
+
+    Gauge connections;
+    Gauge authenticated_connections;
+    // distinct users, the connections of the same user are counted once
+    Gauge online_users;
+    // queued messages and bytes of every connection writer
+    Gauge write_queue_messages;
+    Gauge write_queue_bytes;
+
+  private:
+    Metrics() noexcept = default;
+
+  private:
+    std::array<Counter, MESSAGE_TYPE_COUNT> messages_in_;
+    std::array<Counter, MESSAGE_TYPE_COUNT> bytes_in_;
+    std::array<Counter, MESSAGE_TYPE_COUNT> messages_out_;
+    std::array<Counter, MESSAGE_TYPE_COUNT> bytes_out_;
+    std::array<Counter, RELAY_MODE_COUNT> relayed_messages_;
+    std::array<Counter, RELAY_MODE_COUNT> relayed_bytes_;
+    std::array<Counter, CRYPTO_OPERATION_COUNT> crypto_operations_;
+    std::array<Counter, CRYPTO_OPERATION_COUNT> crypto_nanoseconds_;
+    std::array<Histogram, MESSAGE_TYPE_COUNT> handler_latency_;
+    std::array<Histogram, MESSAGE_TYPE_COUNT> queue_wait_;
+  };
+
+  // log the latency report on every interval, it runs until the context is stopped
+  asio::awaitable<void> log_latency(std::chrono::seconds interval) noexcept;
+
+  // Serves the metrics over plain http, every request gets the metrics whatever its path is except
+  // /trace, which gets the chrome trace when tracing is enabled. There is no authentication, so it
+  // should listen on local address.
+  class MetricsServer
+  {
+  public:
+    static std::expected<std::unique_ptr<MetricsServer>, std::string_view> listen(
+        asio::io_context& context, const asio::ip::tcp::endpoint& endpoint) noexcept;
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+  private:
+    explicit MetricsServer(asio::ip::tcp::acceptor&& acceptor) noexcept;
+
+    asio::awaitable<void> acceptor_handler() noexcept;
+
+    // the socket is closed when the request is not read in a few seconds
+    static asio::awaitable<void> serve(asio::ip::tcp::socket accepted) noexcept;
+
+  private:
+    asio::ip::tcp::acceptor acceptor_;
+  };
+} // namespace ar
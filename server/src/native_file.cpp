@@ -0,0 +1,261 @@
+#include "native_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+#if AR_WINDOWS
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace ar
+{
+  using namespace std::literals;
+
+  MappedView::MappedView(u8* data, usize size, void* mapping) noexcept
+    : data_{data},
+      size_{size},
+      mapping_{mapping}
+  {
+  }
+
+  MappedView::~MappedView() noexcept
+  {
+    unmap();
+  }
+
+  MappedView::MappedView(MappedView&& other) noexcept
+    : data_{std::exchange(other.data_, nullptr)},
+      size_{std::exchange(other.size_, 0)},
+      mapping_{std::exchange(other.mapping_, nullptr)}
+  {
+  }
+
+  MappedView& MappedView::operator=(MappedView&& other) noexcept
+  {
+    if (this == &other)
+      return *this;
+    unmap();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+    return *this;
+  }
+
+  bool MappedView::sync() noexcept
+  {
+    if (!data_)
+      return true;
+#if AR_WINDOWS
+    return FlushViewOfFile(data_, size_);
+#else
+    return ::msync(data_, size_, MS_SYNC) == 0;
+#endif
+  }
+
+  void MappedView::unmap() noexcept
+  {
+    if (!data_)
+      return;
+#if AR_WINDOWS
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+#else
+    ::munmap(data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    mapping_ = nullptr;
+  }
+
+  std::expected<NativeFile, std::string_view> NativeFile::open(const std::filesystem::path& path,
+                                                              bool is_creating) noexcept
+  {
+    NativeFile file{};
+#if AR_WINDOWS
+    auto handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              is_creating ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+      return std::unexpected{"failed to open file"sv};
+    file.handle_ = handle;
+#else
+    auto fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (is_creating ? O_CREAT : 0), 0644);
+    if (fd < 0)
+      return std::unexpected{"failed to open file"sv};
+    file.fd_ = fd;
+#endif
+    return file;
+  }
+
+  NativeFile::~NativeFile() noexcept
+  {
+    close();
+  }
+
+  NativeFile::NativeFile(NativeFile&& other) noexcept
+#if AR_WINDOWS
+    : handle_{std::exchange(other.handle_, nullptr)}
+#else
+    : fd_{std::exchange(other.fd_, -1)}
+#endif
+  {
+  }
+
+  NativeFile& NativeFile::operator=(NativeFile&& other) noexcept
+  {
+    if (this == &other)
+      return *this;
+    close();
+#if AR_WINDOWS
+    handle_ = std::exchange(other.handle_, nullptr);
+#else
+    fd_ = std::exchange(other.fd_, -1);
+#endif
+    return *this;
+  }
+
+  u64 NativeFile::size() const noexcept
+  {
+#if AR_WINDOWS
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(handle_, &size))
+      return 0;
+    return static_cast<u64>(size.QuadPart);
+#else
+    struct stat st{};
+    if (::fstat(fd_, &st) != 0)
+      return 0;
+    return static_cast<u64>(st.st_size);
+#endif
+  }
+
+  bool NativeFile::write(u64 offset, std::span<const u8> bytes) noexcept
+  {
+    while (!bytes.empty())
+    {
+#if AR_WINDOWS
+      OVERLAPPED overlapped{};
+      overlapped.Offset = static_cast<DWORD>(offset);
+      overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD written = 0;
+      auto size = static_cast<DWORD>(std::min<usize>(bytes.size(), 1u << 30));
+      if (!WriteFile(handle_, bytes.data(), size, &written, &overlapped))
+        return false;
+#else
+      auto written = ::pwrite(fd_, bytes.data(), bytes.size(), static_cast<off_t>(offset));
+      if (written < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+#endif
+      offset += static_cast<u64>(written);
+      bytes = bytes.subspan(static_cast<usize>(written));
+    }
+    return true;
+  }
+
+  bool NativeFile::read(u64 offset, std::span<u8> bytes) noexcept
+  {
+    while (!bytes.empty())
+    {
+#if AR_WINDOWS
+      OVERLAPPED overlapped{};
+      overlapped.Offset = static_cast<DWORD>(offset);
+      overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD read = 0;
+      auto size = static_cast<DWORD>(std::min<usize>(bytes.size(), 1u << 30));
+      if (!ReadFile(handle_, bytes.data(), size, &read, &overlapped) || read == 0)
+        return false;
+#else
+      auto read = ::pread(fd_, bytes.data(), bytes.size(), static_cast<off_t>(offset));
+      if (read < 0 && errno == EINTR)
+        continue;
+      if (read <= 0)
+        return false;
+#endif
+      offset += static_cast<u64>(read);
+      bytes = bytes.subspan(static_cast<usize>(read));
+    }
+    return true;
+  }
+
+  bool NativeFile::sync() noexcept
+  {
+#if AR_WINDOWS
+    return FlushFileBuffers(handle_);
+#elif AR_LINUX
+    // the size is part of the data when the file grows, so the appended records are durable
+    return ::fdatasync(fd_) == 0;
+#else
+    return ::fsync(fd_) == 0;
+#endif
+  }
+
+  bool NativeFile::resize(u64 size) noexcept
+  {
+#if AR_WINDOWS
+    FILE_END_OF_FILE_INFO info{};
+    info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    return SetFileInformationByHandle(handle_, FileEndOfFileInfo, &info, sizeof(info));
+#else
+    return ::ftruncate(fd_, static_cast<off_t>(size)) == 0;
+#endif
+  }
+
+  std::expected<MappedView, std::string_view> NativeFile::map(usize size,
+                                                              bool is_writable) noexcept
+  {
+    if (size == 0)
+      return MappedView{};
+#if AR_WINDOWS
+    auto mapping = CreateFileMappingW(handle_, nullptr, is_writable ? PAGE_READWRITE : PAGE_READONLY,
+                                      static_cast<DWORD>(static_cast<u64>(size) >> 32),
+                                      static_cast<DWORD>(size), nullptr);
+    if (!mapping)
+      return std::unexpected{"failed to map file"sv};
+    auto data = MapViewOfFile(mapping, is_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    if (!data)
+    {
+      CloseHandle(mapping);
+      return std::unexpected{"failed to map file"sv};
+    }
+    return MappedView{static_cast<u8*>(data), size, mapping};
+#else
+    auto data = ::mmap(nullptr, size, is_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                       fd_, 0);
+    if (data == MAP_FAILED)
+      return std::unexpected{"failed to map file"sv};
+    return MappedView{static_cast<u8*>(data), size, nullptr};
+#endif
+  }
+
+  NativeFile::native_handle_type NativeFile::native_handle() const noexcept
+  {
+#if AR_WINDOWS
+    return handle_;
+#else
+    return fd_;
+#endif
+  }
+
+  void NativeFile::close() noexcept
+  {
+#if AR_WINDOWS
+    if (handle_)
+      CloseHandle(std::exchange(handle_, nullptr));
+#else
+    if (fd_ >= 0)
+      ::close(std::exchange(fd_, -1));
+#endif
+  }
+} // namespace ar
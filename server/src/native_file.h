@@ -0,0 +1,98 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <string_view>
+
+#include "core.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Memory mapped range of a file, it is unmapped when destroyed
+  class MappedView
+  {
+    friend class NativeFile;
+
+  public:
+    MappedView() noexcept = default;
+    ~MappedView() noexcept;
+
+    MappedView(MappedView&& other) noexcept;
+    MappedView& operator=(MappedView&& other) noexcept;
+
+    MappedView(const MappedView&) = delete;
+    MappedView& operator=(const MappedView&) = delete;
+
+    [[nodiscard]] std::span<u8> bytes() const noexcept
+    {
+      return {data_, size_};
+    }
+
+    // write the modified pages into the file
+    bool sync() noexcept;
+
+  private:
+    MappedView(u8* data, usize size, void* mapping) noexcept;
+
+    void unmap() noexcept;
+
+  private:
+    u8* data_ = nullptr;
+    usize size_ = 0;
+    void* mapping_ = nullptr; // only used on windows
+  };
+
+  // Native file handle for the operations which are not provided by std::fstream, which are
+  // durable sync, resizing and memory mapping. The file is opened for reading and writing, it is
+  // created when it doesn't exist unless is_creating is false.
+  class NativeFile
+  {
+  public:
+#if AR_WINDOWS
+    using native_handle_type = void*;
+#else
+    using native_handle_type = int;
+#endif
+
+    static std::expected<NativeFile, std::string_view> open(const std::filesystem::path& path,
+                                                            bool is_creating = true) noexcept;
+
+    NativeFile() noexcept = default;
+    ~NativeFile() noexcept;
+
+    NativeFile(NativeFile&& other) noexcept;
+    NativeFile& operator=(NativeFile&& other) noexcept;
+
+    NativeFile(const NativeFile&) = delete;
+    NativeFile& operator=(const NativeFile&) = delete;
+
+    [[nodiscard]] u64 size() const noexcept;
+
+    bool write(u64 offset, std::span<const u8> bytes) noexcept;
+
+    // read exactly the size of bytes, it will return false when the file is shorter
+    bool read(u64 offset, std::span<u8> bytes) noexcept;
+
+    // wait until the written bytes are on the disk
+    bool sync() noexcept;
+
+    bool resize(u64 size) noexcept;
+
+    // map the first bytes of the file, the file should be at least as big as the size
+    std::expected<MappedView, std::string_view> map(usize size, bool is_writable) noexcept;
+
+    [[nodiscard]] native_handle_type native_handle() const noexcept;
+
+  private:
+    void close() noexcept;
+
+  private:
+#if AR_WINDOWS
+    void* handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+  };
+} // namespace ar
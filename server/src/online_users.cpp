@@ -0,0 +1,128 @@
+#include "online_users.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "message/payload.h"
+
+namespace ar
+{
+  OnlineUsers::OnlineUsers(const UserLocations& locations, usize page_size) noexcept
+    : locations_{locations},
+      page_size_{std::max(page_size, 1_us)},
+      // start from the current time, so the version seen by client from previous run is unlikely
+      // to be taken as the current one
+      version_{static_cast<u64>(std::chrono::duration_cast<std::chrono::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count()) << 20}
+  {
+  }
+
+  bool OnlineUsers::refresh(const User& user) noexcept
+  {
+    std::unique_lock lock{mutex_};
+    // the locations is read under the lock, so the last refresh always sees the final state even
+    // when the user logs in and out on different shards at once
+    bool is_online = locations_.contains(user.id);
+    if (is_online == users_.contains(user.id))
+      return false;
+
+    if (is_online)
+      users_.emplace(user.id, user.name);
+    else
+      users_.erase(user.id);
+
+    ++version_;
+    changes_.insert_or_assign(user.id, is_online);
+    events_.emplace_back(version_, user.id, is_online);
+    if (events_.size() > MAX_EVENTS)
+      events_.pop_front();
+
+    pages_.clear();
+    deltas_.clear();
+    return true;
+  }
+
+  OnlineUsers::bytes_type OnlineUsers::get(u64 version, User::id_type cursor) noexcept
+  {
+    std::unique_lock lock{mutex_};
+    if (version != 0 && cursor == 0)
+    {
+      if (auto result = delta(version))
+        return result;
+    }
+    return page(cursor);
+  }
+
+  OnlineUsers::bytes_type OnlineUsers::take_changes() noexcept
+  {
+    std::unique_lock lock{mutex_};
+    if (changes_.empty())
+      return nullptr;
+    auto result = serialize_delta(changes_);
+    changes_.clear();
+    return result;
+  }
+
+  u64 OnlineUsers::version() const noexcept
+  {
+    std::unique_lock lock{mutex_};
+    return version_;
+  }
+
+  OnlineUsers::bytes_type OnlineUsers::delta(u64 version) noexcept
+  {
+    // unknown version or the events since it are already dropped
+    if (version > version_)
+      return nullptr;
+    if (version < version_ && (events_.empty() || events_.front().version > version + 1))
+      return nullptr;
+
+    if (auto it = deltas_.find(version); it != deltas_.end())
+      return it->second;
+
+    // only the last event of each user matters
+    std::map<User::id_type, bool> changes;
+    for (auto it = events_.rbegin(); it != events_.rend() && it->version > version; ++it)
+      changes.try_emplace(it->id, it->is_online);
+    if (changes.size() > page_size_)
+      return nullptr;
+
+    auto result = serialize_delta(changes);
+    deltas_.emplace(version, result);
+    return result;
+  }
+
+  OnlineUsers::bytes_type OnlineUsers::page(User::id_type cursor) noexcept
+  {
+    if (auto it = pages_.find(cursor); it != pages_.end())
+      return it->second;
+
+    UserOnlinePayload payload{.version = version_, .is_delta = false, .next_cursor = 0};
+    auto it = users_.lower_bound(cursor);
+    for (; it != users_.end() && payload.users.size() < page_size_; ++it)
+      payload.users.emplace_back(it->first, it->second);
+    if (it != users_.end())
+      payload.next_cursor = it->first;
+
+    auto result = std::make_shared<const std::vector<u8>>(payload.serialize());
+    // client could send any cursor, so only keep as many pages as the snapshot has
+    if (pages_.size() <= users_.size() / page_size_)
+      pages_.emplace(cursor, result);
+    return result;
+  }
+
+  OnlineUsers::bytes_type OnlineUsers::serialize_delta(
+      const std::map<User::id_type, bool>& changes) noexcept
+  {
+    UserOnlinePayload payload{.version = version_, .is_delta = true, .next_cursor = 0};
+    for (const auto& [id, is_online] : changes)
+    {
+      // the changes only keep the last state, which is the current one
+      if (is_online)
+        payload.users.emplace_back(id, users_[id]);
+      else
+        payload.offline_ids.emplace_back(id);
+    }
+    return std::make_shared<const std::vector<u8>>(payload.serialize());
+  }
+} // namespace ar
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shard.h"
+#include "user.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Versioned set of online users which is updated on login and logout instead of being rebuilt on
+  // every request. Replies are serialized UserOnlinePayload which are cached until the set changes,
+  // so the same page or delta is only built once for every client asking it.
+  class OnlineUsers
+  {
+  public:
+    using bytes_type = std::shared_ptr<const std::vector<u8>>;
+
+    // events kept for delta replies, older clients get the full snapshot
+    constexpr static usize MAX_EVENTS = 4096;
+
+    OnlineUsers(const UserLocations& locations, usize page_size) noexcept;
+
+    // update the user state from its locations, it should be called after the user is added into
+    // its first shard or removed from its last one. return true when the state is changed.
+    bool refresh(const User& user) noexcept;
+
+    // reply for client which has seen the set at the version. the delta is replied when it is
+    // still known and smaller than a page, otherwise the page of full snapshot starting from the
+    // cursor is replied.
+    bytes_type get(u64 version, User::id_type cursor) noexcept;
+
+    // delta of every change since the previous call, it will return null when nothing is changed
+    bytes_type take_changes() noexcept;
+
+    [[nodiscard]] u64 version() const noexcept;
+
+  private:
+    struct Event
+    {
+      u64 version;
+      User::id_type id;
+      bool is_online;
+    };
+
+    // the callers should hold the mutex
+    bytes_type delta(u64 version) noexcept;
+    bytes_type page(User::id_type cursor) noexcept;
+    bytes_type serialize_delta(const std::map<User::id_type, bool>& changes) noexcept;
+
+  private:
+    const UserLocations& locations_;
+    usize page_size_;
+
+    mutable std::mutex mutex_;
+    u64 version_;
+    std::map<User::id_type, std::string> users_; // ordered by id for pagination
+    std::deque<Event> events_;
+    // last state of each user changed since the previous take_changes
+    std::map<User::id_type, bool> changes_;
+
+    // cached replies of current version
+    std::unordered_map<User::id_type, bytes_type> pages_;
+    std::unordered_map<u64, bytes_type> deltas_;
+  };
+} // namespace ar
@@ -0,0 +1,51 @@
+#include "password.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "crypto/sha256.h"
+#include "util/algorithm.h"
+
+namespace ar
+{
+  namespace
+  {
+    std::span<const u8> as_bytes(std::string_view str) noexcept
+    {
+      return {reinterpret_cast<const u8*>(str.data()), str.size()};
+    }
+
+    constexpr usize CREDENTIAL_BYTE = sizeof(u32) + PASSWORD_SALT_BYTE + PASSWORD_HASH_BYTE;
+  } // namespace
+
+  std::string hash_password(std::string_view password) noexcept
+  {
+    auto salt = random_bytes<PASSWORD_SALT_BYTE>();
+    auto hash = pbkdf2_sha256(as_bytes(password), salt, PASSWORD_ROUNDS, PASSWORD_HASH_BYTE);
+
+    std::string credential(CREDENTIAL_BYTE, '\0');
+    std::memcpy(credential.data(), &PASSWORD_ROUNDS, sizeof(PASSWORD_ROUNDS));
+    std::ranges::copy(salt, credential.begin() + sizeof(u32));
+    std::ranges::copy(hash, credential.begin() + sizeof(u32) + PASSWORD_SALT_BYTE);
+    return credential;
+  }
+
+  bool verify_password(std::string_view credential, std::string_view password) noexcept
+  {
+    if (credential.size() != CREDENTIAL_BYTE)
+      return false;
+
+    auto bytes = as_bytes(credential);
+    u32 rounds = 0;
+    std::memcpy(&rounds, bytes.data(), sizeof(rounds));
+    if (rounds == 0)
+      return false;
+    auto salt = bytes.subspan(sizeof(u32), PASSWORD_SALT_BYTE);
+    auto expected = bytes.subspan(sizeof(u32) + PASSWORD_SALT_BYTE);
+    auto hash = pbkdf2_sha256(as_bytes(password), salt, rounds, PASSWORD_HASH_BYTE);
+    u8 difference = 0;
+    for (usize i = 0; i < PASSWORD_HASH_BYTE; ++i)
+      difference |= hash[i] ^ expected[i];
+    return difference == 0;
+  }
+} // namespace ar
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "util/types.h"
+
+namespace ar
+{
+  // Passwords are kept as salted PBKDF2-SHA256 credential, the rounds, the random salt and the
+  // hash, so neither the user log nor the memory holds the plain password. The rounds are kept in
+  // the credential, so they could be raised without breaking the stored users. Both functions
+  // take around 100ms, they should not be called on the shard threads.
+  constexpr usize PASSWORD_SALT_BYTE = 16;
+  constexpr usize PASSWORD_HASH_BYTE = 32;
+  constexpr u32 PASSWORD_ROUNDS = 100'000;
+
+  [[nodiscard]] std::string hash_password(std::string_view password) noexcept;
+
+  // the comparison doesn't stop at the first different byte
+  [[nodiscard]] bool verify_password(std::string_view credential,
+                                     std::string_view password) noexcept;
+} // namespace ar
@@ -0,0 +1,367 @@
+#include "relay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <tuple>
+#include <utility>
+
+#include "core.h"
+#include "util/asio.h"
+
+#if AR_LINUX
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+namespace ar
+{
+  RelayStream::RelayStream(asio::any_io_executor executor, u64 body_size, usize consumer_count,
+                           usize window) noexcept
+    : body_size_{body_size},
+      max_pieces_{std::max<usize>(window / PIECE_SIZE, 1)},
+      is_aborted_{false},
+      first_piece_{0},
+      produced_pieces_{0},
+      cursors_(consumer_count, 0),
+      space_signal_{executor}
+  {
+    data_signals_.reserve(consumer_count);
+    for (usize i = 0; i < consumer_count; ++i)
+      data_signals_.emplace_back(std::make_unique<AsyncSignal>(executor));
+  }
+
+  asio::awaitable<bool> RelayStream::push(std::vector<u8>&& piece) noexcept
+  {
+    auto shared_piece = std::make_shared<const std::vector<u8>>(std::move(piece));
+    while (true)
+    {
+      {
+        std::unique_lock l{mutex_};
+        if (std::ranges::all_of(cursors_, [](u64 cursor) { return cursor == DETACHED; }))
+          co_return false;
+
+        if (pieces_.size() < max_pieces_)
+        {
+          pieces_.emplace_back(std::move(shared_piece));
+          ++produced_pieces_;
+          for (const auto& signal : data_signals_)
+            signal->notify();
+          co_return true;
+        }
+      }
+      co_await space_signal_.wait();
+    }
+  }
+
+  void RelayStream::abort() noexcept
+  {
+    std::unique_lock l{mutex_};
+    is_aborted_ = true;
+    for (const auto& signal : data_signals_)
+      signal->notify();
+  }
+
+  asio::awaitable<RelayStream::piece_type> RelayStream::pop(usize consumer) noexcept
+  {
+    while (true)
+    {
+      {
+        std::unique_lock l{mutex_};
+        auto& cursor = cursors_[consumer];
+        if (cursor != DETACHED && cursor < produced_pieces_)
+        {
+          auto piece = pieces_[cursor - first_piece_];
+          ++cursor;
+          trim();
+          co_return piece;
+        }
+        if (is_aborted_ || cursor == DETACHED)
+          co_return nullptr;
+      }
+      co_await data_signals_[consumer]->wait();
+    }
+  }
+
+  void RelayStream::detach(usize consumer) noexcept
+  {
+    std::unique_lock l{mutex_};
+    cursors_[consumer] = DETACHED;
+    trim();
+  }
+
+  u64 RelayStream::body_size() const noexcept
+  {
+    return body_size_;
+  }
+
+  void RelayStream::trim() noexcept
+  {
+    // drop pieces that are already consumed by all the consumers
+    auto min_cursor = std::ranges::min(cursors_);
+    if (min_cursor == DETACHED)
+      min_cursor = produced_pieces_;
+
+    bool is_trimmed = false;
+    while (first_piece_ < min_cursor && !pieces_.empty())
+    {
+      pieces_.pop_front();
+      ++first_piece_;
+      is_trimmed = true;
+    }
+
+    if (is_trimmed)
+      space_signal_.notify();
+  }
+
+  RelayConsumer::RelayConsumer(std::shared_ptr<RelayStream> stream, usize index) noexcept
+    : stream_{std::move(stream)}, index_{index}
+  {
+  }
+
+  RelayConsumer::~RelayConsumer() noexcept
+  {
+    if (stream_)
+      stream_->detach(index_);
+  }
+
+  RelayConsumer::RelayConsumer(RelayConsumer&& other) noexcept
+    : stream_{std::move(other.stream_)}, index_{other.index_}
+  {
+  }
+
+  RelayConsumer& RelayConsumer::operator=(RelayConsumer&& other) noexcept
+  {
+    if (this == &other)
+      return *this;
+    if (stream_)
+      stream_->detach(index_);
+    stream_ = std::move(other.stream_);
+    index_ = other.index_;
+    return *this;
+  }
+
+  asio::awaitable<RelayStream::piece_type> RelayConsumer::next() noexcept
+  {
+    return stream_->pop(index_);
+  }
+
+  u64 RelayConsumer::size() const noexcept
+  {
+    return stream_ ? stream_->body_size() : 0;
+  }
+
+  SpliceRelay::SpliceRelay(asio::ip::tcp::socket& source, u64 body_size, std::array<int, 2> pipe,
+                           usize pipe_size) noexcept
+    : source_{source},
+      body_size_{body_size},
+      pipe_{pipe},
+      pipe_size_{pipe_size},
+      moved_{0},
+      is_source_failed_{false},
+      is_done_{false},
+      done_signal_{source.get_executor()}
+  {
+  }
+
+  std::shared_ptr<SpliceRelay> SpliceRelay::make([[maybe_unused]] asio::ip::tcp::socket& source,
+                                                 [[maybe_unused]] u64 body_size) noexcept
+  {
+#if AR_LINUX
+    std::array<int, 2> pipe{};
+    if (::pipe2(pipe.data(), O_NONBLOCK | O_CLOEXEC) != 0)
+      return nullptr;
+    // bigger pipe takes more bytes per splice, keep the default size when it is refused
+    auto pipe_size = ::fcntl(pipe[1], F_SETPIPE_SZ, static_cast<int>(RelayStream::PIECE_SIZE * 4));
+    if (pipe_size <= 0)
+      pipe_size = ::fcntl(pipe[1], F_GETPIPE_SZ);
+    return std::shared_ptr<SpliceRelay>{
+        new SpliceRelay{source, body_size, pipe, static_cast<usize>(std::max(pipe_size, 4096))}};
+#else
+    return nullptr;
+#endif
+  }
+
+  SpliceRelay::~SpliceRelay() noexcept
+  {
+#if AR_LINUX
+    ::close(pipe_[0]);
+    ::close(pipe_[1]);
+#endif
+  }
+
+  void SpliceRelay::prefix(std::vector<u8>&& bytes) noexcept
+  {
+    prefix_ = std::move(bytes);
+  }
+
+  std::span<const u8> SpliceRelay::prefix() const noexcept
+  {
+    return prefix_;
+  }
+
+  asio::awaitable<asio::error_code> SpliceRelay::transfer(
+      [[maybe_unused]] asio::ip::tcp::socket& destination, [[maybe_unused]] u64& written) noexcept
+  {
+    asio::error_code ec{};
+#if AR_LINUX
+    // the sockets are driven directly, asio only waits for their readiness
+    source_.native_non_blocking(true, ec);
+    if (ec)
+      is_source_failed_ = true;
+    destination.native_non_blocking(true, ec);
+    if (ec)
+    {
+      finish();
+      co_return ec;
+    }
+
+    constexpr static auto flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    u64 remaining = body_size_ - prefix_.size();
+    usize in_pipe = 0;
+    while ((remaining > 0 && !is_source_failed_) || in_pipe > 0)
+    {
+      if (remaining > 0 && !is_source_failed_)
+      {
+        auto n = ::splice(source_.native_handle(), nullptr, pipe_[1], nullptr,
+                          std::min<u64>(remaining, pipe_size_), flags);
+        if (n > 0)
+        {
+          remaining -= n;
+          moved_ += n;
+          in_pipe += n;
+          continue;
+        }
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && errno == EAGAIN)
+        {
+          // the socket is empty when the pipe is, otherwise send what the pipe has first
+          if (in_pipe == 0)
+          {
+            auto [wait_ec] = co_await source_.async_wait(asio::socket_base::wait_read,
+                                                         ar::await_with_error());
+            if (wait_ec)
+              is_source_failed_ = true;
+            continue;
+          }
+        }
+        else
+          is_source_failed_ = true;
+      }
+
+      if (in_pipe == 0)
+        continue;
+      auto n = ::splice(pipe_[0], nullptr, destination.native_handle(), nullptr, in_pipe, flags);
+      if (n > 0)
+      {
+        in_pipe -= n;
+        written += n;
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && errno == EAGAIN)
+      {
+        std::tie(ec) = co_await destination.async_wait(asio::socket_base::wait_write,
+                                                       ar::await_with_error());
+        if (!ec)
+          continue;
+      }
+      else
+        ec = asio::error_code{n < 0 ? errno : EPIPE, asio::system_category()};
+      finish();
+      co_return ec;
+    }
+
+    // the sender is gone, fill the rest of body with zeros to keep the message boundary
+    if (remaining > 0)
+    {
+      std::vector<u8> zeros(std::min<u64>(remaining, RelayStream::PIECE_SIZE));
+      while (!ec && remaining > 0)
+      {
+        auto size = std::min<u64>(remaining, zeros.size());
+        usize n;
+        std::tie(ec, n) = co_await asio::async_write(destination, asio::buffer(zeros.data(), size),
+                                                     ar::await_with_error());
+        remaining -= n;
+        written += n;
+      }
+    }
+#else
+    ec = asio::error::operation_not_supported;
+#endif
+    finish();
+    co_return ec;
+  }
+
+  void SpliceRelay::detach() noexcept
+  {
+    finish();
+  }
+
+  asio::awaitable<std::optional<u64>> SpliceRelay::wait() noexcept
+  {
+    while (!is_done_)
+    {
+      if (!co_await done_signal_.wait())
+        break;
+    }
+    if (is_source_failed_)
+      co_return std::nullopt;
+    co_return body_size_ - prefix_.size() - moved_;
+  }
+
+  u64 SpliceRelay::body_size() const noexcept
+  {
+    return body_size_;
+  }
+
+  void SpliceRelay::finish() noexcept
+  {
+    if (std::exchange(is_done_, true))
+      return;
+    done_signal_.notify();
+  }
+
+  SpliceConsumer::SpliceConsumer(std::shared_ptr<SpliceRelay> relay) noexcept
+    : relay_{std::move(relay)}
+  {
+  }
+
+  SpliceConsumer::~SpliceConsumer() noexcept
+  {
+    if (relay_)
+      relay_->detach();
+  }
+
+  SpliceConsumer::SpliceConsumer(SpliceConsumer&& other) noexcept
+    : relay_{std::move(other.relay_)}
+  {
+  }
+
+  SpliceConsumer& SpliceConsumer::operator=(SpliceConsumer&& other) noexcept
+  {
+    if (this == &other)
+      return *this;
+    if (relay_)
+      relay_->detach();
+    relay_ = std::move(other.relay_);
+    return *this;
+  }
+
+  std::span<const u8> SpliceConsumer::prefix() const noexcept
+  {
+    return relay_->prefix();
+  }
+
+  asio::awaitable<asio::error_code> SpliceConsumer::transfer(asio::ip::tcp::socket& destination,
+                                                             u64& written) noexcept
+  {
+    return relay_->transfer(destination, written);
+  }
+
+  u64 SpliceConsumer::size() const noexcept
+  {
+    return relay_ ? relay_->body_size() : 0;
+  }
+} // namespace ar
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <asio/any_io_executor.hpp>
+#include <array>
+#include <asio/awaitable.hpp>
+#include <asio/ip/tcp.hpp>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <variant>
+#include <vector>
+
+#include "message/message.h"
+#include "util/async_signal.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Body of message that is forwarded into the opponent connections while it is still being read
+  // from the sender socket (cut-through). The sender reader pushes the body piece by piece and each
+  // opponent writer consumes it with its own cursor, only `window` bytes are kept in memory and the
+  // reader waits until the slowest opponent catches up.
+  class RelayStream
+  {
+  public:
+    using piece_type = std::shared_ptr<const std::vector<u8>>;
+
+    constexpr static usize PIECE_SIZE = 64 * 1024;
+
+    RelayStream(asio::any_io_executor executor, u64 body_size, usize consumer_count,
+                usize window) noexcept;
+
+    // push next piece of body, it will wait while the window is full. return false when there is no
+    // consumer left, the caller should still read and drop the body.
+    asio::awaitable<bool> push(std::vector<u8>&& piece) noexcept;
+
+    // the sender failed to deliver the whole body
+    void abort() noexcept;
+
+    // get the next piece for the consumer, it will return nullptr when the stream is aborted
+    asio::awaitable<piece_type> pop(usize consumer) noexcept;
+
+    // consumer will no longer read the stream
+    void detach(usize consumer) noexcept;
+
+    [[nodiscard]] u64 body_size() const noexcept;
+
+  private:
+    void trim() noexcept;
+
+  private:
+    constexpr static u64 DETACHED = std::numeric_limits<u64>::max();
+
+    u64 body_size_;
+    usize max_pieces_;
+
+    std::mutex mutex_;
+    bool is_aborted_;
+    std::deque<piece_type> pieces_;
+    u64 first_piece_; // index of pieces_.front()
+    u64 produced_pieces_;
+    std::vector<u64> cursors_; // next piece index of each consumer
+
+    AsyncSignal space_signal_;
+    std::vector<std::unique_ptr<AsyncSignal>> data_signals_;
+  };
+
+  // Consumer handle of RelayStream, it will detach itself from the stream when destroyed
+  class RelayConsumer
+  {
+  public:
+    RelayConsumer(std::shared_ptr<RelayStream> stream, usize index) noexcept;
+    ~RelayConsumer() noexcept;
+
+    RelayConsumer(const RelayConsumer&) = delete;
+    RelayConsumer& operator=(const RelayConsumer&) = delete;
+
+    RelayConsumer(RelayConsumer&& other) noexcept;
+    RelayConsumer& operator=(RelayConsumer&& other) noexcept;
+
+    asio::awaitable<RelayStream::piece_type> next() noexcept;
+
+    [[nodiscard]] u64 size() const noexcept;
+
+  private:
+    std::shared_ptr<RelayStream> stream_;
+    usize index_;
+  };
+
+  // Message which body is relayed from another connection
+  struct RelayMessage
+  {
+    std::array<u8, Message::header_size> header;
+    RelayConsumer body;
+
+    [[nodiscard]] Message::Header const* as_header() const noexcept
+    {
+      return reinterpret_cast<Message::Header const*>(header.data());
+    }
+
+    [[nodiscard]] usize size() const noexcept
+    {
+      return Message::header_size + body.size();
+    }
+  };
+
+  // Body moved from the sender socket into the opponent socket by the kernel through a pipe, so it
+  // is never copied into user space. The opponent writer moves it when the message is at the front
+  // of its queue while the sender reader waits, so both connections should be on the same thread.
+  class SpliceRelay
+  {
+  public:
+    // return null when splice is not supported or the pipe could not be created
+    static std::shared_ptr<SpliceRelay> make(asio::ip::tcp::socket& source, u64 body_size)
+    noexcept;
+
+    ~SpliceRelay() noexcept;
+
+    SpliceRelay(const SpliceRelay&) = delete;
+    SpliceRelay& operator=(const SpliceRelay&) = delete;
+
+    // body bytes already read by the sender, it should be set before the sender waits
+    void prefix(std::vector<u8>&& bytes) noexcept;
+
+    [[nodiscard]] std::span<const u8> prefix() const noexcept;
+
+    // move the rest of body into destination after the prefix is written. the rest is filled with
+    // zeros when the sender fails, return the error of destination. The bytes written into the
+    // destination are added into written as they are moved.
+    asio::awaitable<asio::error_code> transfer(asio::ip::tcp::socket& destination,
+                                               u64& written) noexcept;
+
+    // the opponent will not take the body
+    void detach() noexcept;
+
+    // wait until the body is moved or the opponent is detached. return the body bytes that are
+    // left on the sender socket, null when the sender failed
+    asio::awaitable<std::optional<u64>> wait() noexcept;
+
+    [[nodiscard]] u64 body_size() const noexcept;
+
+  private:
+    SpliceRelay(asio::ip::tcp::socket& source, u64 body_size, std::array<int, 2> pipe,
+                usize pipe_size) noexcept;
+
+    void finish() noexcept;
+
+  private:
+    asio::ip::tcp::socket& source_;
+    u64 body_size_;
+    std::array<int, 2> pipe_; // read and write end
+    usize pipe_size_;
+
+    std::vector<u8> prefix_;
+    u64 moved_; // body bytes taken from the sender socket
+    bool is_source_failed_;
+    bool is_done_;
+    AsyncSignal done_signal_;
+  };
+
+  // Consumer handle of SpliceRelay, it will detach itself from the relay when destroyed
+  class SpliceConsumer
+  {
+  public:
+    explicit SpliceConsumer(std::shared_ptr<SpliceRelay> relay) noexcept;
+    ~SpliceConsumer() noexcept;
+
+    SpliceConsumer(const SpliceConsumer&) = delete;
+    SpliceConsumer& operator=(const SpliceConsumer&) = delete;
+
+    SpliceConsumer(SpliceConsumer&& other) noexcept;
+    SpliceConsumer& operator=(SpliceConsumer&& other) noexcept;
+
+    [[nodiscard]] std::span<const u8> prefix() const noexcept;
+
+    asio::awaitable<asio::error_code> transfer(asio::ip::tcp::socket& destination,
+                                               u64& written) noexcept;
+
+    [[nodiscard]] u64 size() const noexcept;
+
+  private:
+    std::shared_ptr<SpliceRelay> relay_;
+  };
+
+  // Message which body is spliced from another connection
+  struct SpliceMessage
+  {
+    std::array<u8, Message::header_size> header;
+    SpliceConsumer body;
+  };
+
+  // where the body is forwarded while it is being read, monostate to buffer the body
+  using relay_target_type =
+      std::variant<std::monostate, std::shared_ptr<RelayStream>, std::shared_ptr<SpliceRelay>>;
+} // namespace ar
@@ -8,40 +8,301 @@
 
 #include <asio/bind_executor.hpp>
 #include <asio/placeholders.hpp>
+#include <asio/post.hpp>
+#include <asio/steady_timer.hpp>
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <mutex>
 #include <magic_enum.hpp>
 
 #include "core.h"
 #include "logger.h"
 #include "message/payload.h"
+#include "message/view.h"
+#include "password.h"
 #include "user.h"
 
 namespace ar
 {
   namespace me = magic_enum;
 
-  Server::Server(asio::any_io_executor executor, const asio::ip::address& address,
-                 asio::ip::port_type port)
-    : Server(std::move(executor), asio::ip::tcp::endpoint{address, port})
+  namespace
   {
+    std::unique_ptr<UserStore> open_user_store(const std::filesystem::path& directory) noexcept
+    {
+      if (directory.empty())
+        return nullptr;
+
+      auto store = UserStore::open(directory);
+      if (!store)
+        Logger::critical(fmt::format("could not open user store on {}: {}", directory.string(),
+                                     store.error()));
+      return std::move(store.value());
+    }
+
+    std::unique_ptr<Spool> open_spool(const std::filesystem::path& directory,
+                                      SpoolLimits limits) noexcept
+    {
+      if (directory.empty())
+        return nullptr;
+
+      auto spool = Spool::open(directory, limits);
+      if (!spool)
+        Logger::critical(fmt::format("could not open spool on {}: {}", directory.string(),
+                                     spool.error()));
+      return std::move(spool.value());
+    }
+
+    // the transfer id is the first field of every streamed payload
+    std::optional<Spool::TransferKey> transfer_key_of(const Connection& conn,
+                                                      const Message& msg) noexcept
+    {
+      PayloadReader reader{{msg.body.data(), msg.body.size()}};
+      SendFileBeginPayload::transfer_id_type transfer_id{};
+      if (!reader.read(transfer_id))
+        return std::nullopt;
+      return Spool::TransferKey{.user_id = msg.as_header()->opponent_id,
+                                .connection_id = conn.id(),
+                                .transfer_id = transfer_id};
+    }
+
+    // only the quota is worth telling the sender, the other failures are internal
+    std::string_view spool_feedback(std::string_view error) noexcept
+    {
+      return error == SPOOL_QUOTA_EXCEEDED ? SPOOL_QUOTA_EXCEEDED : SPOOL_FAILED;
+    }
+  } // namespace
+
+  Server::Server(const asio::ip::address& address, asio::ip::port_type port, ServerConfig config)
+    : Server(asio::ip::tcp::endpoint{address, port}, config)
+  {
+  }
+
+  Server::Server(const asio::ip::tcp::endpoint& endpoint, ServerConfig config, Handoff handoff)
+    : config_{config},
+      spool_{open_spool(config_.spool_directory,
+                        {.user_bytes = config_.spool_user_limit,
+                         .total_bytes = config_.spool_limit})},
+      is_reuse_port_{Shard::is_reuse_port_supported()},
+      next_shard_{0},
+      online_users_{user_locations_, config_.online_page_size},
+      is_presence_pending_{false},
+      user_store_{open_user_store(config_.data_directory)},
+      users_{user_store_.get()},
+      password_pool_{std::max<usize>(config_.password_threads, 1)},
+      server_details_{.id = User::SERVER_ID,
+                      .public_key = ar::serialize(asymm_encryptor_.public_key())},
+      is_started_{false}
+  {
+    auto shard_count = config_.shard_count;
+    if (shard_count == 0)
+      shard_count = std::max(std::thread::hardware_concurrency(), 1u);
+    shard_count = std::min(shard_count, Shard::MAX_COUNT);
+
+    for (usize i = 0; i < shard_count; ++i)
+    {
+      auto& shard = shards_.emplace_back(std::make_unique<Shard>(static_cast<Shard::id_type>(i),
+                                                                config_.registered_blocks));
+      // the connections queued on the listening socket of the old process are accepted too
+      if (i < handoff.listeners.size())
+      {
+        if (auto ec = shard->adopt(endpoint.protocol(), handoff.listeners[i]))
+          Logger::critical(fmt::format("shard-{} could not take the listening socket over: {}", i,
+                                       ec.message()));
+        continue;
+      }
+      // without reuse port the first shard accepts the connections of every shard
+      if (i != 0 && !is_reuse_port_)
+        continue;
+
+      if (auto ec = shard->listen(endpoint, is_reuse_port_))
+        Logger::critical(fmt::format("shard-{} could not listen to {}:{}: {}", i,
+                                     endpoint.address().to_string(), endpoint.port(),
+                                     ec.message()));
+    }
+
+    // the connections queued on them are lost, the kernel stops routing into them once closed
+    if (handoff.listeners.size() > shard_count)
+      Logger::warn(fmt::format("closing {} listening sockets of the old process, there are only {} "
+                               "shards", handoff.listeners.size() - shard_count, shard_count));
+    for (usize i = shard_count; i < handoff.listeners.size(); ++i)
+    {
+      asio::ip::tcp::acceptor acceptor{shards_.front()->context()};
+      asio::error_code ec;
+      acceptor.assign(endpoint.protocol(), handoff.listeners[i], ec);
+    }
+
+    // started once the shards run
+    for (usize i = 0; i < handoff.connections.size(); ++i)
+    {
+      auto& shard = *shards_[i % shards_.size()];
+      shard.post([this, &shard, protocol = endpoint.protocol(),
+                  conn = std::move(handoff.connections[i])]() mutable {
+        adopt_connection(shard, protocol, std::move(conn));
+      });
+    }
   }
 
-  Server::Server(asio::any_io_executor executor, const asio::ip::tcp::endpoint& endpoint)
-    : executor_{std::move(executor)},
-      strand_{executor_},
-      acceptor_{executor_, endpoint},
-      user_id_generator_{1}
+  Server::~Server() noexcept
   {
+    stop();
+    threads_.clear();
+    // the passwords in progress are dropped, their connections are already closed
+    password_pool_.stop();
+    password_pool_.join();
+    // the spool callbacks post into the shards, so the writer is stopped while they are alive
+    if (spool_)
+      spool_->close();
+    // the pending commits call back into the registry from the writer thread, so the store is
+    // closed while the registry is still alive
+    user_store_.reset();
   }
 
   void Server::start() noexcept
   {
-    Logger::info(fmt::format("server accepting connection from {}: {}",
-                             acceptor_.local_endpoint().address().to_string(),
-                             acceptor_.local_endpoint().port()));
+    auto& acceptor = shards_.front()->acceptor();
+    Logger::info(fmt::format("server accepting connection from {}: {} on {} shards",
+                             acceptor.local_endpoint().address().to_string(),
+                             acceptor.local_endpoint().port(), shards_.size()));
 
-    asio::co_spawn(strand_, [this] {
-      return connection_acceptor();
-    }, asio::detached);
+    for (auto& shard : shards_)
+    {
+      if (shard->is_listening())
+      {
+        asio::co_spawn(shard->context(), [this, &shard = *shard] {
+          return connection_acceptor(shard);
+        }, asio::detached);
+      }
+      threads_.emplace_back([this, &shard = *shard] {
+        // the thread names are not synchronized, so wait until every shard thread is named
+        is_started_.wait(false);
+        shard.run();
+      });
+      Logger::set_thread_name(fmt::format("SHARD-{}", shard->id()), threads_.back().get_id());
+    }
+    is_started_.store(true);
+    is_started_.notify_all();
+  }
+
+  void Server::stop() noexcept
+  {
+    for (auto& shard : shards_)
+      shard->stop();
+  }
+
+  void Server::hand_over(handoff_callback_type on_released) noexcept
+  {
+    struct Pending
+    {
+      std::mutex mutex;
+      Handoff handoff;
+      usize remaining;
+      handoff_callback_type on_released;
+    };
+
+    auto pending = std::make_shared<Pending>();
+    pending->remaining = shards_.size();
+    pending->on_released = std::move(on_released);
+    Logger::info(fmt::format("handing {} shards over", shards_.size()));
+
+    // the connection relays into the other shards, so every reader is stopped before any shard
+    // detaches its connections. Otherwise the messages for the users of the detached shard are
+    // dropped while they are still online. The messages posted before the barrier are handled
+    // before the release, as it is posted after them.
+    auto release = [this, pending](Shard& shard) {
+      asio::co_spawn(shard.context(), [this, &shard] {
+        return release_shard(shard);
+      }, [pending](std::exception_ptr, Handoff handoff) {
+        std::unique_lock l{pending->mutex};
+        std::ranges::move(handoff.connections, std::back_inserter(pending->handoff.connections));
+        if (--pending->remaining != 0)
+          return;
+        l.unlock();
+        pending->on_released(std::move(pending->handoff));
+      });
+    };
+    for_each_shard([this, pending, release](Shard& shard) {
+      asio::co_spawn(shard.context(), [this, &shard] {
+        return stop_shard(shard);
+      }, [this, pending, release](std::exception_ptr, Handoff handoff) {
+        std::unique_lock l{pending->mutex};
+        std::ranges::move(handoff.listeners, std::back_inserter(pending->handoff.listeners));
+        if (--pending->remaining != 0)
+          return;
+        pending->remaining = shards_.size();
+        l.unlock();
+        Logger::info("every shard stopped reading, releasing the connections");
+        for_each_shard(release);
+      });
+    });
+  }
+
+  asio::awaitable<Handoff> Server::stop_shard(Shard& shard) noexcept
+  {
+    Handoff handoff{};
+    // the listening socket is kept open, so the new connections wait in its backlog
+    if (shard.is_listening())
+    {
+      asio::error_code ec;
+      auto listener = shard.acceptor().release(ec);
+      if (ec)
+        Logger::warn(fmt::format("shard-{} could not release its listening socket: {}",
+                                 shard.id(), ec.message()));
+      else
+        handoff.listeners.emplace_back(listener);
+    }
+
+    // the readers are stopped together, so the slow ones share a single DETACH_TIMEOUT
+    std::vector<std::shared_ptr<Connection>> connections{};
+    for (const auto& conn : shard.connections())
+      connections.emplace_back(conn);
+    usize remaining = connections.size();
+    AsyncSignal stopped{shard.context().get_executor()};
+    for (auto& conn : connections)
+    {
+      asio::co_spawn(shard.context(), conn->wait_reader_stopped(),
+                     [&, conn](std::exception_ptr) {
+                       if (--remaining == 0)
+                         stopped.notify();
+                     });
+    }
+    if (remaining != 0)
+      co_await stopped.wait();
+    co_return handoff;
+  }
+
+  asio::awaitable<Handoff> Server::release_shard(Shard& shard) noexcept
+  {
+    Handoff handoff{};
+    // the readers are already stopped by stop_shard, so the connections no longer produce
+    // messages for each other while they are drained
+    std::vector<std::shared_ptr<Connection>> connections{};
+    for (const auto& conn : shard.connections())
+      connections.emplace_back(conn);
+
+    // the connections are drained together, so the slow ones share a single DETACH_TIMEOUT
+    // instead of waiting for each other
+    usize remaining = connections.size();
+    AsyncSignal detached{shard.context().get_executor()};
+    for (auto& conn : connections)
+    {
+      asio::co_spawn(shard.context(), conn->detach(),
+                     [&, conn](std::exception_ptr, std::optional<HandoffConnection> released) {
+                       // the users are not reported offline, the new process takes them over
+                       shard.remove_connection(*conn);
+                       if (released)
+                         handoff.connections.emplace_back(std::move(released.value()));
+                       if (--remaining == 0)
+                         detached.notify();
+                     });
+    }
+    if (remaining != 0)
+      co_await detached.wait();
+    shard.user_connections().clear();
+    Logger::info(fmt::format("shard-{} released {} of {} connections", shard.id(),
+                             handoff.connections.size(), connections.size()));
+    co_return handoff;
   }
 
   void Server::on_message_in(Connection& conn, const Message& msg) noexcept
@@ -49,6 +310,9 @@ namespace ar
     auto header = msg.as_header();
     Logger::trace(fmt::format("Connection-{} got {} message", conn.id(),
                               me::enum_name(header->message_type)));
+    Metrics::instance().message_in(*header);
+    auto timer = Metrics::instance().time_handler(header->message_type);
+    TraceSpan span{"handle"sv, conn.id(), header->message_type};
 
     switch (header->message_type)
     {
@@ -87,61 +351,293 @@ namespace ar
       send_file_handler(conn, msg);
       break;
     }
+    case Message::Type::SendFileBegin:
+    case Message::Type::SendFileChunk:
+    case Message::Type::SendFileEnd: {
+      // Relayed without being decrypted
+      send_file_stream_handler(conn, msg);
+      break;
+    }
     }
   }
 
-  void Server::on_message_out(Connection& conn, std::span<const u8> bytes) noexcept
+  relay_target_type Server::on_relay_in(Connection& conn, const Message::Header& header) noexcept
   {
-    Logger::trace(fmt::format("new message out to connection-{}", conn.id()));
+    if (config_.cut_through_threshold == 0 || header.body_size < config_.cut_through_threshold)
+      return {};
+
+    // only end-to-end encrypted file messages can be forwarded without being inspected
+    if (header.message_type != Message::Type::SendFile &&
+        header.message_type != Message::Type::SendFileChunk)
+      return {};
+
+    // let the regular handler send the failure feedback
+    if (!conn.is_authenticated() || header.encryption != Message::EncryptionType::None)
+      return {};
+
+    // the consumers are only known on the opponent shards, so the message is only forwarded
+    // while being read when every opponent connection is on this shard
+    auto& shard = *Shard::current();
+    if (user_locations_.get(header.opponent_id) != shard.mask())
+      return {};
+
+    auto it = shard.user_connections().find(header.opponent_id);
+    if (it == shard.user_connections().end())
+      return {};
+
+    std::vector<std::shared_ptr<Connection>> destinations{};
+    for (auto handle : it->second)
+    {
+      if (auto dest = shard.find_connection(handle))
+        destinations.emplace_back(std::move(dest));
+    }
+    // the relay is queued on each destination one by one, so two senders to the same devices
+    // could each wait on a destination the other is holding. Several devices are buffered.
+    if (destinations.size() != 1)
+      return {};
+
+    // change the opponent id into sender id
+    auto relay_header = header;
+    relay_header.opponent_id = conn.user()->id;
+
+    // the kernel moves the body when the opponent connection keeps up, otherwise it goes through
+    // the relay stream so the sender is not bound to the socket
+    auto& dest = destinations.front();
+    if (config_.splice_threshold != 0 &&
+        header.body_size >= config_.splice_threshold && dest->is_writable())
+    {
+      if (auto relay = SpliceRelay::make(conn.socket(), header.body_size))
+      {
+        Logger::info(fmt::format("User-{}[{}] splicing {} bytes {} message to user with id {}",
+                                 conn.user()->name, conn.id(), header.body_size,
+                                 me::enum_name(header.message_type), header.opponent_id));
+        TraceSpan span{"relay"sv, dest->id(), header.message_type, conn.id()};
+        SpliceMessage splice_msg{.header = {}, .body = SpliceConsumer{relay}};
+        std::memcpy(splice_msg.header.data(), &relay_header, Message::header_size);
+        dest->write(std::move(splice_msg));
+        Metrics::instance().message_in(header);
+        Metrics::instance().relayed(RelayMode::Splice, Message::header_size + header.body_size);
+
+        if (header.message_type == Message::Type::SendFile)
+          send_feedback<true, FeedbackId::SendFile>(conn.symmetric_encryptor(), conn);
+        return relay;
+      }
+    }
+
+    Logger::info(fmt::format("User-{}[{}] relaying {} bytes {} message to user with id {}",
+                             conn.user()->name, conn.id(), header.body_size,
+                             me::enum_name(header.message_type), header.opponent_id));
+
+    auto stream = std::make_shared<RelayStream>(conn.socket().get_executor(), header.body_size,
+                                                destinations.size(), config_.relay_window);
+
+    for (usize i = 0; i < destinations.size(); ++i)
+    {
+      TraceSpan span{"relay"sv, destinations[i]->id(), header.message_type, conn.id()};
+      RelayMessage relay_msg{.header = {}, .body = RelayConsumer{stream, i}};
+      std::memcpy(relay_msg.header.data(), &relay_header, Message::header_size);
+      destinations[i]->write(std::move(relay_msg));
+    }
+    Metrics::instance().message_in(header);
+    Metrics::instance().relayed(RelayMode::CutThrough, Message::header_size + header.body_size);
+
+    if (header.message_type == Message::Type::SendFile)
+      send_feedback<true, FeedbackId::SendFile>(conn.symmetric_encryptor(), conn);
+
+    return stream;
+  }
+
+  void Server::on_message_out([[maybe_unused]] Connection& conn,
+                              const Message::Header& header) noexcept
+  {
+    Metrics::instance().message_out(header);
   }
 
   void Server::on_connection_closed(Connection& conn) noexcept
   {
     Logger::trace(fmt::format("remove connection-{} from database", conn.id()));
+    auto& shard = *Shard::current();
     if (conn.is_authenticated())
     {
       // remove from user connections map
       auto user_id = conn.user()->id;
-      auto& connections = user_connections_[user_id];
-      std::erase(connections, conn.id());
+      auto it = shard.user_connections().find(user_id);
+      if (it != shard.user_connections().end())
+        std::erase(it->second, conn.handle());
 
-      // remove from map when the user no longer has connection
-      if (connections.empty())
+      // remove from map when the user no longer has connection on this shard
+      if (it != shard.user_connections().end() && it->second.empty())
       {
-        user_connections_.erase(user_id);
-        // send signal UserLogout payload except for current user
-        UserLogoutPayload payload{user_id};
-        broadcast_message<true>(payload, user_id);
+        shard.user_connections().erase(it);
+        // notify the other clients when the user has no connection on any shard
+        if (user_locations_.remove(user_id, shard))
+        {
+          Metrics::instance().online_users.sub();
+          if (online_users_.refresh(*conn.user()))
+            notify_presence();
+        }
       }
     }
 
+    // the unfinished transfers of the connection would never end
+    if (spool_)
+      spool_->abort_streams(conn.id());
+
     // delete client connection
-    std::erase_if(connections_, [rconn = &conn](const std::weak_ptr<Connection>& conn) {
-      return rconn->id() == conn.lock()->id();
-    });
+    shard.remove_connection(conn);
   }
 
-  asio::awaitable<void> Server::connection_acceptor() noexcept
+  asio::awaitable<void> Server::connection_acceptor(Shard& shard) noexcept
   {
-    auto serialized_pk = ar::serialize(asymm_encryptor_.public_key());
-    ServerDetailsPayload server_detail_payload{.id = User::SERVER_ID,
-                                               .public_key = std::move(serialized_pk)};
     while (true)
     {
-      auto [ec, socket] = co_await acceptor_.async_accept(ar::await_with_error());
+      // the kernel spreads the connections when every shard listens, otherwise this acceptor
+      // spreads them in round robin
+      auto& target = is_reuse_port_ ? shard : *shards_[next_shard_++ % shards_.size()];
+      auto [ec, socket] = co_await shard.acceptor().async_accept(target.context(),
+                                                                 ar::await_with_error());
       if (ec)
       {
-        Logger::warn(fmt::format("error on accepting connection: {}", ec.message()));
+        // the listening socket is released for the hot restart
+        if (ec != asio::error::operation_aborted)
+          Logger::warn(fmt::format("error on accepting connection: {}", ec.message()));
         break;
       }
 
-      auto conn = Connection::make_shared(std::forward<asio::ip::tcp::socket>(socket), this);
-      Logger::info(fmt::format("new connection with id: {}", conn->id()));
-      conn->start();
-      // Send server public key
-      send_message(*conn, server_detail_payload);
-      connections_.push_back(std::move(conn));
+      if (&target == &shard)
+      {
+        add_connection(shard, std::move(socket));
+        continue;
+      }
+      target.post([this, &target, socket = std::move(socket)]() mutable {
+        add_connection(target, std::move(socket));
+      });
+    }
+  }
+
+  void Server::add_connection(Shard& shard, asio::ip::tcp::socket&& socket) noexcept
+  {
+    auto conn = Connection::make_shared(std::forward<asio::ip::tcp::socket>(socket), this,
+                                        config_.connection);
+    Logger::info(fmt::format("new connection with id: {} on shard-{}", conn->id(), shard.id()));
+    shard.add_connection(conn);
+    if (shard.block_pool())
+      conn->use_block_pool(shard.block_pool());
+    conn->start();
+    // Send server public key
+    send_message(*conn, server_details_);
+  }
+
+  void Server::adopt_connection(Shard& shard, const asio::ip::tcp& protocol,
+                                HandoffConnection&& handoff) noexcept
+  {
+    asio::ip::tcp::socket socket{shard.context()};
+    asio::error_code ec;
+    socket.assign(protocol, handoff.socket, ec);
+    if (ec)
+    {
+      Logger::warn(fmt::format("could not take connection over: {}", ec.message()));
+      return;
+    }
+
+    // the users only kept in memory are gone with the old process, so the client should login
+    // again through a new connection
+    User* user = nullptr;
+    if (!handoff.state.username.empty())
+    {
+      user = users_.find(handoff.state.username);
+      if (!user)
+      {
+        Logger::warn(fmt::format("user {} is not found, closing its connection taken over",
+                                 handoff.state.username));
+        return;
+      }
+    }
+
+    auto conn = Connection::make_shared(std::move(socket), this, config_.connection);
+    if (shard.block_pool())
+      conn->use_block_pool(shard.block_pool());
+    // the socket is closed with the connection
+    if (!conn->resume(handoff.state))
+    {
+      Logger::warn(fmt::format("connection taken over has no session key or {} buffered bytes "
+                               "which don't fit the read block, closing it",
+                               handoff.state.buffered.size()));
+      return;
+    }
+    Logger::info(fmt::format("connection with id: {} taken over on shard-{}", conn->id(),
+                             shard.id()));
+    shard.add_connection(conn);
+    if (user)
+    {
+      authenticate(shard, *conn, user);
+      if (spool_)
+        deliver_spool(shard, user->id);
     }
+    conn->start();
+  }
+
+  void Server::authenticate(Shard& shard, Connection& conn, User* user) noexcept
+  {
+    shard.user_connections()[user->id].emplace_back(conn.handle());
+    conn.user(user);
+    // the other clients are notified in the next presence batch
+    if (user_locations_.add(user->id, shard))
+    {
+      Metrics::instance().online_users.add();
+      if (online_users_.refresh(*user))
+        notify_presence();
+    }
+  }
+
+  void Server::notify_presence() noexcept
+  {
+    if (is_presence_pending_.exchange(true))
+      return;
+
+    auto& shard = *shards_.front();
+    shard.post([this, &shard] {
+      if (config_.presence_window.count() == 0)
+      {
+        flush_presence();
+        return;
+      }
+
+      auto timer = std::make_shared<asio::steady_timer>(shard.context(), config_.presence_window);
+      timer->async_wait([this, timer](const asio::error_code& ec) {
+        if (!ec)
+          flush_presence();
+      });
+    });
+  }
+
+  void Server::flush_presence() noexcept
+  {
+    // the changes made after this are flushed in the next batch
+    is_presence_pending_.store(false);
+    auto serialized = online_users_.take_changes();
+    if (!serialized)
+      return;
+
+    Logger::trace(fmt::format("Broadcasting {} message",
+                              me::enum_name(Message::Type::UserPresence)));
+    for_each_shard([this, serialized](Shard& shard) {
+      // the body is shared by all the connections, only the encryption is per connection
+      for (const auto& conn : shard.connections())
+      {
+        if (!conn->user())
+          continue;
+
+        auto [padding, cipher] = [&] {
+          auto timer = Metrics::instance().time_crypto(CryptoOperation::Encrypt);
+          TraceSpan span{"encrypt"sv};
+          return conn->symmetric_encryptor().encrypts(*serialized);
+        }();
+        auto msg = create_message<Message::Type::UserPresence, Message::EncryptionType::Symmetric>(
+            std::move(cipher), User::SERVER_ID, padding);
+        send_message(*conn, std::move(msg));
+      }
+    });
   }
 
   void Server::send_message(Connection& conn, Message&& msg) noexcept
@@ -175,14 +671,8 @@ namespace ar
       return;
     }
 
-    auto aaa = payload.value();
-
-    const auto user = std::ranges::find_if(
-        users_, [username = std::string_view{payload->username}](const std::unique_ptr<User>& usr) {
-          return username == usr->name;
-        });
-
-    if (user == users_.end())
+    const auto user = users_.find(payload->username);
+    if (!user)
     {
       Logger::warn(fmt::format("Connection-{} failed to authenticate with username: {}",
                                conn.id(), payload->username));
@@ -191,25 +681,36 @@ namespace ar
       return;
     }
 
-    if (user->get()->password != payload->password)
-    {
-      Logger::warn(fmt::format("Connection-{} provide invalid password for username: {}",
-                               conn.id(), payload->username));
-
-      send_feedback<false, FeedbackId::Login>(symm_encryptor, conn, PASSWORD_INVALID);
-      return;
-    }
-
-    // add connection into users
-    auto& connections = user_connections_[user->get()->id];
-    connections.emplace_back(conn.id());
-
-    // send signal to other clients UserLogin payload
-    UserLoginPayload login_payload{user->get()->id, user->get()->name};
-    conn.user(user->get());
-    broadcast_message<true>(login_payload, conn.user()->id);
-
-    send_feedback<true, FeedbackId::Login>(symm_encryptor, conn);
+    // the password is verified off the shard, the login is continued on it
+    asio::post(password_pool_, [this, &shard = *Shard::current(), conn = conn.weak_from_this(),
+                                user, password = std::move(payload->password)] {
+      bool is_valid = verify_password(user->password, password);
+      shard.post([this, &shard, conn, user, is_valid] {
+        auto connection = conn.lock();
+        // another login could be done meanwhile
+        if (!connection || !expect_auth<false, FeedbackId::Login>(*connection))
+          return;
+
+        auto& symm_encryptor = connection->symmetric_encryptor();
+        if (!is_valid)
+        {
+          Logger::warn(fmt::format("Connection-{} provide invalid password for username: {}",
+                                   connection->id(), user->name));
+
+          send_feedback<false, FeedbackId::Login>(symm_encryptor, *connection, PASSWORD_INVALID);
+          return;
+        }
+
+        // add connection into users
+        authenticate(shard, *connection, user);
+
+        send_feedback<true, FeedbackId::Login>(symm_encryptor, *connection);
+
+        // the messages sent while the user is offline
+        if (spool_)
+          deliver_spool(shard, user->id);
+      });
+    });
   }
 
   void Server::register_message_handler(Connection& conn, const Message& msg) noexcept
@@ -230,29 +731,34 @@ namespace ar
       return;
     }
 
-    // Check if user already exists
-    const auto user = std::ranges::find_if(
-        users_, [username = std::string_view{payload->username}](const std::unique_ptr<User>& usr) {
-          return username == usr->name;
-        });
-
-    // user with username already exists
-    if (user != users_.end())
-    {
-      Logger::warn(fmt::format("Connection-{} failed on registering with username: {}",
-                               conn.id(), payload->username));
-      send_feedback<false, FeedbackId::Register>(symm_encryptor, conn, USER_NOT_FOUND);
-      return;
-    }
-
-    Logger::info(fmt::format("Connection-{} registered successfully with username: {}",
-                             conn.id(), std::string_view{payload->username}));
-
-    users_.emplace_back(std::make_unique<User>(user_id_generator_.gen(),
-                                               std::move(payload->username),
-                                               std::move(payload->password), std::vector<u8>{}));
-
-    send_feedback<true, FeedbackId::Register>(symm_encryptor, conn);
+    // the password is hashed off the shard, the user is added on it
+    asio::post(password_pool_, [this, &shard = *Shard::current(), conn = conn.weak_from_this(),
+                                username = std::move(payload->username),
+                                password = std::move(payload->password)]() mutable {
+      auto credential = hash_password(password);
+      shard.post([this, conn, username = std::move(username),
+                  credential = std::move(credential)]() mutable {
+        auto connection = conn.lock();
+        if (!connection)
+          return;
+
+        // the username is checked and added at once, so concurrent registration could not take
+        // the same username. The feedback is sent after the user is stored.
+        auto user = users_.add(username, std::move(credential),
+                               feedback_on_commit<FeedbackId::Register>(*connection));
+        if (!user)
+        {
+          Logger::warn(fmt::format("Connection-{} failed on registering with username {}: {}",
+                                   connection->id(), username, user.error()));
+          send_feedback<false, FeedbackId::Register>(connection->symmetric_encryptor(),
+                                                     *connection, user.error());
+          return;
+        }
+
+        Logger::info(fmt::format("Connection-{} registered successfully with username: {}",
+                                 connection->id(), username));
+      });
+    });
   }
 
   void Server::get_user_online_handler(Connection& conn, const Message& msg) noexcept
@@ -263,17 +769,25 @@ namespace ar
         symm_encryptor, conn, *header))
       return;
 
-    // filter online users
-    std::vector<UserResponse> users;
-    for (const auto& con : connections_)
+    auto payload = get_payload<GetUserOnlinePayload>(symm_encryptor, msg);
+    if (!payload)
     {
-      if (!con->user() || con->user()->id == conn.user()->id)
-        continue;
-      users.emplace_back(con->user()->id, con->user()->name);
+      Logger::error(fmt::format("Connection-{} sent malformed packet: {}", conn.id(),
+                                payload.error()));
+      send_feedback<false, FeedbackId::GetUserOnline>(symm_encryptor, conn, MESSAGE_MALFORMED);
+      return;
     }
 
-    UserOnlinePayload payload{.users = std::move(users)};
-    send_message(symm_encryptor, conn, payload);
+    // the reply is shared by every client at the same version, only the encryption is per client
+    auto serialized = online_users_.get(payload->version, payload->cursor);
+    auto [padding, cipher] = [&] {
+      auto timer = Metrics::instance().time_crypto(CryptoOperation::Encrypt);
+      TraceSpan span{"encrypt"sv};
+      return symm_encryptor.encrypts(*serialized);
+    }();
+    auto resp_msg = create_message<Message::Type::GetUserOnline, Message::EncryptionType::Symmetric>(
+        std::move(cipher), User::SERVER_ID, padding);
+    send_message(conn, std::move(resp_msg));
   }
 
   void Server::get_user_details_handler(Connection& conn, const Message& msg) noexcept
@@ -294,12 +808,8 @@ namespace ar
     }
 
     // Get the user
-    auto it = std::ranges::find_if(
-        users_, [&](const std::unique_ptr<User>& user) {
-          return user->id == payload->id;
-        });
-
-    if (it == users_.end())
+    auto user = users_.find(payload->id);
+    if (!user)
     {
       Logger::warn(fmt::format("Connection-{} trying to get details of non-existent user",
                                conn.id()));
@@ -307,9 +817,12 @@ namespace ar
       return;
     }
 
-    UserDetailPayload resp_payload{.id = it->get()->id,
-                                   .username = it->get()->name,
-                                   .public_key = it->get()->public_key};
+    // the older client rejects the compressions, it is left out when they are 0
+    UserDetailPayload resp_payload{
+        .id = user->id,
+        .username = user->name,
+        .public_key = users_.public_key(*user),
+        .compressions = conn.compressions() != 0 ? users_.compressions(*user) : u8{0}};
 
     send_message(symm_encryptor, conn, resp_payload);
   }
@@ -322,7 +835,11 @@ namespace ar
         conn, *header))
       return;
 
-    auto decipher = asymm_encryptor_.decrypts(msg.body);
+    auto decipher = [&] {
+      auto timer = Metrics::instance().time_crypto(CryptoOperation::Decrypt);
+      TraceSpan span{"decrypt"sv};
+      return asymm_encryptor_.decrypts(msg.body);
+    }();
     if (!decipher)
     {
       send_feedback<false, FeedbackId::StoreSymmetricKey>(conn, MESSAGE_MALFORMED);
@@ -387,7 +904,7 @@ namespace ar
         symm_encryptor, conn, *header))
       return;
 
-    auto payload = get_payload<StorePublicKeyPayload>(symm_encryptor, msg);
+    auto payload = get_payload_view<StorePublicKeyPayloadView>(symm_encryptor, msg);
     if (!payload)
     {
       Logger::warn(fmt::format(
@@ -398,14 +915,13 @@ namespace ar
       return;
     }
 
-    // save public key
-    conn.user()->public_key = std::move(payload->key);
-
-    Logger::info(fmt::format("sending {} response packet to user {}",
+    // save public key, the response is sent after it is stored
+    Logger::info(fmt::format("storing {} of user {}",
                              magic_enum::enum_name<Message::Type::StorePublicKey>(),
                              std::string_view{conn.user()->name}));
-
-    send_feedback<true, FeedbackId::StorePublicKey>(symm_encryptor, conn);
+    conn.compressions(payload->compressions);
+    users_.public_key(*conn.user(), payload->key, payload->compressions,
+                      feedback_on_commit<FeedbackId::StorePublicKey>(conn));
   }
 
   void Server::send_file_handler(Connection& conn, const Message& msg) noexcept
@@ -416,8 +932,12 @@ namespace ar
 
     // check if user opponent is online
     auto& symm_encryptor = conn.symmetric_encryptor();
-    if (!user_connections_.contains(header->opponent_id))
+    if (!user_locations_.contains(header->opponent_id))
     {
+      // keep it until the opponent logs in, the feedback is sent once it is saved
+      if (spool_message(conn, msg))
+        return;
+
       Logger::warn(fmt::format(
           "User-{} trying to send file into user with id {}, which doesn't exists",
           conn.user()->name, header->opponent_id));
@@ -425,8 +945,10 @@ namespace ar
       {
         // Show registered and online users
         std::vector<User::id_type> keys{};
-        for (const auto& k : user_connections_ | std::views::keys)
-          keys.emplace_back(k);
+        users_.for_each([&](const User& user) {
+          if (user_locations_.contains(user.id))
+            keys.emplace_back(user.id);
+        });
 
         Logger::info(fmt::format("[DEBUG] Online Users: {}", keys));
       }
@@ -434,43 +956,276 @@ namespace ar
       return;
     }
 
-    auto& connections = user_connections_[header->opponent_id];
-
     if constexpr (AR_DEBUG)
     {
       // get the user opponent
-      auto user = std::ranges::find_if(users_, [&header](const std::unique_ptr<User>& usr) {
-        return usr->id == header->opponent_id;
-      });
+      auto user = users_.find(header->opponent_id);
 
       Logger::info(
           fmt::format("User-{}[{}] sending files to user-{}", conn.user()->name, conn.id(),
-                      user->get()->name));
+                      user->name));
+    }
+
+    relay_message(conn, msg);
+    send_feedback<true, FeedbackId::SendFile>(symm_encryptor, conn);
+  }
+
+  void Server::send_file_stream_handler(Connection& conn, const Message& msg) noexcept
+  {
+    auto header = msg.as_header();
+    if (!expect_prologue<true, Message::EncryptionType::None, FeedbackId::SendFile>(conn, *header))
+      return;
+
+    // the transfer for offline opponent is saved on the spool, the feedback is sent by it
+    if (spool_stream(conn, msg))
+      return;
+
+    auto& symm_encryptor = conn.symmetric_encryptor();
+    bool is_relayed = relay_message(conn, msg);
+
+    // the feedback is only sent once per transfer, the chunks will be dropped silently when the
+    // opponent is going offline in the middle of transfer
+    switch (header->message_type)
+    {
+    case Message::Type::SendFileBegin: {
+      if (is_relayed)
+        break;
+      Logger::warn(fmt::format(
+          "User-{} trying to send file into user with id {}, which doesn't exists",
+          conn.user()->name, header->opponent_id));
+      send_feedback<false, FeedbackId::SendFile>(symm_encryptor, conn, USER_ID_NOT_FOUND);
+      break;
+    }
+    case Message::Type::SendFileEnd: {
+      if (is_relayed)
+        send_feedback<true, FeedbackId::SendFile>(symm_encryptor, conn);
+      else
+        send_feedback<false, FeedbackId::SendFile>(symm_encryptor, conn, USER_ID_NOT_FOUND);
+      break;
+    }
+    default:
+      if (!is_relayed)
+        Logger::trace(fmt::format("dropping {} message from user-{}",
+                                  me::enum_name(header->message_type), conn.user()->name));
+      break;
+    }
+  }
+
+  bool Server::relay_message(Connection& conn, const Message& msg) noexcept
+  {
+    auto opponent_id = msg.as_header()->opponent_id;
+    auto locations = user_locations_.get(opponent_id);
+    if (!locations)
+      return false;
+
+    // copy message and change the opponent id into sender id, the body is shared instead of
+    // being copied
+    auto relayed = msg;
+    relayed.as_header()->opponent_id = conn.user()->id;
+
+    auto& current = *Shard::current();
+    auto sender = conn.weak_from_this();
+    for (auto& shard : shards_)
+    {
+      if (!(locations & shard->mask()) || shard.get() == &current)
+        continue;
+      shard->post([this, &shard = *shard, relayed, opponent_id, sender, sender_id = conn.id(),
+                   &current] {
+        relay_local(shard, relayed, opponent_id, sender, sender_id, current);
+      });
     }
+    if (locations & current.mask())
+      relay_local(current, relayed, opponent_id, sender, conn.id(), current);
+    return true;
+  }
+
+  void Server::relay_local(Shard& shard, const Message& msg, User::id_type opponent_id,
+                           const std::weak_ptr<Connection>& sender,
+                           Connection::id_type sender_id, Shard& sender_shard) noexcept
+  {
+    // the opponent could go offline before the message arrives into the shard
+    auto it = shard.user_connections().find(opponent_id);
+    if (it == shard.user_connections().end())
+      return;
 
     // Send to all clients connected to specific user
-    for (auto& connId : connections)
+    for (auto handle : it->second)
     {
-      const auto con = std::ranges::find_if(
-          connections_,
-          [=](const std::weak_ptr<Connection> conn) {
-            return conn.lock()->id() == connId;
-          });
+      auto con = shard.find_connection(handle);
+      if (!con)
+      {
+        Logger::warn(fmt::format("user connections has handle that not belongs to any client: {}",
+                                 handle.index));
+        continue;
+      }
+      TraceSpan span{"relay"sv, con->id(), msg.as_header()->message_type, sender_id};
 
-      if (con == connections_.end())
+      // keep the message on the disk instead of growing the queue of slow opponent, the spool
+      // file is queued behind the messages already in memory so the order is kept. It is written
+      // by the spool thread, the message is sent from memory when it could not be saved
+      if (spool_ && (con->spooling() != 0 || con->queued_bytes() >= config_.spool_threshold))
       {
-        Logger::warn(
-            fmt::format("user connections has id that not belongs to any client: {}", connId));
+        con->spooling(con->spooling() + 1);
+        Metrics::instance().relayed(RelayMode::Spool, msg.size());
+        spool_->write(opponent_id, msg, [&shard, conn = con->weak_from_this(), msg](
+                                            std::expected<SpoolFile, std::string_view> file) {
+          shard.post([conn, msg, file = std::move(file)]() mutable {
+            // the file is kept on the spool for the next login when the connection is gone
+            auto con = conn.lock();
+            if (!con)
+              return;
+            con->spooling(con->spooling() - 1);
+            if (file)
+            {
+              con->write(std::move(file.value()));
+              return;
+            }
+            Logger::error(fmt::format("could not spool message for connection-{}: {}", con->id(),
+                                      file.error()));
+            con->write(std::move(msg));
+          });
+        });
         continue;
       }
 
-      // copy message and change the opponent id into sender id
       auto msg_copy = msg;
-      msg_copy.as_header()->opponent_id = conn.user()->id;
-      // con->get()->write(std::move(msg_copy));
-      send_message(*con->get(), std::move(msg_copy));
+      send_message(*con, std::move(msg_copy));
+      Metrics::instance().relayed(RelayMode::Buffered, msg.size());
+      if (con->is_writable())
+        continue;
+
+      // pause the sender instead of letting the opponent queue grows, the reader of sender is
+      // only touched by its own shard
+      if (&shard == &sender_shard)
+      {
+        if (auto conn = sender.lock())
+          conn->throttle(std::move(con));
+        continue;
+      }
+      sender_shard.post([sender, con = std::move(con)]() mutable {
+        if (auto conn = sender.lock())
+          conn->throttle(std::move(con));
+      });
     }
+  }
 
-    send_feedback<true, FeedbackId::SendFile>(symm_encryptor, conn);
+  bool Server::spool_message(Connection& conn, const Message& msg) noexcept
+  {
+    auto opponent_id = msg.as_header()->opponent_id;
+    if (!spool_ || !users_.find(opponent_id))
+      return false;
+
+    auto spooled = msg;
+    spooled.as_header()->opponent_id = conn.user()->id;
+    spool_->write(opponent_id, std::move(spooled),
+                  [this, &shard = *Shard::current(), sender = conn.weak_from_this(), opponent_id,
+                   size = msg.size()](std::expected<SpoolFile, std::string_view> file) {
+      if (!file)
+      {
+        Logger::error(fmt::format("could not spool message for user with id {}: {}",
+                                  opponent_id, file.error()));
+        post_spool_feedback(shard, sender, spool_feedback(file.error()));
+        return;
+      }
+      Metrics::instance().relayed(RelayMode::Spool, size);
+      {
+        // the file is kept on the spool when the handle is released
+        auto saved = std::move(file.value());
+      }
+      post_spool_feedback(shard, sender, {});
+      schedule_spool_delivery(opponent_id);
+    });
+    return true;
+  }
+
+  bool Server::spool_stream(Connection& conn, const Message& msg) noexcept
+  {
+    if (!spool_)
+      return false;
+    auto header = msg.as_header();
+    auto key = transfer_key_of(conn, msg);
+    if (!key)
+      return false;
+
+    // a new transfer is only saved for the offline opponent, the saved one is kept on the spool
+    // until it ends even when the opponent logs in meanwhile, so its messages are not split
+    auto type = header->message_type;
+    if (!spool_->is_streaming(*key) &&
+        (type != Message::Type::SendFileBegin || user_locations_.contains(header->opponent_id) ||
+         !users_.find(header->opponent_id)))
+      return false;
+
+    auto spooled = msg;
+    spooled.as_header()->opponent_id = conn.user()->id;
+    Metrics::instance().relayed(RelayMode::Spool, msg.size());
+    spool_->write_stream(*key, std::move(spooled),
+                         [this, &shard = *Shard::current(), sender = conn.weak_from_this(), type,
+                          opponent_id = header->opponent_id](
+                             std::expected<void, std::string_view> result) {
+      if (result)
+      {
+        // the feedback is only sent once per transfer
+        if (type != Message::Type::SendFileEnd)
+          return;
+        post_spool_feedback(shard, sender, {});
+        schedule_spool_delivery(opponent_id);
+        return;
+      }
+
+      // the failure of aborted transfer is already reported, and the chunks are dropped silently
+      // like the relayed ones
+      if (result.error() == Spool::TRANSFER_ABORTED ||
+          (result.error() == Spool::TRANSFER_NOT_SPOOLED && type == Message::Type::SendFileChunk))
+        return;
+      Logger::error(fmt::format("could not spool {} message for user with id {}: {}",
+                                me::enum_name(type), opponent_id, result.error()));
+      post_spool_feedback(shard, sender, spool_feedback(result.error()));
+    });
+    return true;
+  }
+
+  void Server::post_spool_feedback(Shard& shard, std::weak_ptr<Connection> sender,
+                                   std::string_view error) noexcept
+  {
+    shard.post([this, sender = std::move(sender), error] {
+      auto conn = sender.lock();
+      if (!conn)
+        return;
+      auto& symm_encryptor = conn->symmetric_encryptor();
+      if (error.empty())
+        send_feedback<true, FeedbackId::SendFile>(symm_encryptor, *conn);
+      else
+        send_feedback<false, FeedbackId::SendFile>(symm_encryptor, *conn, error);
+    });
+  }
+
+  void Server::schedule_spool_delivery(User::id_type user_id) noexcept
+  {
+    // the opponent could log in before the file is saved, so it won't be delivered on the login
+    if (auto locations = user_locations_.get(user_id))
+    {
+      auto& shard = *shards_[std::countr_zero(locations)];
+      shard.post([this, &shard, user_id] {
+        deliver_spool(shard, user_id);
+      });
+    }
+  }
+
+  void Server::deliver_spool(Shard& shard, User::id_type user_id) noexcept
+  {
+    auto it = shard.user_connections().find(user_id);
+    if (it == shard.user_connections().end() || it->second.empty())
+      return;
+    auto conn = shard.find_connection(it->second.front());
+    if (!conn)
+      return;
+
+    auto files = spool_->take(user_id);
+    if (files.empty())
+      return;
+    Logger::info(fmt::format("sending {} spooled messages to connection-{}", files.size(),
+                             conn->id()));
+    for (auto& file : files)
+      conn->write(std::move(file));
   }
 } // namespace ar
\ No newline at end of file
@@ -1,15 +1,27 @@
 #pragma once
 #include <magic_enum.hpp>
 #include <asio/ip/tcp.hpp>
-#include <asio/strand.hpp>
-#include <map>
+#include <asio/thread_pool.hpp>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
 #include <memory>
 #include <span>
+#include <thread>
 #include <vector>
 
 #include "connection.h"
 #include "generator.h"
 #include "handler.h"
+#include "hot_restart.h"
+#include "metrics.h"
+#include "trace.h"
+#include "message/view.h"
+#include "online_users.h"
+#include "shard.h"
+#include "spool.h"
+#include "user_registry.h"
+#include "user_store.h"
 
 namespace ar
 {
@@ -17,23 +29,97 @@ namespace ar
   struct RegisterPayload;
   struct User;
 
+  struct ServerConfig
+  {
+    // relayed file body with at least this size is forwarded while it is being read instead of
+    // being buffered first, 0 to disable it
+    u64 cut_through_threshold = 1024 * 1024;
+    // maximum bytes of relayed body kept in memory per message
+    usize relay_window = 8 * RelayStream::PIECE_SIZE;
+    // cut-through body with at least this size is spliced between the sockets when the opponent
+    // has one connection that keeps up, 0 to disable it. only supported on linux
+    u64 splice_threshold = 4 * 1024 * 1024;
+    // number of single threaded shards, 0 to use one shard per core
+    usize shard_count = 0;
+    // maximum users per page of online users snapshot
+    usize online_page_size = 512;
+    // logins and logouts in this window are sent as one presence message, 0 to send them as soon
+    // as possible
+    std::chrono::milliseconds presence_window{50};
+    // directory of the persistent user store, the users are only kept in memory when it is empty
+    std::filesystem::path data_directory{};
+    // directory of the relayed file messages waiting for offline or slow opponents, the messages
+    // for offline opponents are refused when it is empty
+    std::filesystem::path spool_directory{};
+    // queued bytes of opponent connection from which the relayed file messages are spooled
+    usize spool_threshold = 1024 * 1024;
+    // bytes on the spool waiting for each user and for every user, 0 for no limit. The file
+    // messages over them are refused
+    u64 spool_user_limit = u64{1} << 30;
+    u64 spool_limit = u64{16} << 30;
+    // read blocks registered into each shard context, the reads into them are fixed buffer
+    // operations with the io_uring backend. 0 to allocate the blocks per connection
+    usize registered_blocks = 0;
+    // threads hashing and verifying the passwords, so the shards are not blocked by them
+    usize password_threads = 2;
+    ConnectionConfig connection{};
+  };
+
   class Server : public IMessageHandler, public IConnectionHandler
   {
     using asymm_type = DMRSA;
 
   public:
-    Server(asio::any_io_executor executor, const asio::ip::address& address,
-           asio::ip::port_type port);
-    Server(asio::any_io_executor executor, const asio::ip::tcp::endpoint& endpoint);
+    using handoff_callback_type = std::move_only_function<void(Handoff&&)>;
+
+    Server(const asio::ip::address& address, asio::ip::port_type port, ServerConfig config = {});
+    // the listening sockets and connections of the handoff are taken instead of listening on the
+    // endpoint, the shards that get no listening socket listen as usual
+    Server(const asio::ip::tcp::endpoint& endpoint, ServerConfig config = {},
+           Handoff handoff = {});
+    ~Server() noexcept;
 
+    // run every shard on its own thread
     void start() noexcept;
 
+    // stop every shard, the shard threads are joined when the server is destroyed
+    void stop() noexcept;
+
+    // stop accepting and release every connection once its queued writes are flushed, the
+    // released sockets are passed to the callback from the last shard. The server should be
+    // stopped after it.
+    void hand_over(handoff_callback_type on_released) noexcept;
+
     void on_message_in(Connection& conn, const Message& msg) noexcept override;
-    void on_message_out(Connection& conn, std::span<const u8> bytes) noexcept override;
+    relay_target_type on_relay_in(Connection& conn,
+                                  const Message::Header& header) noexcept override;
+    void on_message_out(Connection& conn, const Message::Header& header) noexcept override;
     void on_connection_closed(Connection& conn) noexcept override;
 
   private:
-    asio::awaitable<void> connection_acceptor() noexcept;
+    asio::awaitable<void> connection_acceptor(Shard& shard) noexcept;
+
+    // start the connection on the shard thread
+    void add_connection(Shard& shard, asio::ip::tcp::socket&& socket) noexcept;
+
+    // start the connection handed over by the old process without the handshake, it is closed
+    // when its user is not found
+    void adopt_connection(Shard& shard, const asio::ip::tcp& protocol,
+                          HandoffConnection&& handoff) noexcept;
+
+    // release the listening socket and stop the readers of the shard, every shard is stopped
+    // before any of them is released
+    asio::awaitable<Handoff> stop_shard(Shard& shard) noexcept;
+
+    // release the connections of the stopped shard
+    asio::awaitable<Handoff> release_shard(Shard& shard) noexcept;
+
+    // add the connection into the online users of the shard
+    void authenticate(Shard& shard, Connection& conn, User* user) noexcept;
+
+    // run the task on every shard, the current shard runs it immediately
+    template <typename F>
+    void for_each_shard(F&& task) noexcept;
 
     template <bool Expect, FeedbackId Id>
     bool expect_auth(Connection& conn) noexcept;
@@ -68,6 +154,10 @@ namespace ar
     void send_feedback(symm_type& symm_encryptor, Connection& conn,
                        std::string_view message = ""sv) noexcept;
 
+    // send the feedback from the connection shard once the change is stored
+    template <FeedbackId Id>
+    UserStore::callback_type feedback_on_commit(Connection& conn) noexcept;
+
     template <payload T>
     std::expected<T, std::string_view> get_payload(const Message& msg) noexcept;
 
@@ -75,6 +165,11 @@ namespace ar
     std::expected<T, std::string_view> get_payload(symm_type& symm_encryptor,
                                                    const Message& msg) noexcept;
 
+    // parse the decrypted payload in place instead of copying it into payload fields
+    template <payload_view T>
+    std::expected<BodyView<T>, std::string_view> get_payload_view(symm_type& symm_encryptor,
+                                                                  const Message& msg) noexcept;
+
     template <payload T>
     void send_message(Connection& conn, const T& payload) noexcept;
 
@@ -83,9 +178,13 @@ namespace ar
 
     void send_message(Connection& conn, Message&& msg) noexcept;
 
-    // When Encrypt is true, the message will be encrypted by each cliet symmetric key
-    template <bool Encrypt, payload T>
-    void broadcast_message(const T& payload, User::id_type except_id) noexcept;
+    // schedule the presence flush when there is none pending, it should be called after the
+    // online users is changed
+    void notify_presence() noexcept;
+
+    // send the coalesced changes of online users into every authenticated connection. It is only
+    // run on the first shard, so the batches arrive in order on every shard.
+    void flush_presence() noexcept;
 
     // handler
     void login_message_handler(Connection& conn, const Message& msg) noexcept;
@@ -96,20 +195,79 @@ namespace ar
     void get_server_details_handler(Connection& conn, const Message& msg) noexcept;
     void store_public_key_handler(Connection& conn, const Message& msg) noexcept;
     void send_file_handler(Connection& conn, const Message& msg) noexcept;
+    void send_file_stream_handler(Connection& conn, const Message& msg) noexcept;
 
-  private:
-    asio::any_io_executor executor_;
-    asio::strand<asio::any_io_executor> strand_;
-    asio::ip::tcp::acceptor acceptor_;
+    // forward message into all connections of the opponent user with the opponent id replaced
+    // by the sender id, it will return false when the opponent is not online. The shards that have
+    // the opponent connections receive it through their inbox.
+    bool relay_message(Connection& conn, const Message& msg) noexcept;
+
+    // forward the relayed message into the opponent connections on the shard, the sender is
+    // throttled on its own shard by the destinations that are not writable. The sender id tags
+    // the relay spans, as the sender could be gone already
+    void relay_local(Shard& shard, const Message& msg, User::id_type opponent_id,
+                     const std::weak_ptr<Connection>& sender, Connection::id_type sender_id,
+                     Shard& sender_shard) noexcept;
+
+    // save the file message for the offline opponent, it will return false when the spool is not
+    // used or the opponent doesn't exist. The feedback is sent once it is saved.
+    bool spool_message(Connection& conn, const Message& msg) noexcept;
+
+    // save the streamed message when its transfer is for offline opponent or the transfer is
+    // already on the spool, it will return false when it should be relayed instead. The feedback
+    // is sent once the transfer is saved or it fails.
+    bool spool_stream(Connection& conn, const Message& msg) noexcept;
+
+    // send SendFile feedback from the shard of the sender, the empty error means success
+    void post_spool_feedback(Shard& shard, std::weak_ptr<Connection> sender,
+                             std::string_view error) noexcept;
+
+    // deliver the saved messages when the user is already online
+    void schedule_spool_delivery(User::id_type user_id) noexcept;
+
+    // send the spooled messages of the user into its first connection on the shard
+    void deliver_spool(Shard& shard, User::id_type user_id) noexcept;
 
-    std::vector<std::shared_ptr<Connection>> connections_; // client database
-    std::unordered_map<u16, std::vector<u16>> user_connections_;
-    std::vector<std::unique_ptr<User>> users_; // user database
-    IdGenerator<u16> user_id_generator_;
+  private:
+    ServerConfig config_;
+    // outlives the connections, so the undelivered messages could be returned into it
+    std::unique_ptr<Spool> spool_; // null when the spool is not used
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    bool is_reuse_port_;
+    usize next_shard_; // only used by the single acceptor when reuse port is not supported
+
+    UserLocations user_locations_;
+    OnlineUsers online_users_;
+    std::atomic_bool is_presence_pending_;
+    // null when the users are not persisted, it is closed first by the destructor
+    std::unique_ptr<UserStore> user_store_;
+    UserRegistry users_; // user database
+    asio::thread_pool password_pool_; // hash and verify the passwords off the shards
 
     asymm_type asymm_encryptor_; // only used for key exchange
+    ServerDetailsPayload server_details_;
+
+    std::atomic_bool is_started_;
+    std::vector<std::jthread> threads_;
   };
 
+  template <typename F>
+  void Server::for_each_shard(F&& task) noexcept
+  {
+    auto current = Shard::current();
+    for (auto& shard : shards_)
+    {
+      if (shard.get() == current)
+        continue;
+      shard->post([task, &shard = *shard]() mutable {
+        task(shard);
+      });
+    }
+    if (current)
+      task(*current);
+  }
+
   template <bool Expect, FeedbackId Id>
   bool Server::expect_auth(Connection& conn)
     noexcept
@@ -252,8 +410,8 @@ namespace ar
         .response = Resp,
         .message = std::string{message},
     };
-    auto serialized = resp_payload.serialize();
-    auto msg = create_message<Message::Type::Feedback>(serialized, User::SERVER_ID, 0);
+    auto msg = create_message<Message::Type::Feedback>(resp_payload.serialize(), User::SERVER_ID,
+                                                       0);
     send_message(conn, std::move(msg));
   }
 
@@ -269,13 +427,35 @@ namespace ar
     auto serialized = resp_payload.serialize();
 
     // Encrypt
-    auto [filler, cipher] = symm_encryptor.encrypts(serialized);
+    auto [filler, cipher] = [&] {
+      auto timer = Metrics::instance().time_crypto(CryptoOperation::Encrypt);
+      TraceSpan span{"encrypt"sv};
+      return symm_encryptor.encrypts(serialized);
+    }();
 
     auto msg = create_message<Message::Type::Feedback, Message::EncryptionType::Symmetric>(
-        cipher, User::SERVER_ID, filler);
+        std::move(cipher), User::SERVER_ID, filler);
     send_message(conn, std::move(msg));
   }
 
+  template <FeedbackId Id>
+  UserStore::callback_type Server::feedback_on_commit(Connection& conn) noexcept
+  {
+    return [this, &shard = *Shard::current(), conn = conn.weak_from_this()](bool is_committed) {
+      shard.post([this, conn, is_committed] {
+        auto connection = conn.lock();
+        if (!connection)
+          return;
+
+        auto& symm_encryptor = connection->symmetric_encryptor();
+        if (is_committed)
+          send_feedback<true, Id>(symm_encryptor, *connection);
+        else
+          send_feedback<false, Id>(symm_encryptor, *connection, USER_STORE_FAILED);
+      });
+    };
+  }
+
   template <payload T>
   std::expected<T, std::string_view> Server::get_payload(const Message& msg) noexcept
   {
@@ -288,7 +468,11 @@ namespace ar
   {
     auto header = msg.as_header();
     // decrypt
-    auto result = symm_encryptor.decrypts(msg.body, header->body_filler);
+    auto result = [&] {
+      auto timer = Metrics::instance().time_crypto(CryptoOperation::Decrypt);
+      TraceSpan span{"decrypt"sv};
+      return symm_encryptor.decrypts(msg.body, header->body_filler);
+    }();
     if (!result)
       return std::unexpected{result.error()};
 
@@ -296,16 +480,36 @@ namespace ar
     if (result->size() != header->real_size())
       return std::unexpected{MESSAGE_MALFORMED};
 
+    TraceSpan span{"parse"sv};
     return parse_body<T>(result.value());
   }
 
+  template <payload_view T>
+  std::expected<BodyView<T>, std::string_view> Server::get_payload_view(
+      symm_type& symm_encryptor, const Message& msg) noexcept
+  {
+    auto header = msg.as_header();
+    auto result = [&] {
+      auto timer = Metrics::instance().time_crypto(CryptoOperation::Decrypt);
+      TraceSpan span{"decrypt"sv};
+      return symm_encryptor.decrypts(msg.body, header->body_filler);
+    }();
+    if (!result)
+      return std::unexpected{result.error()};
+
+    if (result->size() != header->real_size())
+      return std::unexpected{MESSAGE_MALFORMED};
+
+    TraceSpan span{"parse"sv};
+    return parse_view<T>(SharedBuffer{std::move(result.value())});
+  }
+
   template <payload T>
   void Server::send_message(Connection& conn, const T& payload) noexcept
   {
     constexpr auto payload_type = get_payload_type<T>();
 
-    auto serialized = payload.serialize();
-    auto resp_msg = create_message<payload_type>(serialized, User::SERVER_ID, 0);
+    auto resp_msg = create_message<payload_type>(payload.serialize(), User::SERVER_ID, 0);
 
     send_message(conn, std::move(resp_msg));
   }
@@ -316,45 +520,13 @@ namespace ar
     constexpr auto payload_type = get_payload_type<T>();
 
     auto serialized = payload.serialize();
-    auto [padding, cipher] = symm_encryptor.encrypts(serialized);
+    auto [padding, cipher] = [&] {
+      auto timer = Metrics::instance().time_crypto(CryptoOperation::Encrypt);
+      TraceSpan span{"encrypt"sv};
+      return symm_encryptor.encrypts(serialized);
+    }();
     auto resp_msg = create_message<payload_type, Message::EncryptionType::Symmetric>(
-        cipher, User::SERVER_ID, padding);
+        std::move(cipher), User::SERVER_ID, padding);
     send_message(conn, std::move(resp_msg));
   }
-
-  template <bool Encrypt, payload T>
-  void Server::broadcast_message(const T& payload, User::id_type except) noexcept
-  {
-    constexpr auto payload_type = get_payload_type<T>();
-    if constexpr (Encrypt)
-      Logger::trace(fmt::format("Broadcasting {} message except for client {}",
-                                magic_enum::enum_name<payload_type>(), except));
-    else
-      Logger::trace(fmt::format("Broadcasting {} encrypted message except for client {}",
-                                magic_enum::enum_name<payload_type>(), except));
-
-    auto serialized = payload.serialize();
-    // encrypt
-
-    for (const auto& conn : connections_)
-    {
-      // ignore unauthenticated connection and sender
-      if (!conn->user() || conn->user()->id == except)
-        continue;
-
-      if constexpr (Encrypt)
-      {
-        auto& symm_encryptor = conn->symmetric_encryptor();
-        auto [padding, cipher] = symm_encryptor.encrypts(serialized);
-        auto msg = create_message<payload_type, Message::EncryptionType::Symmetric>(
-            cipher, User::SERVER_ID, padding);
-        send_message(*conn, std::move(msg));
-      }
-      else
-      {
-        auto msg = create_message<payload_type>(serialized, User::SERVER_ID, 0);
-        send_message(*conn, std::move(msg));
-      }
-    }
-  }
 } // namespace ar
\ No newline at end of file
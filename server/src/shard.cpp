@@ -0,0 +1,251 @@
+#include "shard.h"
+
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/steady_timer.hpp>
+#include <limits>
+
+#include "util/asio.h"
+
+namespace ar
+{
+  Shard::Shard(id_type id, usize registered_blocks) noexcept
+    : id_{id},
+      // only the shard thread runs the context
+      context_{1},
+      acceptor_{context_},
+      inbox_signal_{context_.get_executor()},
+      is_inbox_waiting_{false},
+      timers_epoch_{Connection::clock_type::now()}
+  {
+    if (registered_blocks != 0)
+      block_pool_ = BlockPool::make_shared(context_, FrameReader::BLOCK_SIZE, registered_blocks);
+  }
+
+  Shard::~Shard() noexcept
+  {
+    // the bodies read into the blocks could be queued into the connections of other shards, which
+    // are destroyed later, so the blocks are unregistered while the context is still alive
+    if (block_pool_)
+      block_pool_->unregister_blocks();
+  }
+
+  Shard* Shard::current() noexcept
+  {
+    return s_current;
+  }
+
+  bool Shard::is_reuse_port_supported() noexcept
+  {
+#ifdef SO_REUSEPORT
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  asio::error_code Shard::listen(const asio::ip::tcp::endpoint& endpoint, bool reuse_port) noexcept
+  {
+    asio::error_code ec;
+    acceptor_.open(endpoint.protocol(), ec);
+    if (ec)
+      return ec;
+    acceptor_.set_option(asio::socket_base::reuse_address{true}, ec);
+    if (ec)
+      return ec;
+#ifdef SO_REUSEPORT
+    if (reuse_port)
+    {
+      using reuse_port_option = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+      acceptor_.set_option(reuse_port_option{true}, ec);
+      if (ec)
+        return ec;
+    }
+#endif
+    acceptor_.bind(endpoint, ec);
+    if (ec)
+      return ec;
+    acceptor_.listen(asio::socket_base::max_listen_connections, ec);
+    return ec;
+  }
+
+  asio::error_code Shard::adopt(const asio::ip::tcp& protocol,
+                                asio::ip::tcp::acceptor::native_handle_type listener) noexcept
+  {
+    asio::error_code ec;
+    acceptor_.assign(protocol, listener, ec);
+    return ec;
+  }
+
+  void Shard::run() noexcept
+  {
+    s_current = this;
+    asio::co_spawn(context_, [this] {
+      return inbox_handler();
+    }, asio::detached);
+    asio::co_spawn(context_, [this] {
+      return timer_handler();
+    }, asio::detached);
+
+    context_.run();
+    s_current = nullptr;
+  }
+
+  void Shard::stop() noexcept
+  {
+    inbox_signal_.close();
+    context_.stop();
+  }
+
+  void Shard::post(task_type&& task) noexcept
+  {
+    inbox_.push(std::move(task));
+    // pairs with the fence in inbox_handler, either the shard sees the task or it is woken up
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (is_inbox_waiting_.exchange(false))
+      inbox_signal_.notify();
+  }
+
+  void Shard::add_connection(std::shared_ptr<Connection> conn) noexcept
+  {
+    auto& rconn = *conn;
+    rconn.handle(connections_.insert(std::move(conn)));
+    // the first check gets the actual deadline
+    timers_.schedule(tick_of(Connection::clock_type::now()), rconn.handle());
+  }
+
+  void Shard::remove_connection(const Connection& conn) noexcept
+  {
+    connections_.erase(conn.handle());
+  }
+
+  std::shared_ptr<Connection> Shard::find_connection(SlotHandle handle) const noexcept
+  {
+    auto conn = connections_.get(handle);
+    if (!conn)
+      return nullptr;
+    return *conn;
+  }
+
+  Shard::id_type Shard::id() const noexcept
+  {
+    return id_;
+  }
+
+  u64 Shard::mask() const noexcept
+  {
+    return 1_u64 << id_;
+  }
+
+  asio::io_context& Shard::context() noexcept
+  {
+    return context_;
+  }
+
+  asio::ip::tcp::acceptor& Shard::acceptor() noexcept
+  {
+    return acceptor_;
+  }
+
+  const std::shared_ptr<BlockPool>& Shard::block_pool() const noexcept
+  {
+    return block_pool_;
+  }
+
+  bool Shard::is_listening() const noexcept
+  {
+    return acceptor_.is_open();
+  }
+
+  const SlotMap<std::shared_ptr<Connection>>& Shard::connections() const noexcept
+  {
+    return connections_;
+  }
+
+  std::unordered_map<User::id_type, std::vector<SlotHandle>>&
+  Shard::user_connections() noexcept
+  {
+    return user_connections_;
+  }
+
+  asio::awaitable<void> Shard::inbox_handler() noexcept
+  {
+    while (true)
+    {
+      while (!inbox_.empty())
+      {
+        auto task = std::move(inbox_.front());
+        inbox_.pop();
+        task();
+      }
+
+      is_inbox_waiting_.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!inbox_.empty())
+      {
+        is_inbox_waiting_.store(false);
+        continue;
+      }
+      // closed
+      if (!co_await inbox_signal_.wait())
+        break;
+    }
+  }
+
+  asio::awaitable<void> Shard::timer_handler() noexcept
+  {
+    asio::steady_timer timer{context_};
+    while (true)
+    {
+      timer.expires_after(TIMER_TICK);
+      auto [ec] = co_await timer.async_wait(ar::await_with_error());
+      if (ec)
+        break;
+
+      auto now = Connection::clock_type::now();
+      timers_.advance(tick_of(now), [&](SlotHandle handle) {
+        // the removed connection is dropped here instead of being cancelled
+        auto conn = find_connection(handle);
+        if (!conn)
+          return;
+        if (auto deadline = conn->check_liveness(now))
+          timers_.schedule(tick_of(*deadline), handle);
+      });
+    }
+  }
+
+  TimerWheel<SlotHandle>::tick_type Shard::tick_of(Connection::clock_type::time_point time) const
+  noexcept
+  {
+    // round up, so the deadline is never checked early
+    auto elapsed = std::max(time - timers_epoch_, Connection::clock_type::duration{0});
+    return static_cast<TimerWheel<SlotHandle>::tick_type>(
+        (elapsed + TIMER_TICK - Connection::clock_type::duration{1}) / TIMER_TICK);
+  }
+
+  UserLocations::UserLocations() noexcept
+    : masks_{std::make_unique<std::atomic<u64>[]>(
+        static_cast<usize>(std::numeric_limits<User::id_type>::max()) + 1)}
+  {
+  }
+
+  bool UserLocations::add(User::id_type user_id, const Shard& shard) noexcept
+  {
+    return masks_[user_id].fetch_or(shard.mask()) == 0;
+  }
+
+  bool UserLocations::remove(User::id_type user_id, const Shard& shard) noexcept
+  {
+    return masks_[user_id].fetch_and(~shard.mask()) == shard.mask();
+  }
+
+  u64 UserLocations::get(User::id_type user_id) const noexcept
+  {
+    return masks_[user_id].load();
+  }
+
+  bool UserLocations::contains(User::id_type user_id) const noexcept
+  {
+    return get(user_id) != 0;
+  }
+} // namespace ar
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <asio/awaitable.hpp>
+#include <asio/io_context.hpp>
+#include <asio/ip/tcp.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "connection.h"
+#include "message/block_pool.h"
+#include "user.h"
+#include "util/async_signal.h"
+#include "util/mpsc_queue.h"
+#include "util/slot_map.h"
+#include "util/timer_wheel.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Single threaded part of the server. Each shard runs its own io_context on one thread and
+  // accepts its own connections, so the connection tables are only touched by the shard thread.
+  // Other shards reach them by posting tasks into the shard inbox.
+  class Shard
+  {
+  public:
+    using id_type = u8;
+    using task_type = std::move_only_function<void()>;
+
+    // shards are tracked as bits of u64
+    constexpr static usize MAX_COUNT = 64;
+    // resolution of the connection deadlines
+    constexpr static std::chrono::milliseconds TIMER_TICK{100};
+
+    // the connections read into registered blocks of the shard when the count is not 0
+    Shard(id_type id, usize registered_blocks) noexcept;
+
+    // the shard thread should be stopped
+    ~Shard() noexcept;
+
+    Shard(const Shard&) = delete;
+    Shard& operator=(const Shard&) = delete;
+
+    // shard that runs on the current thread, null outside the shard threads
+    static Shard* current() noexcept;
+
+    // whether every shard could listen on the same endpoint and let the kernel spread the
+    // connections, otherwise only one shard should listen
+    static bool is_reuse_port_supported() noexcept;
+
+    asio::error_code listen(const asio::ip::tcp::endpoint& endpoint, bool reuse_port) noexcept;
+
+    // accept from the listening socket of the old process instead of listening
+    asio::error_code adopt(const asio::ip::tcp& protocol,
+                           asio::ip::tcp::acceptor::native_handle_type listener) noexcept;
+
+    // run the io_context on the calling thread until it is stopped
+    void run() noexcept;
+
+    void stop() noexcept;
+
+    // run the task on the shard thread, it could be called from any thread without blocking
+    void post(task_type&& task) noexcept;
+
+    // the connection handle is set to its slot on this shard and its liveness is checked by the
+    // shard timers
+    void add_connection(std::shared_ptr<Connection> conn) noexcept;
+
+    void remove_connection(const Connection& conn) noexcept;
+
+    // return null when the connection is already removed
+    std::shared_ptr<Connection> find_connection(SlotHandle handle) const noexcept;
+
+    [[nodiscard]] id_type id() const noexcept;
+
+    [[nodiscard]] u64 mask() const noexcept;
+
+    asio::io_context& context() noexcept;
+
+    asio::ip::tcp::acceptor& acceptor() noexcept;
+
+    // null when the shard has no registered blocks
+    const std::shared_ptr<BlockPool>& block_pool() const noexcept;
+
+    [[nodiscard]] bool is_listening() const noexcept;
+
+    [[nodiscard]] const SlotMap<std::shared_ptr<Connection>>& connections() const noexcept;
+
+    // authenticated connection handles of each user on this shard
+    std::unordered_map<User::id_type, std::vector<SlotHandle>>& user_connections() noexcept;
+
+  private:
+    asio::awaitable<void> inbox_handler() noexcept;
+
+    // check the connections which deadline is passed on every tick
+    asio::awaitable<void> timer_handler() noexcept;
+
+    [[nodiscard]] TimerWheel<SlotHandle>::tick_type tick_of(Connection::clock_type::time_point time)
+    const noexcept;
+
+  private:
+    inline static thread_local Shard* s_current = nullptr;
+
+    id_type id_;
+    asio::io_context context_;
+    asio::ip::tcp::acceptor acceptor_;
+    std::shared_ptr<BlockPool> block_pool_;
+
+    MpscQueue<task_type> inbox_;
+    AsyncSignal inbox_signal_;
+    std::atomic_bool is_inbox_waiting_;
+
+    SlotMap<std::shared_ptr<Connection>> connections_;
+    // one entry per connection, the connection is checked again when its deadline is moved
+    TimerWheel<SlotHandle> timers_;
+    Connection::clock_type::time_point timers_epoch_;
+    std::unordered_map<User::id_type, std::vector<SlotHandle>> user_connections_;
+  };
+
+  // Shards where each user has authenticated connections, it is shared by every shard. The user id
+  // is only 16 bits so every user has its own slot and lookup never takes a lock.
+  class UserLocations
+  {
+  public:
+    UserLocations() noexcept;
+
+    // return true when the user was not on any shard
+    bool add(User::id_type user_id, const Shard& shard) noexcept;
+
+    // return true when the user is no longer on any shard
+    bool remove(User::id_type user_id, const Shard& shard) noexcept;
+
+    // mask of shards
+    [[nodiscard]] u64 get(User::id_type user_id) const noexcept;
+
+    [[nodiscard]] bool contains(User::id_type user_id) const noexcept;
+
+  private:
+    std::unique_ptr<std::atomic<u64>[]> masks_;
+  };
+} // namespace ar
@@ -0,0 +1,472 @@
+#include "spool.h"
+
+#include <fmt/format.h>
+
+#include <charconv>
+#include <utility>
+
+#include "logger.h"
+#include "message/feedback.h"
+#include "native_file.h"
+
+namespace ar
+{
+  namespace
+  {
+    // the messages in the file should cover the whole file, the transfer file has more than one
+    bool is_complete(const std::filesystem::path& path, u64 size) noexcept
+    {
+      if (size < Message::header_size)
+        return false;
+      auto file = NativeFile::open(path, false);
+      if (!file)
+        return false;
+
+      u64 offset = 0;
+      while (size - offset >= Message::header_size)
+      {
+        Message::Header header{};
+        if (!file->read(offset, {reinterpret_cast<u8*>(&header), Message::header_size}))
+          return false;
+        offset += Message::header_size;
+        if (header.body_size > size - offset)
+          return false;
+        offset += header.body_size;
+      }
+      return offset == size;
+    }
+  } // namespace
+
+  SpoolFile::SpoolFile(Spool* spool, User::id_type user_id, u64 sequence, u64 size) noexcept
+    : spool_{spool},
+      user_id_{user_id},
+      sequence_{sequence},
+      size_{size}
+  {
+  }
+
+  SpoolFile::~SpoolFile() noexcept
+  {
+    release();
+  }
+
+  SpoolFile::SpoolFile(SpoolFile&& other) noexcept
+    : spool_{std::exchange(other.spool_, nullptr)},
+      user_id_{other.user_id_},
+      sequence_{other.sequence_},
+      size_{other.size_},
+      is_delivered_{other.is_delivered_}
+  {
+  }
+
+  SpoolFile& SpoolFile::operator=(SpoolFile&& other) noexcept
+  {
+    if (this == &other)
+      return *this;
+    release();
+    spool_ = std::exchange(other.spool_, nullptr);
+    user_id_ = other.user_id_;
+    sequence_ = other.sequence_;
+    size_ = other.size_;
+    is_delivered_ = other.is_delivered_;
+    return *this;
+  }
+
+  std::filesystem::path SpoolFile::path() const noexcept
+  {
+    return spool_->path_of(user_id_, sequence_);
+  }
+
+  u64 SpoolFile::size() const noexcept
+  {
+    return size_;
+  }
+
+  void SpoolFile::delivered() noexcept
+  {
+    is_delivered_ = true;
+  }
+
+  void SpoolFile::release() noexcept
+  {
+    if (auto spool = std::exchange(spool_, nullptr))
+      spool->release(user_id_, sequence_, size_, is_delivered_);
+  }
+
+  Spool::Spool(std::filesystem::path directory, SpoolLimits limits) noexcept
+    : directory_{std::move(directory)},
+      limits_{limits},
+      next_sequence_{0},
+      total_usage_{0},
+      is_stopping_{false}
+  {
+  }
+
+  std::expected<std::unique_ptr<Spool>, std::string_view> Spool::open(
+      std::filesystem::path directory, SpoolLimits limits) noexcept
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec)
+      return std::unexpected{"failed to create the spool directory"sv};
+
+    std::unique_ptr<Spool> spool{new Spool{std::move(directory), limits}};
+    usize count = 0;
+    for (const auto& entry : std::filesystem::directory_iterator{spool->directory_, ec})
+    {
+      // ec is kept for the iteration, the failure of an entry only skips it
+      std::error_code entry_ec;
+      auto path = entry.path();
+      // the message and the transfer are written into temporary file first, so it is not complete
+      if (path.extension() == ".tmp")
+      {
+        std::filesystem::remove(path, entry_ec);
+        continue;
+      }
+      if (path.extension() != ".msg")
+        continue;
+
+      auto stem = path.stem().string();
+      auto separator = stem.find('-');
+      if (separator == std::string::npos)
+        continue;
+      User::id_type user_id{};
+      u64 sequence{};
+      auto [user_end, user_ec] = std::from_chars(stem.data(), stem.data() + separator, user_id);
+      auto [seq_end, seq_ec] = std::from_chars(stem.data() + separator + 1,
+                                               stem.data() + stem.size(), sequence);
+      if (user_ec != std::errc{} || seq_ec != std::errc{})
+        continue;
+
+      auto size = entry.file_size(entry_ec);
+      if (entry_ec)
+        continue;
+      if (!is_complete(path, size))
+      {
+        Logger::warn(fmt::format("dropping incomplete spool file {}", path.string()));
+        std::filesystem::remove(path, entry_ec);
+        continue;
+      }
+      // the files saved before the limits are lowered are kept, they only block the new ones
+      spool->pending_[user_id].emplace(sequence, size);
+      spool->usage_[user_id] += size;
+      spool->total_usage_ += size;
+      spool->next_sequence_ = std::max(spool->next_sequence_, sequence + 1);
+      ++count;
+    }
+    if (ec)
+      return std::unexpected{"failed to read the spool directory"sv};
+
+    spool->writer_thread_ = std::jthread{[spool = spool.get()] {
+      spool->writer();
+    }};
+    Logger::set_thread_name("SPOOL", spool->writer_thread_.get_id());
+    Logger::info(fmt::format("spool has {} messages for {} users", count, spool->pending_.size()));
+    return spool;
+  }
+
+  Spool::~Spool() noexcept
+  {
+    close();
+  }
+
+  void Spool::write(User::id_type user_id, Message msg, write_callback_type callback) noexcept
+  {
+    post([this, user_id, msg = std::move(msg), callback = std::move(callback)]() mutable {
+      if (!reserve(user_id, msg.size()))
+      {
+        callback(std::unexpected{SPOOL_QUOTA_EXCEEDED});
+        return;
+      }
+      auto file = save(user_id, msg);
+      if (!file)
+        unreserve(user_id, msg.size());
+      callback(std::move(file));
+    });
+  }
+
+  void Spool::write_stream(const TransferKey& key, Message msg,
+                           stream_callback_type callback) noexcept
+  {
+    // the transfer is marked before it is written, so the next messages of it follow it here
+    // instead of being relayed
+    {
+      std::unique_lock lock{mutex_};
+      auto type = msg.as_header()->message_type;
+      if (type == Message::Type::SendFileBegin)
+        streaming_.insert(key);
+      else if (type == Message::Type::SendFileEnd)
+        streaming_.erase(key);
+    }
+    post([this, key, msg = std::move(msg), callback = std::move(callback)]() mutable {
+      callback(append(key, msg));
+    });
+  }
+
+  bool Spool::is_streaming(const TransferKey& key) const noexcept
+  {
+    std::unique_lock lock{mutex_};
+    return streaming_.contains(key);
+  }
+
+  void Spool::abort_streams(u16 connection_id) noexcept
+  {
+    {
+      std::unique_lock lock{mutex_};
+      std::erase_if(streaming_, [&](const TransferKey& key) {
+        return key.connection_id == connection_id;
+      });
+    }
+    post([this, connection_id] {
+      for (auto it = transfers_.begin(); it != transfers_.end();)
+      {
+        if (it->first.connection_id != connection_id)
+        {
+          ++it;
+          continue;
+        }
+        abort(it->first, it->second);
+        it = transfers_.erase(it);
+      }
+    });
+  }
+
+  void Spool::close() noexcept
+  {
+    {
+      std::unique_lock lock{mutex_};
+      is_stopping_ = true;
+    }
+    cv_.notify_one();
+    if (writer_thread_.joinable())
+      writer_thread_.join();
+  }
+
+  std::vector<SpoolFile> Spool::take(User::id_type user_id) noexcept
+  {
+    std::vector<SpoolFile> files{};
+    std::unique_lock lock{mutex_};
+    auto it = pending_.find(user_id);
+    if (it == pending_.end())
+      return files;
+
+    files.reserve(it->second.size());
+    for (auto [sequence, size] : it->second)
+      files.emplace_back(SpoolFile{this, user_id, sequence, size});
+    pending_.erase(it);
+    return files;
+  }
+
+  bool Spool::contains(User::id_type user_id) const noexcept
+  {
+    std::unique_lock lock{mutex_};
+    return pending_.contains(user_id);
+  }
+
+  std::filesystem::path Spool::path_of(User::id_type user_id, u64 sequence) const noexcept
+  {
+    return directory_ / fmt::format("{}-{}.msg", user_id, sequence);
+  }
+
+  bool Spool::reserve(User::id_type user_id, u64 size) noexcept
+  {
+    std::unique_lock lock{mutex_};
+    auto& usage = usage_[user_id];
+    if ((limits_.user_bytes != 0 && usage + size > limits_.user_bytes) ||
+        (limits_.total_bytes != 0 && total_usage_ + size > limits_.total_bytes))
+      return false;
+    usage += size;
+    total_usage_ += size;
+    return true;
+  }
+
+  void Spool::unreserve(User::id_type user_id, u64 size) noexcept
+  {
+    std::unique_lock lock{mutex_};
+    auto it = usage_.find(user_id);
+    if (it == usage_.end())
+      return;
+    size = std::min(size, it->second);
+    it->second -= size;
+    total_usage_ -= size;
+    if (it->second == 0)
+      usage_.erase(it);
+  }
+
+  void Spool::post(std::move_only_function<void()> job) noexcept
+  {
+    {
+      std::unique_lock lock{mutex_};
+      jobs_.emplace_back(std::move(job));
+    }
+    cv_.notify_one();
+  }
+
+  void Spool::writer() noexcept
+  {
+    while (true)
+    {
+      std::vector<std::move_only_function<void()>> batch{};
+      {
+        std::unique_lock lock{mutex_};
+        cv_.wait(lock, [this] {
+          return !jobs_.empty() || is_stopping_;
+        });
+        if (jobs_.empty())
+          break;
+        batch.swap(jobs_);
+      }
+
+      for (auto& job : batch)
+        job();
+    }
+  }
+
+  std::expected<SpoolFile, std::string_view> Spool::save(User::id_type user_id,
+                                                         const Message& msg) noexcept
+  {
+    u64 sequence;
+    {
+      std::unique_lock lock{mutex_};
+      sequence = next_sequence_++;
+    }
+
+    auto path = path_of(user_id, sequence);
+    auto temp_path = path;
+    temp_path.replace_extension(".tmp");
+    {
+      auto file = NativeFile::open(temp_path);
+      if (!file)
+        return std::unexpected{file.error()};
+      // the content is synced before the rename, so the message file is never seen incomplete
+      if (!file->write(0, msg.header) ||
+          !file->write(Message::header_size, {msg.body.data(), msg.body.size()}) ||
+          !file->sync())
+      {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        return std::unexpected{"failed to write the spool file"sv};
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec)
+    {
+      std::filesystem::remove(temp_path, ec);
+      return std::unexpected{"failed to write the spool file"sv};
+    }
+    return SpoolFile{this, user_id, sequence, msg.size()};
+  }
+
+  std::expected<void, std::string_view> Spool::append(const TransferKey& key,
+                                                      const Message& msg) noexcept
+  {
+    auto type = msg.as_header()->message_type;
+    if (type == Message::Type::SendFileBegin)
+    {
+      // the sender reuses the transfer id, the previous one is never ended
+      if (auto it = transfers_.find(key); it != transfers_.end())
+      {
+        abort(key, it->second);
+        transfers_.erase(it);
+      }
+
+      Transfer transfer{.sequence = 0, .file = {}, .size = 0, .is_aborted = true};
+      if (!reserve(key.user_id, msg.size()))
+      {
+        transfers_.emplace(key, std::move(transfer));
+        return std::unexpected{SPOOL_QUOTA_EXCEEDED};
+      }
+      {
+        std::unique_lock lock{mutex_};
+        transfer.sequence = next_sequence_++;
+      }
+      auto temp_path = path_of(key.user_id, transfer.sequence).replace_extension(".tmp");
+      auto file = NativeFile::open(temp_path);
+      if (!file || !file->write(0, msg.header) ||
+          !file->write(Message::header_size, {msg.body.data(), msg.body.size()}))
+      {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        unreserve(key.user_id, msg.size());
+        transfers_.emplace(key, std::move(transfer));
+        return std::unexpected{"failed to write the spool file"sv};
+      }
+      transfer.file = std::move(file.value());
+      transfer.size = msg.size();
+      transfer.is_aborted = false;
+      transfers_.emplace(key, std::move(transfer));
+      return {};
+    }
+
+    auto it = transfers_.find(key);
+    if (it == transfers_.end())
+      return std::unexpected{TRANSFER_NOT_SPOOLED};
+    auto& transfer = it->second;
+    bool is_end = type == Message::Type::SendFileEnd;
+    auto result = [&]() -> std::expected<void, std::string_view> {
+      if (transfer.is_aborted)
+        return std::unexpected{TRANSFER_ABORTED};
+      if (!reserve(key.user_id, msg.size()))
+      {
+        abort(key, transfer);
+        return std::unexpected{SPOOL_QUOTA_EXCEEDED};
+      }
+      transfer.size += msg.size();
+      if (!transfer.file.write(transfer.size - msg.size(), msg.header) ||
+          !transfer.file.write(transfer.size - msg.size() + Message::header_size,
+                               {msg.body.data(), msg.body.size()}) ||
+          (is_end && !transfer.file.sync()))
+      {
+        abort(key, transfer);
+        return std::unexpected{"failed to write the spool file"sv};
+      }
+      if (!is_end)
+        return {};
+
+      // every message of the transfer is synced, so it is delivered as one file
+      transfer.file = {};
+      auto path = path_of(key.user_id, transfer.sequence);
+      std::error_code ec;
+      std::filesystem::rename(path_of(key.user_id, transfer.sequence).replace_extension(".tmp"),
+                              path, ec);
+      if (ec)
+      {
+        abort(key, transfer);
+        return std::unexpected{"failed to write the spool file"sv};
+      }
+      std::unique_lock lock{mutex_};
+      pending_[key.user_id].emplace(transfer.sequence, transfer.size);
+      return {};
+    }();
+    if (is_end)
+      transfers_.erase(it);
+    return result;
+  }
+
+  void Spool::abort(const TransferKey& key, Transfer& transfer) noexcept
+  {
+    if (transfer.is_aborted)
+      return;
+    transfer.is_aborted = true;
+    transfer.file = {};
+    std::error_code ec;
+    std::filesystem::remove(path_of(key.user_id, transfer.sequence).replace_extension(".tmp"), ec);
+    unreserve(key.user_id, transfer.size);
+  }
+
+  void Spool::release(User::id_type user_id, u64 sequence, u64 size, bool is_delivered) noexcept
+  {
+    if (is_delivered)
+    {
+      std::error_code ec;
+      std::filesystem::remove(path_of(user_id, sequence), ec);
+      unreserve(user_id, size);
+      return;
+    }
+
+    std::unique_lock lock{mutex_};
+    pending_[user_id].emplace(sequence, size);
+  }
+} // namespace ar
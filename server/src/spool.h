@@ -0,0 +1,180 @@
+#pragma once
+
+#include <condition_variable>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "message/message.h"
+#include "message/payload.h"
+#include "native_file.h"
+#include "user.h"
+#include "util/types.h"
+
+namespace ar
+{
+  class Spool;
+
+  // Spooled messages saved on the spool, the file is deleted when it is delivered. Otherwise it
+  // is kept on the spool until the recipient logs in again. The file holds one message, or every
+  // message of a streamed transfer.
+  class SpoolFile
+  {
+    friend class Spool;
+
+  public:
+    SpoolFile() noexcept = default;
+    ~SpoolFile() noexcept;
+
+    SpoolFile(SpoolFile&& other) noexcept;
+    SpoolFile& operator=(SpoolFile&& other) noexcept;
+
+    SpoolFile(const SpoolFile&) = delete;
+    SpoolFile& operator=(const SpoolFile&) = delete;
+
+    [[nodiscard]] std::filesystem::path path() const noexcept;
+
+    // header and body bytes
+    [[nodiscard]] u64 size() const noexcept;
+
+    void delivered() noexcept;
+
+  private:
+    SpoolFile(Spool* spool, User::id_type user_id, u64 sequence, u64 size) noexcept;
+
+    void release() noexcept;
+
+  private:
+    Spool* spool_ = nullptr;
+    User::id_type user_id_ = User::SERVER_ID;
+    u64 sequence_ = 0;
+    u64 size_ = 0;
+    bool is_delivered_ = false;
+  };
+
+  struct SpoolLimits
+  {
+    u64 user_bytes = 0;  // bytes waiting for each user, 0 for no limit
+    u64 total_bytes = 0; // bytes of the whole spool, 0 for no limit
+  };
+
+  // Directory of relayed messages waiting for their recipients, which are offline or too slow to
+  // keep the messages in memory. Each message is saved as `<user id>-<sequence>.msg`, so the
+  // messages are kept across restarts and delivered in the order they are saved. The messages of
+  // streamed transfer are appended into one file, which is only delivered once the transfer ends.
+  // The files are written and synced by the writer thread, the callbacks are called from it in
+  // the order of the writes. The writes over the limits fail with SPOOL_QUOTA_EXCEEDED.
+  class Spool
+  {
+    friend class SpoolFile;
+
+  public:
+    using write_callback_type =
+        std::move_only_function<void(std::expected<SpoolFile, std::string_view>)>;
+    using stream_callback_type =
+        std::move_only_function<void(std::expected<void, std::string_view>)>;
+
+    // streamed transfer of the sender connection for the recipient
+    struct TransferKey
+    {
+      User::id_type user_id;
+      u16 connection_id;
+      SendFileBeginPayload::transfer_id_type transfer_id;
+
+      auto operator<=>(const TransferKey&) const = default;
+    };
+
+    // the transfer is not started on the spool, or it is already ended
+    constexpr static std::string_view TRANSFER_NOT_SPOOLED{"the transfer is not spooled"};
+    // the transfer is dropped by the previous message, its failure is already reported
+    constexpr static std::string_view TRANSFER_ABORTED{"the transfer is aborted"};
+
+    static std::expected<std::unique_ptr<Spool>, std::string_view> open(
+        std::filesystem::path directory, SpoolLimits limits = {}) noexcept;
+
+    // the pending writes are done before it returns
+    ~Spool() noexcept;
+
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    // save the message for the user
+    void write(User::id_type user_id, Message msg, write_callback_type callback) noexcept;
+
+    // append the streamed message into the file of its transfer, the transfer is started by
+    // SendFileBegin and the file is saved by SendFileEnd
+    void write_stream(const TransferKey& key, Message msg, stream_callback_type callback) noexcept;
+
+    // the transfer is started and not ended yet, so its next messages should be spooled too
+    [[nodiscard]] bool is_streaming(const TransferKey& key) const noexcept;
+
+    // drop the unfinished transfers of the sender connection
+    void abort_streams(u16 connection_id) noexcept;
+
+    // finish the pending writes and stop the writer thread, the callbacks are not called after it
+    void close() noexcept;
+
+    // take the saved messages of the user in the order they are saved
+    std::vector<SpoolFile> take(User::id_type user_id) noexcept;
+
+    [[nodiscard]] bool contains(User::id_type user_id) const noexcept;
+
+  private:
+    struct Transfer
+    {
+      u64 sequence;
+      NativeFile file;
+      u64 size;
+      bool is_aborted;
+    };
+
+    Spool(std::filesystem::path directory, SpoolLimits limits) noexcept;
+
+    [[nodiscard]] std::filesystem::path path_of(User::id_type user_id, u64 sequence) const
+      noexcept;
+
+    // account the bytes into the quota of the user, it will return false when it is exceeded
+    bool reserve(User::id_type user_id, u64 size) noexcept;
+    void unreserve(User::id_type user_id, u64 size) noexcept;
+
+    // run on the writer thread
+    void post(std::move_only_function<void()> job) noexcept;
+    void writer() noexcept;
+    std::expected<SpoolFile, std::string_view> save(User::id_type user_id,
+                                                    const Message& msg) noexcept;
+    std::expected<void, std::string_view> append(const TransferKey& key,
+                                                 const Message& msg) noexcept;
+    void abort(const TransferKey& key, Transfer& transfer) noexcept;
+
+    // delete the delivered file, or keep it for the next take
+    void release(User::id_type user_id, u64 sequence, u64 size, bool is_delivered) noexcept;
+
+  private:
+    std::filesystem::path directory_;
+    SpoolLimits limits_;
+
+    mutable std::mutex mutex_;
+    u64 next_sequence_;
+    // size of the files waiting for each user by sequence
+    std::unordered_map<User::id_type, std::map<u64, u64>> pending_;
+    // bytes of the files and unfinished transfers
+    std::unordered_map<User::id_type, u64> usage_;
+    u64 total_usage_;
+    std::set<TransferKey> streaming_;
+
+    std::condition_variable cv_;
+    std::vector<std::move_only_function<void()>> jobs_;
+    bool is_stopping_;
+    // only touched by the writer thread
+    std::map<TransferKey, Transfer> transfers_;
+    std::jthread writer_thread_;
+  };
+} // namespace ar
@@ -0,0 +1,238 @@
+#include "trace.h"
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+#include <fstream>
+#include <iterator>
+
+#include "shard.h"
+
+namespace ar
+{
+  using namespace std::literals;
+  namespace me = magic_enum;
+
+  namespace
+  {
+    double to_microseconds(TraceEvent::clock_type::duration duration) noexcept
+    {
+      return static_cast<double>(
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()) /
+             1e3;
+    }
+
+    void write_args(std::string& out, const TraceEvent& event) noexcept
+    {
+      fmt::format_to(std::back_inserter(out), R"("args":{{"connection":{})", event.connection);
+      if (event.type)
+        fmt::format_to(std::back_inserter(out), R"(,"type":"{}")", me::enum_name(*event.type));
+      if (event.peer != 0)
+        fmt::format_to(std::back_inserter(out), R"(,"peer":{})", event.peer);
+      out += '}';
+    }
+  } // namespace
+
+  void Tracer::enable(usize capacity) noexcept
+  {
+    s_capacity = std::max<usize>(capacity, 1);
+    s_started_at = clock_type::now();
+    s_is_enabled.store(true, std::memory_order_release);
+  }
+
+  bool Tracer::is_enabled() noexcept
+  {
+    return s_is_enabled.load(std::memory_order_relaxed);
+  }
+
+  void Tracer::record(const TraceEvent& event) noexcept
+  {
+    auto& ring = current_ring();
+    std::lock_guard lock{ring.mutex};
+    if (ring.events.size() < s_capacity)
+    {
+      ring.events.push_back(event);
+      return;
+    }
+    ring.events[ring.next] = event;
+    ring.next = (ring.next + 1) % s_capacity;
+    ring.is_full = true;
+  }
+
+  u64 Tracer::next_async_id() noexcept
+  {
+    return s_next_async_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Tracer::Ring& Tracer::current_ring() noexcept
+  {
+    thread_local Ring* ring = nullptr;
+    if (ring)
+      return *ring;
+
+    std::lock_guard lock{s_rings_mutex};
+    auto& created = s_rings.emplace_back(std::make_unique<Ring>());
+    auto shard = Shard::current();
+    created->thread_name = shard ? fmt::format("shard-{}", shard->id())
+                                 : fmt::format("thread-{}", s_rings.size());
+    created->events.reserve(s_capacity);
+    ring = created.get();
+    return *ring;
+  }
+
+  std::string Tracer::chrome_trace() noexcept
+  {
+    struct Snapshot
+    {
+      std::string thread_name;
+      std::vector<TraceEvent> events; // from the oldest
+    };
+
+    // the events are copied under the locks and formatted after, so the recording threads only
+    // wait for the copy. The rings are never removed, so they are kept after the lock
+    std::vector<Ring*> rings{};
+    {
+      std::lock_guard rings_lock{s_rings_mutex};
+      for (const auto& ring : s_rings)
+        rings.emplace_back(ring.get());
+    }
+    std::vector<Snapshot> snapshots(rings.size());
+    for (usize tid = 0; tid < rings.size(); ++tid)
+    {
+      auto& ring = *rings[tid];
+      auto& snapshot = snapshots[tid];
+      std::lock_guard lock{ring.mutex};
+      snapshot.thread_name = ring.thread_name;
+      // the oldest event is at next once the ring is wrapped
+      auto oldest = ring.events.begin() + static_cast<std::ptrdiff_t>(ring.is_full ? ring.next : 0);
+      snapshot.events.reserve(ring.events.size());
+      snapshot.events.insert(snapshot.events.end(), oldest, ring.events.end());
+      snapshot.events.insert(snapshot.events.end(), ring.events.begin(), oldest);
+    }
+
+    std::string out{R"({"displayTimeUnit":"ns","traceEvents":[)"};
+    bool is_first = true;
+    auto separate = [&] {
+      if (!is_first)
+        out += ',';
+      is_first = false;
+    };
+
+    for (usize tid = 0; tid < snapshots.size(); ++tid)
+    {
+      const auto& snapshot = snapshots[tid];
+      separate();
+      fmt::format_to(std::back_inserter(out),
+                     R"({{"ph":"M","name":"thread_name","pid":1,"tid":{},)"
+                     R"("args":{{"name":"{}"}}}})",
+                     tid, snapshot.thread_name);
+
+      for (const auto& event : snapshot.events)
+      {
+        auto start = to_microseconds(event.start - s_started_at);
+        auto end = to_microseconds(event.end - s_started_at);
+        separate();
+        if (event.async_id == 0)
+        {
+          fmt::format_to(std::back_inserter(out),
+                         R"({{"ph":"X","name":"{}","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f},)",
+                         event.name, tid, start, end - start);
+          write_args(out, event);
+          out += '}';
+          continue;
+        }
+        // async pair, the overlapping spans are laid out on their own rows
+        fmt::format_to(std::back_inserter(out),
+                       R"({{"ph":"b","cat":"connection","name":"{}","id":{},"pid":1,"tid":{},)"
+                       R"("ts":{:.3f},)",
+                       event.name, event.async_id, tid, start);
+        write_args(out, event);
+        fmt::format_to(std::back_inserter(out),
+                       R"(}},{{"ph":"e","cat":"connection","name":"{}","id":{},"pid":1,"tid":{},)"
+                       R"("ts":{:.3f}}})",
+                       event.name, event.async_id, tid, end);
+      }
+    }
+    out += "]}";
+    return out;
+  }
+
+  std::expected<void, std::string_view> Tracer::write_chrome_trace(
+      const std::filesystem::path& path) noexcept
+  {
+    auto trace = chrome_trace();
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    if (!file.is_open())
+      return std::unexpected{"failed to open the trace file"sv};
+    file.write(trace.data(), static_cast<std::streamsize>(trace.size()));
+    if (!file)
+      return std::unexpected{"failed to write the trace file"sv};
+    return {};
+  }
+
+  TraceSpan::TraceSpan(std::string_view name) noexcept
+    : is_enabled_{Tracer::is_enabled()},
+      event_{},
+      previous_{}
+  {
+    if (!is_enabled_)
+      return;
+    event_ = TraceEvent{.name = name, .start = Tracer::clock_type::now(), .end = {},
+                        .async_id = 0, .connection = s_context.connection,
+                        .type = s_context.type};
+    previous_ = s_context;
+  }
+
+  TraceSpan::TraceSpan(std::string_view name, u16 connection, Message::Type type, u16 peer)
+    noexcept
+    : is_enabled_{Tracer::is_enabled()},
+      event_{},
+      previous_{}
+  {
+    if (!is_enabled_)
+      return;
+    event_ = TraceEvent{.name = name, .start = Tracer::clock_type::now(), .end = {},
+                        .async_id = 0, .connection = connection, .type = type, .peer = peer};
+    previous_ = std::exchange(s_context, Context{.connection = connection, .type = type});
+  }
+
+  TraceSpan::~TraceSpan() noexcept
+  {
+    if (!is_enabled_)
+      return;
+    event_.end = Tracer::clock_type::now();
+    s_context = previous_;
+    Tracer::record(event_);
+  }
+
+  AsyncTraceSpan::AsyncTraceSpan(std::string_view name, u16 connection,
+                                 std::optional<Message::Type> type) noexcept
+    : is_enabled_{Tracer::is_enabled()},
+      event_{}
+  {
+    if (!is_enabled_)
+      return;
+    event_ = TraceEvent{.name = name, .start = Tracer::clock_type::now(), .end = {},
+                        .async_id = Tracer::next_async_id(), .connection = connection,
+                        .type = type};
+  }
+
+  AsyncTraceSpan::~AsyncTraceSpan() noexcept
+  {
+    if (!is_enabled_)
+      return;
+    event_.end = Tracer::clock_type::now();
+    Tracer::record(event_);
+  }
+
+  void AsyncTraceSpan::record(std::string_view name, TraceEvent::clock_type::time_point start,
+                              TraceEvent::clock_type::time_point end, u16 connection,
+                              std::optional<Message::Type> type) noexcept
+  {
+    if (!Tracer::is_enabled())
+      return;
+    Tracer::record(TraceEvent{.name = name, .start = start, .end = end,
+                              .async_id = Tracer::next_async_id(), .connection = connection,
+                              .type = type});
+  }
+} // namespace ar
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "message/message.h"
+#include "util/types.h"
+
+namespace ar
+{
+  struct TraceEvent
+  {
+    using clock_type = std::chrono::steady_clock;
+
+    std::string_view name; // only static strings
+    clock_type::time_point start;
+    clock_type::time_point end;
+    u64 async_id; // 0 for the span on the thread track
+    u16 connection;
+    std::optional<Message::Type> type;
+    u16 peer = 0; // sender connection of the relayed message, 0 for the other spans
+  };
+
+  // Opt-in span tracing exported as chrome trace json, which could be opened by perfetto or
+  // chrome://tracing. Each thread records into its own ring buffer, so the oldest events are
+  // overwritten instead of growing. When it is disabled each span only costs one relaxed load.
+  class Tracer
+  {
+  public:
+    using clock_type = TraceEvent::clock_type;
+
+    constexpr static usize DEFAULT_CAPACITY = 64 * 1024;
+
+    // events kept by each thread, it should be called before the threads are started
+    static void enable(usize capacity = DEFAULT_CAPACITY) noexcept;
+
+    [[nodiscard]] static bool is_enabled() noexcept;
+
+    static void record(const TraceEvent& event) noexcept;
+
+    // id of the span which could overlap the other spans of the thread
+    [[nodiscard]] static u64 next_async_id() noexcept;
+
+    [[nodiscard]] static std::string chrome_trace() noexcept;
+
+    static std::expected<void, std::string_view> write_chrome_trace(
+        const std::filesystem::path& path) noexcept;
+
+  private:
+    struct Ring
+    {
+      std::string thread_name;
+      std::vector<TraceEvent> events; // only written by the owner thread
+      usize next = 0;
+      bool is_full = false;
+      std::mutex mutex; // taken by the owner thread and the exporter
+    };
+
+    static Ring& current_ring() noexcept;
+
+  private:
+    inline static std::atomic_bool s_is_enabled{false};
+    inline static usize s_capacity{DEFAULT_CAPACITY};
+    inline static std::atomic<u64> s_next_async_id{1};
+    inline static clock_type::time_point s_started_at{};
+
+    inline static std::mutex s_rings_mutex;
+    inline static std::vector<std::unique_ptr<Ring>> s_rings;
+  };
+
+  // Span of synchronous code on the thread track. Nested span without connection takes it and
+  // the message type from the enclosing span, so the crypto calls are tagged with the message.
+  class TraceSpan
+  {
+  public:
+    explicit TraceSpan(std::string_view name) noexcept;
+    // the relay span is tagged with the peer too, so the message could be followed from the
+    // sender connection into the opponent connection
+    TraceSpan(std::string_view name, u16 connection, Message::Type type, u16 peer = 0) noexcept;
+    ~TraceSpan() noexcept;
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+  private:
+    struct Context
+    {
+      u16 connection;
+      std::optional<Message::Type> type;
+    };
+
+    bool is_enabled_;
+    TraceEvent event_;
+    Context previous_;
+
+    inline static thread_local Context s_context{};
+  };
+
+  // Span of coroutine, it could be suspended in the middle, so it is shown on its own row instead
+  // of the thread track. It doesn't take the context of the enclosing span.
+  class AsyncTraceSpan
+  {
+  public:
+    AsyncTraceSpan(std::string_view name, u16 connection,
+                   std::optional<Message::Type> type = std::nullopt) noexcept;
+    ~AsyncTraceSpan() noexcept;
+
+    AsyncTraceSpan(const AsyncTraceSpan&) = delete;
+    AsyncTraceSpan& operator=(const AsyncTraceSpan&) = delete;
+
+    // record the span which is already passed
+    static void record(std::string_view name, TraceEvent::clock_type::time_point start,
+                       TraceEvent::clock_type::time_point end, u16 connection,
+                       std::optional<Message::Type> type) noexcept;
+
+  private:
+    bool is_enabled_;
+    TraceEvent event_;
+  };
+} // namespace ar
@@ -0,0 +1,159 @@
+#include "user_registry.h"
+
+#include <functional>
+#include <mutex>
+
+#include "message/feedback.h"
+
+namespace ar
+{
+  UserRegistry::UserRegistry(UserStore* store) noexcept
+    : store_{store},
+      ids_{std::make_unique<std::atomic<User*>[]>(MAX_USERS + 1)},
+      compressions_{std::make_unique<std::atomic<u8>[]>(MAX_USERS + 1)},
+      next_id_{store ? std::max<u32>(store->next_id(), User::SERVER_ID + 1) : User::SERVER_ID + 1}
+  {
+  }
+
+  std::expected<User*, std::string_view> UserRegistry::add(std::string name,
+                                                          std::string credential,
+                                                          UserStore::callback_type on_commit)
+    noexcept
+  {
+    auto& stripe = stripe_of(name);
+    std::unique_lock lock{stripe.mutex};
+    if (stripe.users.contains(name) || stripe.pending.contains(name) ||
+        (store_ && store_->load(name)))
+      return std::unexpected{USER_ALREADY_EXIST};
+
+    auto id = next_id_.fetch_add(1);
+    if (id > MAX_USERS)
+      return std::unexpected{USER_LIMIT_REACHED};
+
+    auto user = std::make_unique<User>(static_cast<User::id_type>(id), std::move(name),
+                                       std::move(credential), std::vector<u8>{});
+    auto result = user.get();
+    if (!store_)
+    {
+      stripe.users.emplace(result->name, std::move(user));
+      ids_[id].store(result, std::memory_order_release);
+      if (on_commit)
+        on_commit(true);
+      return result;
+    }
+
+    // the user is only published once it is in the log, so the public key could not be appended
+    // before it and a failed registration doesn't leave the name taken
+    stripe.pending.emplace(result->name, std::move(user));
+    store_->append_user(*result, [this, name = std::string{result->name},
+                                  on_commit = std::move(on_commit)](bool is_committed) mutable {
+      on_user_committed(name, is_committed);
+      if (on_commit)
+        on_commit(is_committed);
+    });
+    return result;
+  }
+
+  void UserRegistry::on_user_committed(std::string_view name, bool is_committed) noexcept
+  {
+    auto& stripe = stripe_of(name);
+    std::unique_lock lock{stripe.mutex};
+    auto node = stripe.pending.extract(name);
+    if (node.empty() || !is_committed)
+      return;
+
+    // it could be loaded from the store by lookup once the index is updated
+    auto user = node.mapped().get();
+    if (stripe.users.contains(name))
+      return;
+    stripe.users.emplace(user->name, std::move(node.mapped()));
+    ids_[user->id].store(user, std::memory_order_release);
+  }
+
+  User* UserRegistry::find(std::string_view name) const noexcept
+  {
+    auto& stripe = stripe_of(name);
+    {
+      std::shared_lock lock{stripe.mutex};
+      auto it = stripe.users.find(name);
+      if (it != stripe.users.end())
+        return it->second.get();
+    }
+
+    if (!store_)
+      return nullptr;
+    auto user = store_->load(name);
+    if (!user)
+      return nullptr;
+    return insert_loaded(std::move(user.value()));
+  }
+
+  User* UserRegistry::find(User::id_type id) const noexcept
+  {
+    if (auto user = ids_[id].load(std::memory_order_acquire))
+      return user;
+
+    if (!store_)
+      return nullptr;
+    auto user = store_->load(id);
+    if (!user)
+      return nullptr;
+    return insert_loaded(std::move(user.value()));
+  }
+
+  void UserRegistry::public_key(User& user, std::span<const u8> key, u8 compressions,
+                                UserStore::callback_type on_commit) noexcept
+  {
+    auto& stripe = stripe_of(user.name);
+    std::unique_lock lock{stripe.mutex};
+    user.public_key.assign(key.begin(), key.end());
+    compressions_[user.id].store(compressions, std::memory_order_relaxed);
+
+    if (store_)
+      store_->append_public_key(user.id, key, std::move(on_commit));
+    else if (on_commit)
+      on_commit(true);
+  }
+
+  std::vector<u8> UserRegistry::public_key(const User& user) const noexcept
+  {
+    auto& stripe = stripe_of(user.name);
+    std::shared_lock lock{stripe.mutex};
+    return user.public_key;
+  }
+
+  u8 UserRegistry::compressions(const User& user) const noexcept
+  {
+    return compressions_[user.id].load(std::memory_order_relaxed);
+  }
+
+  usize UserRegistry::size() const noexcept
+  {
+    return std::min<usize>(next_id_.load(), MAX_USERS + 1) - (User::SERVER_ID + 1);
+  }
+
+  User* UserRegistry::insert_loaded(User&& user) const noexcept
+  {
+    auto& stripe = stripe_of(user.name);
+    std::unique_lock lock{stripe.mutex};
+    if (auto it = stripe.users.find(user.name); it != stripe.users.end())
+      return it->second.get();
+
+    auto id = user.id;
+    auto loaded = std::make_unique<User>(std::move(user));
+    auto result = loaded.get();
+    stripe.users.emplace(result->name, std::move(loaded));
+    ids_[id].store(result, std::memory_order_release);
+    return result;
+  }
+
+  UserRegistry::Stripe& UserRegistry::stripe_of(std::string_view name) noexcept
+  {
+    return stripes_[std::hash<std::string_view>{}(name) % STRIPE_COUNT];
+  }
+
+  const UserRegistry::Stripe& UserRegistry::stripe_of(std::string_view name) const noexcept
+  {
+    return stripes_[std::hash<std::string_view>{}(name) % STRIPE_COUNT];
+  }
+} // namespace ar
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <expected>
+#include <limits>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "user.h"
+#include "user_store.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // User database indexed by name and by id. Users are never removed, so the returned pointers
+  // stay valid as long as the registry. Lookup by id never takes a lock, lookup by name takes the
+  // shared lock of the stripe that owns the name. Name, id and password are immutable after the
+  // user is added, the public key should only be accessed through the registry. The password is
+  // kept as salted hash, it should be checked with verify_password.
+  // When the store is used, the users in it are loaded on their first lookup and the changes are
+  // appended into it, the callbacks are called once the change is durable. The added user is only
+  // found after it is committed, until then its name is reserved. The user is dropped when the
+  // commit fails, its id is not reused until restart.
+  class UserRegistry
+  {
+  public:
+    explicit UserRegistry(UserStore* store = nullptr) noexcept;
+
+    UserRegistry(const UserRegistry&) = delete;
+    UserRegistry& operator=(const UserRegistry&) = delete;
+
+    // the credential is made by hash_password. It will return error message when the name is
+    // already used or there is no id left. The returned user could be destroyed when the commit
+    // fails, it should not be used after that.
+    std::expected<User*, std::string_view> add(std::string name, std::string credential,
+                                               UserStore::callback_type on_commit = {}) noexcept;
+
+    [[nodiscard]] User* find(std::string_view name) const noexcept;
+
+    [[nodiscard]] User* find(User::id_type id) const noexcept;
+
+    // the compressions are advertised along with the key, they are only kept in memory
+    void public_key(User& user, std::span<const u8> key, u8 compressions,
+                    UserStore::callback_type on_commit = {}) noexcept;
+
+    // copy of the serialized public key
+    [[nodiscard]] std::vector<u8> public_key(const User& user) const noexcept;
+
+    // bits of CompressionType the owner of the public key could decompress, 0 when it is unknown
+    [[nodiscard]] u8 compressions(const User& user) const noexcept;
+
+    [[nodiscard]] usize size() const noexcept;
+
+    // iterate users by id, users added while iterating could be skipped. Every user in the store
+    // is loaded.
+    template <typename F>
+    void for_each(F&& func) const noexcept;
+
+  private:
+    constexpr static usize STRIPE_COUNT = 64;
+    constexpr static usize MAX_USERS = std::numeric_limits<User::id_type>::max();
+
+    // keep the locks of different stripes in different cache lines
+    struct alignas(64) Stripe
+    {
+      mutable std::shared_mutex mutex;
+      // the key refers to the name of the owned user, users loaded from the store are added on
+      // lookup
+      mutable std::unordered_map<std::string_view, std::unique_ptr<User>> users;
+      // users added but not committed into the store yet
+      std::unordered_map<std::string_view, std::unique_ptr<User>> pending;
+    };
+
+    Stripe& stripe_of(std::string_view name) noexcept;
+    const Stripe& stripe_of(std::string_view name) const noexcept;
+
+    // add the user loaded from the store, it will return the existing one when it is already
+    // loaded by another thread
+    User* insert_loaded(User&& user) const noexcept;
+
+    // move the pending user into the users when it is committed, drop it otherwise
+    void on_user_committed(std::string_view name, bool is_committed) noexcept;
+
+  private:
+    UserStore* store_;
+    std::array<Stripe, STRIPE_COUNT> stripes_;
+    std::unique_ptr<std::atomic<User*>[]> ids_;
+    std::unique_ptr<std::atomic<u8>[]> compressions_; // by id
+    std::atomic<u32> next_id_;
+  };
+
+  template <typename F>
+  void UserRegistry::for_each(F&& func) const noexcept
+  {
+    auto last = std::min<usize>(next_id_.load(), MAX_USERS + 1);
+    for (usize id = User::SERVER_ID + 1; id < last; ++id)
+    {
+      if (auto user = find(static_cast<User::id_type>(id)))
+        func(*user);
+    }
+  }
+} // namespace ar
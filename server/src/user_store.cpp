@@ -0,0 +1,428 @@
+#include "user_store.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "logger.h"
+
+namespace ar
+{
+  namespace
+  {
+    constexpr u64 INDEX_MAGIC = 0x5844'4955'524f'4e41; // "ANORUIDX"
+    constexpr u32 INDEX_FORMAT = 1;
+
+    struct IndexHeader
+    {
+      u64 magic;
+      u32 format;
+      u32 is_clean;      // the index is only trusted when the store is closed cleanly
+      u64 indexed_size;  // bytes of log covered by the index
+      u32 next_id;
+      u32 reserved;
+    };
+
+    // size, checksum, type, reserved and id
+    struct RecordHeader
+    {
+      u32 size; // payload bytes
+      u32 checksum;
+      u8 type;
+      u8 reserved;
+      User::id_type id;
+    };
+
+    constexpr usize RECORD_HEADER_SIZE = sizeof(RecordHeader);
+    static_assert(RECORD_HEADER_SIZE == 12);
+
+    // the index file is the header followed by offset of user record by id, offset of the last
+    // public key record by id and open addressing table of user id by name. The offsets are
+    // stored plus one, so 0 means there is no record.
+    constexpr usize INDEX_HEADER_SIZE = 64;
+    static_assert(sizeof(IndexHeader) <= INDEX_HEADER_SIZE);
+
+    // stable across builds unlike std::hash
+    u64 fnv1a(std::span<const u8> bytes, u64 hash = 0xcbf2'9ce4'8422'2325) noexcept
+    {
+      for (auto byte : bytes)
+      {
+        hash ^= byte;
+        hash *= 0x100'0000'01b3;
+      }
+      return hash;
+    }
+
+    u64 hash_name(std::string_view name) noexcept
+    {
+      return fnv1a({reinterpret_cast<const u8*>(name.data()), name.size()});
+    }
+
+    u32 record_checksum(const RecordHeader& header, std::span<const u8> payload) noexcept
+    {
+      const u8 prefix[] = {header.type, static_cast<u8>(header.id), static_cast<u8>(header.id >> 8)};
+      return static_cast<u32>(fnv1a(payload, fnv1a(prefix)));
+    }
+  } // namespace
+
+  std::expected<std::unique_ptr<UserStore>, std::string_view> UserStore::open(
+      const std::filesystem::path& directory) noexcept
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec)
+      return std::unexpected{"failed to create the store directory"sv};
+
+    std::unique_ptr<UserStore> store{new UserStore{}};
+    auto log = NativeFile::open(directory / LOG_FILENAME);
+    if (!log)
+      return std::unexpected{log.error()};
+    store->log_ = std::move(log.value());
+
+    if (auto result = store->open_index(directory / INDEX_FILENAME); !result)
+      return std::unexpected{result.error()};
+
+    // the log could be created by the older server with the default permissions
+    constexpr auto owner_only = std::filesystem::perms::owner_read |
+                                std::filesystem::perms::owner_write;
+    for (auto filename : {LOG_FILENAME, INDEX_FILENAME})
+    {
+      std::filesystem::permissions(directory / filename, owner_only, ec);
+      if (ec)
+        return std::unexpected{"failed to restrict the permissions of the store files"sv};
+    }
+    if (auto result = store->recover(); !result)
+      return std::unexpected{result.error()};
+
+    store->writer_thread_ = std::jthread{[store = store.get()] {
+      store->writer();
+    }};
+    Logger::set_thread_name("USER-STORE", store->writer_thread_.get_id());
+    return store;
+  }
+
+  UserStore::~UserStore() noexcept
+  {
+    bool is_opened = writer_thread_.joinable();
+    {
+      std::unique_lock lock{mutex_};
+      is_stopping_ = true;
+    }
+    cv_.notify_one();
+    if (!is_opened)
+      return;
+    writer_thread_.join();
+
+    // every record is indexed, so the next open doesn't need to rebuild it
+    auto header = reinterpret_cast<IndexHeader*>(index_.bytes().data());
+    if (!index_.sync())
+      return;
+    header->is_clean = 1;
+    index_.sync();
+  }
+
+  u32 UserStore::next_id() const noexcept
+  {
+    auto header = reinterpret_cast<IndexHeader*>(index_.bytes().data());
+    return std::atomic_ref{header->next_id}.load(std::memory_order_relaxed);
+  }
+
+  std::optional<User> UserStore::load(std::string_view name) const noexcept
+  {
+    auto names = reinterpret_cast<User::id_type*>(
+        index_.bytes().data() + INDEX_HEADER_SIZE + 2 * ID_COUNT * sizeof(u64));
+    auto slot = hash_name(name) % NAME_SLOTS;
+    for (usize i = 0; i < NAME_SLOTS; ++i, slot = (slot + 1) % NAME_SLOTS)
+    {
+      auto id = std::atomic_ref{names[slot]}.load(std::memory_order_acquire);
+      if (id == User::SERVER_ID)
+        return std::nullopt;
+
+      auto user = read_user(id);
+      if (user && user->name == name)
+        return user;
+    }
+    return std::nullopt;
+  }
+
+  std::optional<User> UserStore::load(User::id_type id) const noexcept
+  {
+    if (id == User::SERVER_ID)
+      return std::nullopt;
+    return read_user(id);
+  }
+
+  void UserStore::append_user(const User& user, callback_type callback) noexcept
+  {
+    // name size, name and the salted hash of password
+    auto name_size = static_cast<u16>(user.name.size());
+    std::vector<u8> bytes(RECORD_HEADER_SIZE + sizeof(name_size) + user.name.size() +
+                          user.password.size());
+    auto payload = bytes.data() + RECORD_HEADER_SIZE;
+    std::memcpy(payload, &name_size, sizeof(name_size));
+    std::memcpy(payload + sizeof(name_size), user.name.data(), user.name.size());
+    std::memcpy(payload + sizeof(name_size) + user.name.size(), user.password.data(),
+                user.password.size());
+
+    std::string_view name{reinterpret_cast<const char*>(payload + sizeof(name_size)),
+                          user.name.size()};
+    append(Pending{.type = RecordType::User, .id = user.id, .name = name,
+                   .bytes = std::move(bytes), .callback = std::move(callback)});
+  }
+
+  void UserStore::append_public_key(User::id_type id, std::span<const u8> key,
+                                    callback_type callback) noexcept
+  {
+    std::vector<u8> bytes(RECORD_HEADER_SIZE + key.size());
+    std::ranges::copy(key, bytes.begin() + RECORD_HEADER_SIZE);
+    append(Pending{.type = RecordType::PublicKey, .id = id, .name = {},
+                   .bytes = std::move(bytes), .callback = std::move(callback)});
+  }
+
+  std::expected<void, std::string_view> UserStore::open_index(
+      const std::filesystem::path& path) noexcept
+  {
+    constexpr usize index_size = INDEX_HEADER_SIZE + 2 * ID_COUNT * sizeof(u64) +
+                                 NAME_SLOTS * sizeof(User::id_type);
+
+    auto file = NativeFile::open(path);
+    if (!file)
+      return std::unexpected{file.error()};
+    bool is_resized = file->size() != index_size;
+    if (is_resized && !file->resize(index_size))
+      return std::unexpected{"failed to resize the index file"sv};
+
+    auto view = file->map(index_size, true);
+    if (!view)
+      return std::unexpected{view.error()};
+    index_file_ = std::move(file.value());
+    index_ = std::move(view.value());
+
+    auto header = reinterpret_cast<IndexHeader*>(index_.bytes().data());
+    bool is_valid = !is_resized && header->magic == INDEX_MAGIC &&
+                    header->format == INDEX_FORMAT && header->is_clean &&
+                    header->indexed_size <= log_.size();
+    if (!is_valid)
+    {
+      Logger::warn("user index is missing or not closed cleanly, it will be rebuilt from the log");
+      std::ranges::fill(index_.bytes(), 0);
+      header->magic = INDEX_MAGIC;
+      header->format = INDEX_FORMAT;
+      header->indexed_size = 0;
+      header->next_id = User::SERVER_ID + 1;
+    }
+
+    // it is only trusted again after the store is closed
+    header->is_clean = 0;
+    if (!index_.sync())
+      return std::unexpected{"failed to sync the index file"sv};
+    return {};
+  }
+
+  std::expected<void, std::string_view> UserStore::recover() noexcept
+  {
+    auto size = log_.size();
+    auto view = log_.map(size, false);
+    if (!view)
+      return std::unexpected{view.error()};
+    log_view_ = std::move(view.value());
+
+    auto header = reinterpret_cast<IndexHeader*>(index_.bytes().data());
+    auto bytes = log_view_.bytes();
+    auto offset = header->indexed_size;
+    while (offset + RECORD_HEADER_SIZE <= size)
+    {
+      RecordHeader record{};
+      std::memcpy(&record, bytes.data() + offset, RECORD_HEADER_SIZE);
+      if (offset + RECORD_HEADER_SIZE + record.size > size)
+        break;
+
+      auto payload = bytes.subspan(offset + RECORD_HEADER_SIZE, record.size);
+      if (record_checksum(record, payload) != record.checksum)
+        break;
+
+      auto type = static_cast<RecordType>(record.type);
+      std::string_view name{};
+      if (type == RecordType::User)
+      {
+        u16 name_size = 0;
+        if (payload.size() < sizeof(name_size))
+          break;
+        std::memcpy(&name_size, payload.data(), sizeof(name_size));
+        if (sizeof(name_size) + name_size > payload.size())
+          break;
+        name = {reinterpret_cast<const char*>(payload.data() + sizeof(name_size)), name_size};
+      }
+      else if (type != RecordType::PublicKey)
+        break;
+
+      index_record(type, record.id, name, offset);
+      offset += RECORD_HEADER_SIZE + record.size;
+    }
+
+    Logger::info(fmt::format("user store indexed {} bytes of log, {} bytes were already indexed",
+                             offset - header->indexed_size, header->indexed_size));
+
+    // the last records are torn when the server is stopped while writing them
+    if (offset != size)
+    {
+      Logger::warn(fmt::format("dropping {} bytes of torn records at the end of user log",
+                               size - offset));
+      log_view_ = {};
+      if (!log_.resize(offset) || !log_.sync())
+        return std::unexpected{"failed to truncate the log file"sv};
+      view = log_.map(offset, false);
+      if (!view)
+        return std::unexpected{view.error()};
+      log_view_ = std::move(view.value());
+    }
+
+    log_size_ = offset;
+    header->indexed_size = offset;
+    return {};
+  }
+
+  void UserStore::index_record(RecordType type, User::id_type id, std::string_view name,
+                               u64 offset) noexcept
+  {
+    auto data = index_.bytes().data();
+    auto header = reinterpret_cast<IndexHeader*>(data);
+    auto users = reinterpret_cast<u64*>(data + INDEX_HEADER_SIZE);
+    auto keys = users + ID_COUNT;
+    auto names = reinterpret_cast<User::id_type*>(keys + ID_COUNT);
+
+    if (type == RecordType::PublicKey)
+    {
+      std::atomic_ref{keys[id]}.store(offset + 1, std::memory_order_release);
+      return;
+    }
+
+    // the offset is stored first, so the name is never found without its record
+    std::atomic_ref{users[id]}.store(offset + 1, std::memory_order_release);
+    auto slot = hash_name(name) % NAME_SLOTS;
+    while (std::atomic_ref{names[slot]}.load(std::memory_order_relaxed) != User::SERVER_ID)
+      slot = (slot + 1) % NAME_SLOTS;
+    std::atomic_ref{names[slot]}.store(id, std::memory_order_release);
+
+    std::atomic_ref next_id{header->next_id};
+    if (next_id.load(std::memory_order_relaxed) <= id)
+      next_id.store(id + 1u, std::memory_order_relaxed);
+  }
+
+  std::optional<User> UserStore::read_user(User::id_type id) const noexcept
+  {
+    auto data = index_.bytes().data();
+    auto users = reinterpret_cast<u64*>(data + INDEX_HEADER_SIZE);
+    auto keys = users + ID_COUNT;
+
+    // the records written after the store is opened are not mapped
+    auto bytes = log_view_.bytes();
+    // the index could point anywhere when it is corrupted, so the record should fit the view
+    auto read_payload = [&](u64 stored_offset,
+                            RecordType type) -> std::optional<std::span<const u8>> {
+      if (stored_offset == 0 || stored_offset - 1 + RECORD_HEADER_SIZE > bytes.size())
+        return std::nullopt;
+      RecordHeader record{};
+      std::memcpy(&record, bytes.data() + stored_offset - 1, RECORD_HEADER_SIZE);
+      auto offset = stored_offset - 1 + RECORD_HEADER_SIZE;
+      if (record.size > bytes.size() - offset || static_cast<RecordType>(record.type) != type)
+        return std::nullopt;
+      return bytes.subspan(offset, record.size);
+    };
+
+    auto payload = read_payload(std::atomic_ref{users[id]}.load(std::memory_order_acquire),
+                                RecordType::User);
+    u16 name_size = 0;
+    if (!payload || payload->size() < sizeof(name_size))
+      return std::nullopt;
+    std::memcpy(&name_size, payload->data(), sizeof(name_size));
+    if (sizeof(name_size) + name_size > payload->size())
+      return std::nullopt;
+    auto name = payload->subspan(sizeof(name_size), name_size);
+    auto password = payload->subspan(sizeof(name_size) + name_size);
+
+    User user{.id = id,
+              .name = {name.begin(), name.end()},
+              .password = {password.begin(), password.end()},
+              .public_key = {}};
+    if (auto key = read_payload(std::atomic_ref{keys[id]}.load(std::memory_order_acquire),
+                                RecordType::PublicKey))
+      user.public_key.assign(key->begin(), key->end());
+    return user;
+  }
+
+  void UserStore::append(Pending&& pending) noexcept
+  {
+    RecordHeader record{.size = static_cast<u32>(pending.bytes.size() - RECORD_HEADER_SIZE),
+                        .checksum = 0,
+                        .type = static_cast<u8>(pending.type),
+                        .reserved = 0,
+                        .id = pending.id};
+    record.checksum = record_checksum(
+        record, std::span{pending.bytes}.subspan(RECORD_HEADER_SIZE));
+    std::memcpy(pending.bytes.data(), &record, RECORD_HEADER_SIZE);
+
+    {
+      std::unique_lock lock{mutex_};
+      pending_.emplace_back(std::move(pending));
+    }
+    cv_.notify_one();
+  }
+
+  void UserStore::writer() noexcept
+  {
+    while (true)
+    {
+      // every record queued while the previous batch is synced goes into the next one
+      std::vector<Pending> batch{};
+      {
+        std::unique_lock lock{mutex_};
+        cv_.wait(lock, [this] {
+          return !pending_.empty() || is_stopping_;
+        });
+        if (pending_.empty())
+          break;
+        batch.swap(pending_);
+      }
+
+      bool is_committed = commit(batch);
+      for (auto& pending : batch)
+      {
+        if (pending.callback)
+          pending.callback(is_committed);
+      }
+    }
+  }
+
+  bool UserStore::commit(std::vector<Pending>& batch) noexcept
+  {
+    usize total = 0;
+    for (const auto& pending : batch)
+      total += pending.bytes.size();
+
+    std::vector<u8> bytes{};
+    bytes.reserve(total);
+    for (const auto& pending : batch)
+      bytes.insert(bytes.end(), pending.bytes.begin(), pending.bytes.end());
+
+    if (!log_.write(log_size_, bytes) || !log_.sync())
+    {
+      Logger::error(fmt::format("failed to write {} records into user log", batch.size()));
+      // remove the partially written records, so the next batch is not appended after them
+      log_.resize(log_size_);
+      return false;
+    }
+
+    auto offset = log_size_;
+    for (const auto& pending : batch)
+    {
+      index_record(pending.type, pending.id, pending.name, offset);
+      offset += pending.bytes.size();
+    }
+    log_size_ = offset;
+    reinterpret_cast<IndexHeader*>(index_.bytes().data())->indexed_size = log_size_;
+    return true;
+  }
+} // namespace ar
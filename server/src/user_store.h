@@ -0,0 +1,109 @@
+#pragma once
+
+#include <condition_variable>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "native_file.h"
+#include "user.h"
+#include "util/types.h"
+
+namespace ar
+{
+  // Persistent user database. Registrations and public keys are appended into a log, the pending
+  // records are written and synced together by the writer thread so concurrent requests share a
+  // single sync. The log is indexed by id and name in a memory mapped index file which is updated
+  // after every commit, so opening the store only scans the records written after the index is
+  // saved, and the users are only read from the log when they are requested. The index is
+  // rebuilt from the whole log only when it is missing or the server is not stopped cleanly.
+  // The user record holds the salted hash of the password, the files are only accessible by the
+  // owner.
+  class UserStore
+  {
+  public:
+    // called from the writer thread with false when the record could not be written
+    using callback_type = std::move_only_function<void(bool)>;
+
+    constexpr static std::string_view LOG_FILENAME = "users.log";
+    constexpr static std::string_view INDEX_FILENAME = "users.idx";
+
+    static std::expected<std::unique_ptr<UserStore>, std::string_view> open(
+        const std::filesystem::path& directory) noexcept;
+
+    // the pending records are committed before it returns
+    ~UserStore() noexcept;
+
+    UserStore(const UserStore&) = delete;
+    UserStore& operator=(const UserStore&) = delete;
+
+    // id after the last user in the log, it could be out of the id range when the log is full
+    [[nodiscard]] u32 next_id() const noexcept;
+
+    // read the user written before the store is opened, the users added after that should be
+    // already known by the caller
+    [[nodiscard]] std::optional<User> load(std::string_view name) const noexcept;
+    [[nodiscard]] std::optional<User> load(User::id_type id) const noexcept;
+
+    void append_user(const User& user, callback_type callback) noexcept;
+    void append_public_key(User::id_type id, std::span<const u8> key,
+                           callback_type callback) noexcept;
+
+  private:
+    enum class RecordType : u8
+    {
+      User = 1,
+      PublicKey,
+    };
+
+    struct Pending
+    {
+      RecordType type;
+      User::id_type id;
+      std::string_view name; // points into bytes, only used by user record
+      std::vector<u8> bytes;
+      callback_type callback;
+    };
+
+    constexpr static usize ID_COUNT =
+        static_cast<usize>(std::numeric_limits<User::id_type>::max()) + 1;
+    // twice the ids, so the probe is short even when every id is used
+    constexpr static usize NAME_SLOTS = ID_COUNT * 2;
+
+    UserStore() noexcept = default;
+
+    std::expected<void, std::string_view> open_index(const std::filesystem::path& path) noexcept;
+    // scan the log from the indexed size, the torn record at the end is removed
+    std::expected<void, std::string_view> recover() noexcept;
+
+    void index_record(RecordType type, User::id_type id, std::string_view name,
+                      u64 offset) noexcept;
+    [[nodiscard]] std::optional<User> read_user(User::id_type id) const noexcept;
+
+    void append(Pending&& pending) noexcept;
+    void writer() noexcept;
+    bool commit(std::vector<Pending>& batch) noexcept;
+
+  private:
+    NativeFile log_;
+    NativeFile index_file_;
+    MappedView index_;
+    // the log at the time the store is opened, the records appended after that are not read
+    MappedView log_view_;
+    u64 log_size_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Pending> pending_;
+    bool is_stopping_ = false;
+    std::jthread writer_thread_;
+  };
+} // namespace ar
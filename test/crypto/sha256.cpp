@@ -0,0 +1,59 @@
+#include "crypto/sha256.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+
+#include "util/types.h"
+
+namespace
+{
+  std::span<const u8> as_bytes(std::string_view text)
+  {
+    return {reinterpret_cast<const u8*>(text.data()), text.size()};
+  }
+
+  std::string to_hex(std::span<const u8> bytes)
+  {
+    constexpr std::string_view digits = "0123456789abcdef";
+    std::string result{};
+    for (auto byte : bytes)
+    {
+      result += digits[byte >> 4];
+      result += digits[byte & 0xf];
+    }
+    return result;
+  }
+} // namespace
+
+TEST(sha256, digest)
+{
+  EXPECT_EQ(to_hex(ar::SHA256::digest(as_bytes("abc"))),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+  // updated in uneven pieces across the block boundaries
+  std::string text(1000, 'a');
+  ar::SHA256 hasher{};
+  for (usize offset = 0; offset < text.size(); offset += 37)
+    hasher.update(as_bytes(std::string_view{text}.substr(offset, 37)));
+  EXPECT_EQ(to_hex(hasher.finish()),
+            "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+}
+
+TEST(sha256, hmac_long_key)
+{
+  std::string key(100, 'k');
+  EXPECT_EQ(to_hex(ar::hmac_sha256(as_bytes(key), as_bytes("msg"))),
+            "bd56a1782c2830e8abc6ed866a57a1230661e650b84c62f7ee3accc5fa5af491");
+}
+
+TEST(sha256, pbkdf2)
+{
+  EXPECT_EQ(to_hex(ar::pbkdf2_sha256(as_bytes("password"), as_bytes("salt"), 4096, 32)),
+            "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a");
+  // more than one block
+  EXPECT_EQ(to_hex(ar::pbkdf2_sha256(as_bytes("passwd"), as_bytes("salt"), 1, 64)),
+            "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+            "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783");
+}
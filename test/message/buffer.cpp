@@ -0,0 +1,49 @@
+#include "message/buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+TEST(shared_buffer, move_vector)
+{
+  std::vector<u8> bytes{1, 2, 3, 4, 5};
+  auto data = bytes.data();
+
+  ar::SharedBuffer buffer{std::move(bytes)};
+  // the bytes are moved instead of copied
+  EXPECT_EQ(buffer.data(), data);
+  EXPECT_EQ(buffer.size(), 5);
+  EXPECT_FALSE(buffer.empty());
+}
+
+TEST(shared_buffer, copy_shares_bytes)
+{
+  ar::SharedBuffer buffer{std::vector<u8>{1, 2, 3}};
+  EXPECT_EQ(buffer.use_count(), 1);
+
+  auto copy = buffer;
+  EXPECT_EQ(copy.data(), buffer.data());
+  EXPECT_EQ(copy.size(), buffer.size());
+  EXPECT_EQ(buffer.use_count(), 2);
+
+  std::span<const u8> view = copy;
+  EXPECT_EQ(view.data(), buffer.data());
+  EXPECT_EQ(view[2], 3);
+}
+
+TEST(shared_buffer, copy_span)
+{
+  std::vector<u8> bytes{1, 2, 3};
+  ar::SharedBuffer buffer{std::span<const u8>{bytes}};
+  EXPECT_NE(buffer.data(), bytes.data());
+  EXPECT_TRUE(std::ranges::equal(buffer, bytes));
+}
+
+TEST(shared_buffer, empty)
+{
+  ar::SharedBuffer buffer{};
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_EQ(buffer.size(), 0);
+  EXPECT_EQ(buffer.begin(), buffer.end());
+}
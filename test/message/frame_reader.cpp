@@ -0,0 +1,182 @@
+#include "message/frame_reader.h"
+
+#include <gtest/gtest.h>
+
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/io_context.hpp>
+#include <algorithm>
+#include <asio/write.hpp>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  std::vector<u8> make_frame(const std::vector<u8>& body)
+  {
+    ar::Message::Header header{.body_size = body.size()};
+    std::vector<u8> frame(ar::Message::header_size);
+    std::memcpy(frame.data(), &header, ar::Message::header_size);
+    frame.insert(frame.end(), body.begin(), body.end());
+    return frame;
+  }
+} // namespace
+
+TEST(frame_reader, many_frames_per_read)
+{
+  asio::io_context context{};
+  asio::ip::tcp::acceptor acceptor{context, {asio::ip::address_v4::loopback(), 0}};
+  asio::ip::tcp::socket sender{context};
+  asio::ip::tcp::socket receiver{context};
+  sender.connect(acceptor.local_endpoint());
+  acceptor.accept(receiver);
+
+  // small bodies followed by one bigger than the block
+  std::vector<std::vector<u8>> bodies{};
+  for (usize i = 0; i < 100; ++i)
+    bodies.emplace_back(i, static_cast<u8>(i));
+  bodies.emplace_back(ar::FrameReader::BLOCK_SIZE * 2, 0xAB);
+
+  std::vector<u8> stream{};
+  for (const auto& body : bodies)
+  {
+    auto frame = make_frame(body);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+  asio::write(sender, asio::buffer(stream));
+
+  std::vector<ar::SharedBuffer> results{};
+  u64 read_count = 0;
+  u64 read_bytes = 0;
+  asio::co_spawn(
+      context, [&]() -> asio::awaitable<void> {
+        ar::FrameReader reader{};
+        for (usize i = 0; i < bodies.size(); ++i)
+        {
+          ar::Message message{};
+          if (co_await reader.read_header(receiver, message.header))
+            co_return;
+          if (co_await reader.read_body(receiver, message.as_header()->body_size, message.body))
+            co_return;
+          results.emplace_back(std::move(message.body));
+        }
+        read_count = reader.read_count();
+        read_bytes = reader.read_bytes();
+      },
+      asio::detached);
+  context.run();
+
+  ASSERT_EQ(results.size(), bodies.size());
+  for (usize i = 0; i < bodies.size(); ++i)
+    EXPECT_TRUE(std::ranges::equal(results[i], bodies[i]));
+  // the small frames don't need a read each
+  EXPECT_LT(read_count, bodies.size());
+  EXPECT_EQ(read_bytes, stream.size());
+}
+
+TEST(frame_reader, pooled_blocks)
+{
+  asio::io_context context{};
+  asio::ip::tcp::acceptor acceptor{context, {asio::ip::address_v4::loopback(), 0}};
+  asio::ip::tcp::socket sender{context};
+  asio::ip::tcp::socket receiver{context};
+  sender.connect(acceptor.local_endpoint());
+  acceptor.accept(receiver);
+
+  std::vector<std::vector<u8>> bodies{};
+  for (usize i = 0; i < 50; ++i)
+    bodies.emplace_back(100, static_cast<u8>(i));
+
+  std::vector<u8> stream{};
+  for (const auto& body : bodies)
+  {
+    auto frame = make_frame(body);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+  asio::write(sender, asio::buffer(stream));
+
+  // the bodies keep the blocks, so the pool runs out and the rest is allocated
+  auto pool = ar::BlockPool::make_shared(context, 256, 2);
+  std::vector<ar::SharedBuffer> results{};
+  asio::co_spawn(
+      context, [&]() -> asio::awaitable<void> {
+        ar::FrameReader reader{};
+        reader.use_pool(pool);
+        for (usize i = 0; i < bodies.size(); ++i)
+        {
+          ar::Message message{};
+          if (co_await reader.read_header(receiver, message.header))
+            co_return;
+          if (co_await reader.read_body(receiver, message.as_header()->body_size, message.body))
+            co_return;
+          results.emplace_back(std::move(message.body));
+        }
+      },
+      asio::detached);
+  context.run();
+
+  ASSERT_EQ(results.size(), bodies.size());
+  for (usize i = 0; i < bodies.size(); ++i)
+    EXPECT_TRUE(std::ranges::equal(results[i], bodies[i]));
+  EXPECT_FALSE(pool->acquire());
+
+  // every block is returned once the bodies are released
+  results.clear();
+  auto first = pool->acquire();
+  auto second = pool->acquire();
+  EXPECT_TRUE(first && second);
+}
+
+TEST(frame_reader, preloaded_bytes)
+{
+  asio::io_context context{};
+  asio::ip::tcp::acceptor acceptor{context, {asio::ip::address_v4::loopback(), 0}};
+  asio::ip::tcp::socket sender{context};
+  asio::ip::tcp::socket receiver{context};
+  sender.connect(acceptor.local_endpoint());
+  acceptor.accept(receiver);
+
+  std::vector<std::vector<u8>> bodies{std::vector<u8>(40, 1), std::vector<u8>(60, 2)};
+  std::vector<u8> stream{};
+  for (const auto& body : bodies)
+  {
+    auto frame = make_frame(body);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  // the previous reader of the socket stopped in the middle of the second header
+  auto split = make_frame(bodies[0]).size() + 3;
+  asio::write(sender, asio::buffer(stream.data() + split, stream.size() - split));
+
+  std::vector<ar::SharedBuffer> results{};
+  asio::co_spawn(
+      context, [&]() -> asio::awaitable<void> {
+        ar::FrameReader reader{};
+        EXPECT_TRUE(reader.preload({stream.data(), split}));
+        for (usize i = 0; i < bodies.size(); ++i)
+        {
+          ar::Message message{};
+          if (co_await reader.read_header(receiver, message.header))
+            co_return;
+          if (co_await reader.read_body(receiver, message.as_header()->body_size, message.body))
+            co_return;
+          results.emplace_back(std::move(message.body));
+        }
+      },
+      asio::detached);
+  context.run();
+
+  ASSERT_EQ(results.size(), bodies.size());
+  for (usize i = 0; i < bodies.size(); ++i)
+    EXPECT_TRUE(std::ranges::equal(results[i], bodies[i]));
+}
+
+TEST(frame_reader, preload_bigger_than_block)
+{
+  ar::FrameReader reader{64};
+  std::vector<u8> bytes(40, 1);
+  EXPECT_TRUE(reader.preload(bytes));
+  EXPECT_FALSE(reader.preload(bytes));
+  EXPECT_EQ(reader.buffered(), bytes.size());
+  EXPECT_FALSE(reader.preload(std::vector<u8>(65, 2)));
+}
@@ -150,4 +150,96 @@ TEST(payload, hybrid_func)
   ASSERT_EQ(data_payload->file_size, data.file_size);
   ASSERT_EQ(data_payload->filename, data.filename);
   check_span_eq<u8, u8>(data_payload->files, bytes);
-}
\ No newline at end of file
+}
+
+TEST(payload, send_file_stream)
+{
+  // 2 full chunks and 1 partial chunk
+  std::vector<u8> files(ar::SEND_FILE_CHUNK_SIZE * 2 + 25);
+  for (usize i = 0; i < files.size(); ++i)
+    files[i] = static_cast<u8>(i);
+
+  ar::DMRSA rsa{};
+  auto symmetric_key = ar::random_bytes<ar::KEY_BYTE>();
+  ar::Camellia encryptor{symmetric_key};
+  auto [key_padding, cipher_key] = ar::encrypt_key(rsa.public_key(), symmetric_key);
+
+  ar::SendFileBeginPayload::Data data{
+      .file_size = files.size(),
+      .filename = "hello.jpg",
+      .compression = ar::CompressionType::None,
+  };
+  auto [data_padding, cipher_data] = encryptor.encrypts(data.serialize());
+
+  ar::SendFileBeginPayload begin{
+      .transfer_id = 1,
+      .key_padding = key_padding,
+      .data_padding = static_cast<u8>(data_padding),
+      .key = std::move(cipher_key),
+      .data = std::move(cipher_data)
+  };
+
+  std::vector<std::vector<u8>> chunks{};
+  for (usize offset = 0; offset < files.size(); offset += ar::SEND_FILE_CHUNK_SIZE)
+  {
+    auto size = std::min(ar::SEND_FILE_CHUNK_SIZE, files.size() - offset);
+    auto [padding, cipher] = encryptor.encrypts(std::span{files.data() + offset, size});
+    ar::SendFileChunkPayload chunk{
+        .transfer_id = begin.transfer_id,
+        .padding = static_cast<u8>(padding),
+        .is_compressed = false,
+        .data = std::move(cipher)
+    };
+    chunks.emplace_back(chunk.serialize());
+  }
+  ASSERT_EQ(chunks.size(), 3);
+
+  // Receiver side
+  auto begin_result = ar::parse_body<ar::SendFileBeginPayload>(begin.serialize());
+  ASSERT_TRUE(begin_result);
+
+  auto decryptor = ar::decrypt_key(rsa, begin_result->key_padding, begin_result->key);
+  ASSERT_TRUE(decryptor);
+
+  auto data_bytes = decryptor->decrypts(begin_result->data, begin_result->data_padding);
+  ASSERT_TRUE(data_bytes);
+  auto data_result = ar::parse_body<ar::SendFileBeginPayload::Data>(data_bytes.value());
+  ASSERT_TRUE(data_result);
+  ASSERT_EQ(data_result->file_size, data.file_size);
+  ASSERT_EQ(data_result->filename, data.filename);
+
+  std::vector<u8> received{};
+  for (const auto& chunk : chunks)
+  {
+    auto chunk_result = ar::parse_body<ar::SendFileChunkPayload>(chunk);
+    ASSERT_TRUE(chunk_result);
+    ASSERT_EQ(chunk_result->transfer_id, begin.transfer_id);
+
+    auto bytes = decryptor->decrypts(chunk_result->data, chunk_result->padding);
+    ASSERT_TRUE(bytes);
+    received.insert(received.end(), bytes->begin(), bytes->end());
+  }
+
+  check_span_eq<u8, u8>(received, files);
+}
+
+TEST(payload, user_online_delta)
+{
+  ar::UserOnlinePayload payload{
+      .version = 42,
+      .is_delta = true,
+      .users = {{1, "alice"}, {300, "bob"}},
+      .offline_ids = {7, 1291},
+      .next_cursor = 0,
+  };
+
+  auto result = ar::parse_body<ar::UserOnlinePayload>(payload.serialize());
+  ASSERT_TRUE(result);
+  EXPECT_EQ(result->version, payload.version);
+  EXPECT_TRUE(result->is_delta);
+  ASSERT_EQ(result->users.size(), 2);
+  EXPECT_EQ(result->users[1].id, 300);
+  EXPECT_EQ(result->users[1].name, "bob");
+  EXPECT_EQ(result->offline_ids, payload.offline_ids);
+  EXPECT_EQ(result->next_cursor, 0);
+}
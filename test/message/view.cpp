@@ -0,0 +1,119 @@
+#include "message/view.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+TEST(payload_view, user_detail)
+{
+  // long enough to use multiple bytes of size
+  std::vector<u8> public_key(300);
+  for (usize i = 0; i < public_key.size(); ++i)
+    public_key[i] = static_cast<u8>(i);
+
+  ar::UserDetailPayload payload{
+      .id = 1291,
+      .username = "nourton",
+      .public_key = public_key,
+      .compressions = ar::SUPPORTED_COMPRESSIONS
+  };
+  auto bytes = payload.serialize();
+
+  auto view = ar::parse_view<ar::UserDetailPayloadView>(bytes);
+  ASSERT_TRUE(view);
+  EXPECT_EQ(view->id, payload.id);
+  EXPECT_EQ(view->username, payload.username);
+  EXPECT_TRUE(std::ranges::equal(view->public_key, public_key));
+  EXPECT_EQ(view->compressions, payload.compressions);
+
+  // the fields refer to the parsed bytes
+  EXPECT_GE(view->public_key.data(), bytes.data());
+  EXPECT_LE(view->public_key.data() + view->public_key.size(), bytes.data() + bytes.size());
+
+  // unknown compressions are left out, like the payload of the older servers
+  payload.compressions = 0;
+  auto legacy = payload.serialize();
+  EXPECT_EQ(legacy.size(), bytes.size() - 1);
+  auto legacy_view = ar::parse_view<ar::UserDetailPayloadView>(legacy);
+  ASSERT_TRUE(legacy_view);
+  EXPECT_EQ(legacy_view->id, payload.id);
+  EXPECT_EQ(legacy_view->compressions, 0);
+}
+
+TEST(payload_view, send_file)
+{
+  std::vector<u8> files(100'000, 'a');
+  ar::SendFilePayload2::Data data{
+      .file_size = files.size(),
+      .filename = "hello.txt",
+      .files = files
+  };
+  auto data_bytes = data.serialize();
+
+  auto data_view = ar::parse_view<ar::SendFilePayload2View::Data>(data_bytes);
+  ASSERT_TRUE(data_view);
+  EXPECT_EQ(data_view->file_size, data.file_size);
+  EXPECT_EQ(data_view->filename, data.filename);
+  EXPECT_TRUE(std::ranges::equal(data_view->files, files));
+
+  ar::SendFilePayload2 payload{
+      .key_padding = 3,
+      .data_padding = 7,
+      .key = {1, 2, 3},
+      .data = std::move(data_bytes)
+  };
+  ar::SharedBuffer body{payload.serialize()};
+
+  auto view = ar::parse_view<ar::SendFilePayload2View>(body);
+  ASSERT_TRUE(view);
+  EXPECT_EQ(view->key_padding, payload.key_padding);
+  EXPECT_EQ(view->data_padding, payload.data_padding);
+  EXPECT_TRUE(std::ranges::equal(view->key, payload.key));
+  EXPECT_TRUE(std::ranges::equal(view->data, payload.data));
+  // the view keeps the body alive
+  EXPECT_EQ(view->bytes.use_count(), 2);
+}
+
+TEST(payload_view, send_file_chunk)
+{
+  ar::SendFileChunkPayload payload{
+      .transfer_id = 0xDEADBEEF,
+      .padding = 5,
+      .is_compressed = true,
+      .data = std::vector<u8>(ar::SEND_FILE_CHUNK_SIZE, 0x12)
+  };
+  auto bytes = payload.serialize();
+
+  auto view = ar::parse_view<ar::SendFileChunkPayloadView>(bytes);
+  ASSERT_TRUE(view);
+  EXPECT_EQ(view->transfer_id, payload.transfer_id);
+  EXPECT_EQ(view->padding, payload.padding);
+  EXPECT_EQ(view->is_compressed, payload.is_compressed);
+  EXPECT_TRUE(std::ranges::equal(view->data, payload.data));
+}
+
+TEST(payload_view, malformed)
+{
+  ar::StorePublicKeyPayload payload{.key = std::vector<u8>(64, 1),
+                                    .compressions = ar::SUPPORTED_COMPRESSIONS};
+  auto bytes = payload.serialize();
+  ASSERT_TRUE(ar::parse_view<ar::StorePublicKeyPayloadView>(bytes));
+
+  // without the compressions of the older clients
+  auto legacy = std::span{bytes}.first(bytes.size() - 1);
+  auto legacy_view = ar::parse_view<ar::StorePublicKeyPayloadView>(legacy);
+  ASSERT_TRUE(legacy_view);
+  EXPECT_EQ(legacy_view->compressions, 0);
+
+  // truncated
+  auto truncated = std::span{bytes}.first(bytes.size() - 2);
+  EXPECT_FALSE(ar::parse_view<ar::StorePublicKeyPayloadView>(truncated));
+
+  // trailing bytes
+  bytes.push_back(0);
+  EXPECT_FALSE(ar::parse_view<ar::StorePublicKeyPayloadView>(bytes));
+
+  // size bigger than the payload
+  std::vector<u8> oversize{0x7F, 0x7F, 0x7F, 1};
+  EXPECT_FALSE(ar::parse_view<ar::StorePublicKeyPayloadView>(oversize));
+}
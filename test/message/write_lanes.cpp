@@ -0,0 +1,77 @@
+#include "message/write_lanes.h"
+
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/io_context.hpp>
+
+#include <gtest/gtest.h>
+
+TEST(write_lanes, lane_of)
+{
+  EXPECT_EQ(ar::lane_of(ar::Message::Type::SendFileChunk), ar::WriteLane::Bulk);
+  EXPECT_EQ(ar::lane_of(ar::Message::Type::SendFile), ar::WriteLane::Bulk);
+  EXPECT_EQ(ar::lane_of(ar::Message::Type::Feedback), ar::WriteLane::Control);
+  EXPECT_EQ(ar::lane_of(ar::Message::Type::UserLogin), ar::WriteLane::Control);
+}
+
+TEST(write_lanes, take_turn)
+{
+  asio::io_context context;
+  ar::WriteLanes<int> lanes{context.get_executor()};
+  EXPECT_TRUE(lanes.empty());
+
+  for (int i = 0; i < 3; ++i)
+    lanes.push(ar::WriteLane::Bulk, 100 + i);
+  lanes.push(ar::WriteLane::Control, 1);
+  lanes.push(ar::WriteLane::Control, 2);
+
+  auto pop = [&] {
+    auto& queue = lanes.next();
+    auto value = queue.front();
+    queue.pop();
+    return value;
+  };
+
+  // control first, then alternate while both have entries
+  EXPECT_EQ(pop(), 1);
+  EXPECT_EQ(pop(), 100);
+  EXPECT_EQ(pop(), 2);
+  EXPECT_EQ(pop(), 101);
+  // only bulk left
+  EXPECT_EQ(pop(), 102);
+  EXPECT_TRUE(lanes.empty());
+
+  // control always goes first when bulk is empty
+  lanes.push(ar::WriteLane::Control, 3);
+  EXPECT_EQ(pop(), 3);
+  lanes.push(ar::WriteLane::Control, 4);
+  EXPECT_EQ(pop(), 4);
+}
+
+TEST(write_lanes, wait)
+{
+  asio::io_context context;
+  ar::WriteLanes<int> lanes{context.get_executor()};
+
+  std::vector<bool> results;
+  asio::co_spawn(context, [&]() -> asio::awaitable<void> {
+    results.push_back(co_await lanes.wait());
+    lanes.clear();
+    results.push_back(co_await lanes.wait());
+  }, asio::detached);
+
+  // the writer is parked until something is pushed
+  context.run_for(std::chrono::milliseconds{10});
+  EXPECT_TRUE(results.empty());
+
+  lanes.push(ar::WriteLane::Bulk, 1);
+  context.run_for(std::chrono::milliseconds{10});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_TRUE(results[0]);
+
+  // closing wakes up the writer
+  lanes.close();
+  context.run_for(std::chrono::milliseconds{10});
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_FALSE(results[1]);
+}
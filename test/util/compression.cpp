@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <util/compression.h>
+
+#include <random>
+
+TEST(compression, round_trip)
+{
+  std::mt19937 rng{1291};
+  std::vector<std::vector<u8>> inputs{
+      {},
+      {'a'},
+      std::vector<u8>(13, 'a'),
+      std::vector<u8>(64 * 1024, 0),
+  };
+
+  std::vector<u8> text{};
+  constexpr std::string_view line = "2024-04-19 12:00:00 [INFO] connection-1 got data 128 bytes\n";
+  while (text.size() < 64 * 1024)
+    text.insert(text.end(), line.begin(), line.end());
+  inputs.emplace_back(std::move(text));
+
+  std::vector<u8> random(64 * 1024);
+  for (auto& byte : random)
+    byte = static_cast<u8>(rng());
+  inputs.emplace_back(std::move(random));
+
+  for (const auto& input : inputs)
+  {
+    auto compressed = ar::compress(input);
+    EXPECT_LE(compressed.size(), ar::compress_bound(input.size()));
+
+    auto result = ar::decompress(compressed, input.size());
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.value(), input);
+  }
+}
+
+TEST(compression, ratio)
+{
+  std::vector<u8> text{};
+  constexpr std::string_view line = "id,name,amount\n1,nourton,1291\n";
+  while (text.size() < 64 * 1024)
+    text.insert(text.end(), line.begin(), line.end());
+
+  auto compressed = ar::compress(text);
+  EXPECT_LT(compressed.size(), text.size() / 10);
+}
+
+TEST(compression, malformed)
+{
+  std::vector<u8> input(1024, 'x');
+  auto compressed = ar::compress(input);
+
+  // smaller output bound
+  EXPECT_FALSE(ar::decompress(compressed, input.size() - 1));
+
+  // truncated block
+  compressed.resize(compressed.size() / 2);
+  EXPECT_FALSE(ar::decompress(compressed, input.size()));
+
+  // offset pointing before the output
+  std::vector<u8> bad_offset{0x10, 'a', 0x05, 0x00};
+  EXPECT_FALSE(ar::decompress(bad_offset, 1024));
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <util/counter.h>
+
+#include <thread>
+#include <vector>
+
+TEST(counter, sum_of_threads)
+{
+  ar::Counter counter{};
+  // more threads than slots, so some of them share a slot
+  constexpr usize thread_count = ar::Counter::SLOT_COUNT + 8;
+  constexpr u64 adds = 10'000;
+  {
+    std::vector<std::jthread> threads{};
+    for (usize i = 0; i < thread_count; ++i)
+    {
+      threads.emplace_back([&] {
+        for (u64 j = 0; j < adds; ++j)
+          counter.add();
+      });
+    }
+  }
+  EXPECT_EQ(counter.value(), thread_count * adds);
+}
+
+TEST(counter, gauge_across_threads)
+{
+  ar::Gauge gauge{};
+  gauge.add(100);
+  // another thread takes what this one added
+  std::jthread{[&] {
+    gauge.sub(70);
+  }}.join();
+  EXPECT_EQ(gauge.value(), 30);
+
+  gauge.sub(30);
+  EXPECT_EQ(gauge.value(), 0);
+}
+
+TEST(counter, scoped_timer)
+{
+  ar::Counter nanoseconds{};
+  {
+    ar::ScopedTimer timer{nanoseconds};
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+  EXPECT_GE(nanoseconds.value(), 1'000'000);
+}
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <util/histogram.h>
+
+#include <thread>
+#include <vector>
+
+TEST(histogram, bucket_bounds)
+{
+  using ar::HistogramSnapshot;
+  // the small values are exact
+  for (u64 i = 0; i < HistogramSnapshot::SUB_BUCKET_COUNT; ++i)
+    EXPECT_EQ(HistogramSnapshot::upper_bound_of(HistogramSnapshot::bucket_of(i)), i);
+
+  // every value is within its bucket and the error is bounded
+  for (u64 value : std::initializer_list<u64>{16, 17, 31, 32, 1000, 123'456, 999'999'999})
+  {
+    auto bound = HistogramSnapshot::upper_bound_of(HistogramSnapshot::bucket_of(value));
+    EXPECT_GE(bound, value);
+    EXPECT_LE(bound - value, value / HistogramSnapshot::SUB_BUCKET_COUNT);
+  }
+
+  EXPECT_EQ(HistogramSnapshot::bucket_of(HistogramSnapshot::MAX_VALUE - 1),
+            HistogramSnapshot::BUCKET_COUNT - 1);
+  EXPECT_EQ(HistogramSnapshot::bucket_of(~u64{0}), HistogramSnapshot::BUCKET_COUNT - 1);
+}
+
+TEST(histogram, percentile)
+{
+  ar::HistogramSnapshot snapshot{};
+  EXPECT_EQ(snapshot.percentile(0.5), 0);
+
+  for (u64 i = 1; i <= 1000; ++i)
+    snapshot.record(i * 1000);
+  EXPECT_EQ(snapshot.count(), 1000);
+  EXPECT_EQ(snapshot.max(), 1'000'000);
+
+  auto within = [](u64 value, u64 expected) {
+    return value >= expected && value - expected <= expected / 16;
+  };
+  EXPECT_TRUE(within(snapshot.percentile(0.5), 500'000));
+  EXPECT_TRUE(within(snapshot.percentile(0.99), 990'000));
+  EXPECT_EQ(snapshot.percentile(1.0), 1'000'000);
+}
+
+TEST(histogram, merge_threads)
+{
+  ar::Histogram histogram{};
+  constexpr usize thread_count = 8;
+  constexpr u64 records = 10'000;
+  {
+    std::vector<std::jthread> threads{};
+    for (usize i = 0; i < thread_count; ++i)
+    {
+      threads.emplace_back([&, i] {
+        for (u64 j = 0; j < records; ++j)
+          histogram.record(i + 1);
+      });
+    }
+  }
+  auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count(), thread_count * records);
+  EXPECT_EQ(snapshot.sum(), records * thread_count * (thread_count + 1) / 2);
+  EXPECT_EQ(snapshot.max(), thread_count);
+
+  ar::HistogramSnapshot other{};
+  other.record(1000);
+  snapshot.merge(other);
+  EXPECT_EQ(snapshot.count(), thread_count * records + 1);
+  EXPECT_EQ(snapshot.max(), 1000);
+}
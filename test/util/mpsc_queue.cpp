@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include <util/mpsc_queue.h>
+
+#include <thread>
+#include <vector>
+
+TEST(mpsc_queue, fifo)
+{
+  ar::MpscQueue<int> queue{};
+  EXPECT_TRUE(queue.empty());
+  for (int i = 0; i < 4; ++i)
+    queue.push(int{i});
+  for (int i = 0; i < 4; ++i)
+  {
+    ASSERT_FALSE(queue.empty());
+    EXPECT_EQ(queue.front(), i);
+    queue.pop();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(mpsc_queue, multi_producer)
+{
+  constexpr int producer_count = 4;
+  constexpr int value_count = 10'000;
+
+  ar::MpscQueue<std::pair<int, int>> queue{};
+  std::vector<std::jthread> producers;
+  for (int p = 0; p < producer_count; ++p)
+    producers.emplace_back([&queue, p] {
+      for (int i = 0; i < value_count; ++i)
+        queue.push({p, i});
+    });
+
+  // values of each producer keep their order
+  std::vector<int> nexts(producer_count, 0);
+  int received = 0;
+  while (received < producer_count * value_count)
+  {
+    if (queue.empty())
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    auto [p, i] = queue.front();
+    queue.pop();
+    EXPECT_EQ(i, nexts[p]++);
+    ++received;
+  }
+  EXPECT_TRUE(queue.empty());
+}
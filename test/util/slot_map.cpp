@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include <util/slot_map.h>
+
+#include <algorithm>
+#include <string>
+
+TEST(slot_map, insert_get_erase)
+{
+  ar::SlotMap<std::string> map{};
+  auto a = map.insert("a");
+  auto b = map.insert("b");
+  auto c = map.insert("c");
+  EXPECT_EQ(map.size(), 3);
+  ASSERT_NE(map.get(b), nullptr);
+  EXPECT_EQ(*map.get(b), "b");
+
+  // erasing keeps the other handles valid
+  EXPECT_TRUE(map.erase(a));
+  EXPECT_FALSE(map.erase(a));
+  EXPECT_EQ(map.get(a), nullptr);
+  EXPECT_EQ(*map.get(b), "b");
+  EXPECT_EQ(*map.get(c), "c");
+  EXPECT_EQ(map.size(), 2);
+
+  // the slot is reused but the stale handle doesn't refer to the new value
+  auto d = map.insert("d");
+  EXPECT_EQ(d.index, a.index);
+  EXPECT_NE(d, a);
+  EXPECT_EQ(map.get(a), nullptr);
+  EXPECT_EQ(*map.get(d), "d");
+}
+
+TEST(slot_map, dense_iteration)
+{
+  ar::SlotMap<int> map{};
+  std::vector<ar::SlotHandle> handles;
+  for (int i = 0; i < 8; ++i)
+    handles.emplace_back(map.insert(int{i}));
+  for (int i = 0; i < 8; i += 2)
+    map.erase(handles[i]);
+
+  std::vector<int> values{map.begin(), map.end()};
+  std::ranges::sort(values);
+  EXPECT_EQ(values, (std::vector{1, 3, 5, 7}));
+  for (int i = 1; i < 8; i += 2)
+    EXPECT_EQ(*map.get(handles[i]), i);
+
+  EXPECT_FALSE(map.contains(ar::SlotHandle{}));
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include <util/spsc_ring.h>
+
+#include <string>
+#include <thread>
+
+TEST(spsc_ring, full_and_empty)
+{
+  ar::SpscRing<int> ring{3};
+  EXPECT_EQ(ring.capacity(), 4);
+  EXPECT_EQ(ring.front(), nullptr);
+
+  for (int i = 0; i < 4; ++i)
+  {
+    auto slot = ring.reserve();
+    ASSERT_NE(slot, nullptr);
+    *slot = i;
+    ring.commit();
+  }
+  EXPECT_EQ(ring.reserve(), nullptr);
+  EXPECT_EQ(ring.size(), 4);
+
+  for (int i = 0; i < 4; ++i)
+  {
+    auto slot = ring.front();
+    ASSERT_NE(slot, nullptr);
+    EXPECT_EQ(*slot, i);
+    ring.pop();
+  }
+  EXPECT_EQ(ring.front(), nullptr);
+  EXPECT_NE(ring.reserve(), nullptr);
+}
+
+TEST(spsc_ring, producer_consumer)
+{
+  constexpr int value_count = 100'000;
+  ar::SpscRing<std::string> ring{64};
+
+  std::jthread producer{[&ring] {
+    for (int i = 0; i < value_count;)
+    {
+      auto slot = ring.reserve();
+      if (!slot)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      // the slot keeps the string of the previous round
+      slot->assign(std::to_string(i));
+      ring.commit();
+      ++i;
+    }
+  }};
+
+  for (int expected = 0; expected < value_count;)
+  {
+    auto slot = ring.front();
+    if (!slot)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(*slot, std::to_string(expected));
+    ring.pop();
+    ++expected;
+  }
+}
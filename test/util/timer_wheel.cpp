@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <util/timer_wheel.h>
+
+#include <map>
+#include <random>
+#include <vector>
+
+TEST(timer_wheel, expire_on_deadline)
+{
+  ar::TimerWheel<int> wheel{};
+  wheel.schedule(5, 1);
+  wheel.schedule(5, 2);
+  wheel.schedule(70, 3);
+  wheel.schedule(5000, 4);
+  EXPECT_EQ(wheel.size(), 4);
+
+  std::vector<int> expired{};
+  auto collect = [&](int value) {
+    expired.emplace_back(value);
+  };
+  wheel.advance(4, collect);
+  EXPECT_TRUE(expired.empty());
+  wheel.advance(5, collect);
+  EXPECT_EQ(expired, (std::vector{1, 2}));
+  wheel.advance(69, collect);
+  EXPECT_EQ(expired.size(), 2);
+  wheel.advance(70, collect);
+  EXPECT_EQ(expired.back(), 3);
+  wheel.advance(4999, collect);
+  EXPECT_EQ(expired.size(), 3);
+  wheel.advance(5000, collect);
+  EXPECT_EQ(expired.back(), 4);
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(timer_wheel, passed_deadline_expires_on_next_tick)
+{
+  ar::TimerWheel<int> wheel{100};
+  wheel.schedule(10, 1);
+  int count = 0;
+  wheel.advance(101, [&](int) {
+    ++count;
+  });
+  EXPECT_EQ(count, 1);
+}
+
+TEST(timer_wheel, reschedule_while_expiring)
+{
+  // the usual pattern of the owner, check the value and schedule it again
+  ar::TimerWheel<int> wheel{};
+  wheel.schedule(10, 0);
+  int count = 0;
+  for (ar::TimerWheel<int>::tick_type now = 0; now <= 100; ++now)
+    wheel.advance(now, [&](int value) {
+      ++count;
+      wheel.schedule(wheel.now() + 10, value);
+    });
+  EXPECT_EQ(count, 10);
+  EXPECT_EQ(wheel.size(), 1);
+}
+
+TEST(timer_wheel, random_deadlines)
+{
+  std::mt19937_64 random{42};
+  ar::TimerWheel<u64> wheel{12345};
+  std::map<u64, usize> remaining{};
+  for (usize i = 0; i < 10000; ++i)
+  {
+    // up to beyond the wheel range
+    auto deadline = wheel.now() + 1 + random() % (u64{1} << 26);
+    wheel.schedule(deadline, deadline);
+    ++remaining[deadline];
+  }
+
+  // advance in uneven steps, every entry should expire exactly on its deadline
+  while (!remaining.empty())
+  {
+    auto now = wheel.now() + 1 + random() % 5000;
+    wheel.advance(now, [&](u64 deadline) {
+      EXPECT_EQ(deadline, wheel.now());
+      if (--remaining[deadline] == 0)
+        remaining.erase(deadline);
+    });
+    if (!remaining.empty())
+    {
+      EXPECT_GT(remaining.begin()->first, now);
+    }
+  }
+  EXPECT_EQ(wheel.size(), 0);
+}